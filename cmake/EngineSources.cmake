@@ -0,0 +1,32 @@
+# Sources from npackdg/src that are shared by all executables and are not
+# listed in every CMakeLists.txt separately.
+# New shared classes should be added here.
+
+set(NPACKD_ENGINE_DIR ${CMAKE_CURRENT_LIST_DIR}/../npackdg/src)
+
+set(NPACKD_ENGINE_SOURCES
+    ${NPACKD_ENGINE_DIR}/dependencysolver.cpp
+    ${NPACKD_ENGINE_DIR}/directorycopier.cpp
+    ${NPACKD_ENGINE_DIR}/directoryremover.cpp
+    ${NPACKD_ENGINE_DIR}/httptransport.cpp
+    ${NPACKD_ENGINE_DIR}/sockettransport.cpp
+    ${NPACKD_ENGINE_DIR}/wininettransport.cpp
+    ${NPACKD_ENGINE_DIR}/dbsnapshot.cpp
+    ${NPACKD_ENGINE_DIR}/titleindex.cpp
+    ${NPACKD_ENGINE_DIR}/downloadcache.cpp
+    ${NPACKD_ENGINE_DIR}/sqlprofiler.cpp
+)
+
+set(NPACKD_ENGINE_HEADERS
+    ${NPACKD_ENGINE_DIR}/dependencysolver.h
+    ${NPACKD_ENGINE_DIR}/directorycopier.h
+    ${NPACKD_ENGINE_DIR}/directoryremover.h
+    ${NPACKD_ENGINE_DIR}/httptransport.h
+    ${NPACKD_ENGINE_DIR}/sockettransport.h
+    ${NPACKD_ENGINE_DIR}/wininettransport.h
+    ${NPACKD_ENGINE_DIR}/dbsnapshot.h
+    ${NPACKD_ENGINE_DIR}/titleindex.h
+    ${NPACKD_ENGINE_DIR}/downloadcache.h
+    ${NPACKD_ENGINE_DIR}/objectcache.h
+    ${NPACKD_ENGINE_DIR}/sqlprofiler.h
+)
@@ -18,6 +18,8 @@
 #include "hrtimer.h"
 #include "controlpanelthirdpartypm.h"
 #include "packageutils.h"
+#include "downloadcache.h"
+#include "sqlprofiler.h"
 
 static bool compareByPackageTitle(const QPair<PackageVersion*, QString>& e1,
         const QPair<PackageVersion*, QString>& e2) {
@@ -72,7 +74,7 @@ int App::process()
 {
     // alphabetically sorted options by the short name
     cl.add("bare-format", 'b', "bare format (no heading or summary)",
-            "", false, "list,list-repos,search,install-dir,which,where,info,path");
+            "", false, "list,list-repos,search,install-dir,which,where,info,path,cache");
     cl.add("cmd", 'c', "output a .cmd script",
             "", false, "path");
     cl.add("debug", 'd', "turn on the debug output", "", false);
@@ -84,7 +86,7 @@ int App::process()
     cl.add("install", 'i',
             "install a package if it was not installed", "", false, "update");
     cl.add("json", 'j', "json format for the output",
-            "", false, "list,list-repos,search,install-dir,which,where,info,path");
+            "", false, "list,list-repos,search,install-dir,which,where,info,path,cache");
     cl.add("keep-directories", 'k',
             "use the same directories for updated packages", "", false,
            "update");
@@ -129,6 +131,21 @@ int App::process()
             "internal package name (e.g. com.example.Editor or just Editor)",
             "package", true, "build");
 
+    cl.add("max-size", 0, "maximum size of the download cache in MiB (0 disables the cache)",
+            "MiB", false, "cache");
+    cl.add("shared-dir", 0, "read-only directory (e.g. a network share) with downloaded files",
+            "directory", false, "cache");
+    cl.add("prune", 0, "remove the least recently used files above the maximum size",
+            "", false, "cache");
+    cl.add("clear", 0, "remove all files", "", false, "cache");
+
+    cl.add("profile-sql", 0,
+            "print the execution times of the SQL statements at the end",
+            "", false);
+    cl.add("profile-sql-explain", 0,
+            "with --profile-sql: show the query plans for statements slower than this",
+            "milliseconds", false);
+
     QString err = cl.parse();
     if (!err.isEmpty()) {
         err = "Error: " + err;
@@ -149,6 +166,20 @@ int App::process()
 
             QLoggingCategory::setFilterRules("npackd=true");
         }
+
+        if (cl.isPresent("profile-sql"))
+            SQLProfiler::getDefault()->setEnabled(true);
+
+        QString explain = cl.get("profile-sql-explain");
+        if (!explain.isNull()) {
+            bool ok;
+            double ms = explain.toDouble(&ok);
+            if (ok && ms >= 0)
+                SQLProfiler::getDefault()->setExplainThreshold(
+                        static_cast<qint64>(ms * 1000000));
+            else
+                err = "The value for --profile-sql-explain is not a valid number";
+        }
     }
 
     QList<CommandLine::ParsedOption*> options = cl.getParsedOptions();
@@ -248,6 +279,8 @@ int App::process()
             getInstallPath(job);
         } else if (cmd == "build") {
             build(job);
+        } else if (cmd == "cache") {
+            cache(job);
         } else {
             job->setErrorMessage(QStringLiteral("Wrong command: ") + cmd +
                     QStringLiteral(". Try \"ncl help\""));
@@ -255,11 +288,29 @@ int App::process()
 
         err = job->getErrorMessage();
 
+        // the next read-only command will start faster. The snapshot is only
+        // rebuilt after the commands that change the database.
+        if (err.isEmpty() && (cmd == "add" || cmd == "remove" ||
+                cmd == "rm" || cmd == "update" || cmd == "place" ||
+                cmd == "detect")) {
+            QString e = DBRepository::getDefault()->updateSnapshot();
+            if (!e.isEmpty())
+                qCDebug(npackd) << e;
+        }
+
         this->currentJob = nullptr;
 
         delete job;
     }
 
+    // the report is written to stderr so that the output can still be parsed
+    if (SQLProfiler::getDefault()->isEnabled()) {
+        QStringList report = SQLProfiler::getDefault()->createReport();
+        for (int i = 0; i < report.size(); i++) {
+            WPMUtils::writeln(report.at(i), false);
+        }
+    }
+
     int r = 0;
     if (err.isEmpty())
         r = 0;
@@ -338,6 +389,10 @@ void App::usage(Job* job)
         "    ncl build --package <package> [--version <version> | --versions <versions>])",
         "            --output-package <package>",
         "        build a package from another one (e.g. a binary from source code)",
+        "    ncl cache [--max-size <MiB>] [--shared-dir <directory>]",
+        "            [--prune | --clear] [--bare-format | --json]",
+        "        shows the download cache. Changes the settings and removes",
+        "        files if requested.",
         "    ncl check",
         "        checks the installed packages for missing dependencies",
         "    ncl detect [--user <user name>] [--password <password>]",
@@ -458,6 +513,79 @@ void App::listRepos(Job* job)
     job->complete();
 }
 
+void App::cache(Job* job)
+{
+    bool bare = cl.isPresent("bare-format");
+    bool json = cl.isPresent("json");
+
+    DownloadCache* c = DownloadCache::getDefault();
+
+    bool changed = false;
+    QString maxSize = cl.get("max-size");
+    if (job->shouldProceed() && !maxSize.isNull()) {
+        bool ok;
+        qint64 v = maxSize.toLongLong(&ok);
+        if (!ok || v < 0 || v > 0xFFFFFFFFLL) {
+            job->setErrorMessage("The value for --max-size is not a valid number");
+        } else {
+            c->setMaxSize(v * 1024 * 1024);
+            changed = true;
+        }
+    }
+
+    QString sharedDir = cl.get("shared-dir");
+    if (job->shouldProceed() && !sharedDir.isNull()) {
+        c->setSharedDir(sharedDir);
+        changed = true;
+    }
+
+    if (job->shouldProceed() && changed) {
+        QString err = c->saveSettings();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed() && (cl.isPresent("prune") ||
+            cl.isPresent("clear"))) {
+        int removed;
+        QString err = c->prune(cl.isPresent("clear") ? 0 : c->getMaxSize(),
+                &removed);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else if (!bare && !json)
+            WPMUtils::writeln(QString("%L1 files removed").arg(removed));
+    }
+
+    if (job->shouldProceed()) {
+        DownloadCacheStatistics st = c->getStatistics();
+        if (json) {
+            QJsonObject top;
+            top["dir"] = st.dir;
+            top["sharedDir"] = st.sharedDir;
+            top["files"] = st.files;
+            top["size"] = static_cast<double>(st.size);
+            top["maxSize"] = static_cast<double>(st.maxSize);
+            printJSON(top);
+        } else if (bare) {
+            WPMUtils::writeln(QString("%1\t%2\t%3\t%4\t%5").
+                    arg(st.dir, st.sharedDir).arg(st.files).
+                    arg(st.size).arg(st.maxSize));
+        } else {
+            const qint64 MiB = 1024 * 1024;
+            WPMUtils::writeln(QString("Directory: %1").arg(st.dir));
+            WPMUtils::writeln(QString("Shared directory: %1").arg(
+                    st.sharedDir.isEmpty() ? "-" : st.sharedDir));
+            WPMUtils::writeln(QString("Files: %L1").arg(st.files));
+            WPMUtils::writeln(QString("Size: %L1 MiB").arg(
+                    (st.size + MiB - 1) / MiB));
+            WPMUtils::writeln(QString("Maximum size: %L1 MiB").arg(
+                    st.maxSize / MiB));
+        }
+    }
+
+    job->complete();
+}
+
 void App::getInstallPath(Job* job)
 {
     bool json = cl.isPresent("json");
@@ -486,7 +614,7 @@ void App::which(Job* job)
     }
 
     if (job->shouldProceed()) {
-        QString r = DBRepository::getDefault()->openDefault("default", true);
+        QString r = DBRepository::getDefault()->openDefaultSnapshot();
         if (!r.isEmpty())
             job->setErrorMessage(r);
     }
@@ -806,7 +934,7 @@ void App::list(Job* job)
     job->setTitle("Listing package versions");
 
     if (job->shouldProceed()) {
-        QString err = DBRepository::getDefault()->openDefault("default", true);
+        QString err = DBRepository::getDefault()->openDefaultSnapshot();
         if (!err.isEmpty())
             job->setErrorMessage(err);
     }
@@ -1100,7 +1228,7 @@ void App::removeRepo(Job* job)
 void App::path(Job* job)
 {
     if (job->shouldProceed()) {
-        QString err = DBRepository::getDefault()->openDefault();
+        QString err = DBRepository::getDefault()->openDefaultSnapshot(false);
         if (!err.isEmpty())
             job->setErrorMessage(err);
     }
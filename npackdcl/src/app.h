@@ -57,6 +57,7 @@ private:
     void setInstallPath(Job *job);
     void removeSCP(Job *job);
     void build(Job *job);
+    void cache(Job *job);
 
     bool confirm(const QList<InstallOperation *> ops, QString *title,
             QString *err);
@@ -1,9 +1,14 @@
 #include <limits>
 #include <math.h>
 #include <memory>
+#include <algorithm>
 
 #include <QRegExp>
 #include <QProcess>
+#include <QElapsedTimer>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QtConcurrent/QtConcurrent>
 
 #include "app.h"
 #include "wpmutils.h"
@@ -14,6 +19,19 @@
 #include "abstractrepository.h"
 #include "dbrepository.h"
 #include "hrtimer.h"
+#include "installoperation.h"
+#include "packageinfoloader.h"
+#include "downloadcache.h"
+#include "httptestserver.h"
+#include "sockettransport.h"
+#include "sqlprofiler.h"
+#include "directorycopier.h"
+#include "directoryremover.h"
+#include "dbsnapshot.h"
+#include "testdatabase.h"
+
+#include <quazip.h>
+#include <quazipfile.h>
 
 void App::test()
 {
@@ -199,3 +217,2249 @@ void App::testNormalizePath()
 {
     QCOMPARE(WPMUtils::normalizePath("../", false), "..");
 }
+
+void App::testPackageVersionBinary()
+{
+    PackageVersion pv("com.example.Test", Version(1, 2));
+    pv.type = PackageVersion::Type::INNO_SETUP;
+    pv.download = QUrl("https://www.example.com/test-1.2.exe");
+    pv.sha1 = "0123456789012345678901234567890123456789";
+    pv.importantFiles.append("test.exe");
+    pv.importantFilesTitles.append("Test");
+    pv.cmdFiles.append("bin\\test.exe");
+    pv.files.append(new PackageVersionFile(".Npackd\\Install.bat",
+            "echo installing"));
+    Dependency* d = new Dependency();
+    d->package = "com.example.Lib";
+    d->setVersions("[2, 3)");
+    d->var = "LIB";
+    pv.dependencies.append(d);
+
+    QByteArray data = pv.toBinary();
+    QVERIFY(PackageVersion::isBinary(data));
+
+    QString err;
+    std::unique_ptr<PackageVersion> r(PackageVersion::parse(data, &err));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r.get() != nullptr);
+
+    QByteArray xml1, xml2;
+    QXmlStreamWriter w1(&xml1);
+    pv.toXML(&w1);
+    QXmlStreamWriter w2(&xml2);
+    r->toXML(&w2);
+    QCOMPARE(xml2, xml1);
+
+    r.reset(PackageVersion::parseBinary(data, &err, false));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(r->package, pv.package);
+    QVERIFY(r->version == pv.version);
+    QCOMPARE(r->download, pv.download);
+    QVERIFY(r->files.isEmpty());
+    QVERIFY(r->dependencies.isEmpty());
+
+    data.chop(3);
+    r.reset(PackageVersion::parseBinary(data, &err));
+    QVERIFY(r.get() == nullptr);
+    QVERIFY(!err.isEmpty());
+}
+
+void App::testPackageVersionContent()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testPackageVersionContent");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+
+    PackageVersion pv("com.example.Test", Version(1, 2));
+    pv.download = QUrl("https://www.example.com/test-1.2.exe");
+    pv.cmdFiles.append("bin\\test.exe");
+    QVERIFY(dbr.savePackageVersion(&pv, true).isEmpty());
+
+    QSqlDatabase db = tdb.getDatabase();
+    QSqlQuery q(db);
+    QVERIFY(q.exec("SELECT CONTENT, BINARY_CONTENT FROM PACKAGE_VERSION"));
+    QVERIFY(q.next());
+    QByteArray xml = q.value(0).toByteArray();
+    QVERIFY(!PackageVersion::isBinary(xml));
+    QVERIFY(PackageVersion::isBinary(q.value(1).toByteArray()));
+    q.finish();
+
+    // a row written by an older program version
+    QVERIFY(q.prepare("INSERT INTO PACKAGE_VERSION(NAME, PACKAGE, URL, "
+            "CONTENT, DETECT_FILE_COUNT) VALUES('1.3', 'com.example.Test', "
+            "'', :CONTENT, 0)"));
+    q.bindValue(":CONTENT", xml.replace("1.2", "1.3"));
+    QVERIFY(q.exec());
+
+    std::unique_ptr<PackageVersion> r(dbr.findPackageVersion_(
+            "com.example.Test", Version(1, 3), &err));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r.get() != nullptr);
+    QVERIFY(r->version == Version(1, 3));
+    QCOMPARE(r->cmdFiles, pv.cmdFiles);
+
+    r.reset(dbr.findPackageVersion_("com.example.Test", Version(1, 2), &err));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(r.get() != nullptr);
+    QCOMPARE(r->download, pv.download);
+}
+
+/**
+ * @brief saves synthetic packages for the search tests
+ * @param dbr database
+ * @param n number of packages
+ * @return error message
+ */
+static QString saveSearchTestPackages(DBRepository& dbr, int n)
+{
+    QStringList words = QString("editor viewer player browser compiler "
+            "archive image video audio office database network backup "
+            "converter manager terminal server client library runtime "
+            "framework toolkit driver monitor scanner").split(' ');
+    QString err = dbr.exec("BEGIN TRANSACTION");
+    for (int i = 0; i < n && err.isEmpty(); i++) {
+        QString title = words.at(i % words.size()) + " " +
+                words.at((i / words.size()) % words.size()) + " " +
+                QString::number(i);
+        Package p(QString("com.example.Package%1").arg(i), title);
+        p.description = QString("A %1 for %2 files, 64 bit").
+                arg(words.at((i * 7) % words.size())).
+                arg(words.at((i * 13) % words.size()));
+        p.stars = i % 100;
+        err = dbr.savePackage(&p, false);
+    }
+    if (err.isEmpty())
+        err = dbr.updateSearchIndex();
+    if (err.isEmpty())
+        err = dbr.exec("COMMIT");
+    else
+        dbr.exec("ROLLBACK");
+    return err;
+}
+
+void App::testSearchLike()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testSearchLike");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+    if (!dbr.isFullTextIndexEnabled())
+        QSKIP("SQLite was compiled without FTS5 or the trigram tokenizer");
+
+    err = saveSearchTestPackages(dbr, 1000);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // prefixes, infixes, short words, LIKE wildcards and exclusions
+    QStringList queries = QString("editor|edit|ditor|video converter|"
+            "x86_64 backup|network -client|package99|64 bit|or|"
+            "layer -ditor|rowse 12|-player|ew_r").split('|');
+    for (int i = 0; i < queries.size(); i++) {
+        const QString& query = queries.at(i);
+
+        QStringList found[2];
+        for (int mode = 0; mode < 2; mode++) {
+            dbr.setFullTextIndexEnabled(mode == 0);
+            found[mode] = dbr.findPackages(Package::NOT_INSTALLED,
+                    Package::NOT_INSTALLED_NOT_AVAILABLE, query, -1, -1,
+                    &err);
+            QVERIFY2(err.isEmpty(), qPrintable(err));
+
+            // only the order depends on the ranking
+            found[mode].sort();
+        }
+        QVERIFY2(found[0] == found[1], qPrintable(query));
+    }
+    dbr.setFullTextIndexEnabled(true);
+}
+
+void App::benchmarkSearch()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    TestDatabase tdb;
+    QString err = tdb.open("benchmarkSearch");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+    if (!dbr.isFullTextIndexEnabled())
+        QSKIP("SQLite was compiled without FTS5 or the trigram tokenizer");
+
+    // synthetic repository with 50000 packages
+    err = saveSearchTestPackages(dbr, 50000);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QStringList queries = QString("editor|video converter|x86_64 backup|"
+            "network -client|package4999").split('|');
+    for (int i = 0; i < queries.size(); i++) {
+        const QString& query = queries.at(i);
+
+        double times[2];
+        int found[2];
+        for (int mode = 0; mode < 2; mode++) {
+            dbr.setFullTextIndexEnabled(mode == 0);
+
+            QElapsedTimer timer;
+            timer.start();
+            QStringList r;
+            for (int j = 0; j < 10; j++) {
+                r = dbr.findPackages(Package::NOT_INSTALLED,
+                        Package::NOT_INSTALLED_NOT_AVAILABLE, query, -1, -1,
+                        &err);
+                QVERIFY2(err.isEmpty(), qPrintable(err));
+            }
+            times[mode] = timer.nsecsElapsed() / 10.0 / 1000000.0;
+            found[mode] = r.size();
+        }
+
+        // the results are compared in testSearchLike()
+        QVERIFY(found[0] > 0);
+        QCOMPARE(found[0], found[1]);
+
+        qCDebug(npackd).noquote() << QString(
+                "\"%1\": FTS5 %2 ms (%3 packages), LIKE %4 ms (%5 packages)").
+                arg(query).arg(times[0], 0, 'f', 2).arg(found[0]).
+                arg(times[1], 0, 'f', 2).arg(found[1]);
+    }
+}
+
+/**
+ * @brief plans the installation using the specified planner
+ * @param rep repository
+ * @param pv package version
+ * @param recursive true = use the recursive planner
+ * @param ops the operations will be stored here as strings
+ * @param ms the duration in milliseconds will be stored here
+ * @return error message
+ */
+static QString planWith(AbstractRepository* rep, PackageVersion* pv,
+        bool recursive, QStringList* ops, double* ms)
+{
+    InstalledPackages installed;
+    QList<InstallOperation*> ops_;
+    QList<PackageVersion*> avoid;
+
+    PackageVersion::useRecursivePlanner = recursive;
+    QElapsedTimer timer;
+    timer.start();
+    QString err = pv->planInstallation(rep, installed, ops_, avoid);
+    *ms = timer.nsecsElapsed() / 1000000.0;
+    PackageVersion::useRecursivePlanner = false;
+
+    for (int i = 0; i < ops_.size(); i++) {
+        Version v = ops_.at(i)->version;
+        v.normalize();
+        ops->append(ops_.at(i)->package + " " + v.getVersionString());
+    }
+    qDeleteAll(ops_);
+    qDeleteAll(avoid);
+
+    return err;
+}
+
+/**
+ * @brief adds a package version with an archive to the repository
+ * @param rep repository
+ * @param package package name
+ * @param version version
+ * @param deps dependencies like "com.example.B [1, 2]"
+ */
+static void addPackageVersion(Repository* rep, const QString& package,
+        int version, const QStringList& deps)
+{
+    PackageVersion pv(package, Version(version, 0));
+    pv.download = QUrl("https://example.com/" + package + ".zip");
+    for (int i = 0; i < deps.size(); i++) {
+        Dependency* d = new Dependency();
+        d->package = deps.at(i).section(' ', 0, 0);
+        QVERIFY(d->setVersions(deps.at(i).section(' ', 1)));
+        pv.dependencies.append(d);
+    }
+    rep->savePackageVersion(&pv, false);
+}
+
+void App::testSearchIndexUpdate()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testSearchIndexUpdate");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+    if (!dbr.isFullTextIndexEnabled())
+        QSKIP("SQLite was compiled without FTS5");
+
+    Package a("com.example.A", "Alpha editor");
+    QVERIFY(dbr.savePackage(&a, false).isEmpty());
+    Package b("com.example.B", "Beta player");
+    QVERIFY(dbr.savePackage(&b, false).isEmpty());
+
+    QStringList r = dbr.findPackages(Package::NOT_INSTALLED,
+            Package::NOT_INSTALLED_NOT_AVAILABLE, "alpha", -1, -1, &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(r, QStringList() << "com.example.A");
+
+    // the old words must not be found after the title changed
+    a.title = "Gamma viewer";
+    a.description = "Shows images";
+    QVERIFY(dbr.savePackage(&a, true).isEmpty());
+
+    r = dbr.findPackages(Package::NOT_INSTALLED,
+            Package::NOT_INSTALLED_NOT_AVAILABLE, "gamma", -1, -1, &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(r, QStringList() << "com.example.A");
+    r = dbr.findPackages(Package::NOT_INSTALLED,
+            Package::NOT_INSTALLED_NOT_AVAILABLE, "images", -1, -1, &err);
+    QCOMPARE(r, QStringList() << "com.example.A");
+    r = dbr.findPackages(Package::NOT_INSTALLED,
+            Package::NOT_INSTALLED_NOT_AVAILABLE, "alpha", -1, -1, &err);
+    QVERIFY(r.isEmpty());
+    r = dbr.findPackages(Package::NOT_INSTALLED,
+            Package::NOT_INSTALLED_NOT_AVAILABLE, "beta", -1, -1, &err);
+    QCOMPARE(r, QStringList() << "com.example.B");
+
+    // nothing is left to be repaired
+    QVERIFY(dbr.updateSearchIndex().isEmpty());
+    r = dbr.findPackages(Package::NOT_INSTALLED,
+            Package::NOT_INSTALLED_NOT_AVAILABLE, "viewer", -1, -1, &err);
+    QCOMPARE(r, QStringList() << "com.example.A");
+}
+
+void App::testSnapshot()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // only the stamp of the database file is used
+    QString dbFile = dir.path() + "/Data.db";
+    QFile f(dbFile);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    f.write("data");
+    f.close();
+
+    Package p("com.example.Editor", "Editor");
+    p.description = "An editor";
+    p.setIcon("https://example.com/editor.png");
+    p.links.insert("homepage", "https://example.com");
+    p.tags.append("text");
+
+    DBSnapshot s;
+    s.readDatabaseStamp(dbFile);
+    s.addPackage(&p);
+    QString file = DBSnapshot::getFile(dbFile);
+    QString err = s.save(file);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(DBSnapshot::isUpToDate(file, dbFile));
+
+    DBSnapshot r;
+    err = r.open(file, dbFile);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    std::unique_ptr<Package> found(r.findPackage("com.example.Editor"));
+    QVERIFY(found.get() != nullptr);
+    QCOMPARE(found->title, QString("Editor"));
+    QCOMPARE(found->description, p.description);
+    QCOMPARE(found->getIcon(), p.getIcon());
+    QCOMPARE(found->links.value("homepage"), QString("https://example.com"));
+    QCOMPARE(found->tags, p.tags);
+
+    // a change after the stamp was read makes the snapshot out of date
+    DBSnapshot changed;
+    changed.readDatabaseStamp(dbFile);
+    QVERIFY(f.open(QIODevice::Append));
+    f.write("more data");
+    f.close();
+    changed.addPackage(&p);
+    QString changedFile = dir.path() + "/Changed.snapshot";
+    err = changed.save(changedFile);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(!DBSnapshot::isUpToDate(changedFile, dbFile));
+}
+
+void App::testDependencySolver()
+{
+    // diamond: D 2 is the only version that fulfills both dependencies
+    Repository rep;
+    addPackageVersion(&rep, "com.example.A", 1,
+            QStringList() << "com.example.B [1, 9]" << "com.example.C [1, 9]");
+    addPackageVersion(&rep, "com.example.B", 1,
+            QStringList() << "com.example.D [1, 2]");
+    addPackageVersion(&rep, "com.example.C", 1,
+            QStringList() << "com.example.D [2, 3]");
+    for (int i = 1; i <= 3; i++)
+        addPackageVersion(&rep, "com.example.D", i, QStringList());
+
+    QStringList ops[2];
+    double ms[2];
+    QString err[2];
+    for (int mode = 0; mode < 2; mode++) {
+        std::unique_ptr<PackageVersion> pv(
+                rep.package2versions.value("com.example.A")->clone());
+        err[mode] = planWith(&rep, pv.get(), mode == 1, &ops[mode], &ms[mode]);
+        QVERIFY2(err[mode].isEmpty(), qPrintable(err[mode]));
+    }
+    QCOMPARE(ops[0], ops[1]);
+    QCOMPARE(ops[0].join(", "), QString("com.example.D 2, com.example.B 1, "
+            "com.example.C 1, com.example.A 1"));
+
+    // a chain of 6 packages with 4 versions each that cannot be installed
+    // because of the last dependency
+    Repository rep2;
+    for (int i = 0; i < 6; i++) {
+        for (int v = 1; v <= 4; v++) {
+            addPackageVersion(&rep2, QString("com.example.P%1").arg(i), v,
+                    QStringList() << QString("com.example.P%1 [1, 9]").
+                    arg(i + 1));
+        }
+    }
+    for (int mode = 0; mode < 2; mode++) {
+        ops[mode].clear();
+        std::unique_ptr<PackageVersion> pv(
+                rep2.package2versions.value("com.example.P0")->clone());
+        err[mode] = planWith(&rep2, pv.get(), mode == 1, &ops[mode],
+                &ms[mode]);
+        QVERIFY(!err[mode].isEmpty());
+        QVERIFY(ops[mode].isEmpty());
+    }
+    QCOMPARE(err[0], err[1]);
+
+    qCDebug(npackd).noquote() << QString(
+            "DependencySolver %1 ms, recursive planner %2 ms").
+            arg(ms[0], 0, 'f', 2).arg(ms[1], 0, 'f', 2);
+}
+
+void App::testOperationOrder()
+{
+    Repository rep;
+    addPackageVersion(&rep, "com.example.B", 1,
+            QStringList() << "com.example.D [1, 2]");
+    addPackageVersion(&rep, "com.example.C", 1,
+            QStringList() << "com.example.D [2, 3]");
+    addPackageVersion(&rep, "com.example.D", 2, QStringList());
+    addPackageVersion(&rep, "com.example.X", 1, QStringList());
+    addPackageVersion(&rep, "com.example.Old", 1, QStringList());
+
+    // removal, D, B -> D, X, C -> D, removal
+    QStringList names = QStringList() << "com.example.Old" <<
+            "com.example.D" << "com.example.B" << "com.example.X" <<
+            "com.example.C" << "com.example.Old";
+    QList<InstallOperation*> ops;
+    QList<PackageVersion*> pvs;
+    for (int i = 0; i < names.size(); i++) {
+        InstallOperation* op = new InstallOperation();
+        op->package = names.at(i);
+        op->install = i != 0 && i != names.size() - 1;
+        ops.append(op);
+        pvs.append(rep.package2versions.value(names.at(i))->clone());
+    }
+
+    QVector<QVector<int> > deps =
+            AbstractRepository::getOperationDependencies(ops, pvs);
+    QCOMPARE(deps.at(0), QVector<int>());
+    QCOMPARE(deps.at(1), QVector<int>() << 0);
+    QCOMPARE(deps.at(2), QVector<int>() << 0 << 1);
+    QCOMPARE(deps.at(3), QVector<int>() << 0);
+    QCOMPARE(deps.at(4), QVector<int>() << 0 << 1);
+    QCOMPARE(deps.at(5), QVector<int>() << 0 << 1 << 2 << 3 << 4);
+
+    // the binary for D is downloaded last
+    int n = ops.size();
+    QVector<bool> downloaded(n, true);
+    downloaded[1] = false;
+    QVector<bool> processed(n);
+    QStringList order;
+    for (int step = 0; step < 2 * n; step++) {
+        int i = AbstractRepository::findReadyOperation(deps, downloaded,
+                processed);
+        if (i < 0) {
+            QVERIFY(!downloaded.at(1));
+            order.append("wait");
+            downloaded[1] = true;
+        } else {
+            processed[i] = true;
+            order.append(QString::number(i));
+        }
+
+        if (!processed.contains(false))
+            break;
+    }
+    QCOMPARE(order.join(", "), QString("0, 3, wait, 1, 2, 4, 5"));
+
+    qDeleteAll(pvs);
+    qDeleteAll(ops);
+}
+
+/**
+ * @brief saves installed packages with 10 versions each. Version 1.9 has no
+ *     download for odd packages. Every 7th package has no download at all
+ *     and for every 5th package the installed version does not exist.
+ * @param dbr database
+ * @param n number of packages
+ * @param names the package names will be stored here
+ * @param installed package name -> installed version will be stored here
+ * @return error message
+ */
+static QString savePlanTestPackages(DBRepository& dbr, int n,
+        QStringList* names, QMap<QString, Version>* installed)
+{
+    QString err = dbr.exec("BEGIN TRANSACTION");
+    for (int i = 0; i < n && err.isEmpty(); i++) {
+        QString name = QString("com.example.Package%1").arg(i);
+        names->append(name);
+        installed->insert(name, i % 5 == 4 ? Version(2, 0) :
+                Version(1, i % 10));
+        for (int v = 0; v < 10 && err.isEmpty(); v++) {
+            PackageVersion pv(name, Version(1, v));
+            if ((v != 9 || i % 2 == 0) && i % 7 != 3)
+                pv.download = QUrl("https://example.com/" + name + ".zip");
+            err = dbr.savePackageVersion(&pv, false);
+        }
+    }
+    if (err.isEmpty())
+        err = dbr.exec("COMMIT");
+    else
+        dbr.exec("ROLLBACK");
+    return err;
+}
+
+/**
+ * @brief finds the newest installable and the installed versions using
+ *     one query for every package as in the old planUpdates and using
+ *     DBRepository::findNewestAndInstalled_()
+ * @param dbr database
+ * @param names package names
+ * @param installed package name -> installed version
+ * @param ms the durations in milliseconds for both methods will be stored
+ *     here
+ * @return error message or the first difference between the results
+ */
+static QString compareNewestAndInstalled(DBRepository& dbr,
+        const QStringList& names, const QMap<QString, Version>& installed,
+        double* ms)
+{
+    QString err;
+    QMap<QString, PackageVersion*> newest[2], installedVersions[2];
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < names.size() && err.isEmpty(); i++) {
+        const QString& name = names.at(i);
+        PackageVersion* a = dbr.findNewestInstallablePackageVersion_(name,
+                &err);
+        if (a)
+            newest[0].insert(name, a);
+        PackageVersion* b = nullptr;
+        if (err.isEmpty())
+            b = dbr.findPackageVersion_(name, installed.value(name), &err);
+        if (b)
+            installedVersions[0].insert(name, b);
+    }
+    ms[0] = timer.nsecsElapsed() / 1000000.0;
+
+    timer.restart();
+    if (err.isEmpty())
+        err = dbr.findNewestAndInstalled_(names, installed, &newest[1],
+                &installedVersions[1]);
+    ms[1] = timer.nsecsElapsed() / 1000000.0;
+
+    for (int i = 0; i < names.size() && err.isEmpty(); i++) {
+        const QString& name = names.at(i);
+        for (int j = 0; j < 2 && err.isEmpty(); j++) {
+            QMap<QString, PackageVersion*>* r = j == 0 ? newest :
+                    installedVersions;
+            PackageVersion* a = r[0].value(name);
+            PackageVersion* b = r[1].value(name);
+            if ((a == nullptr) != (b == nullptr) ||
+                    (a && !(a->version == b->version)))
+                err = QString("%1: %2 instead of %3").arg(name).
+                        arg(b ? b->version.getVersionString() : "none").
+                        arg(a ? a->version.getVersionString() : "none");
+        }
+    }
+
+    for (int mode = 0; mode < 2; mode++) {
+        qDeleteAll(newest[mode]);
+        qDeleteAll(installedVersions[mode]);
+    }
+
+    return err;
+}
+
+void App::testFindNewestAndInstalled()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testFindNewestAndInstalled");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // more packages than the 500 parameters in one query
+    QStringList names;
+    QMap<QString, Version> installed;
+    err = savePlanTestPackages(tdb.dbr, 600, &names, &installed);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    double ms[2];
+    err = compareNewestAndInstalled(tdb.dbr, names, installed, ms);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+}
+
+void App::benchmarkPlanUpdates()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    TestDatabase tdb;
+    QString err = tdb.open("benchmarkPlanUpdates");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // 300 installed packages with 10 versions each
+    QStringList names;
+    QMap<QString, Version> installed;
+    err = savePlanTestPackages(tdb.dbr, 300, &names, &installed);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // the results are compared in testFindNewestAndInstalled()
+    double ms[2];
+    err = compareNewestAndInstalled(tdb.dbr, names, installed, ms);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    qCDebug(npackd).noquote() << QString(
+            "300 packages: per package %1 ms, batched %2 ms").
+            arg(ms[0], 0, 'f', 2).arg(ms[1], 0, 'f', 2);
+}
+
+/**
+ * @brief sorts random versions using the packed and the part-by-part
+ *     comparison. Every 10th version has 5 parts and cannot be packed.
+ * @param n number of versions
+ * @param ms the durations in milliseconds for both comparisons will be
+ *     stored here
+ * @return true if both sorted lists are equal
+ */
+static bool sortVersions(int n, double* ms)
+{
+    QVector<Version> versions;
+    versions.reserve(n);
+    qsrand(1);
+    for (int i = 0; i < n; i++) {
+        Version v;
+        if (i % 10 == 0)
+            v.setVersion(QString("%1.%2.%3.%4.%5").arg(qrand() % 5).
+                    arg(qrand() % 20).arg(qrand() % 20).arg(qrand() % 20).
+                    arg(qrand() % 5));
+        else
+            v.setVersion(qrand() % 5, qrand() % 20, qrand() % 20,
+                    qrand() % 20);
+        versions.append(v);
+    }
+
+    QVector<Version> sorted[2] = {versions, versions};
+    for (int mode = 0; mode < 2; mode++) {
+        QElapsedTimer timer;
+        timer.start();
+        if (mode == 0) {
+            std::sort(sorted[mode].begin(), sorted[mode].end(),
+                    [](const Version& a, const Version& b) {
+                return a.compare(b) < 0;
+            });
+        } else {
+            std::sort(sorted[mode].begin(), sorted[mode].end(),
+                    [](const Version& a, const Version& b) {
+                return a.compareParts(b) < 0;
+            });
+        }
+        ms[mode] = timer.nsecsElapsed() / 1000000.0;
+    }
+
+    for (int i = 0; i < versions.size(); i++) {
+        if (sorted[0].at(i).compareParts(sorted[1].at(i)) != 0)
+            return false;
+    }
+    return true;
+}
+
+void App::testVersionCompare()
+{
+    // packed and not packed versions must be comparable with each other
+    Version a, b;
+    a.setVersion("1.2.3.4.5");
+    b.setVersion("1.2.3.5");
+    QVERIFY(a < b);
+    QVERIFY(a.compare(b) < 0 && a.compareParts(b) < 0);
+    b.setVersion("1.2.3.4");
+    QVERIFY(a > b);
+    a.setVersion("1.100000");
+    b.setVersion("1.99999.1");
+    QVERIFY(a > b);
+    QVERIFY(a.compare(b) > 0 && a.compareParts(b) > 0);
+    a.setVersion("70000");
+    b.setVersion("2.65535.65535.65535");
+    QVERIFY(a > b);
+
+    // trailing zeros do not change the packed key
+    a.setVersion("2.0.0.0.0.0");
+    b.setVersion("2");
+    QVERIFY(a == b);
+    QCOMPARE(a.compare(b), 0);
+    a.setVersion("1.2.0");
+    b.setVersion(1, 2);
+    QVERIFY(a == b);
+    QVERIFY(!(a < b) && !(a > b));
+
+    // the canonical string passed to setVersion() is returned as is,
+    // others are re-created
+    a.setVersion("01.02");
+    QCOMPARE(a.getVersionString(), QString("1.2"));
+    QCOMPARE(a.toComparableString(), QString("0000000001.0000000002"));
+    a.setVersion("1.2.3");
+    QCOMPARE(a.getVersionString(), QString("1.2.3"));
+    a.setVersion("1.2.0.0");
+    QCOMPARE(a.getVersionString(), QString("1.2.0.0"));
+    a.normalize();
+    QCOMPARE(a.getVersionString(), QString("1.2"));
+    a.setVersion(3, 0, 1);
+    QCOMPARE(a.getVersionString(), QString("3.0.1"));
+
+    double ms[2];
+    QVERIFY(sortVersions(2000, ms));
+}
+
+void App::benchmarkVersionSort()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    // the results are compared in testVersionCompare()
+    double ms[2];
+    QVERIFY(sortVersions(100000, ms));
+
+    qCDebug(npackd).noquote() << QString(
+            "Sorting 100000 versions: packed %1 ms, part by part %2 ms").
+            arg(ms[0], 0, 'f', 2).arg(ms[1], 0, 'f', 2);
+}
+
+/**
+ * @param ip installed package versions
+ * @param filePath a file
+ * @return [move] the owner found by the previous linear search or nullptr
+ */
+static InstalledPackageVersion* findOwnerLinear(const InstalledPackages& ip,
+        const QString& filePath)
+{
+    InstalledPackageVersion* r = nullptr;
+    QList<InstalledPackageVersion*> all = ip.getAll();
+    for (int i = 0; i < all.size(); i++) {
+        if (WPMUtils::isUnderOrEquals(filePath, all.at(i)->getDirectory())) {
+            r = all.at(i)->clone();
+            break;
+        }
+    }
+    qDeleteAll(all);
+    return r;
+}
+
+/**
+ * @brief installs 10 versions per package, some of them nested in a common
+ *     directory. The version 9.1 of test.p3 is installed and uninstalled
+ *     again.
+ * @param ip installed package versions
+ * @param n number of package versions
+ * @return error message
+ */
+static QString installTestPackages(InstalledPackages& ip, int n)
+{
+    QString err;
+    for (int i = 0; i < n && err.isEmpty(); i++) {
+        QString package = QString("test.p%1").arg(i / 10);
+        Version v(i % 10, 1);
+        QString dir = QString("C:\\Test\\P%1\\V%2").
+                arg(i / 10).arg(i % 10);
+        err = ip.setPackageVersionPath(package, v, dir, false);
+    }
+    if (err.isEmpty())
+        err = ip.setPackageVersionPath("test.common", Version(1, 0),
+                "C:\\Test\\P7", false);
+
+    // uninstalled versions must disappear from all indexes
+    if (err.isEmpty())
+        err = ip.setPackageVersionPath("test.p3", Version(9, 1), "", false);
+    if (err.isEmpty())
+        err = ip.setPackageVersionPath("test.p3", Version(9, 1),
+                "C:\\Other", false);
+    if (err.isEmpty())
+        err = ip.setPackageVersionPath("test.p3", Version(9, 1), "", false);
+
+    return err;
+}
+
+void App::testInstalledPackagesIndex()
+{
+    InstalledPackages ip;
+    QString err = installTestPackages(ip, 1000);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QStringList files;
+    files << "C:\\Test\\P5\\V3\\bin\\a.exe" <<
+            "c:/test/p5/v3" << "C:\\Test\\P7\\V1\\x.txt" <<
+            "C:\\Test\\P7" << "C:\\Test" <<
+            "C:\\Test\\P3\\V9\\a.txt" << "C:\\Other" <<
+            "C:\\Test\\P5\\V30";
+    for (int i = 0; i < files.size(); i++) {
+        std::unique_ptr<InstalledPackageVersion> a(
+                ip.findOwner(files.at(i)));
+        std::unique_ptr<InstalledPackageVersion> b(
+                findOwnerLinear(ip, files.at(i)));
+        QVERIFY2((a.get() == nullptr) == (b.get() == nullptr),
+                qPrintable(files.at(i)));
+        if (a)
+            QVERIFY2(*a == *b, qPrintable(files.at(i)));
+    }
+
+    QVERIFY(ip.isUsedBelow("C:\\Test"));
+    QVERIFY(ip.isUsedBelow("c:\\test\\p5\\v3\\"));
+    QVERIFY(!ip.isUsedBelow("C:\\Test\\P3\\V9"));
+    QVERIFY(!ip.isUsedBelow("C:\\Other"));
+
+    QList<InstalledPackageVersion*> vs = ip.getByPackage("test.p3");
+    QVERIFY(vs.size() == 9);
+    for (int i = 1; i < vs.size(); i++) {
+        QVERIFY(vs.at(i - 1)->version < vs.at(i)->version);
+    }
+    qDeleteAll(vs);
+
+    std::unique_ptr<InstalledPackageVersion> newest(
+            ip.getNewestInstalled("test.p3"));
+    QVERIFY(newest && newest->version == Version(8, 1));
+
+    Dependency d;
+    d.package = "test.p3";
+    QVERIFY(d.setVersions("[9, 10)"));
+    QVERIFY(!ip.isInstalled(d));
+    QVERIFY(d.setVersions("[8, 9)"));
+    QVERIFY(ip.isInstalled(d));
+    QList<InstalledPackageVersion*> m = ip.findAllInstalledMatches(d);
+    QVERIFY(m.size() == 1);
+    qDeleteAll(m);
+}
+
+void App::benchmarkInstalledPackages()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    // the results are compared in testInstalledPackagesIndex()
+    const int sizes[] = {1000, 10000};
+    for (int s = 0; s < 2; s++) {
+        int n = sizes[s];
+        InstalledPackages ip;
+        QString err = installTestPackages(ip, n);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < 1000; i++) {
+            QString file = QString("C:\\Test\\P%1\\V%2\\bin\\a.exe").
+                    arg(i % (n / 10)).arg(i % 10);
+            std::unique_ptr<InstalledPackageVersion> a(ip.findOwner(file));
+            QVERIFY(a.get() != nullptr);
+            std::unique_ptr<InstalledPackageVersion> b(
+                    ip.getNewestInstalled(a->package));
+            QVERIFY(b.get() != nullptr);
+        }
+        double indexed = timer.nsecsElapsed() / 1000000.0;
+
+        timer.restart();
+        for (int i = 0; i < 100; i++) {
+            QString file = QString("C:\\Test\\P%1\\V%2\\bin\\a.exe").
+                    arg(i % (n / 10)).arg(i % 10);
+            std::unique_ptr<InstalledPackageVersion> a(
+                    findOwnerLinear(ip, file));
+            QVERIFY(a.get() != nullptr);
+        }
+        double linear = timer.nsecsElapsed() / 1000000.0 * 10;
+
+        qCDebug(npackd).noquote() << QString(
+                "%1 package versions, 1000 lookups: indexed %2 ms, "
+                "linear %3 ms").arg(n + 1).arg(indexed, 0, 'f', 2).
+                arg(linear, 0, 'f', 2);
+    }
+}
+
+void App::testTitleIndexLike()
+{
+    QVERIFY(TitleIndex::like(" x86 64 ", "% x86_64 %"));
+    QVERIFY(TitleIndex::like(" editor 1.0 ", "% editor %"));
+    QVERIFY(!TitleIndex::like(" Editor 1.0 ", "% editor %"));
+    QVERIFY(!TitleIndex::like(" editors ", "% editor %"));
+    QVERIFY(TitleIndex::like("", "%"));
+    QVERIFY(!TitleIndex::like("a", "_b%"));
+}
+
+/**
+ * @brief saves packages with similar titles and searches for better packages
+ *     with and without TitleIndex
+ * @param dbr repository
+ * @param n number of packages
+ * @param ms the time needed for LIKE and for TitleIndex in milliseconds will
+ *     be stored here
+ * @param titles the searched titles will be stored here
+ * @return error message. A title is returned if the results for it differ.
+ */
+static QString compareTitleIndex(DBRepository& dbr, int n, double* ms,
+        QStringList* titles)
+{
+    dbr.setFullTextIndexEnabled(false);
+
+    QStringList words = QString("editor viewer player browser compiler "
+            "archive image video audio office database network backup").
+            split(' ');
+    QString err = dbr.exec("BEGIN TRANSACTION");
+    for (int i = 0; i < n && err.isEmpty(); i++) {
+        QString title = words.at(i % words.size()) + " " +
+                words.at((i / words.size()) % words.size()) + " " +
+                QString("Tool%1").arg(i % 700);
+        if (i % 50 == 0)
+            title += " (x64)";
+        if (i % 333 == 0)
+            title += " 100% C++";
+        QString name = QString("com.example.Package%1").arg(i);
+        if (i % 10 == 0)
+            name = QString("msi.%1").arg(i);
+        Package p(name, title);
+        err = dbr.savePackage(&p, false);
+    }
+    if (err.isEmpty())
+        err = dbr.exec("COMMIT");
+    if (!err.isEmpty())
+        return err;
+
+    for (int i = 0; i < 400; i++) {
+        int j = i * 11;
+        titles->append(words.at(j % words.size()) + " " +
+                words.at((j / words.size()) % words.size()) + " " +
+                QString("tool%1").arg(j % 700));
+    }
+    *titles << "Editor Viewer 3 x64" << "editor 100%" << "C++" << "a b" <<
+            "" << "database x86_64" << "Backup (64 bit)";
+
+    QList<QStringList> found[2];
+    for (int mode = 0; mode < 2 && err.isEmpty(); mode++) {
+        dbr.setTitleIndexEnabled(mode == 1);
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < titles->size() && err.isEmpty(); i++) {
+            found[mode].append(dbr.findBetterPackages(titles->at(i), &err));
+        }
+        ms[mode] = timer.nsecsElapsed() / 1000000.0;
+    }
+    dbr.setTitleIndexEnabled(false);
+    if (!err.isEmpty())
+        return err;
+
+    int one = 0;
+    for (int i = 0; i < titles->size(); i++) {
+        if (found[0].at(i) != found[1].at(i))
+            return titles->at(i);
+        if (found[0].at(i).size() == 1)
+            one++;
+    }
+    if (one == 0)
+        err = "No title matches exactly one package";
+
+    return err;
+}
+
+void App::testTitleIndex()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testTitleIndex");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    double ms[2];
+    QStringList titles;
+    err = compareTitleIndex(tdb.dbr, 500, ms, &titles);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+}
+
+void App::benchmarkFindBetterPackages()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    TestDatabase tdb;
+    QString err = tdb.open("benchmarkFindBetterPackages");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // 5000 packages with similar titles. The results are compared in
+    // testTitleIndex().
+    double ms[2];
+    QStringList titles;
+    err = compareTitleIndex(tdb.dbr, 5000, ms, &titles);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    qCDebug(npackd).noquote() << QString(
+            "%1 titles: LIKE %2 ms, index %3 ms").arg(titles.size()).
+            arg(ms[0], 0, 'f', 2).arg(ms[1], 0, 'f', 2);
+}
+
+/**
+ * @param db database
+ * @return names and titles of the test packages
+ */
+static QStringList readTestPackages(QSqlDatabase& db)
+{
+    QStringList r;
+    QSqlQuery q(db);
+    q.exec("SELECT NAME, TITLE FROM PACKAGE WHERE NAME LIKE 'test.%' "
+            "ORDER BY NAME");
+    while (q.next()) {
+        r.append(q.value(0).toString() + "=" + q.value(1).toString());
+    }
+    return r;
+}
+
+void App::testSaveDetected()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testSaveDetected");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+
+    Package pre("test.pre", "existing");
+    QVERIFY(dbr.savePackage(&pre, false).isEmpty());
+
+    // 2 inserting and 2 replacing package managers with overlapping packages
+    QList<bool> replace;
+    replace << false << false << true << true;
+    QList<Repository*> reps;
+    for (int i = 0; i < replace.size(); i++) {
+        Repository* r = new Repository();
+        QStringList names;
+        names << "test.all" << "test.pre" << QString("test.only%1").arg(i);
+        if (i % 2 == 0)
+            names << "test.even";
+        if (i != 1)
+            names << "test.not1";
+        if (i == 1 || i == 2)
+            names << "test.mixed";
+        for (int j = 0; j < names.size(); j++) {
+            r->packages.append(new Package(names.at(j),
+                    QString("from %1").arg(i)));
+        }
+        reps.append(r);
+    }
+
+    QSqlDatabase db = tdb.getDatabase();
+
+    err = dbr.exec("BEGIN TRANSACTION");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    for (int i = 0; i < reps.size(); i++) {
+        Job* job = new Job();
+        dbr.saveAll(job, reps.at(i), replace.at(i));
+        QVERIFY(job->getErrorMessage().isEmpty());
+        delete job;
+    }
+    QStringList expected = readTestPackages(db);
+    err = dbr.exec("ROLLBACK");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QVERIFY(expected.contains("test.pre=from 3"));
+    QVERIFY(expected.contains("test.mixed=from 2"));
+
+    QList<int> order;
+    for (int i = 0; i < reps.size(); i++) {
+        order.append(i);
+    }
+    do {
+        err = dbr.exec("BEGIN TRANSACTION");
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        QHash<QString, int> writers;
+        for (int i = 0; i < order.size(); i++) {
+            Job* job = new Job();
+            dbr.saveDetected(job, reps.at(order.at(i)), order.at(i), replace,
+                    &writers);
+            QVERIFY(job->getErrorMessage().isEmpty());
+            delete job;
+        }
+        QStringList found = readTestPackages(db);
+        err = dbr.exec("ROLLBACK");
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+
+        QVERIFY(found == expected);
+    } while (std::next_permutation(order.begin(), order.end()));
+
+    qDeleteAll(reps);
+}
+
+/**
+ * @param db database
+ * @return content of the tables changed by the detection
+ */
+static QStringList readDetectedTables(QSqlDatabase& db)
+{
+    QStringList sql;
+    sql << "SELECT NAME, STATUS FROM PACKAGE ORDER BY NAME" <<
+            "SELECT PACKAGE, NAME, URL FROM PACKAGE_VERSION "
+            "ORDER BY PACKAGE, NAME" <<
+            "SELECT PACKAGE, VERSION, NAME FROM CMD_FILE "
+            "ORDER BY PACKAGE, VERSION, NAME" <<
+            "SELECT PACKAGE, HREF FROM LINK ORDER BY PACKAGE, HREF" <<
+            "SELECT PACKAGE, VALUE FROM TAG ORDER BY PACKAGE, VALUE";
+
+    QStringList r;
+    QSqlQuery q(db);
+    for (int i = 0; i < sql.size(); i++) {
+        q.exec(sql.at(i));
+        while (q.next()) {
+            QStringList row;
+            for (int j = 0; j < q.record().count(); j++)
+                row.append(q.value(j).toString());
+            r.append(QString::number(i) + ":" + row.join('|'));
+        }
+    }
+    return r;
+}
+
+/**
+ * @brief fills the database like DBRepository::clearAndLoad(). The
+ *     repository contains com.example.App 2.
+ * @param dbr database
+ * @param detected the detected packages. Version 1 is installed for each of
+ *     them.
+ * @return error message
+ */
+static QString loadTestRepository(DBRepository& dbr,
+        const QStringList& detected)
+{
+    dbr.currentRepository = 0;
+    Package app("com.example.App", "App");
+    QString err = dbr.savePackage(&app, true);
+    PackageVersion app2("com.example.App", Version(2));
+    app2.download = QUrl("https://www.example.com/app-2.exe");
+    if (err.isEmpty())
+        err = dbr.savePackageVersion(&app2, true);
+
+    dbr.currentRepository = DBRepository::DETECTED_REPOSITORY;
+    for (int i = 0; i < detected.size() && err.isEmpty(); i++) {
+        const QString& name = detected.at(i);
+        if (!name.startsWith("com.example.")) {
+            Package p(name, name);
+            p.links.insert("homepage", "https://www.example.com/" + name);
+            p.tags.append("detected");
+            err = dbr.savePackage(&p, true);
+        }
+
+        PackageVersion pv(name, Version(1));
+        pv.cmdFiles.append("bin\\" + name + ".exe");
+        if (err.isEmpty())
+            err = dbr.savePackageVersion(&pv, true);
+        if (err.isEmpty())
+            err = dbr.exec("UPDATE PACKAGE SET STATUS=1 WHERE NAME='" +
+                    name + "'");
+    }
+    dbr.currentRepository = 0;
+
+    if (err.isEmpty())
+        err = dbr.deletePackagesWithoutVersions();
+
+    return err;
+}
+
+void App::testIncrementalRefresh()
+{
+    QStringList before, after;
+    before << "msi.a" << "msi.b" << "control-panel.c" << "com.example.App";
+    after << "msi.b";
+
+    TestDatabase full;
+    QString err = full.open("testIncrementalRefreshFull");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    err = loadTestRepository(full.dbr, after);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // see DBRepository::updateF5Runnable()
+    TestDatabase incremental;
+    err = incremental.open("testIncrementalRefresh");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = incremental.dbr;
+    err = loadTestRepository(dbr, before);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    err = dbr.exec("UPDATE PACKAGE SET STATUS=0");
+    if (err.isEmpty())
+        err = dbr.deleteDetectedPackageVersions();
+    if (err.isEmpty())
+        err = loadTestRepository(dbr, after);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QSqlDatabase fullDb = full.getDatabase();
+    QSqlDatabase incrementalDb = incremental.getDatabase();
+    QStringList expected = readDetectedTables(fullDb);
+    QVERIFY(expected.contains("1:msi.b|1|"));
+    QVERIFY(expected.contains("1:com.example.App|2|"
+            "https://www.example.com/app-2.exe"));
+    QCOMPARE(readDetectedTables(incrementalDb), expected);
+}
+
+void App::testPackageCache()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testPackageCache");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+
+    Package a("test.a", "A");
+    QVERIFY(dbr.savePackage(&a, false).isEmpty());
+    Package b("test.b", "B");
+    QVERIFY(dbr.savePackage(&b, false).isEmpty());
+    for (int i = 1; i <= 3; i++) {
+        PackageVersion pva("test.a", Version(1, i));
+        QVERIFY(dbr.savePackageVersion(&pva, false).isEmpty());
+        PackageVersion pvb("test.b", Version(2, i));
+        QVERIFY(dbr.savePackageVersion(&pvb, false).isEmpty());
+    }
+
+    ObjectCacheStatistics before = dbr.getPackageCacheStatistics();
+    std::shared_ptr<const Package> a1 = dbr.findPackageShared("test.a");
+    std::shared_ptr<const Package> a2 = dbr.findPackageShared("test.a");
+    QVERIFY(a1 && a1 == a2);
+    ObjectCacheStatistics after = dbr.getPackageCacheStatistics();
+    QVERIFY(after.misses == before.misses + 1);
+    QVERIFY(after.hits == before.hits + 1);
+    QVERIFY(after.cost > 0 && after.cost <= after.maxCost);
+
+    QList<std::shared_ptr<const PackageVersion> > va =
+            dbr.getPackageVersionsShared("test.a", &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(va.size() == 3 && va.at(0)->version == Version(1, 3));
+    QList<std::shared_ptr<const PackageVersion> > vb =
+            dbr.getPackageVersionsShared("test.b", &err);
+    QVERIFY(vb.size() == 3);
+
+    // only the changed package is reloaded
+    a.title = "A2";
+    QVERIFY(dbr.savePackage(&a, true).isEmpty());
+    PackageVersion pva("test.a", Version(1, 4));
+    QVERIFY(dbr.savePackageVersion(&pva, false).isEmpty());
+
+    std::shared_ptr<const Package> a3 = dbr.findPackageShared("test.a");
+    QVERIFY(a3 && a3 != a1 && a3->title == "A2");
+    QVERIFY(a1->title == "A");
+    QVERIFY(dbr.getPackageVersionsShared("test.a", &err).size() == 4);
+    QVERIFY(dbr.getPackageVersionsShared("test.b", &err).at(0) == vb.at(0));
+}
+
+void App::benchmarkPackageInfoLoader()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    TestDatabase tdb;
+    QString err = tdb.open("benchmarkPackageInfoLoader");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+
+    err = dbr.exec("BEGIN TRANSACTION");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    License lic("test.License", "Test License");
+    QVERIFY(dbr.saveLicense(&lic, false).isEmpty());
+    QStringList names;
+    for (int i = 0; i < 15000; i++) {
+        QString name = QString("test.Package%1").arg(i);
+        Package p(name, QString("Package %1").arg(i));
+        p.description = QString("Description for the package %1").arg(i);
+        p.license = lic.name;
+        QVERIFY(dbr.savePackage(&p, false).isEmpty());
+        for (int j = 0; j < 3; j++) {
+            PackageVersion pv(name, Version(1, j));
+            pv.download = QUrl(QString("https://example.com/p%1-%2.zip").
+                    arg(i).arg(j));
+            QVERIFY(dbr.savePackageVersion(&pv, false).isEmpty());
+        }
+        names.append(name);
+    }
+    err = dbr.exec("COMMIT");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // one frame shows 40 rows and scrolls by one page
+    const int page = 40;
+    for (int mode = 0; mode < 2; mode++) {
+        dbr.clearCache();
+        PackageInfoLoader loader(&dbr, mode == 1);
+        loader.setPackages(names);
+
+        QVector<double> frames;
+        int placeholders = 0;
+        for (int first = 0; first + page <= names.size(); first += page) {
+            QElapsedTimer timer;
+            timer.start();
+            loader.setVisibleRows(first, first + page - 1);
+            for (int row = first; row < first + page; row++) {
+                if (!loader.get(row))
+                    placeholders++;
+            }
+            QCoreApplication::processEvents();
+            frames.append(timer.nsecsElapsed() / 1000000.0);
+        }
+
+        // the last page is loaded in the background
+        QElapsedTimer timer;
+        timer.start();
+        while (loader.isLoading() && timer.elapsed() < 60000) {
+            QTest::qWait(10);
+        }
+        QVERIFY(!loader.isLoading());
+        for (int row = names.size() - page; row < names.size(); row++) {
+            const PackageRowInfo* info = loader.get(row);
+            QVERIFY(info != nullptr);
+            QVERIFY(info->title == QString("Package %1").arg(row));
+            QVERIFY(info->avail == "1.2");
+            QVERIFY(info->licenseTitle == "Test License");
+        }
+
+        std::sort(frames.begin(), frames.end());
+        double sum = 0;
+        for (int i = 0; i < frames.size(); i++) {
+            sum += frames.at(i);
+        }
+
+        qCDebug(npackd).noquote() << QString(
+                "%1: %2 frames, average %3 ms, 95th percentile %4 ms, "
+                "max %5 ms, "
+                "%6 placeholders").arg(mode == 0 ? "synchronous" :
+                "asynchronous").arg(frames.size()).
+                arg(sum / frames.size(), 0, 'f', 2).
+                arg(frames.at(frames.size() * 95 / 100), 0, 'f', 2).
+                arg(frames.last(), 0, 'f', 2).arg(placeholders);
+    }
+}
+
+void App::testJobNotifications()
+{
+    int interval = Job::getNotificationInterval();
+    Job::setNotificationInterval(10000);
+
+    Job* job = new Job("Test");
+    int notifications = 0;
+    QObject::connect(job, &Job::changed, job, [&](Job*) {
+        notifications++;
+    }, Qt::DirectConnection);
+
+    // the first change is reported, the second one is held back
+    job->setProgress(0.1);
+    QCOMPARE(notifications, 1);
+    job->setProgress(0.2);
+    QCOMPARE(notifications, 1);
+
+    // the title is always reported
+    job->setTitle("Another title");
+    QCOMPARE(notifications, 2);
+
+    // the held back progress change is reported only once
+    job->setProgress(0.3);
+    job->flushChange();
+    QCOMPARE(notifications, 3);
+    job->flushChange();
+    QCOMPARE(notifications, 3);
+
+    // the timeout is checked even if the change is not reported
+    job->setTimeout(1);
+    QThread::sleep(2);
+    job->setProgress(0.4);
+    QVERIFY(job->isCancelled());
+
+    job->complete();
+    delete job;
+
+    Job::setNotificationInterval(interval);
+}
+
+void App::benchmarkJobProgress()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    int interval = Job::getNotificationInterval();
+
+    // 0 = every change is reported as before
+    int intervals[] = {0, interval};
+    for (int mode = 0; mode < 2; mode++) {
+        Job::setNotificationInterval(intervals[mode]);
+
+        Job* top = new Job("Top");
+        QAtomicInt notifications;
+        QObject::connect(top, &Job::changed, top, [&](Job*) {
+            notifications.ref();
+        }, Qt::DirectConnection);
+
+        const int threads = 8;
+        const int n = 1000000 / threads;
+        QList<Job*> subs;
+        for (int i = 0; i < threads; i++) {
+            subs.append(top->newSubJob(1.0 / threads,
+                    QString("Thread %1").arg(i)));
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < threads; i++) {
+            Job* sub = subs.at(i);
+            QtConcurrent::run([sub, n]() {
+                for (int j = 0; j < n; j++) {
+                    sub->setProgress(static_cast<double>(j) / n);
+                }
+                sub->completeWithProgress();
+            });
+        }
+        top->waitForChildren();
+        double ms = timer.nsecsElapsed() / 1000000.0;
+
+        for (int i = 0; i < threads; i++) {
+            QVERIFY(subs.at(i)->isCompleted());
+            QVERIFY(subs.at(i)->getProgress() == 1);
+        }
+        top->complete();
+        top->waitFor();
+
+        qCDebug(npackd).noquote() << QString(
+                "notification interval %1 ms: %2 ms, %3 notifications").
+                arg(intervals[mode]).arg(ms, 0, 'f', 2).
+                arg(notifications.load());
+
+        delete top;
+    }
+
+    Job::setNotificationInterval(interval);
+}
+
+void App::testUnzip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QString zipfile = dir.path() + "\\test.zip";
+    QString outputdir = dir.path() + "\\out";
+
+    QuaZip zip(zipfile);
+    QVERIFY(zip.open(QuaZip::mdCreate));
+    QuaZipFile zf(&zip);
+    for (int i = 0; i < 500; i++) {
+        QString name = QString("d%1/e%2/file%3.txt").arg(i % 7).arg(i % 3).
+                arg(i);
+        QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo(name)));
+        zf.write(QByteArray(i * 100, static_cast<char>('a' + i % 26)));
+        zf.close();
+    }
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("empty/")));
+    zf.close();
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("Rep.xml")));
+    zf.write("<root/>");
+    zf.close();
+    zip.close();
+
+    Job* job = new Job("Unzip");
+    WPMUtils::unzip(job, zipfile, outputdir);
+    QVERIFY2(job->getErrorMessage().isEmpty(),
+            qPrintable(job->getErrorMessage()));
+    QVERIFY(job->isCompleted());
+    delete job;
+
+    for (int i = 0; i < 500; i++) {
+        QFile f(QString("%1\\d%2\\e%3\\file%4.txt").arg(outputdir).
+                arg(i % 7).arg(i % 3).arg(i));
+        QVERIFY2(f.open(QIODevice::ReadOnly), qPrintable(f.fileName()));
+        QCOMPARE(f.readAll(), QByteArray(i * 100,
+                static_cast<char>('a' + i % 26)));
+    }
+    QVERIFY(QDir(outputdir + "\\empty").exists());
+
+    QString err;
+    std::unique_ptr<QIODevice> entry(WPMUtils::openZipEntry(zipfile,
+            "rep.xml", &err));
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(entry->readAll(), QByteArray("<root/>"));
+
+    entry.reset(WPMUtils::openZipEntry(zipfile, "missing.xml", &err));
+    QVERIFY(!entry);
+    QVERIFY(!err.isEmpty());
+}
+
+void App::testDownloadCache()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QString shared = dir.path() + "\\shared";
+    DownloadCache cache(dir.path() + "\\local", shared, 3000);
+
+    QStringList hashes;
+    for (int i = 0; i < 4; i++) {
+        QByteArray data(1000, static_cast<char>('a' + i));
+        QString file = QString("%1\\%2.bin").arg(dir.path()).arg(i);
+        QFile f(file);
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(data);
+        f.close();
+
+        QString h = QCryptographicHash::hash(data,
+                QCryptographicHash::Sha256).toHex();
+        hashes.append(h);
+        QString err = cache.add(file, QCryptographicHash::Sha256, h);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        QVERIFY(!cache.find(QCryptographicHash::Sha256, h).isEmpty());
+    }
+
+    DownloadCacheStatistics st = cache.getStatistics();
+    QCOMPARE(st.files, 3);
+    QCOMPARE(st.size, 3000LL);
+
+    // hash sums are never used as paths
+    QVERIFY(cache.find(QCryptographicHash::Sha256, "..\\0.bin").isEmpty());
+
+    // an incomplete download always uses the same file and is not counted
+    QUrl url("https://example.com/a.zip");
+    QString partial = cache.getPartialDownloadPath(url);
+    QVERIFY(!partial.isEmpty());
+    QCOMPARE(cache.getPartialDownloadPath(url), partial);
+    QVERIFY(cache.getPartialDownloadPath(
+            QUrl("https://example.com/b.zip")) != partial);
+    QFile pf(partial);
+    QVERIFY(pf.open(QIODevice::WriteOnly));
+    pf.write(QByteArray(5000, 'p'));
+    pf.close();
+    QCOMPARE(cache.getStatistics().files, 3);
+
+    int removed;
+    QString err = cache.prune(0, &removed);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(removed, 3);
+    QVERIFY(QFile::exists(partial));
+    QVERIFY(cache.find(QCryptographicHash::Sha256, hashes.at(0)).isEmpty());
+
+    // the shared directory has the same layout
+    QVERIFY(QDir().mkpath(shared + "\\sha256"));
+    QVERIFY(QFile::copy(dir.path() + "\\0.bin",
+            shared + "\\sha256\\" + hashes.at(0)));
+    QCOMPARE(QDir::toNativeSeparators(cache.find(QCryptographicHash::Sha256,
+            hashes.at(0))),
+            QDir::toNativeSeparators(shared + "\\sha256\\" + hashes.at(0)));
+}
+
+void App::testLocalFileDownload()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QByteArray data;
+    for (int i = 0; i < 70 * 1024; i++) {
+        data.append(QByteArray::number(i).rightJustified(1024, 'x'));
+    }
+
+    QString source = dir.path() + "\\source.bin";
+    QFile f(source);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QCOMPARE(f.write(data), static_cast<qint64>(data.size()));
+    f.close();
+
+    QFile target(dir.path() + "\\target.bin");
+    QVERIFY(target.open(QIODevice::ReadWrite));
+
+    Job* job = new Job("Copy");
+    Downloader::Request request(QUrl::fromLocalFile(source));
+    request.file = &target;
+    request.hashSum = true;
+    request.alg = QCryptographicHash::Sha256;
+    Downloader::Response response = Downloader::download(job, request);
+    QVERIFY2(job->getErrorMessage().isEmpty(),
+            qPrintable(job->getErrorMessage()));
+    delete job;
+
+    QCOMPARE(response.hashSum, QString(QCryptographicHash::hash(data,
+            QCryptographicHash::Sha256).toHex().toLower()));
+
+    target.seek(0);
+    QVERIFY(target.readAll() == data);
+    target.close();
+}
+
+void App::testSegmentedDownload()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // 8 MiB
+    QByteArray data;
+    for (int i = 0; i < 8 * 1024; i++) {
+        data.append(QByteArray::number(i).rightJustified(1024, 'x'));
+    }
+    QString hash = QCryptographicHash::hash(data,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    // 0: dropped connections, 1: no ranges, 2: interrupted and resumed
+    for (int mode = 0; mode < 3; mode++) {
+        HttpTestServer server;
+        server.content = data;
+        if (mode == 0) {
+            server.drops = 3;
+            server.dropAfter = 100000;
+        } else if (mode == 1) {
+            server.ranges = false;
+        } else {
+            server.bytesPerSecond = 1024 * 1024;
+        }
+        QString err = server.start();
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+
+        QFile f(QString("%1\\file%2.bin").arg(dir.path()).arg(mode));
+        QVERIFY(f.open(QIODevice::ReadWrite));
+
+        Downloader::Request request(server.getURL());
+        request.file = &f;
+        request.hashSum = true;
+        request.interactive = false;
+        request.useCache = false;
+        request.segments = 4;
+
+        if (mode == 2) {
+            Job* job = new Job("Interrupted download");
+            QFuture<void> canceller = QtConcurrent::run([job]() {
+                QThread::msleep(500);
+                job->cancel();
+            });
+            Downloader::download(job, request);
+            canceller.waitForFinished();
+            QVERIFY(job->isCancelled());
+            delete job;
+
+            QVERIFY(QFile::exists(f.fileName() + ".segments"));
+            server.bytesPerSecond = 0;
+        }
+
+        Job* job = new Job("Download");
+        Downloader::Response response = Downloader::download(job, request);
+        QVERIFY2(job->getErrorMessage().isEmpty(),
+                qPrintable(job->getErrorMessage()));
+        delete job;
+
+        QCOMPARE(response.hashSum, hash);
+        f.seek(0);
+        QVERIFY(f.readAll() == data);
+        f.close();
+        QVERIFY(!QFile::exists(f.fileName() + ".segments"));
+
+        // the downloaded data is not requested again
+        if (mode == 2)
+            QVERIFY(server.getBytesSent() < data.size() * 3 / 2);
+
+        server.stop();
+    }
+}
+
+void App::testSocketTransport()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // 8 MiB
+    QByteArray data;
+    for (int i = 0; i < 8 * 1024; i++) {
+        data.append(QByteArray::number(i).rightJustified(1024, 'y'));
+    }
+    QString hash = QCryptographicHash::hash(data,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    SocketTransport socketTransport;
+
+    // 0: one connection, 1: chunked and compressed after "100 Continue",
+    // 2: segments
+    for (int mode = 0; mode < 3; mode++) {
+        double ms[2] = {0, 0};
+
+        // 0: WinINet, 1: sockets
+        for (int t = 0; t < 2; t++) {
+            // WinINet decodes compressed data itself
+            if (mode == 1 && t == 0)
+                continue;
+
+            HttpTestServer server;
+            server.content = data;
+            if (mode == 1) {
+                // qCompress() prepends the length to a zlib stream
+                server.content = qCompress(data).mid(4);
+                server.contentEncoding = "deflate";
+                server.chunked = true;
+                server.interim = true;
+            } else if (mode == 2) {
+                server.drops = 2;
+                server.dropAfter = 100000;
+            }
+            QString err = server.start();
+            QVERIFY2(err.isEmpty(), qPrintable(err));
+
+            QFile f(QString("%1\\file%2_%3.bin").arg(dir.path()).
+                    arg(mode).arg(t));
+            QVERIFY(f.open(QIODevice::ReadWrite));
+
+            Downloader::Request request(server.getURL());
+            request.file = &f;
+            request.hashSum = true;
+            request.interactive = false;
+            request.useCache = false;
+            request.segments = mode == 2 ? 4 : 1;
+            if (t == 1)
+                request.transport = &socketTransport;
+
+            QElapsedTimer timer;
+            timer.start();
+            Job* job = new Job("Download");
+            Downloader::Response response = Downloader::download(job,
+                    request);
+            QVERIFY2(job->getErrorMessage().isEmpty(),
+                    qPrintable(job->getErrorMessage()));
+            delete job;
+            ms[t] = timer.nsecsElapsed() / 1000000.0;
+
+            QCOMPARE(response.statusCode, 200);
+            QCOMPARE(response.hashSum, hash);
+            f.seek(0);
+            QVERIFY(f.readAll() == data);
+            f.close();
+
+            server.stop();
+        }
+
+        qCDebug(npackd).noquote() << QString(
+                "Downloading 8 MiB in mode %1: WinINet %2 ms, sockets %3 ms").
+                arg(mode).arg(ms[0], 0, 'f', 2).arg(ms[1], 0, 'f', 2);
+    }
+
+    // errors are reported the same way
+    Downloader::Request request(QUrl("http://127.0.0.1:1/missing.bin"));
+    request.interactive = false;
+    request.timeout = 5;
+    request.transport = &socketTransport;
+    Job* job = new Job("Download");
+    Downloader::download(job, request);
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    delete job;
+}
+
+void App::testPublishDatabase()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString base = QDir::toNativeSeparators(dir.path() + "/Data.db");
+
+    // the first generation is the base file itself
+    QCOMPARE(DBRepository::getCurrentFile(base), base);
+    DBRepository a;
+    QString err = a.open("testPublishDatabaseA", base);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    a.currentRepository = 0;
+    Package pa("com.example.A", "A");
+    err = a.savePackage(&pa, false);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // a new generation is built while the old one is open
+    QString file = DBRepository::createGenerationFile(base);
+    QVERIFY(file.endsWith(".part"));
+    QCOMPARE(QFileInfo(file).absolutePath(), QFileInfo(base).absolutePath());
+    {
+        DBRepository b;
+        err = b.open("testPublishDatabaseB", file);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        b.currentRepository = 0;
+        Package pb("com.example.B", "B");
+        err = b.savePackage(&pb, false);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        b.close();
+    }
+    err = DBRepository::publish(base, file);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(!QFileInfo::exists(file));
+    QString current = DBRepository::getCurrentFile(base);
+    QVERIFY(current != base);
+    QVERIFY(QFileInfo::exists(current));
+
+    // new readers see the new generation, the old reader still the old one
+    DBRepository c;
+    err = c.open("testPublishDatabaseC", current);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    std::unique_ptr<Package> p(c.findPackage_("com.example.B"));
+    QVERIFY(p.get() != nullptr);
+    p.reset(c.findPackage_("com.example.A"));
+    QVERIFY(p.get() == nullptr);
+    p.reset(a.findPackage_("com.example.A"));
+    QVERIFY(p.get() != nullptr);
+
+    // generations that are still open and the base file are kept
+    a.close();
+    for (int i = 0; i < 2; i++) {
+        if (i == 1)
+            c.close();
+        file = DBRepository::createGenerationFile(base);
+        {
+            DBRepository d;
+            err = d.open("testPublishDatabaseD", file);
+            QVERIFY2(err.isEmpty(), qPrintable(err));
+            d.close();
+        }
+        err = DBRepository::publish(base, file);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        QVERIFY(QFileInfo::exists(base));
+        QCOMPARE(QFileInfo::exists(current), i == 0);
+        QVERIFY(QFileInfo::exists(DBRepository::getCurrentFile(base)));
+    }
+}
+
+void App::testConcurrentReaders()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testConcurrentReaders");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+
+    // replaces all packages and versions in one transaction like a refresh
+    const int n = 2000;
+    auto refresh = [&dbr, n](int round) {
+        QString err = dbr.exec("BEGIN TRANSACTION");
+        for (int i = 0; i < n && err.isEmpty(); i++) {
+            QString name = QString("com.example.Package%1").arg(i);
+            Package p(name, QString("Package %1").arg(i));
+            p.description = QString("Round %1").arg(round);
+            err = dbr.savePackage(&p, true);
+            for (int j = 0; j < 3 && err.isEmpty(); j++) {
+                PackageVersion pv(name, Version(1, j));
+                pv.download = QUrl(QString(
+                        "https://example.com/p%1-%2-%3.zip").
+                        arg(i).arg(j).arg(round));
+                err = dbr.savePackageVersion(&pv, true);
+            }
+        }
+        if (err.isEmpty())
+            err = dbr.exec("COMMIT");
+        else
+            dbr.exec("ROLLBACK");
+        return err;
+    };
+    err = refresh(0);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(9);
+
+    QAtomicInt stop(0);
+    QFuture<QString> writer = QtConcurrent::run(&pool, [&refresh, &stop]() {
+        QString err;
+        for (int round = 1; round < 4 && err.isEmpty(); round++) {
+            err = refresh(round);
+        }
+        stop.storeRelease(1);
+        return err;
+    });
+
+    // every reader measures the duration of each lookup in microseconds
+    const int readers = 8;
+    QVector<QVector<double> > latencies(readers);
+    QVector<QString> errors(readers);
+    QList<QFuture<void> > futures;
+    for (int t = 0; t < readers; t++) {
+        futures.append(QtConcurrent::run(&pool,
+                [&dbr, &stop, &latencies, &errors, t, n]() {
+            int i = t * 97;
+            while (stop.loadAcquire() == 0 && errors[t].isEmpty()) {
+                QString name = QString("com.example.Package%1").arg(i % n);
+                QElapsedTimer timer;
+                timer.start();
+
+                // the writer removes every package from the caches once per
+                // refresh and the pooled readers do not fill them while a
+                // transaction is running
+                std::unique_ptr<Package> p(dbr.findPackage_(name));
+                QString err;
+                QList<PackageVersion*> pvs = dbr.getPackageVersions_(name,
+                        &err);
+                latencies[t].append(timer.nsecsElapsed() / 1000.0);
+
+                if (!err.isEmpty())
+                    errors[t] = err;
+                else if (!p)
+                    errors[t] = "Package not found: " + name;
+                else if (pvs.size() != 3)
+                    errors[t] = QString("%1 versions for %2").
+                            arg(pvs.size()).arg(name);
+                qDeleteAll(pvs);
+                i += 13;
+            }
+        }));
+    }
+
+    writer.waitForFinished();
+    for (int t = 0; t < readers; t++) {
+        futures[t].waitForFinished();
+    }
+
+    err = writer.result();
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QVector<double> all;
+    for (int t = 0; t < readers; t++) {
+        QVERIFY2(errors.at(t).isEmpty(), qPrintable(errors.at(t)));
+        all += latencies.at(t);
+    }
+    QVERIFY(all.size() > 0);
+
+    std::sort(all.begin(), all.end());
+    qCDebug(npackd).noquote() << QString(
+            "%1 reads during 3 refreshes: median %2 us, 99th percentile "
+            "%3 us, 99.9th percentile %4 us, max %5 us").arg(all.size()).
+            arg(all.at(all.size() / 2), 0, 'f', 0).
+            arg(all.at(all.size() * 99 / 100), 0, 'f', 0).
+            arg(all.at(all.size() * 999 / 1000), 0, 'f', 0).
+            arg(all.last(), 0, 'f', 0);
+}
+
+void App::testWALChanges()
+{
+    TestDatabase tdb;
+    QString err = tdb.open("testWALChanges");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+
+    // the changes are not committed and only visible on the main connection
+    err = dbr.exec("SAVEPOINT TEST");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    Package a("com.example.A", "A");
+    err = dbr.savePackage(&a, false);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    dbr.clearCache();
+    std::unique_ptr<Package> p(dbr.findPackage_("com.example.A"));
+    QVERIFY(p.get() != nullptr);
+    err = dbr.exec("RELEASE TEST");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QString dbFile = QSqlDatabase::database("testWALChanges").databaseName();
+    QString file = DBSnapshot::getFile(dbFile);
+    err = dbr.updateSnapshot();
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(DBSnapshot::isUpToDate(file, dbFile));
+
+    // the commit only changes the write-ahead log
+    Package b("com.example.B", "B");
+    err = dbr.savePackage(&b, false);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(!DBSnapshot::isUpToDate(file, dbFile));
+
+    QFile::remove(file);
+}
+
+void App::testReadOnlyAfterWriter()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString file = QDir::toNativeSeparators(dir.path() + "/Data.db");
+
+    // the last writer before the reader used the WAL mode or not
+    for (int wal = 0; wal < 2; wal++) {
+        {
+            DBRepository w;
+            QString err = w.open("testReadOnlyAfterWriterW", file, false,
+                    wal == 1);
+            QVERIFY2(err.isEmpty(), qPrintable(err));
+            w.currentRepository = 0;
+            Package p(QString("com.example.P%1").arg(wal), "P");
+            err = w.savePackage(&p, false);
+            QVERIFY2(err.isEmpty(), qPrintable(err));
+            w.close();
+        }
+        {
+            DBRepository w;
+            QString err = w.open("testReadOnlyAfterWriterW", file);
+            QVERIFY2(err.isEmpty(), qPrintable(err));
+            w.close();
+        }
+        QVERIFY(!QFileInfo::exists(file + "-wal"));
+        QVERIFY(!QFileInfo::exists(file + "-shm"));
+
+        DBRepository r;
+        QString err = r.open("testReadOnlyAfterWriterR", file, true);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        {
+            MySQLQuery q(QSqlDatabase::database("testReadOnlyAfterWriterR"));
+            QVERIFY(q.exec("PRAGMA journal_mode") && q.next());
+            QCOMPARE(q.value(0).toString().toLower(), QString("delete"));
+        }
+        for (int i = 0; i <= wal; i++) {
+            std::unique_ptr<Package> p(r.findPackage_(
+                    QString("com.example.P%1").arg(i)));
+            QVERIFY(p.get() != nullptr);
+        }
+        r.close();
+    }
+}
+
+void App::testSQLProfiler()
+{
+    QCOMPARE(SQLProfiler::normalize("SELECT  NAME FROM PACKAGE\r\n"
+            "WHERE NAME = 'it''s' AND STARS > 12.5"),
+            QString("SELECT NAME FROM PACKAGE WHERE NAME = ? AND STARS > ?"));
+    QCOMPARE(SQLProfiler::normalize(
+            "SELECT CATEGORY0 FROM PACKAGE WHERE NAME IN ('a', 'b', 'c')"),
+            QString("SELECT CATEGORY0 FROM PACKAGE WHERE NAME IN (?, ...)"));
+    QCOMPARE(SQLProfiler::normalize(
+            "SELECT * FROM PACKAGE WHERE NAME = :NAME1 LIMIT 1"),
+            QString("SELECT * FROM PACKAGE WHERE NAME = :NAME1 LIMIT ?"));
+
+    TestDatabase tdb;
+    QString err = tdb.open("testSQLProfiler");
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    DBRepository& dbr = tdb.dbr;
+    for (int i = 0; i < 10; i++) {
+        Package p(QString("com.example.Package%1").arg(i), "Package");
+        err = dbr.savePackage(&p, false);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+    }
+
+    SQLProfiler* profiler = SQLProfiler::getDefault();
+    profiler->clear();
+    profiler->setEnabled(true);
+    profiler->setExplainThreshold(0);
+
+    // the same statement with different literals
+    QSqlDatabase db = tdb.getDatabase();
+    for (int i = 0; i < 5; i++) {
+        MySQLQuery q(db);
+        QVERIFY(q.exec(QString("SELECT NAME FROM PACKAGE WHERE NAME <> "
+                "'com.example.Package%1'").arg(i)));
+        while (q.next()) {
+        }
+    }
+
+    profiler->setEnabled(false);
+    profiler->setExplainThreshold(-1);
+
+    QList<SQLStatementStatistics> stats = profiler->getStatistics();
+    QCOMPARE(stats.size(), 1);
+    const SQLStatementStatistics& s = stats.at(0);
+    QCOMPARE(s.sql, QString("SELECT NAME FROM PACKAGE WHERE NAME <> ?"));
+    QCOMPARE(s.count, static_cast<quint64>(5));
+    QCOMPARE(s.rows, static_cast<quint64>(45));
+    QCOMPARE(s.samples.size(), 5);
+    QVERIFY(s.percentile(0.5) <= s.percentile(0.99));
+    QVERIFY(s.percentile(0.99) <= s.max);
+    QVERIFY(s.max <= s.total);
+    QVERIFY(!s.plan.isEmpty() && s.plan != "...");
+
+    QStringList report = profiler->createReport();
+    QCOMPARE(report.size(), 2 + 1 + s.plan.split('\n').size());
+    QVERIFY(report.at(2).endsWith(s.sql));
+
+    // an execution is recorded after the last row while the query still
+    // exists. The plan uses the values bound for that execution.
+    profiler->clear();
+    profiler->setEnabled(true);
+    profiler->setExplainThreshold(0);
+    {
+        MySQLQuery q(db);
+        QVERIFY(q.prepare("SELECT NAME FROM PACKAGE WHERE NAME = :NAME"));
+        q.bindValue(":NAME", "com.example.Package1");
+        QVERIFY(q.exec());
+        while (q.next()) {
+        }
+        q.bindValue(":NAME", "com.example.Package2");
+
+        stats = profiler->getStatistics();
+        QCOMPARE(stats.size(), 1);
+        QCOMPARE(stats.at(0).count, static_cast<quint64>(1));
+        QCOMPARE(stats.at(0).rows, static_cast<quint64>(1));
+        QVERIFY(stats.at(0).plan.contains("PACKAGE"));
+    }
+    profiler->setEnabled(false);
+    profiler->setExplainThreshold(-1);
+
+    profiler->clear();
+}
+
+void App::testRemoveDirectory()
+{
+    QCOMPARE(WPMUtils::toLongPath("C:\\Program Files\\A"),
+            QString("\\\\?\\C:\\Program Files\\A"));
+    QCOMPARE(WPMUtils::toLongPath("\\\\server\\share\\A"),
+            QString("\\\\?\\UNC\\server\\share\\A"));
+    QCOMPARE(WPMUtils::toLongPath("\\\\?\\C:\\A"), QString("\\\\?\\C:\\A"));
+    QCOMPARE(WPMUtils::toLongPath("A\\B"), QString("A\\B"));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QString root = dir.path() + "/tree";
+    for (int i = 0; i < 20; i++) {
+        QString sub = root + QString("/a%1/b%2").arg(i % 4).arg(i);
+        QVERIFY(QDir().mkpath(sub));
+        QFile f(sub + "/file.txt");
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write("data");
+    }
+    QVERIFY(QDir().mkpath(root + "/empty/empty"));
+
+    // the path is longer than MAX_PATH
+    QString deep = root + "/deep";
+    for (int i = 0; i < 10; i++)
+        deep += "/" + QString(30, 'd');
+    QVERIFY(QDir().mkpath(deep));
+    QFile df(deep + "/file.txt");
+    QVERIFY(df.open(QIODevice::WriteOnly));
+    df.close();
+
+    // an open file cannot be deleted on Windows
+    QString locked = root + "/a1/b5/file.txt";
+    QFile f(locked);
+    QVERIFY(f.open(QIODevice::ReadOnly));
+
+    Job* job = new Job("Delete");
+    DirectoryRemover r(4);
+    r.remove(job, root);
+    QVERIFY(job->isCompleted());
+    QVERIFY(job->getErrorMessage().contains(
+            QDir::toNativeSeparators(locked)));
+    QVERIFY(QFileInfo::exists(locked));
+    QVERIFY(QFileInfo::exists(root));
+    delete job;
+
+    f.close();
+
+    job = new Job("Delete");
+    r.remove(job, root);
+    QVERIFY2(job->getErrorMessage().isEmpty(),
+            qPrintable(job->getErrorMessage()));
+    QVERIFY(job->isCompleted());
+    QCOMPARE(job->getProgress(), 1.0);
+    QVERIFY(!QFileInfo::exists(root));
+    delete job;
+
+    // a missing directory is not an error
+    job = new Job("Delete");
+    r.remove(job, root);
+    QVERIFY(job->getErrorMessage().isEmpty());
+    delete job;
+}
+
+void App::benchmarkRemoveDirectory()
+{
+    if (!TestDatabase::isBenchmarkEnabled())
+        QSKIP("Set NPACKD_BENCHMARKS=1 to run the benchmarks");
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    int threads[] = {1, 0};
+    for (int mode = 0; mode < 2; mode++) {
+        // 100 x 10 directories with 100 files each
+        QString root = dir.path() + QString("/tree%1").arg(mode);
+        QByteArray data(16, 'x');
+        for (int i = 0; i < 100; i++) {
+            for (int j = 0; j < 10; j++) {
+                QString sub = root + QString("/d%1/e%2").arg(i).arg(j);
+                QVERIFY(QDir().mkpath(sub));
+                for (int k = 0; k < 100; k++) {
+                    QFile f(sub + QString("/file%1.txt").arg(k));
+                    QVERIFY(f.open(QIODevice::WriteOnly));
+                    f.write(data);
+                }
+            }
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        Job* job = new Job("Delete");
+        DirectoryRemover r(threads[mode]);
+        r.remove(job, root);
+        qint64 ms = timer.elapsed();
+        QVERIFY2(job->getErrorMessage().isEmpty(),
+                qPrintable(job->getErrorMessage()));
+        QVERIFY(!QFileInfo::exists(root));
+        delete job;
+
+        qCDebug(npackd).noquote() << QString(
+                "100000 files, %1: %2 ms").arg(threads[mode] == 1 ?
+                "1 thread" : "default threads").arg(ms);
+    }
+}
+
+void App::testDirectoryCopier()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QString src = dir.path() + "/src";
+    QStringList files;
+    for (int i = 0; i < 20; i++) {
+        QString sub = QString("a%1/b%2").arg(i % 4).arg(i);
+        QVERIFY(QDir().mkpath(src + "/" + sub));
+        files.append(sub + "/file.txt");
+        QFile f(src + "/" + files.last());
+        QVERIFY(f.open(QIODevice::WriteOnly));
+        f.write(QByteArray::number(i));
+    }
+    QVERIFY(QDir().mkpath(src + "/empty/empty"));
+
+    // the path is longer than MAX_PATH
+    QString deep = "deep";
+    for (int i = 0; i < 10; i++)
+        deep += "/" + QString(30, 'd');
+    QVERIFY(QDir().mkpath(src + "/" + deep));
+    files.append(deep + "/file.txt");
+    QFile df(src + "/" + files.last());
+    QVERIFY(df.open(QIODevice::WriteOnly));
+    df.write("deep");
+    df.close();
+
+    // larger than the copy buffer
+    QByteArray big(3 * 1024 * 1024 + 17, 'x');
+    for (int i = 0; i < big.size(); i += 4096)
+        big[i] = static_cast<char>(i / 4096);
+    files.append("big.bin");
+    QFile bf(src + "/big.bin");
+    QVERIFY(bf.open(QIODevice::WriteOnly));
+    bf.write(big);
+    bf.close();
+
+    DirectoryCopier::Mode modes[] = {DirectoryCopier::COPY,
+            DirectoryCopier::HARD_LINK, DirectoryCopier::CLONE};
+    for (int m = 0; m < 3; m++) {
+        QString dest = dir.path() + QString("/dest%1").arg(m);
+
+        Job* job = new Job("Copy");
+        DirectoryCopier c(4);
+        c.setMode(modes[m]);
+        c.copy(job, src, dest);
+        QVERIFY2(job->getErrorMessage().isEmpty(),
+                qPrintable(job->getErrorMessage()));
+        QVERIFY(job->isCompleted());
+        QCOMPARE(job->getProgress(), 1.0);
+        delete job;
+
+        QVERIFY(QFileInfo(dest + "/empty/empty").isDir());
+        for (int i = 0; i < files.size(); i++) {
+            QFile a(src + "/" + files.at(i));
+            QFile b(dest + "/" + files.at(i));
+            QVERIFY(a.open(QIODevice::ReadOnly));
+            QVERIFY2(b.open(QIODevice::ReadOnly), qPrintable(files.at(i)));
+            QVERIFY(a.readAll() == b.readAll());
+        }
+    }
+
+    // existing files are not overwritten
+    QString existing = dir.path() + "/dest0/" + files.at(5);
+    QFile ef(existing);
+    QVERIFY(ef.open(QIODevice::WriteOnly));
+    ef.write("changed");
+    ef.close();
+
+    Job* job = new Job("Copy");
+    DirectoryCopier c(4);
+    c.copy(job, src, dir.path() + "/dest0");
+    QVERIFY(job->isCompleted());
+    QVERIFY(job->getErrorMessage().contains(
+            QDir::toNativeSeparators(existing)));
+    delete job;
+
+    QVERIFY(ef.open(QIODevice::ReadOnly));
+    QCOMPARE(ef.readAll(), QByteArray("changed"));
+}
@@ -15,7 +15,8 @@
 #include "clprogress.h"
 
 /**
- * NpackdCL tests
+ * NpackdCL tests. The benchmarks are only run if the environment variable
+ * NPACKD_BENCHMARKS is set.
  */
 class App: public QObject
 {
@@ -45,6 +46,212 @@ private slots:
      * Tests for WPMUtils::normalizePath
      */
     void testNormalizePath();
+
+    /**
+     * Tests for PackageVersion::toBinary and PackageVersion::parseBinary
+     */
+    void testPackageVersionBinary();
+
+    /**
+     * @brief PACKAGE_VERSION.CONTENT stays XML for older program versions
+     */
+    void testPackageVersionContent();
+
+    /**
+     * Compares the search using the full text index with LIKE
+     */
+    void benchmarkSearch();
+
+    /**
+     * @brief the full text index finds the same packages as LIKE
+     */
+    void testSearchLike();
+
+    /**
+     * Changes the title of a saved package and searches for the new words
+     */
+    void testSearchIndexUpdate();
+
+    /**
+     * Saves a package with an icon in a DBSnapshot and reads it back
+     */
+    void testSnapshot();
+
+    /**
+     * Compares DependencySolver with the recursive planner
+     */
+    void testDependencySolver();
+
+    /**
+     * Order of the operations in AbstractRepository::process with
+     * downloads finishing in different order
+     */
+    void testOperationOrder();
+
+    /**
+     * @brief DBRepository::findNewestAndInstalled_ returns the same versions
+     *     as the queries for every package
+     */
+    void testFindNewestAndInstalled();
+
+    /**
+     * Compares AbstractRepository::findNewestAndInstalled_ with the queries
+     * for every package
+     */
+    void benchmarkPlanUpdates();
+
+    /**
+     * @brief the packed and the part-by-part comparison of versions give the
+     *     same results
+     */
+    void testVersionCompare();
+
+    /**
+     * Sorts 100000 versions using the packed and the part-by-part comparison
+     */
+    void benchmarkVersionSort();
+
+    /**
+     * @brief the indexes in InstalledPackages give the same results as a
+     *     linear search
+     */
+    void testInstalledPackagesIndex();
+
+    /**
+     * Measures the lookups in InstalledPackages for 1000 and 10000 package
+     * versions
+     */
+    void benchmarkInstalledPackages();
+
+    /**
+     * Tests for TitleIndex::like
+     */
+    void testTitleIndexLike();
+
+    /**
+     * DBRepository::findBetterPackages finds the same packages with and
+     * without the in-memory index
+     */
+    void testTitleIndex();
+
+    /**
+     * Measures DBRepository::findBetterPackages with and without the
+     * in-memory index for 5000 packages
+     */
+    void benchmarkFindBetterPackages();
+
+    /**
+     * Compares DBRepository::saveDetected in all orders with saveAll
+     */
+    void testSaveDetected();
+
+    /**
+     * @brief refreshing the installation status in an up-to-date database
+     *     gives the same result as a full rebuild
+     */
+    void testIncrementalRefresh();
+
+    /**
+     * Checks that DBRepository shares cached packages and versions and only
+     * invalidates the changed package
+     */
+    void testPackageCache();
+
+    /**
+     * Scrolls through 15000 packages with PackageInfoLoader in the
+     * synchronous and the asynchronous mode and reports the frame latency
+     */
+    void benchmarkPackageInfoLoader();
+
+    /**
+     * Notifications about progress and title changes and the timeout with
+     * the rate limit for the notifications
+     */
+    void testJobNotifications();
+
+    /**
+     * Calls Job::setProgress 1000000 times from 8 threads with and without
+     * the rate limit for the notifications
+     */
+    void benchmarkJobProgress();
+
+    /**
+     * Creates a ZIP file with 500 files in nested directories, unzips it and
+     * reads one entry without extracting it
+     */
+    void testUnzip();
+
+    /**
+     * Adds files to a DownloadCache with a small maximum size and searches
+     * for them in the local and the shared directory. Incomplete downloads
+     * are not removed.
+     */
+    void testDownloadCache();
+
+    /**
+     * Copies a local file bigger than one mapped view using a file: URL and
+     * compares the computed hash sum
+     */
+    void testLocalFileDownload();
+
+    /**
+     * Downloads a file in segments from a local HTTP server that drops
+     * connections, does not support ranges or is interrupted
+     */
+    void testSegmentedDownload();
+
+    /**
+     * Downloads files from a local HTTP server over WinINet and over plain
+     * sockets
+     */
+    void testSocketTransport();
+
+    /**
+     * Publishes a new generation of a database while the old one is still
+     * open
+     */
+    void testPublishDatabase();
+
+    /**
+     * Reads packages from 8 threads while the database is refreshed in
+     * another thread and reports the latency
+     */
+    void testConcurrentReaders();
+
+    /**
+     * A thread reads its own changes after SAVEPOINT and a commit in the WAL
+     * mode makes the snapshot outdated
+     */
+    void testWALChanges();
+
+    /**
+     * A database written in the default mode or switched back from the WAL
+     * mode can be read using a read-only connection after the writer closed
+     * it
+     */
+    void testReadOnlyAfterWriter();
+
+    /**
+     * Normalization of SQL statements and statistics in SQLProfiler
+     */
+    void testSQLProfiler();
+
+    /**
+     * Deletes a directory tree and stops at a file that cannot be deleted
+     */
+    void testRemoveDirectory();
+
+    /**
+     * Deletes a synthetic tree with 100000 files using one and several
+     * threads
+     */
+    void benchmarkRemoveDirectory();
+
+    /**
+     * Copies a directory tree with data and hard links and stops at an
+     * existing file
+     */
+    void testDirectoryCopier();
 };
 
 #endif // APP_H
@@ -0,0 +1,212 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "httptestserver.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <QList>
+#include <QMutexLocker>
+
+HttpTestServer::HttpTestServer(): listener(static_cast<quintptr>(INVALID_SOCKET)),
+        port(0), stopping(false), requests(0), bytesSent(0), dropsLeft(0)
+{
+    WSADATA data;
+    WSAStartup(MAKEWORD(2, 2), &data);
+}
+
+HttpTestServer::~HttpTestServer()
+{
+    stop();
+    WSACleanup();
+}
+
+QString HttpTestServer::start()
+{
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+        return QString("socket() failed with %1").arg(WSAGetLastError());
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    int len = sizeof(addr);
+    if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(s, SOMAXCONN) != 0 ||
+            getsockname(s, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        QString err = QString("Cannot listen: %1").arg(WSAGetLastError());
+        closesocket(s);
+        return err;
+    }
+
+    port = ntohs(addr.sin_port);
+    listener = static_cast<quintptr>(s);
+    stopping = false;
+    dropsLeft = drops;
+    acceptThread = std::thread(&HttpTestServer::run, this);
+
+    return QString();
+}
+
+void HttpTestServer::stop()
+{
+    if (listener == static_cast<quintptr>(INVALID_SOCKET))
+        return;
+
+    stopping = true;
+
+    // accept() returns an error for a closed socket
+    closesocket(static_cast<SOCKET>(listener));
+    listener = static_cast<quintptr>(INVALID_SOCKET);
+    acceptThread.join();
+
+    QMutexLocker ml(&mutex);
+    for (size_t i = 0; i < handlers.size(); i++) {
+        handlers[i].join();
+    }
+    handlers.clear();
+}
+
+QUrl HttpTestServer::getURL() const
+{
+    return QUrl(QString("http://127.0.0.1:%1/content.bin").arg(port));
+}
+
+int HttpTestServer::getRequests() const
+{
+    return requests;
+}
+
+qint64 HttpTestServer::getBytesSent() const
+{
+    return bytesSent;
+}
+
+void HttpTestServer::run()
+{
+    SOCKET l = static_cast<SOCKET>(listener);
+    while (!stopping) {
+        SOCKET s = accept(l, nullptr, nullptr);
+        if (s == INVALID_SOCKET)
+            break;
+
+        QMutexLocker ml(&mutex);
+        handlers.push_back(std::thread(&HttpTestServer::handle, this,
+                static_cast<quintptr>(s)));
+    }
+}
+
+void HttpTestServer::handle(quintptr s_)
+{
+    SOCKET s = static_cast<SOCKET>(s_);
+
+    QByteArray req;
+    char buf[4096];
+    while (!req.contains("\r\n\r\n") && req.size() < 65536) {
+        int r = recv(s, buf, sizeof(buf), 0);
+        if (r <= 0)
+            break;
+        req.append(buf, r);
+    }
+
+    if (req.contains("\r\n\r\n")) {
+        requests++;
+
+        QList<QByteArray> lines = req.left(req.indexOf("\r\n\r\n")).
+                split('\n');
+        QByteArray method = lines.at(0).split(' ').at(0);
+
+        qint64 size = content.size();
+        qint64 from = 0;
+        qint64 to = size - 1;
+        bool partial = false;
+        if (ranges) {
+            for (int i = 1; i < lines.size(); i++) {
+                QByteArray line = lines.at(i).trimmed();
+                if (line.toLower().startsWith("range:")) {
+                    QByteArray v = line.mid(6).trimmed();
+                    if (v.startsWith("bytes=")) {
+                        QList<QByteArray> parts = v.mid(6).split('-');
+                        from = parts.at(0).toLongLong();
+                        if (parts.size() > 1 && !parts.at(1).isEmpty())
+                            to = std::min<qint64>(
+                                    parts.at(1).toLongLong(), size - 1);
+                        partial = true;
+                    }
+                }
+            }
+        }
+
+        QByteArray h;
+        if (partial && (from > to || from >= size)) {
+            h = "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                    "Content-Length: 0\r\n"
+                    "Connection: close\r\n\r\n";
+            from = 0;
+            to = -1;
+        } else {
+            if (partial)
+                h = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " +
+                        QByteArray::number(from) + "-" +
+                        QByteArray::number(to) + "/" +
+                        QByteArray::number(size) + "\r\n";
+            else
+                h = "HTTP/1.1 200 OK\r\n";
+            if (chunked && !partial)
+                h += "Transfer-Encoding: chunked\r\n";
+            else
+                h += "Content-Length: " +
+                        QByteArray::number(to - from + 1) + "\r\n";
+            h += "Content-Type: application/octet-stream\r\n"
+                    "ETag: \"1\"\r\n"
+                    "Connection: close\r\n";
+            if (ranges)
+                h += "Accept-Ranges: bytes\r\n";
+            if (!contentEncoding.isEmpty())
+                h += "Content-Encoding: " + contentEncoding + "\r\n";
+            h += "\r\n";
+        }
+
+        if (interim)
+            h.prepend("HTTP/1.1 100 Continue\r\nX-Interim: 1\r\n\r\n");
+
+        bool ok = send(s, h.constData(), h.size(), 0) == h.size();
+
+        if (ok && method == "GET") {
+            qint64 limit = to - from + 1;
+            if (dropsLeft-- > 0)
+                limit = std::min<qint64>(limit, dropAfter);
+            bool chunks = chunked && !partial;
+
+            const qint64 CHUNK = 16 * 1024;
+            qint64 pos = from;
+            while (!stopping && pos < from + limit) {
+                int n = static_cast<int>(std::min<qint64>(CHUNK,
+                        from + limit - pos));
+                QByteArray ch = QByteArray::number(n, 16) + "\r\n";
+                if (chunks && send(s, ch.constData(), ch.size(), 0) !=
+                        ch.size())
+                    break;
+                if (send(s, content.constData() + pos, n, 0) != n)
+                    break;
+                if (chunks && send(s, "\r\n", 2, 0) != 2)
+                    break;
+                pos += n;
+                bytesSent += n;
+
+                int bps = bytesPerSecond;
+                if (bps > 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(
+                            n * 1000LL / bps));
+            }
+
+            if (chunks && pos == to + 1)
+                send(s, "0\r\n\r\n", 5, 0);
+        }
+    }
+
+    closesocket(s);
+}
@@ -0,0 +1,109 @@
+#ifndef HTTPTESTSERVER_H
+#define HTTPTESTSERVER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <QByteArray>
+#include <QMutex>
+#include <QUrl>
+
+/**
+ * @brief HTTP/1.1 server on the loopback interface for testing downloads.
+ *     Every GET or HEAD request returns the same content. The server can
+ *     simulate slow connections, dropped connections and servers without
+ *     the support for HTTP Range requests.
+ *
+ * The settings should be changed before start().
+ */
+class HttpTestServer
+{
+private:
+    /** listening socket or ~0 */
+    quintptr listener;
+
+    int port;
+
+    std::thread acceptThread;
+
+    QMutex mutex;
+
+    /** one thread for every connection. Access is protected by "mutex". */
+    std::vector<std::thread> handlers;
+
+    std::atomic<bool> stopping;
+    std::atomic<int> requests;
+    std::atomic<qint64> bytesSent;
+    std::atomic<int> dropsLeft;
+
+    void run();
+
+    /**
+     * @brief handles one connection
+     * @param s socket
+     */
+    void handle(quintptr s);
+public:
+    /** the response for every request */
+    QByteArray content;
+
+    /** true = support HTTP Range requests */
+    bool ranges = true;
+
+    /**
+     * maximum speed for one connection in bytes per second or 0. This value
+     * can be changed while the server is running.
+     */
+    std::atomic<int> bytesPerSecond{0};
+
+    /** number of responses that are interrupted */
+    int drops = 0;
+
+    /** number of bytes sent before a response is interrupted */
+    int dropAfter = 0;
+
+    /** value for the Content-Encoding header or "" */
+    QByteArray contentEncoding;
+
+    /** true = use "Transfer-Encoding: chunked" for complete responses */
+    bool chunked = false;
+
+    /** true = send "100 Continue" before every response */
+    bool interim = false;
+
+    HttpTestServer();
+
+    ~HttpTestServer();
+
+    HttpTestServer(const HttpTestServer&) = delete;
+    HttpTestServer& operator=(const HttpTestServer&) = delete;
+
+    /**
+     * @brief starts listening on a free port
+     * @return error message
+     */
+    QString start();
+
+    /**
+     * @brief stops the server and waits for all connections
+     */
+    void stop();
+
+    /**
+     * @return URL of the content
+     */
+    QUrl getURL() const;
+
+    /**
+     * @return number of received requests
+     */
+    int getRequests() const;
+
+    /**
+     * @return number of content bytes sent in all responses
+     */
+    qint64 getBytesSent() const;
+};
+
+#endif // HTTPTESTSERVER_H
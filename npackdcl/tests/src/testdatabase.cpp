@@ -0,0 +1,27 @@
+#include "testdatabase.h"
+
+QString TestDatabase::open(const QString& name)
+{
+    if (!file.open())
+        return file.errorString();
+    file.close();
+
+    this->name = name;
+
+    // the file is not shared with read-only connections
+    QString err = dbr.open(name, file.fileName(), false, true);
+    if (err.isEmpty())
+        dbr.currentRepository = 0;
+
+    return err;
+}
+
+QSqlDatabase TestDatabase::getDatabase() const
+{
+    return QSqlDatabase::database(name);
+}
+
+bool TestDatabase::isBenchmarkEnabled()
+{
+    return qEnvironmentVariableIsSet("NPACKD_BENCHMARKS");
+}
@@ -0,0 +1,45 @@
+#ifndef TESTDATABASE_H
+#define TESTDATABASE_H
+
+#include <QString>
+#include <QSqlDatabase>
+#include <QTemporaryFile>
+
+#include "dbrepository.h"
+
+/**
+ * @brief an empty package database in a temporary file. The file is deleted
+ *     together with this object.
+ */
+class TestDatabase
+{
+    QTemporaryFile file;
+    QString name;
+public:
+    /** the database. Valid after open(). */
+    DBRepository dbr;
+
+    /**
+     * @brief creates the file and opens the database in the WAL mode. The
+     *     current repository is set to 0 so that packages can be saved
+     *     directly.
+     * @param name name of the database connection
+     * @return error message
+     */
+    QString open(const QString& name);
+
+    /**
+     * @return the database connection. Transactions are started and
+     *     finished using DBRepository::exec().
+     */
+    QSqlDatabase getDatabase() const;
+
+    /**
+     * @return true if the benchmarks should be run. The benchmarks only
+     *     measure the time and are skipped unless the environment variable
+     *     NPACKD_BENCHMARKS is set.
+     */
+    static bool isBenchmarkEnabled();
+};
+
+#endif // TESTDATABASE_H
@@ -1,5 +1,9 @@
 #include "QLoggingCategory"
 
+#include <QtConcurrent/QtConcurrent>
+#include <QThreadPool>
+#include <QMutex>
+
 #include "abstractrepository.h"
 #include "wpmutils.h"
 #include "windowsregistry.h"
@@ -348,80 +352,161 @@ void AbstractRepository::process(Job *job,
 
     int n = install.count();
 
+    // The binaries are downloaded in parallel. The number of connections is
+    // limited by PackageVersion::httpConnections. A package version is
+    // installed as soon as its binary is available and all the operations it
+    // depends on are done. All job progress is set from this thread.
+
     // where the binary was downloaded
     QStringList dirs;
 
     // names of the binaries relative to the directory
     QStringList binaries;
 
+    QVector<Job*> downloadJobs(n);
+    QSemaphore downloadsFinished;
+    QThreadPool downloaders;
+
+    // results of the downloads. A download stores its binary and sets
+    // "published" before it releases "downloadsFinished".
+    QMutex downloadsMutex;
+    QStringList downloadResults;
+    QVector<bool> published(n);
+    for (int i = 0; i < n; i++)
+        downloadResults.append(QString());
+
+    // true = the result of the download was already checked
+    QVector<bool> downloaded(n);
+
+    // true = the operation was performed
+    QVector<bool> processed(n);
+
+    // indexes of the operations that must be performed before
+    QVector<QVector<int> > deps;
+
+    if (job->shouldProceed())
+        deps = getOperationDependencies(install, pvs);
+
     // 70% for downloading the binaries
     if (job->shouldProceed()) {
-        // downloading packages
-        for (int i = 0; i < install.count(); i++) {
+        QStringList used;
+        int count = 0;
+        for (int i = 0; i < n; i++) {
             InstallOperation* op = install.at(i);
             PackageVersion* pv = pvs.at(i);
+            dirs.append("");
+            binaries.append("");
             if (op->install) {
-                QString txt = QObject::tr("Downloading %1").arg(
-                        pv->toString());
-
-                Job* sub = job->newSubJob(0.7 / n, txt, true, true);
-
                 // dir is not the final installation directory. It can be
                 // changed later during the installation.
                 QString dir = op->where;
                 if (dir.isEmpty()) {
                     dir = pv->getIdealInstallationDirectory();
                 }
-                dir = WPMUtils::findNonExistingFile(dir, "");
+                QString base = dir;
+                dir = WPMUtils::findNonExistingFile(base, "");
+
+                // the directories are only created by the downloads
+                for (int k = 2; used.contains(dir.toLower()) && k < 100;
+                        k++) {
+                    dir = WPMUtils::findNonExistingFile(base +
+                            QStringLiteral("_") + QString::number(k), "");
+                }
 
-                if (d.exists(dir)) {
-                    sub->setErrorMessage(
+                if (d.exists(dir) || used.contains(dir.toLower())) {
+                    job->setErrorMessage(QObject::tr("Downloading %1").arg(
+                            pv->toString()) + ": " +
                             QObject::tr("Directory %1 already exists").
                             arg(dir));
-                    dirs.append("");
-                    binaries.append("");
-                } else {
-                    dirs.append(dir);
-
-                    QString binary = pv->download_(sub, dir, interactive,
-                            user, password, proxyUser, proxyPassword);
-                    binaries.append(QFileInfo(binary).fileName());
-                    if (sub->isCancelled())
-                        job->cancel();
+                    break;
                 }
+
+                used.append(dir.toLower());
+                dirs[i] = dir;
+                count++;
             } else {
-                dirs.append("");
-                binaries.append("");
-                job->setProgress(job->getProgress() + 0.7 / n);
+                downloaded[i] = true;
             }
-
-            if (!job->shouldProceed())
-                break;
         }
+        downloaders.setMaxThreadCount(qMax(count, 1));
     }
 
-    bool installationScriptAcquired = false;
-
     if (job->shouldProceed()) {
-        job->setTitle(initialTitle + " / " +
-                QObject::tr("Waiting while other (un)installation scripts are running"));
-
-        time_t start = time(nullptr);
-        while (!job->isCancelled()) {
-            installationScriptAcquired = installationScripts.
-                    tryAcquire(1, 10000);
-            if (installationScriptAcquired) {
-                job->setProgress(job->getProgress() + 0.01);
-                break;
-            }
+        for (int i = 0; i < n; i++) {
+            if (dirs.at(i).isEmpty())
+                continue;
 
-            time_t seconds = time(nullptr) - start;
-            job->setTitle(initialTitle + " / " + QString(
-                    QObject::tr("Waiting while other (un)installation scripts are running (%1 minutes)")).
-                    arg(seconds / 60));
+            PackageVersion* pv = pvs.at(i);
+            QString txt = QObject::tr("Downloading %1").arg(pv->toString());
+            Job* sub = job->newSubJob(0.7 / n, txt, false, false);
+            downloadJobs[i] = sub;
+            QString dir = dirs.at(i);
+            QSemaphore* finished = &downloadsFinished;
+            QMutex* m = &downloadsMutex;
+            QStringList* results = &downloadResults;
+            QVector<bool>* p = &published;
+            QtConcurrent::run(&downloaders, [=]() {
+                QString binary = pv->download_(sub, dir, interactive,
+                        user, password, proxyUser, proxyPassword);
+                m->lock();
+                (*results)[i] = binary;
+                (*p)[i] = true;
+                m->unlock();
+                finished->release();
+            });
         }
     }
-    job->setTitle(initialTitle);
+
+    // progress of the operations other than downloading
+    double done = 0;
+    auto updateProgress = [&]() {
+        double p = done;
+        for (int i = 0; i < n; i++) {
+            InstallOperation* op = install.at(i);
+            if (!op->install)
+                p += 0.7 / n;
+            else if (downloadJobs.at(i))
+                p += downloadJobs.at(i)->getProgress() * 0.7 / n;
+        }
+        job->setProgress(p);
+    };
+
+    // checks the finished downloads
+    auto checkDownloads = [&]() {
+        for (int i = 0; i < n; i++) {
+            if (downloaded.at(i) || !downloadJobs.at(i))
+                continue;
+
+            downloadsMutex.lock();
+            bool ready = published.at(i);
+            QString binary = downloadResults.at(i);
+            downloadsMutex.unlock();
+            if (!ready)
+                continue;
+
+            downloaded[i] = true;
+            Job* sub = downloadJobs.at(i);
+            binaries[i] = QFileInfo(binary).fileName();
+            if (!sub->getErrorMessage().isEmpty())
+                job->setErrorMessage(sub->getTitle() + ": " +
+                        sub->getErrorMessage());
+            else if (sub->isCancelled())
+                job->cancel();
+        }
+        updateProgress();
+    };
+
+    // only one (un)installation script runs at the same time. The lock is
+    // requested for each operation separately so that other processes can run
+    // their scripts while the binaries are being downloaded.
+    auto acquireInstallationScripts = [&]() {
+        if (!installationScripts.tryAcquire()) {
+            job->setTitle(initialTitle + " / " +
+                    QObject::tr("Waiting while other (un)installation scripts are running"));
+            installationScripts.acquire();
+            job->setTitle(initialTitle);
+        }
+    };
 
     QStringList stoppedServices;
 
@@ -433,122 +518,153 @@ void AbstractRepository::process(Job *job,
             if (!op->install) {
                 Job* sub = job->newSubJob(0.1 / n,
                         QObject::tr("Stopping the package %1 of %2").
-                        arg(i + 1).arg(n));
+                        arg(i + 1).arg(n), false);
+                acquireInstallationScripts();
                 pv->stop(sub, programCloseType, printScriptOutput,
                         &stoppedServices);
+                installationScripts.release();
                 if (!sub->getErrorMessage().isEmpty()) {
                     job->setErrorMessage(sub->getErrorMessage());
                     break;
                 }
-            } else {
-                job->setProgress(job->getProgress() + 0.1 / n);
             }
+            done += 0.1 / n;
+            checkDownloads();
         }
     }
 
-    int processed = 0;
-
     // 19% for removing/installing the packages
-    if (job->shouldProceed()) {
-        // installing/removing packages
-        for (int i = 0; i < install.count(); i++) {
-            InstallOperation* op = install.at(i);
-            PackageVersion* pv = pvs.at(i);
-            QString txt;
-            if (op->install)
-                txt = QString(QObject::tr("Installing %1")).arg(
-                        pv->toString());
-            else
-                txt = QString(QObject::tr("Uninstalling %1")).arg(
-                        pv->toString());
-
-            Job* sub = job->newSubJob(0.18 / n, txt, true, true);
-            if (op->install) {
-                QString dir = dirs.at(i);
-                QString binary = binaries.at(i);
+    int remaining = n;
+    while (job->shouldProceed() && remaining > 0) {
+        checkDownloads();
+        if (!job->shouldProceed())
+            break;
 
-                if (op->where.isEmpty()) {
-                    // if we are not forced to install in a particular
-                    // directory, we try to use the ideal location
-                    QString try_ = pv->getIdealInstallationDirectory();
+        int i = findReadyOperation(deps, downloaded, processed);
+
+        // the first operation that was not yet performed always has all its
+        // dependencies processed. It only waits for its download that
+        // releases the semaphore after its result was published, even if it
+        // fails or is cancelled. Every permit belongs to a published result,
+        // so a permit taken here is never missing later.
+        if (i < 0) {
+            downloadsFinished.acquire();
+            continue;
+        }
+
+        InstallOperation* op = install.at(i);
+        PackageVersion* pv = pvs.at(i);
+        QString txt;
+        if (op->install)
+            txt = QString(QObject::tr("Installing %1")).arg(
+                    pv->toString());
+        else
+            txt = QString(QObject::tr("Uninstalling %1")).arg(
+                    pv->toString());
+
+        Job* sub = job->newSubJob(0.18 / n, txt, false, true);
+        if (op->install) {
+            QString dir = dirs.at(i);
+            QString binary = binaries.at(i);
+
+            if (op->where.isEmpty()) {
+                // if we are not forced to install in a particular
+                // directory, we try to use the ideal location
+                QString try_ = pv->getIdealInstallationDirectory();
+                if (WPMUtils::pathEquals(try_, dir) ||
+                        (!d.exists(try_) && d.rename(dir, try_))) {
+                    dir = try_;
+                } else {
+                    qCWarning(npackdImportant()).noquote() << QObject::tr(
+                            "The preferred installation directory \"%1\" is not available").arg(try_);
+
+                    try_ = pv->getSecondaryInstallationDirectory();
                     if (WPMUtils::pathEquals(try_, dir) ||
                             (!d.exists(try_) && d.rename(dir, try_))) {
                         dir = try_;
                     } else {
-                        qCWarning(npackdImportant()).noquote() << QObject::tr(
-                                "The preferred installation directory \"%1\" is not available").arg(try_);
-
-                        try_ = pv->getSecondaryInstallationDirectory();
+                        try_ = WPMUtils::findNonExistingFile(try_, "");
                         if (WPMUtils::pathEquals(try_, dir) ||
                                 (!d.exists(try_) && d.rename(dir, try_))) {
                             dir = try_;
-                        } else {
-                            try_ = WPMUtils::findNonExistingFile(try_, "");
-                            if (WPMUtils::pathEquals(try_, dir) ||
-                                    (!d.exists(try_) && d.rename(dir, try_))) {
-                                dir = try_;
-                            }
                         }
                     }
+                }
+            } else {
+                if (d.exists(op->where)) {
+                    if (!WPMUtils::pathEquals(op->where, dir) &&
+                            op->exactLocation) {
+                        // we should install in a particular directory, but it
+                        // exists.
+                        Job* djob = sub->newSubJob(1,
+                                QObject::tr("Deleting temporary directory %1").
+                                arg(dir));
+                        WPMUtils::removeDirectory(djob, dir);
+                        processed[i] = true;
+                        job->setErrorMessage(QObject::tr(
+                                "Cannot install %1 into %2. The directory already exists.").
+                                arg(pv->toString(true)).arg(op->where));
+                        break;
+                    }
                 } else {
-                    if (d.exists(op->where)) {
-                        if (!WPMUtils::pathEquals(op->where, dir) &&
-                                op->exactLocation) {
-                            // we should install in a particular directory, but it
-                            // exists.
-                            Job* djob = sub->newSubJob(1,
-                                    QObject::tr("Deleting temporary directory %1").
-                                    arg(dir));
-                            WPMUtils::removeDirectory(djob, dir);
-                            job->setErrorMessage(QObject::tr(
-                                    "Cannot install %1 into %2. The directory already exists.").
-                                    arg(pv->toString(true)).arg(op->where));
-                            break;
-                        }
-                    } else {
-                        Job* moveJob = sub->newSubJob(0.01, QObject::tr("Renaming directory"), true, true);
-                        WPMUtils::renameDirectory(moveJob, dir, op->where);
-                        if (moveJob->getErrorMessage().isEmpty())
-                            dir = op->where;
-                        else if (op->exactLocation) {
-                            // we should install in a particular directory, but it
-                            // exists.
-                            Job* djob = sub->newSubJob(1,
-                                    QObject::tr("Deleting temporary directory %1").
-                                    arg(dir));
-                            WPMUtils::removeDirectory(djob, dir);
-                            job->setErrorMessage(QObject::tr(
-                                    "Cannot install %1 into %2. Cannot rename %3.").
-                                    arg(pv->toString(true), op->where, dir));
-                            break;
-                        }
+                    Job* moveJob = sub->newSubJob(0.01, QObject::tr("Renaming directory"), true, true);
+                    WPMUtils::renameDirectory(moveJob, dir, op->where);
+                    if (moveJob->getErrorMessage().isEmpty())
+                        dir = op->where;
+                    else if (op->exactLocation) {
+                        // we should install in a particular directory, but it
+                        // exists.
+                        Job* djob = sub->newSubJob(1,
+                                QObject::tr("Deleting temporary directory %1").
+                                arg(dir));
+                        WPMUtils::removeDirectory(djob, dir);
+                        processed[i] = true;
+                        job->setErrorMessage(QObject::tr(
+                                "Cannot install %1 into %2. Cannot rename %3.").
+                                arg(pv->toString(true), op->where, dir));
+                        break;
                     }
                 }
+            }
 
-                pv->install(sub, dir, binary, printScriptOutput,
-                        programCloseType, &stoppedServices);
-            } else
-                pv->uninstall(sub, printScriptOutput, programCloseType,
-                        &stoppedServices);
+            acquireInstallationScripts();
+            pv->install(sub, dir, binary, printScriptOutput,
+                    programCloseType, &stoppedServices);
+            installationScripts.release();
+        } else {
+            acquireInstallationScripts();
+            pv->uninstall(sub, printScriptOutput, programCloseType,
+                    &stoppedServices);
+            installationScripts.release();
+        }
 
-            if (!job->shouldProceed())
-                break;
+        if (!job->shouldProceed())
+            break;
+
+        processed[i] = true;
+        remaining--;
+        done += 0.18 / n;
+    }
 
-            processed = i + 1;
+    // the remaining downloads are cancelled if we should not proceed
+    if (!job->shouldProceed()) {
+        for (int i = 0; i < n; i++) {
+            if (downloadJobs.at(i))
+                downloadJobs.at(i)->cancel();
         }
     }
+    downloaders.waitForDone();
 
     // removing the binaries if we should not proceed
     if (!job->shouldProceed()) {
-        for (int i = processed; i < dirs.count(); i++) {
+        for (int i = 0; i < dirs.count(); i++) {
             QString dir = dirs.at(i);
-            if (!dir.isEmpty()) {
+            if (!dir.isEmpty() && !processed.at(i)) {
                 QString txt = QObject::tr("Deleting %1").arg(dir);
 
-                Job* sub = job->newSubJob(0.01 / dirs.count(), txt, true, false);
+                Job* sub = job->newSubJob(0.01 / dirs.count(), txt, false,
+                        false);
                 WPMUtils::removeDirectory(sub, dir);
-            } else {
-                job->setProgress(job->getProgress() + 0.01 / dirs.count());
             }
         }
     }
@@ -589,15 +705,65 @@ void AbstractRepository::process(Job *job,
             CloseServiceHandle(schSCManager);
     }
 
-    if (installationScriptAcquired)
-        installationScripts.release();
-
     if (job->shouldProceed())
         job->setProgress(1);
 
     job->complete();
 }
 
+QVector<QVector<int> > AbstractRepository::getOperationDependencies(
+        const QList<InstallOperation*>& install,
+        const QList<PackageVersion*>& pvs)
+{
+    int n = install.size();
+    QVector<QVector<int> > deps(n);
+    for (int i = 0; i < n; i++) {
+        InstallOperation* op = install.at(i);
+        PackageVersion* pv = pvs.at(i);
+
+        // removing a package is not reordered
+        for (int j = 0; j < i; j++) {
+            if (!op->install || !install.at(j)->install) {
+                deps[i].append(j);
+            } else {
+                PackageVersion* other = pvs.at(j);
+                for (int k = 0; k < pv->dependencies.size(); k++) {
+                    Dependency* d = pv->dependencies.at(k);
+                    if (d->package == other->package &&
+                            d->test(other->version)) {
+                        deps[i].append(j);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return deps;
+}
+
+int AbstractRepository::findReadyOperation(
+        const QVector<QVector<int> >& deps, const QVector<bool>& downloaded,
+        const QVector<bool>& processed)
+{
+    for (int j = 0; j < deps.size(); j++) {
+        if (processed.at(j) || !downloaded.at(j))
+            continue;
+
+        bool ready = true;
+        for (int k = 0; k < deps.at(j).size(); k++) {
+            if (!processed.at(deps.at(j).at(k))) {
+                ready = false;
+                break;
+            }
+        }
+        if (ready)
+            return j;
+    }
+
+    return -1;
+}
+
 QList<PackageVersion*> AbstractRepository::getInstalled_(QString *err)
 {
     *err = "";
@@ -664,38 +830,55 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
     // get the list of installed packages
     QSet<QString> before;
 
-    // packages first
+    // packages first. The newest and the installed versions for all
+    // packages are read at once.
+    QMap<QString, PackageVersion*> newestMap, installedMap;
+    if (err.isEmpty() && packages.count() > 0) {
+        QStringList names;
+        for (int i = 0; i < packages.count(); i++) {
+            names.append(packages.at(i)->name);
+        }
+        QSet<QString> requested = names.toSet();
+
+        QMap<QString, Version> newestInstalled;
+        QList<InstalledPackageVersion*> all = installed.getAll();
+        for (int i = 0; i < all.count(); i++) {
+            InstalledPackageVersion* ipv = all.at(i);
+            if (requested.contains(ipv->package)) {
+                auto it = newestInstalled.find(ipv->package);
+                if (it == newestInstalled.end())
+                    newestInstalled.insert(ipv->package, ipv->version);
+                else if (it.value() < ipv->version)
+                    it.value() = ipv->version;
+            }
+        }
+        qDeleteAll(all);
+
+        err = findNewestAndInstalled_(names, newestInstalled, &newestMap,
+                &installedMap);
+        if (!err.isEmpty())
+            err = QString(QObject::tr("Cannot find the newest installed versions: %1")).
+                    arg(err);
+    }
+
     if (err.isEmpty()) {
         for (int i = 0; i < packages.count(); i++) {
             Package* p = packages.at(i);
 
-            PackageVersion* a = findNewestInstallablePackageVersion_(p->name,
-                    &err);
-            if (!err.isEmpty())
-                break;
+            PackageVersion* a = newestMap.take(p->name);
 
             // packages that cannot be installed are ignored
             if (a == nullptr) {
                 continue;
             }
 
-            InstalledPackageVersion* ib = installed.getNewestInstalled(p->name);
-            PackageVersion* b = nullptr;
-            if (ib) {
-                b = this->findPackageVersion_(p->name, ib->version, &err);
-                delete ib;
-            }
-
-            if (!err.isEmpty()) {
-                err = QString(QObject::tr("Cannot find the newest installed version for %1: %2")).
-                        arg(p->title).arg(err);
-                break;
-            }
+            PackageVersion* b = installedMap.take(p->name);
 
             if (b == nullptr) {
                 if (!install) {
                     err = QString(QObject::tr("No installed version found for the package %1")).
                             arg(p->title);
+                    delete a;
                     break;
                 }
             }
@@ -709,9 +892,14 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                 newest.append(a);
                 newesti.append(b);
                 used.append(false);
+            } else {
+                delete a;
+                delete b;
             }
         }
     }
+    qDeleteAll(newestMap);
+    qDeleteAll(installedMap);
 
     // version ranges second
     if (err.isEmpty()) {
@@ -978,6 +1166,43 @@ PackageVersion* AbstractRepository::findNewestInstallablePackageVersion_(
     return r;
 }
 
+QString AbstractRepository::findNewestAndInstalled_(
+        const QStringList &packages, const QMap<QString, Version> &installed,
+        QMap<QString, PackageVersion *> *newest,
+        QMap<QString, PackageVersion *> *installedVersions) const
+{
+    QString err;
+
+    for (int i = 0; i < packages.count(); i++) {
+        const QString& package = packages.at(i);
+
+        QList<PackageVersion*> pvs = this->getPackageVersions_(package, &err);
+        if (!err.isEmpty())
+            break;
+
+        PackageVersion* a = nullptr;
+        PackageVersion* b = nullptr;
+        auto it = installed.constFind(package);
+        for (int j = 0; j < pvs.count(); j++) {
+            PackageVersion* p = pvs.at(j);
+            if (p->download.isValid() &&
+                    (a == nullptr || p->version.compare(a->version) > 0))
+                a = p;
+            if (it != installed.constEnd() && p->version == it.value())
+                b = p;
+        }
+
+        if (a)
+            newest->insert(package, a->clone());
+        if (b)
+            installedVersions->insert(package, b->clone());
+
+        qDeleteAll(pvs);
+    }
+
+    return err;
+}
+
 AbstractRepository::AbstractRepository()
 {
 }
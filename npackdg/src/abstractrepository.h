@@ -25,6 +25,29 @@ public:
 
     virtual ~AbstractRepository();
 
+    /**
+     * @brief computes the order of the operations for process()
+     * @param install operations
+     * @param pvs package versions for the operations
+     * @return indexes of the earlier operations that must be performed
+     *     before each operation. Removals are not reordered. An installation
+     *     only waits for the earlier installations of its dependencies.
+     */
+    static QVector<QVector<int> > getOperationDependencies(
+            const QList<InstallOperation*>& install,
+            const QList<PackageVersion*>& pvs);
+
+    /**
+     * @brief searches for the next operation that can be performed
+     * @param deps see getOperationDependencies()
+     * @param downloaded true = the binary for the operation is available
+     * @param processed true = the operation was already performed
+     * @return index of the first operation with the binary available and
+     *     all the operations it depends on performed or -1
+     */
+    static int findReadyOperation(const QVector<QVector<int> >& deps,
+            const QVector<bool>& downloaded, const QVector<bool>& processed);
+
     /**
      * @brief checks a value for the installation directory
      * @param dir a directory
@@ -120,7 +143,28 @@ public:
                                                          QString *err) const;
 
     /**
-     * @brief processes the given operations
+     * Finds the newest installable versions and the installed versions for
+     * many packages at once.
+     *
+     * @param packages full package names. No duplicates are allowed here.
+     * @param installed full package name -> installed version
+     * @param newest [move] the newest installable version for every package
+     *     will be stored here. Packages without installable versions are
+     *     not added.
+     * @param installedVersions [move] the package versions for "installed"
+     *     will be stored here. Versions that are not in the repository are
+     *     not added.
+     * @return error message
+     */
+    virtual QString findNewestAndInstalled_(const QStringList& packages,
+            const QMap<QString, Version>& installed,
+            QMap<QString, PackageVersion*>* newest,
+            QMap<QString, PackageVersion*>* installedVersions) const;
+
+    /**
+     * @brief processes the given operations. The binaries are downloaded in
+     *     parallel and every package version is installed as soon as its
+     *     binary and the package versions it depends on are available.
      * @param job job
      * @param install operations that should be performed
      * @param programCloseType how to close running applications
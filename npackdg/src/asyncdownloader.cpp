@@ -5,6 +5,7 @@
 
 #include "asyncdownloader.h"
 #include "wpmutils.h"
+#include "wininettransport.h"
 
 #define BUFFER_LEN  4096
 #define ERR_MSG_LEN 512
@@ -985,11 +986,11 @@ DWORD AsyncDownloader::CreateWininetHandles(Job* job, PREQUEST_CONTEXT ReqContex
 
     if (job->shouldProceed()) {
         if (!request.user.isEmpty()) {
-            setStringOption(hConnectHandle, INTERNET_OPTION_USERNAME,
+            WinINetTransport::setStringOption(hConnectHandle, INTERNET_OPTION_USERNAME,
                     request.user);
 
             if (!request.password.isEmpty()) {
-                setStringOption(hConnectHandle, INTERNET_OPTION_PASSWORD,
+                WinINetTransport::setStringOption(hConnectHandle, INTERNET_OPTION_PASSWORD,
                         request.password);
             }
         }
@@ -997,11 +998,11 @@ DWORD AsyncDownloader::CreateWininetHandles(Job* job, PREQUEST_CONTEXT ReqContex
 
     if (job->shouldProceed()) {
         if (!request.proxyUser.isEmpty()) {
-            setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_USERNAME,
+            WinINetTransport::setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_USERNAME,
                     request.proxyUser);
 
             if (!request.proxyPassword.isEmpty()) {
-                setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_PASSWORD,
+                WinINetTransport::setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_PASSWORD,
                         request.proxyPassword);
             }
         }
@@ -2,23 +2,32 @@
 
 #include <shlobj.h>
 #include <ctime>
+#include <algorithm>
+#include <functional>
 
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QDir>
+#include <QFileInfo>
 #include <QVariant>
 #include <QTextStream>
 #include <QByteArray>
 #include <QLoggingCategory>
 #include <QXmlStreamWriter>
 #include <QSqlRecord>
-#include <QTemporaryDir>
 #include <QtConcurrent/QtConcurrentRun>
 #include <QFuture>
 #include <QSqlResult>
 #include <QtPlugin>
 #include <QMutexLocker>
+#include <QThreadPool>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QThread>
+#include <QThreadStorage>
 
 #include "package.h"
 #include "repository.h"
@@ -32,6 +41,30 @@
 #include "packageutils.h"
 #include "sqlutils.h"
 
+/**
+ * @brief pooled read connections of one thread (see
+ *     DBRepository::beginRead()). The connections are removed when the
+ *     thread ends.
+ */
+class ReadConnections
+{
+public:
+    /** DBRepository -> name of the connection */
+    QHash<const void*, QString> names;
+
+    ~ReadConnections()
+    {
+        for (auto it = names.constBegin(); it != names.constEnd(); ++it) {
+            QSqlDatabase::removeDatabase(it.value());
+        }
+    }
+};
+
+static QThreadStorage<ReadConnections*> readConnections;
+
+/** source for DBRepository::readPoolEpoch */
+static std::atomic<quint64> nextReadPoolEpoch(1);
+
 static bool packageVersionLessThan3(const PackageVersion* a,
         const PackageVersion* b)
 {
@@ -43,9 +76,169 @@ static bool packageVersionLessThan3(const PackageVersion* a,
     return r > 0;
 }
 
+/**
+ * @param s a string
+ * @return estimated memory used by the string in bytes
+ */
+static qint64 estimateCost(const QString& s)
+{
+    return static_cast<qint64>(sizeof(QString)) + 24 + s.size() * 2;
+}
+
+static qint64 estimateCost(const QStringList& sl)
+{
+    qint64 r = sizeof(QStringList);
+    for (int i = 0; i < sl.size(); i++) {
+        r += estimateCost(sl.at(i));
+    }
+    return r;
+}
+
+/**
+ * @param p a package
+ * @return estimated memory used by the package in bytes
+ */
+static qint64 estimateCost(const Package& p)
+{
+    qint64 r = sizeof(Package) + estimateCost(p.name) + estimateCost(p.title) +
+            estimateCost(p.url) + estimateCost(p.description) +
+            estimateCost(p.license) + estimateCost(p.getIcon()) +
+            estimateCost(p.categories) + estimateCost(p.tags);
+    for (auto it = p.links.constBegin(); it != p.links.constEnd(); ++it) {
+        r += 32 + estimateCost(it.key()) + estimateCost(it.value());
+    }
+    return r;
+}
+
+/**
+ * @param pv a package version
+ * @return estimated memory used by the package version in bytes
+ */
+static qint64 estimateCost(const PackageVersion& pv)
+{
+    qint64 r = sizeof(PackageVersion) + estimateCost(pv.package) +
+            estimateCost(pv.importantFiles) +
+            estimateCost(pv.importantFilesTitles) +
+            estimateCost(pv.cmdFiles) + estimateCost(pv.sha1) +
+            estimateCost(pv.download.toString());
+    for (int i = 0; i < pv.files.size(); i++) {
+        const PackageVersionFile* f = pv.files.at(i);
+        r += sizeof(PackageVersionFile) + estimateCost(f->path) +
+                estimateCost(f->content);
+    }
+    for (int i = 0; i < pv.dependencies.size(); i++) {
+        const Dependency* d = pv.dependencies.at(i);
+        r += sizeof(Dependency) + estimateCost(d->package) +
+                estimateCost(d->var);
+    }
+    return r;
+}
+
 DBRepository DBRepository::def;
 
-DBRepository::DBRepository(): mutex(QMutex::Recursive)
+RepositoryBatchQueue::~RepositoryBatchQueue()
+{
+    qDeleteAll(queue);
+    delete current;
+}
+
+QString RepositoryBatchQueue::flush(bool force)
+{
+    if (!force && currentSize < BATCH_SIZE)
+        return QStringLiteral("");
+
+    while (!cancelled && queue.size() >= MAX_QUEUED)
+        changed.wait(&mutex);
+
+    if (cancelled)
+        return QObject::tr("Cancelled");
+
+    if (current) {
+        queue.enqueue(current);
+        current = nullptr;
+        currentSize = 0;
+        changed.wakeAll();
+    }
+
+    return QStringLiteral("");
+}
+
+QString RepositoryBatchQueue::savePackage(Package *p, bool /*replace*/)
+{
+    QMutexLocker ml(&mutex);
+
+    if (!current)
+        current = new Repository();
+    current->packages.append(new Package(*p));
+    currentSize++;
+
+    return flush(false);
+}
+
+QString RepositoryBatchQueue::savePackageVersion(PackageVersion *p,
+        bool /*replace*/)
+{
+    QMutexLocker ml(&mutex);
+
+    if (!current)
+        current = new Repository();
+    current->packageVersions.append(p->clone());
+    currentSize++;
+
+    return flush(false);
+}
+
+QString RepositoryBatchQueue::saveLicense(License *p, bool /*replace*/)
+{
+    QMutexLocker ml(&mutex);
+
+    if (!current)
+        current = new Repository();
+    current->licenses.append(p->clone());
+    currentSize++;
+
+    return flush(false);
+}
+
+void RepositoryBatchQueue::finish()
+{
+    QMutexLocker ml(&mutex);
+
+    flush(true);
+    finished = true;
+    changed.wakeAll();
+}
+
+void RepositoryBatchQueue::cancel()
+{
+    QMutexLocker ml(&mutex);
+
+    cancelled = true;
+    qDeleteAll(queue);
+    queue.clear();
+    changed.wakeAll();
+}
+
+Repository* RepositoryBatchQueue::take()
+{
+    QMutexLocker ml(&mutex);
+
+    while (queue.isEmpty() && !finished && !cancelled)
+        changed.wait(&mutex);
+
+    Repository* r = nullptr;
+    if (!queue.isEmpty()) {
+        r = queue.dequeue();
+        changed.wakeAll();
+    }
+
+    return r;
+}
+
+DBRepository::DBRepository(): mutex(QMutex::Recursive),
+        readPoolEpoch(0), cacheVersion(0), transactionThread(nullptr),
+        transactionDepth(0),
+        packageVersions(32 * 1024 * 1024), packages(8 * 1024 * 1024)
 {
     currentRepository = -1;
     replacePackageVersionQuery = nullptr;
@@ -56,6 +249,9 @@ DBRepository::DBRepository(): mutex(QMutex::Recursive)
     replacePackageQuery = nullptr;
     selectCategoryQuery = nullptr;
     insertInstalledQuery = nullptr;
+    fullTextIndex = false;
+    useFullTextIndex = true;
+    useTitleIndex = false;
 
     // please note that words shorter than 3 characters are removed later anyway
     stopWords = QString("version build edition remove only "
@@ -67,14 +263,7 @@ DBRepository::DBRepository(): mutex(QMutex::Recursive)
 
 DBRepository::~DBRepository()
 {
-    delete insertInstalledQuery;
-    delete selectCategoryQuery;
-    delete deleteLinkQuery;
-    delete insertLinkQuery;
-    delete insertPackageQuery;
-    delete replacePackageQuery;
-    delete replacePackageVersionQuery;
-    delete insertPackageVersionQuery;
+    deleteQueries();
 }
 
 QString DBRepository::saveInstalled(const QList<InstalledPackageVersion *> &installed)
@@ -140,9 +329,111 @@ QString DBRepository::exec(const QString& sql)
     q.exec(sql);
     QString err = SQLUtils::getErrorString(q);
 
+    // the pooled readers do not see the changes until they are committed.
+    // "ROLLBACK TO" does not finish the transaction.
+    if (err.isEmpty()) {
+        QString s = sql.trimmed();
+        int depth = transactionDepth;
+        if (s.startsWith(QStringLiteral("BEGIN"), Qt::CaseInsensitive) ||
+                s.startsWith(QStringLiteral("SAVEPOINT"),
+                Qt::CaseInsensitive))
+            depth++;
+        else if (s.startsWith(QStringLiteral("RELEASE"), Qt::CaseInsensitive))
+            depth = std::max<int>(0, depth - 1);
+        else if (s.startsWith(QStringLiteral("COMMIT"), Qt::CaseInsensitive) ||
+                s.startsWith(QStringLiteral("END"), Qt::CaseInsensitive) ||
+                (s.startsWith(QStringLiteral("ROLLBACK"),
+                Qt::CaseInsensitive) && !s.contains(QStringLiteral(" TO "),
+                Qt::CaseInsensitive)))
+            depth = 0;
+
+        if (depth != transactionDepth) {
+            QMutexLocker cl(&cacheMutex);
+            transactionDepth = depth;
+            transactionThread = depth > 0 ? QThread::currentThreadId() :
+                    nullptr;
+            invalidateReads();
+        }
+    }
+
     return err;
 }
 
+void DBRepository::beginRead(ReadConnection* rc) const
+{
+    readPoolMutex.lock();
+    QString file = readPoolFile;
+    quint64 epoch = readPoolEpoch;
+    readPoolMutex.unlock();
+
+    Qt::HANDLE current = QThread::currentThreadId();
+    if (!file.isEmpty() && transactionThread != current) {
+        if (!readConnections.hasLocalData())
+            readConnections.setLocalData(new ReadConnections());
+        ReadConnections* rcs = readConnections.localData();
+
+        QString name = QStringLiteral("read-%1-%2").arg(epoch).
+                arg(reinterpret_cast<quintptr>(current));
+        QString old = rcs->names.value(this);
+        if (old != name) {
+            // the connection to a closed database is not used anymore
+            if (!old.isEmpty())
+                QSqlDatabase::removeDatabase(old);
+            rcs->names.insert(this, name);
+
+            QSqlDatabase d = QSqlDatabase::addDatabase(
+                    QStringLiteral("QSQLITE"), name);
+            d.setDatabaseName(file);
+            d.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY"));
+            if (d.open()) {
+                MySQLQuery q(d);
+                if (!q.exec(QStringLiteral("PRAGMA busy_timeout = 30000")) ||
+                        !q.exec(QStringLiteral(
+                        "PRAGMA case_sensitive_like = on"))) {
+                    qCDebug(npackd) << "cannot configure the read connection" <<
+                            SQLUtils::getErrorString(q);
+                    d.close();
+                }
+            } else {
+                qCDebug(npackd) << "cannot open the read connection" <<
+                        toString(d.lastError());
+            }
+        }
+
+        QSqlDatabase d = QSqlDatabase::database(name, false);
+        if (d.isOpen()) {
+            rc->db = d;
+            rc->pooled = true;
+            rc->cacheVersion = cacheVersion;
+        }
+    }
+
+    if (!rc->pooled) {
+        rc->locker.reset(new QMutexLocker(&this->mutex));
+        rc->db = db;
+    }
+}
+
+bool DBRepository::canCache(const ReadConnection& rc) const
+{
+    return !rc.pooled || (rc.cacheVersion == cacheVersion &&
+            transactionThread == nullptr);
+}
+
+void DBRepository::invalidateReads()
+{
+    cacheVersion++;
+}
+
+void DBRepository::removeReadConnection()
+{
+    if (readConnections.hasLocalData()) {
+        QString name = readConnections.localData()->names.take(this);
+        if (!name.isEmpty())
+            QSqlDatabase::removeDatabase(name);
+    }
+}
+
 int DBRepository::count(const QString& sql, QString* err)
 {
     QMutexLocker ml(&this->mutex);
@@ -206,16 +497,28 @@ QString DBRepository::saveLicense(License* p, bool replace)
 
 Package *DBRepository::findPackage_(const QString &name) const
 {
-    QMutexLocker ml(&this->mutex);
+    std::shared_ptr<const Package> p = findPackageShared(name);
+    return p ? new Package(*p) : nullptr;
+}
 
-    QString err;
+std::shared_ptr<const Package> DBRepository::findPackageShared(
+        const QString &name) const
+{
+    // cache hits do not need the database and are not serialized
+    std::shared_ptr<const Package> cached = packages.get(name);
+    if (cached)
+        return cached;
 
-    Package* r = packages.object(name);
+    ReadConnection rc;
+    beginRead(&rc);
 
-    if (r) {
-        r = new Package(*r);
+    QString err;
+
+    Package* r = nullptr;
+    if (!rc.pooled && snapshot) {
+        r = snapshot->findPackage(name);
     } else {
-        MySQLQuery q(db);
+        MySQLQuery q(rc.db);
         if (!q.prepare(QStringLiteral(
                 "SELECT TITLE, URL, ICON, DESCRIPTION, LICENSE, "
                 "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4, STARS "
@@ -263,27 +566,44 @@ Package *DBRepository::findPackage_(const QString &name) const
             r->categories.append(c);
 
             if (err.isEmpty())
-                err = readLinks(r);
+                err = readLinks(rc.db, r);
 
             if (err.isEmpty())
-                err = readTags(r);
+                err = readTags(rc.db, r);
 
             if (!err.isEmpty()) {
                 delete r;
                 r = nullptr;
             }
         }
+    }
 
-        if (r)
-            packages.insert(name, new Package(*r));
+    // the object is inserted while the mutex or cacheMutex is locked so that
+    // a concurrent savePackage() cannot be overwritten by older data
+    std::shared_ptr<const Package> result(r);
+    if (result) {
+        QMutexLocker cl(&cacheMutex);
+        if (canCache(rc))
+            packages.put(name, result, estimateCost(*result));
     }
 
-    return r;
+    return result;
+}
+
+ObjectCacheStatistics DBRepository::getPackageCacheStatistics() const
+{
+    return packages.getStatistics();
+}
+
+ObjectCacheStatistics DBRepository::getPackageVersionCacheStatistics() const
+{
+    return packageVersions.getStatistics();
 }
 
 QList<Package*> DBRepository::findPackages(const QStringList& names)
 {
-    QMutexLocker ml(&this->mutex);
+    ReadConnection rc;
+    beginRead(&rc);
 
     QList<Package*> ret;
     QString err;
@@ -301,7 +621,7 @@ QList<Package*> DBRepository::findPackages(const QStringList& names)
     sql += QStringLiteral(")");
 
     while (start < c) {
-        MySQLQuery q(db);
+        MySQLQuery q(rc.db);
         if (!q.prepare(sql))
             err = SQLUtils::getErrorString(q);
 
@@ -330,12 +650,12 @@ QList<Package*> DBRepository::findPackages(const QStringList& names)
             r->license = q.value(5).toString();
             r->stars = q.value(6).toInt();
 
-            err = readLinks(r);
+            err = readLinks(rc.db, r);
 
             if (!err.isEmpty())
                 break;
 
-            err = readTags(r);
+            err = readTags(rc.db, r);
 
             if (!err.isEmpty())
                 break;
@@ -368,7 +688,7 @@ QList<Package*> DBRepository::findPackages(const QStringList& names)
 
 QString DBRepository::findCategory(int cat) const
 {
-    QMutexLocker ml(&this->mutex);
+    QMutexLocker ml(&this->categoriesMutex);
 
     QString r = categories.value(cat);
 
@@ -378,7 +698,11 @@ QString DBRepository::findCategory(int cat) const
 PackageVersion* DBRepository::findPackageVersion_(
         const QString& package, const Version& version, QString* err) const
 {
-    QMutexLocker ml(&this->mutex);
+    ReadConnection rc;
+    beginRead(&rc);
+
+    if (!rc.pooled && snapshot)
+        return snapshot->findPackageVersion(package, version, err);
 
     *err = "";
 
@@ -387,9 +711,9 @@ PackageVersion* DBRepository::findPackageVersion_(
     QString version_ = v.getVersionString();
     PackageVersion* r = nullptr;
 
-    MySQLQuery q(db);
+    MySQLQuery q(rc.db);
     if (!q.prepare(QStringLiteral("SELECT NAME, "
-            "PACKAGE, CONTENT, MSIGUID FROM PACKAGE_VERSION "
+            "PACKAGE, IFNULL(BINARY_CONTENT, CONTENT), MSIGUID FROM PACKAGE_VERSION "
             "WHERE NAME = :NAME AND PACKAGE = :PACKAGE")))
         *err = SQLUtils::getErrorString(q);
 
@@ -410,6 +734,219 @@ PackageVersion* DBRepository::findPackageVersion_(
 
 QList<PackageVersion*> DBRepository::getPackageVersions_(const QString& package,
         QString *err) const
+{
+    QList<std::shared_ptr<const PackageVersion> > pvs =
+            getPackageVersionsShared(package, err);
+
+    QList<PackageVersion*> r;
+    r.reserve(pvs.size());
+    for (int i = 0; i < pvs.size(); i++) {
+        r.append(pvs.at(i)->clone());
+    }
+
+    return r;
+}
+
+QList<std::shared_ptr<const PackageVersion> >
+        DBRepository::getPackageVersionsShared(const QString& package,
+        QString *err) const
+{
+    *err = "";
+
+    std::shared_ptr<const PackageVersionList> cached =
+            packageVersions.get(package);
+    if (cached)
+        return cached->data;
+
+    ReadConnection rc;
+    beginRead(&rc);
+
+    QList<PackageVersion*> r;
+
+    if (!rc.pooled && snapshot) {
+        r = snapshot->getPackageVersions(package, err);
+    } else {
+        MySQLQuery q(rc.db);
+        if (!q.prepare(QStringLiteral("SELECT IFNULL(BINARY_CONTENT, CONTENT) "
+                "FROM PACKAGE_VERSION WHERE PACKAGE = :PACKAGE")))
+            *err = SQLUtils::getErrorString(q);
+
+        if (err->isEmpty()) {
+            q.bindValue(QStringLiteral(":PACKAGE"), package);
+            if (!q.exec()) {
+                *err = SQLUtils::getErrorString(q);
+            }
+        }
+
+        while (err->isEmpty() && q.next()) {
+            QByteArray ba = q.value(0).toByteArray();
+            PackageVersion* pv = PackageVersion::parse(ba,
+                    err, false);
+            if (err->isEmpty())
+                r.append(pv);
+        }
+
+        // qCDebug(npackd) << vs.count();
+    }
+
+    std::sort(r.begin(), r.end(), packageVersionLessThan3);
+
+    std::shared_ptr<PackageVersionList> pvl(new PackageVersionList());
+    pvl->data.reserve(r.size());
+    qint64 cost = sizeof(PackageVersionList);
+    for (int i = 0; i < r.size(); i++) {
+        pvl->data.append(std::shared_ptr<const PackageVersion>(r.at(i)));
+        cost += estimateCost(*r.at(i));
+    }
+
+    if (err->isEmpty()) {
+        QMutexLocker cl(&cacheMutex);
+        if (canCache(rc))
+            this->packageVersions.put(package, pvl, cost);
+    }
+
+    return pvl->data;
+}
+
+QString DBRepository::prefetchPackages(const QStringList &packages) const
+{
+    ReadConnection rc;
+    beginRead(&rc);
+
+    // the snapshot does not need SQL queries
+    if (!rc.pooled && snapshot)
+        return QString();
+
+    QStringList names;
+    for (int i = 0; i < packages.size(); i++) {
+        const QString& p = packages.at(i);
+        if (!this->packages.contains(p) || !packageVersions.contains(p))
+            names.append(p);
+    }
+
+    QString err;
+
+    // SQLite allows at most 999 parameters in one statement
+    const int chunk = 500;
+    MySQLQuery q(rc.db);
+    for (int i = 0; i < names.size() && err.isEmpty(); i += chunk) {
+        int n = std::min<int>(chunk, names.size() - i);
+
+        QString in(QStringLiteral(" IN ("));
+        for (int j = 0; j < n; j++) {
+            if (j != 0)
+                in.append(QStringLiteral(", "));
+            in.append('?');
+        }
+        in.append(')');
+
+        auto exec = [&](const QString& sql) {
+            if (!q.prepare(sql))
+                err = SQLUtils::getErrorString(q);
+
+            if (err.isEmpty()) {
+                for (int j = 0; j < n; j++) {
+                    q.addBindValue(names.at(i + j));
+                }
+                if (!q.exec())
+                    err = SQLUtils::getErrorString(q);
+            }
+        };
+
+        // full package name -> package
+        QHash<QString, Package*> found;
+
+        exec(QStringLiteral(
+                "SELECT NAME, TITLE, URL, ICON, DESCRIPTION, LICENSE, "
+                "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4, STARS "
+                "FROM PACKAGE WHERE NAME") + in);
+        while (err.isEmpty() && q.next()) {
+            QString name = q.value(0).toString();
+            Package* r = new Package(name, name);
+            r->title = q.value(1).toString();
+            r->url = q.value(2).toString();
+            r->setIcon(q.value(3).toString());
+            r->description = q.value(4).toString();
+            r->license = q.value(5).toString();
+            r->categories.append(getCategoryPath(q.value(6).toInt(),
+                    q.value(7).toInt(), q.value(8).toInt(),
+                    q.value(9).toInt(), q.value(10).toInt()));
+            r->stars = q.value(11).toInt();
+            found.insert(name, r);
+        }
+
+        // the same order as in readLinks() and readTags()
+        if (err.isEmpty())
+            exec(QStringLiteral("SELECT PACKAGE, REL, HREF FROM LINK "
+                    "WHERE PACKAGE") + in +
+                    QStringLiteral(" ORDER BY PACKAGE, INDEX_"));
+        while (err.isEmpty() && q.next()) {
+            Package* r = found.value(q.value(0).toString());
+            if (r)
+                r->links.insert(q.value(1).toString(), q.value(2).toString());
+        }
+
+        if (err.isEmpty())
+            exec(QStringLiteral("SELECT PACKAGE, VALUE FROM TAG "
+                    "WHERE PACKAGE") + in +
+                    QStringLiteral(" ORDER BY PACKAGE, VALUE"));
+        while (err.isEmpty() && q.next()) {
+            Package* r = found.value(q.value(0).toString());
+            if (r)
+                r->tags.append(q.value(1).toString());
+        }
+
+        // full package name -> versions
+        QHash<QString, QList<PackageVersion*> > versions;
+        if (err.isEmpty())
+            exec(QStringLiteral("SELECT PACKAGE, "
+                    "IFNULL(BINARY_CONTENT, CONTENT) FROM PACKAGE_VERSION "
+                    "WHERE PACKAGE") + in);
+        while (err.isEmpty() && q.next()) {
+            QByteArray ba = q.value(1).toByteArray();
+            PackageVersion* pv = PackageVersion::parse(ba, &err, false);
+            if (err.isEmpty())
+                versions[q.value(0).toString()].append(pv);
+        }
+
+        // see findPackage_()
+        QMutexLocker cl(&cacheMutex);
+        if (err.isEmpty() && canCache(rc)) {
+            for (auto it = found.begin(); it != found.end(); ++it) {
+                std::shared_ptr<const Package> p(it.value());
+                this->packages.put(it.key(), p, estimateCost(*p));
+            }
+            found.clear();
+
+            for (int j = 0; j < n; j++) {
+                const QString& name = names.at(i + j);
+                QList<PackageVersion*> r = versions.take(name);
+                std::sort(r.begin(), r.end(), packageVersionLessThan3);
+
+                std::shared_ptr<PackageVersionList> pvl(
+                        new PackageVersionList());
+                pvl->data.reserve(r.size());
+                qint64 cost = sizeof(PackageVersionList);
+                for (int k = 0; k < r.size(); k++) {
+                    pvl->data.append(std::shared_ptr<const PackageVersion>(
+                            r.at(k)));
+                    cost += estimateCost(*r.at(k));
+                }
+                packageVersions.put(name, pvl, cost);
+            }
+        }
+
+        qDeleteAll(found);
+        for (auto it = versions.begin(); it != versions.end(); ++it) {
+            qDeleteAll(it.value());
+        }
+    }
+
+    return err;
+}
+
+QList<PackageVersion*> DBRepository::getPackageVersionHeaders(
+        const QString& package, QString *err) const
 {
     QMutexLocker ml(&this->mutex);
 
@@ -417,7 +954,8 @@ QList<PackageVersion*> DBRepository::getPackageVersions_(const QString& package,
 
     QList<PackageVersion*> r;
 
-    PackageVersionList* pvl = packageVersions.object(package);
+    std::shared_ptr<const PackageVersionList> pvl =
+            packageVersions.get(package);
     if (pvl) {
         r.reserve(pvl->data.size());
         for (int i = 0; i < pvl->data.size(); i++) {
@@ -425,8 +963,8 @@ QList<PackageVersion*> DBRepository::getPackageVersions_(const QString& package,
         }
     } else {
         MySQLQuery q(db);
-        if (!q.prepare(QStringLiteral("SELECT CONTENT FROM PACKAGE_VERSION "
-                "WHERE PACKAGE = :PACKAGE")))
+        if (!q.prepare(QStringLiteral("SELECT IFNULL(BINARY_CONTENT, CONTENT) "
+                "FROM PACKAGE_VERSION WHERE PACKAGE = :PACKAGE")))
             *err = SQLUtils::getErrorString(q);
 
         if (err->isEmpty()) {
@@ -438,27 +976,100 @@ QList<PackageVersion*> DBRepository::getPackageVersions_(const QString& package,
 
         while (err->isEmpty() && q.next()) {
             QByteArray ba = q.value(0).toByteArray();
-            PackageVersion* pv = PackageVersion::parse(ba,
-                    err, false);
+            PackageVersion* pv;
+            if (PackageVersion::isBinary(ba))
+                pv = PackageVersion::parseBinary(ba, err, false);
+            else
+                pv = PackageVersion::parse(ba, err, false);
             if (err->isEmpty())
                 r.append(pv);
         }
+    }
 
-        // qCDebug(npackd) << vs.count();
+    return r;
+}
 
-        std::sort(r.begin(), r.end(), packageVersionLessThan3);
+QString DBRepository::findNewestAndInstalled_(const QStringList &packages,
+        const QMap<QString, Version> &installed,
+        QMap<QString, PackageVersion *> *newest,
+        QMap<QString, PackageVersion *> *installedVersions) const
+{
+    QMutexLocker ml(&this->mutex);
 
-        if (err->isEmpty()) {
-            pvl = new PackageVersionList();
-            pvl->data.reserve(r.size());
-            for (int i = 0; i < r.size(); i++) {
-                pvl->data.append(r.at(i)->clone());
+    if (snapshot)
+        return AbstractRepository::findNewestAndInstalled_(packages,
+                installed, newest, installedVersions);
+
+    QString err;
+
+    // package name -> (version, CONTENT)
+    QMap<QString, QPair<Version, QByteArray>> newestContent;
+    QMap<QString, QByteArray> installedContent;
+
+    // SQLite allows at most 999 parameters in one statement
+    const int chunk = 500;
+    MySQLQuery q(db);
+    for (int i = 0; i < packages.size() && err.isEmpty(); i += chunk) {
+        int n = std::min<int>(chunk, packages.size() - i);
+
+        QString sql = QStringLiteral("SELECT PACKAGE, NAME, URL, "
+                "IFNULL(BINARY_CONTENT, CONTENT) "
+                "FROM PACKAGE_VERSION WHERE PACKAGE IN (");
+        for (int j = 0; j < n; j++) {
+            if (j != 0)
+                sql.append(QStringLiteral(", "));
+            sql.append('?');
+        }
+        sql.append(')');
+
+        if (!q.prepare(sql))
+            err = SQLUtils::getErrorString(q);
+
+        if (err.isEmpty()) {
+            for (int j = 0; j < n; j++) {
+                q.addBindValue(packages.at(i + j));
+            }
+            if (!q.exec())
+                err = SQLUtils::getErrorString(q);
+        }
+
+        while (err.isEmpty() && q.next()) {
+            QString package = q.value(0).toString();
+            Version v;
+            if (!v.setVersion(q.value(1).toString()))
+                continue;
+
+            if (QUrl(q.value(2).toString()).isValid()) {
+                auto it = newestContent.find(package);
+                if (it == newestContent.end())
+                    newestContent.insert(package,
+                            qMakePair(v, q.value(3).toByteArray()));
+                else if (v.compare(it.value().first) > 0)
+                    it.value() = qMakePair(v, q.value(3).toByteArray());
             }
-            this->packageVersions.insert(package, pvl);
+
+            auto it = installed.constFind(package);
+            if (it != installed.constEnd() && it.value() == v)
+                installedContent.insert(package, q.value(3).toByteArray());
         }
     }
 
-    return r;
+    for (auto it = newestContent.begin();
+            it != newestContent.end() && err.isEmpty(); ++it) {
+        PackageVersion* pv = PackageVersion::parse(it.value().second, &err,
+                false);
+        if (err.isEmpty())
+            newest->insert(it.key(), pv);
+    }
+
+    for (auto it = installedContent.begin();
+            it != installedContent.end() && err.isEmpty(); ++it) {
+        PackageVersion* pv = PackageVersion::parse(it.value(), &err, false);
+        if (err.isEmpty())
+            installedVersions->insert(it.key(), pv);
+    }
+
+    return err;
 }
 
 QList<PackageVersion *> DBRepository::findPackageVersionsWithCmdFile(
@@ -470,8 +1081,15 @@ QList<PackageVersion *> DBRepository::findPackageVersionsWithCmdFile(
 
     QList<PackageVersion*> r;
 
+    if (snapshot) {
+        r = snapshot->findPackageVersionsWithCmdFile(name, err);
+        std::sort(r.begin(), r.end(), packageVersionLessThan3);
+        return r;
+    }
+
     MySQLQuery q(db);
-    if (!q.prepare(QStringLiteral("SELECT CONTENT FROM PACKAGE_VERSION PV "
+    if (!q.prepare(QStringLiteral("SELECT IFNULL(BINARY_CONTENT, CONTENT) "
+            "FROM PACKAGE_VERSION PV "
             "WHERE EXISTS (SELECT 1 FROM CMD_FILE WHERE "
             "PACKAGE = PV.PACKAGE AND "
             "VERSION = PV.NAME AND "
@@ -506,6 +1124,9 @@ License *DBRepository::findLicense_(const QString& name, QString *err)
 
     *err = QStringLiteral("");
 
+    if (snapshot)
+        return snapshot->findLicense(name, err);
+
     License* r = nullptr;
     License* cached = this->licenses.object(name);
     if (!cached) {
@@ -557,12 +1178,9 @@ QStringList DBRepository::tokenizeTitle(const QString& title)
 
     // synonyms
     for (int i = 0; i < keywords.size(); i++) {
-        const QString& p = keywords.at(i);
-        if (p == QStringLiteral("x64") || p == QStringLiteral("amd64") ) {
-            keywords[i] = QStringLiteral("x86_64");
-        } else if (p == QStringLiteral("x86")) {
-            keywords[i] = QStringLiteral("i686");
-        }
+        QString synonym = getSynonym(keywords.at(i));
+        if (!synonym.isEmpty())
+            keywords[i] = synonym;
     }
 
     // "32 bit" and "64 bit"
@@ -618,13 +1236,200 @@ QStringList DBRepository::tokenizeTitle(const QString& title)
     return keywords;
 }
 
+QString DBRepository::getSynonym(const QString& word)
+{
+    QString r;
+    if (word == QStringLiteral("x64") || word == QStringLiteral("amd64")) {
+        r = QStringLiteral("x86_64");
+    } else if (word == QStringLiteral("x86")) {
+        r = QStringLiteral("i686");
+    }
+    return r;
+}
+
+QString DBRepository::createMatchExpression(const QString& query) const
+{
+    if (!fullTextIndex || !useFullTextIndex)
+        return QString();
+
+    QStringList keywords = query.toLower().simplified().split(
+            QStringLiteral(" "), Qt::SkipEmptyParts);
+
+    QStringList positive, negative;
+    for (int i = 0; i < keywords.count(); i++) {
+        QString kw = keywords.at(i);
+
+        // the same rules as in createQuery()
+        if (kw.length() <= 1)
+            continue;
+
+        if (kw.length() == 2 && kw.at(0) == '-')
+            continue;
+
+        bool neg = kw.startsWith('-');
+        if (neg)
+            kw.remove(0, 1);
+
+        if (!isMatchKeyword(kw))
+            continue;
+
+        kw.replace('"', QStringLiteral("\"\""));
+        QString phrase = '"' + kw + '"';
+        if (neg)
+            negative.append(phrase);
+        else
+            positive.append(phrase);
+    }
+
+    if (positive.isEmpty())
+        return QString();
+
+    QString r = positive.join(QStringLiteral(" AND "));
+    if (!negative.isEmpty())
+        r = '(' + r + QStringLiteral(") NOT (") +
+                negative.join(QStringLiteral(" OR ")) + ')';
+
+    return r;
+}
+
+bool DBRepository::isMatchKeyword(const QString& keyword)
+{
+    // the trigram tokenizer cannot find shorter strings. "%" and "_" are
+    // wildcards for LIKE.
+    return keyword.length() >= 3 && !keyword.contains('%') &&
+            !keyword.contains('_');
+}
+
+bool DBRepository::isTrigramSearchIndex(QString* err) const
+{
+    bool r = false;
+
+    MySQLQuery q(db);
+    if (!q.exec(QStringLiteral("SELECT SQL FROM SQLITE_MASTER "
+            "WHERE TYPE='table' AND NAME='PACKAGE_FTS'")))
+        *err = SQLUtils::getErrorString(q);
+    else if (q.next())
+        r = q.value(0).toString().contains(QStringLiteral("trigram"));
+
+    return r;
+}
+
+QString DBRepository::updateSearchIndex()
+{
+    if (!fullTextIndex)
+        return QString();
+
+    QMutexLocker ml(&this->mutex);
+
+    // a replaced package gets a new ROWID
+    QString err = exec(QStringLiteral("DELETE FROM PACKAGE_FTS "
+            "WHERE NOT EXISTS (SELECT 1 FROM PACKAGE "
+            "WHERE PACKAGE.ROWID = PACKAGE_FTS.ROWID "
+            "AND PACKAGE.NAME = PACKAGE_FTS.NAME)"));
+
+    MySQLQuery q(db);
+    if (err.isEmpty()) {
+        if (!q.prepare(QStringLiteral("SELECT ROWID, NAME, TITLE, "
+                "FULLTEXT FROM PACKAGE "
+                "WHERE ROWID NOT IN (SELECT ROWID FROM PACKAGE_FTS)")))
+            err = SQLUtils::getErrorString(q);
+    }
+
+    MySQLQuery insert(db);
+    if (err.isEmpty()) {
+        if (!insert.prepare(QStringLiteral("INSERT INTO PACKAGE_FTS"
+                "(ROWID, NAME, TITLE, TEXT) "
+                "VALUES(:ROWID, :NAME, :TITLE, :TEXT)")))
+            err = SQLUtils::getErrorString(insert);
+    }
+
+    if (err.isEmpty()) {
+        if (!q.exec())
+            err = SQLUtils::getErrorString(q);
+    }
+
+    if (err.isEmpty()) {
+        while (q.next()) {
+            insert.bindValue(QStringLiteral(":ROWID"), q.value(0));
+            insert.bindValue(QStringLiteral(":NAME"), q.value(1).toString());
+            insert.bindValue(QStringLiteral(":TITLE"),
+                    q.value(2).toString().toLower());
+            insert.bindValue(QStringLiteral(":TEXT"), q.value(3).toString());
+            if (!insert.exec()) {
+                err = SQLUtils::getErrorString(insert);
+                break;
+            }
+        }
+    }
+
+    return err;
+}
+
+void DBRepository::setFullTextIndexEnabled(bool v)
+{
+    useFullTextIndex = v;
+}
+
+bool DBRepository::isFullTextIndexEnabled() const
+{
+    return fullTextIndex && useFullTextIndex;
+}
+
+void DBRepository::setTitleIndexEnabled(bool v)
+{
+    QMutexLocker ml(&this->mutex);
+
+    useTitleIndex = v;
+    titleIndex.reset();
+}
+
+QString DBRepository::createTitleIndex(TitleIndex* index) const
+{
+    QString err;
+
+    // the same packages in the same order as in findBetterPackages()
+    MySQLQuery q(db);
+    if (!q.prepare(QStringLiteral("SELECT NAME, TITLE_FULLTEXT FROM PACKAGE "
+            "WHERE NAME NOT LIKE 'msi.%' "
+            "AND NAME NOT LIKE 'control-panel.%' "
+            "ORDER BY NAME")))
+        err = SQLUtils::getErrorString(q);
+
+    if (err.isEmpty()) {
+        if (!q.exec())
+            err = SQLUtils::getErrorString(q);
+    }
+
+    if (err.isEmpty()) {
+        while (q.next()) {
+            QVariant text = q.value(1);
+            index->add(q.value(0).toString(), text.toString(), text.isNull());
+        }
+    }
+
+    return err;
+}
+
 QStringList DBRepository::findBetterPackages(const QString& title, QString* err)
 {
     QStringList packages;
 
     QStringList keywords = tokenizeTitle(title);
 
-    if (keywords.size() > 0) {
+    if (keywords.size() > 0 && useTitleIndex) {
+        QMutexLocker ml(&this->mutex);
+
+        // the results are the same as for the LIKE query below
+        if (!titleIndex) {
+            std::unique_ptr<TitleIndex> index(new TitleIndex());
+            *err = createTitleIndex(index.get());
+            if (err->isEmpty())
+                titleIndex = std::move(index);
+        }
+
+        if (titleIndex)
+            packages = titleIndex->find(keywords, 2);
+    } else if (keywords.size() > 0) {
         QString where = QStringLiteral("select name from package "
                 "where name not like 'msi.%' "
                 "and name not like 'control-panel.%'");
@@ -642,10 +1447,13 @@ QStringList DBRepository::findBetterPackages(const QString& title, QString* err)
             }
         }
 
-        where.append(QStringLiteral(" LIMIT 2"));
+        // the same order as in the title index
+        where.append(QStringLiteral(" ORDER BY NAME LIMIT 2"));
 
         packages = findPackagesWhere(where, params, err);
+    }
 
+    if (keywords.size() > 0) {
         QString what;
         if (packages.size() == 1)
             what = packages.at(0);
@@ -666,7 +1474,8 @@ int DBRepository::getMaxStars(QString* err)
 
 QString DBRepository::createQuery(Package::Status minStatus,
       Package::Status maxStatus,
-      const QString& query, int cat0, int cat1, QList<QVariant>& params) const
+      const QString& query, int cat0, int cat1, QList<QVariant>& params,
+      bool joined) const
 {
     QString where;
 
@@ -676,6 +1485,16 @@ QString DBRepository::createQuery(Package::Status minStatus,
             QStringLiteral(" "),
             Qt::SkipEmptyParts);
 
+    QString match = createMatchExpression(query);
+    if (!match.isEmpty()) {
+        if (joined)
+            where = QStringLiteral("PACKAGE_FTS MATCH :MATCH");
+        else
+            where = QStringLiteral("PACKAGE.NAME IN (SELECT NAME "
+                    "FROM PACKAGE_FTS WHERE PACKAGE_FTS MATCH :MATCH)");
+        params.append(match);
+    }
+
     for (int i = 0; i < keywords.count(); i++) {
         QString kw = keywords.at(i);
 
@@ -685,6 +1504,11 @@ QString DBRepository::createQuery(Package::Status minStatus,
         if (kw.length() == 2 && kw.at(0) == '-')
             continue;
 
+        // already a part of the FTS5 query
+        if (!match.isEmpty() && isMatchKeyword(kw.startsWith('-') ?
+                kw.mid(1) : kw))
+            continue;
+
         if (!where.isEmpty())
             where += QStringLiteral(" AND ");
         if (kw.startsWith('-')) {
@@ -740,13 +1564,29 @@ QStringList DBRepository::findPackages(Package::Status minStatus,
     // qCDebug(npackd) << "DBRepository::findPackages.0";
 
     QList<QVariant> params;
-    QString where = createQuery(minStatus, maxStatus, query, cat0, cat1, params);
+    bool ranked = !createMatchExpression(query).isEmpty();
+    QString where = createQuery(minStatus, maxStatus, query, cat0, cat1, params,
+            ranked);
 
     if (!where.isEmpty())
         where = QStringLiteral("WHERE ") + where;
 
     // qCDebug(npackd) << "DBRepository::findPackages.1";
 
+    if (ranked) {
+        // BM25 returns negative values, better matches first. The title is
+        // weighted 10 times higher than the rest of the text. Popular
+        // packages get up to twice the score.
+        return findPackagesWhere(QStringLiteral("SELECT PACKAGE.NAME "
+                "FROM PACKAGE_FTS JOIN PACKAGE "
+                "ON PACKAGE.NAME = PACKAGE_FTS.NAME ") +
+                where + QStringLiteral(" ORDER BY "
+                "bm25(PACKAGE_FTS, 0.0, 10.0, 1.0) * "
+                "(1.0 + IFNULL(PACKAGE.STARS, 0) / "
+                "(IFNULL(PACKAGE.STARS, 0) + 10.0)), PACKAGE.TITLE"),
+                params, err);
+    }
+
     return findPackagesWhere(QStringLiteral("SELECT NAME FROM PACKAGE ") +
             where + QStringLiteral(" ORDER BY TITLE"), params, err);
 }
@@ -969,6 +1809,79 @@ QString DBRepository::deleteTags(const QString& name)
     return err;
 }
 
+qint64 DBRepository::findPackageRowid(const QString& name, QString* err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    qint64 r = -1;
+
+    if (!selectPackageRowidQuery) {
+        selectPackageRowidQuery.reset(new MySQLQuery(db));
+        if (!selectPackageRowidQuery->prepare(QStringLiteral(
+                "SELECT ROWID FROM PACKAGE WHERE NAME=:NAME"))) {
+            *err = SQLUtils::getErrorString(*selectPackageRowidQuery);
+            selectPackageRowidQuery.reset();
+            return r;
+        }
+    }
+
+    selectPackageRowidQuery->bindValue(QStringLiteral(":NAME"), name);
+    if (!selectPackageRowidQuery->exec())
+        *err = SQLUtils::getErrorString(*selectPackageRowidQuery);
+    else if (selectPackageRowidQuery->next())
+        r = selectPackageRowidQuery->value(0).toLongLong();
+    selectPackageRowidQuery->finish();
+
+    return r;
+}
+
+QString DBRepository::saveSearchEntry(const QString& name, qint64 oldRowid,
+        qint64 rowid, const QString& title, const QString& text)
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    if (!deleteSearchEntryQuery) {
+        deleteSearchEntryQuery.reset(new MySQLQuery(db));
+        if (!deleteSearchEntryQuery->prepare(QStringLiteral(
+                "DELETE FROM PACKAGE_FTS WHERE ROWID=:ROWID"))) {
+            err = SQLUtils::getErrorString(*deleteSearchEntryQuery);
+            deleteSearchEntryQuery.reset();
+        }
+    }
+
+    if (err.isEmpty() && !insertSearchEntryQuery) {
+        insertSearchEntryQuery.reset(new MySQLQuery(db));
+        if (!insertSearchEntryQuery->prepare(QStringLiteral(
+                "INSERT OR REPLACE INTO PACKAGE_FTS(ROWID, NAME, TITLE, TEXT) "
+                "VALUES(:ROWID, :NAME, :TITLE, :TEXT)"))) {
+            err = SQLUtils::getErrorString(*insertSearchEntryQuery);
+            insertSearchEntryQuery.reset();
+        }
+    }
+
+    // the ROWID is looked up directly, the column NAME is not indexed
+    if (err.isEmpty() && oldRowid >= 0 && oldRowid != rowid) {
+        deleteSearchEntryQuery->bindValue(QStringLiteral(":ROWID"), oldRowid);
+        if (!deleteSearchEntryQuery->exec())
+            err = SQLUtils::getErrorString(*deleteSearchEntryQuery);
+        deleteSearchEntryQuery->finish();
+    }
+
+    if (err.isEmpty()) {
+        insertSearchEntryQuery->bindValue(QStringLiteral(":ROWID"), rowid);
+        insertSearchEntryQuery->bindValue(QStringLiteral(":NAME"), name);
+        insertSearchEntryQuery->bindValue(QStringLiteral(":TITLE"), title);
+        insertSearchEntryQuery->bindValue(QStringLiteral(":TEXT"), text);
+        if (!insertSearchEntryQuery->exec())
+            err = SQLUtils::getErrorString(*insertSearchEntryQuery);
+        insertSearchEntryQuery->finish();
+    }
+
+    return err;
+}
+
 QString DBRepository::deleteCmdFiles(const QString& name, const Version& version)
 {
     QMutexLocker ml(&this->mutex);
@@ -1089,10 +2002,29 @@ QString DBRepository::saveTags(Package* p)
     return err;
 }
 
+QByteArray DBRepository::computeContentHash(const Package *p)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << p->name << p->title << p->url << p->getIcon() << p->description <<
+            p->license << p->categories << p->tags << p->links <<
+            static_cast<qint32>(p->stars);
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
 QString DBRepository::savePackage(Package *p, bool replace)
 {
+    QMutexLocker ml(&this->mutex);
+
     QString err;
 
+    // the detected packages are not searched by findBetterPackages()
+    if (!p->name.startsWith(QStringLiteral("msi.")) &&
+            !p->name.startsWith(QStringLiteral("control-panel.")))
+        titleIndex.reset();
+
     /*
     if (p->name == "com.microsoft.Windows64")
         qCDebug(npackd) << p->name << "->" << p->description;
@@ -1134,8 +2066,6 @@ QString DBRepository::savePackage(Package *p, bool replace)
         }
     }
 
-    QMutexLocker ml(&this->mutex);
-
     if (!insertPackageQuery) {
         insertPackageQuery = new MySQLQuery(db);
         replacePackageQuery = new MySQLQuery(db);
@@ -1147,12 +2077,12 @@ QString DBRepository::savePackage(Package *p, bool replace)
                 "(REPOSITORY, NAME, TITLE, URL, ICON, "
                 "DESCRIPTION, LICENSE, FULLTEXT, "
                 "STATUS, SHORT_NAME, CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3,"
-                " CATEGORY4, TITLE_FULLTEXT, STARS)"
+                " CATEGORY4, TITLE_FULLTEXT, STARS, CONTENT_HASH)"
                 "VALUES(:REPOSITORY, :NAME, :TITLE, :URL, "
                 ":ICON, :DESCRIPTION, :LICENSE, "
                 ":FULLTEXT, :STATUS, :SHORT_NAME, "
                 ":CATEGORY0, :CATEGORY1, :CATEGORY2, :CATEGORY3, :CATEGORY4, "
-                ":TITLE_FULLTEXT, :STARS)");
+                ":TITLE_FULLTEXT, :STARS, :CONTENT_HASH)");
 
         insertSQL += add;
         replaceSQL += add;
@@ -1173,7 +2103,20 @@ QString DBRepository::savePackage(Package *p, bool replace)
         }
     }
 
+    QString fulltext = (p->title + QStringLiteral(" ") + p->description +
+            QStringLiteral(" ") +
+            p->name + QStringLiteral(" ") +
+            p->categories.join(' ') + QStringLiteral(" ") +
+            p->tags.join(' ')).toLower();
+    QString titleFulltext = ' ' + tokenizeTitle(p->title).join(' ') + ' ';
+
+    // the entry in the full text index has the same ROWID as the package
+    qint64 oldRowid = -1;
+    if (err.isEmpty() && fullTextIndex && replace)
+        oldRowid = findPackageRowid(p->name, &err);
+
     int affected = 0;
+    qint64 rowid = -1;
 
     if (err.isEmpty()) {
         MySQLQuery* savePackageQuery;
@@ -1193,11 +2136,7 @@ QString DBRepository::savePackage(Package *p, bool replace)
                     p->description);
             savePackageQuery->bindValue(QStringLiteral(":LICENSE"), p->license);
             savePackageQuery->bindValue(QStringLiteral(":FULLTEXT"),
-                    (p->title + QStringLiteral(" ") + p->description +
-                    QStringLiteral(" ") +
-                    p->name + QStringLiteral(" ") +
-                    p->categories.join(' ') + QStringLiteral(" ") +
-                    p->tags.join(' ')).toLower());
+                    fulltext);
             savePackageQuery->bindValue(QStringLiteral(":STATUS"), 0);
             savePackageQuery->bindValue(QStringLiteral(":SHORT_NAME"),
                     p->getShortName());
@@ -1227,13 +2166,17 @@ QString DBRepository::savePackage(Package *p, bool replace)
             else
                 savePackageQuery->bindValue(QStringLiteral(":CATEGORY4"), cat4);
             savePackageQuery->bindValue(QStringLiteral(":TITLE_FULLTEXT"),
-                    ' ' + tokenizeTitle(p->title).join(' ') + ' ');
+                    titleFulltext);
             savePackageQuery->bindValue(QStringLiteral(":STARS"), p->stars);
+            savePackageQuery->bindValue(QStringLiteral(":CONTENT_HASH"),
+                    computeContentHash(p));
 
             if (!savePackageQuery->exec())
                 err = SQLUtils::getErrorString(*savePackageQuery);
-            else
+            else {
                 affected = savePackageQuery->numRowsAffected();
+                rowid = savePackageQuery->lastInsertId().toLongLong();
+            }
         }
 
         savePackageQuery->finish();
@@ -1241,6 +2184,10 @@ QString DBRepository::savePackage(Package *p, bool replace)
 
     bool exists = affected == 0;
 
+    if (err.isEmpty() && fullTextIndex && !exists)
+        err = saveSearchEntry(p->name, oldRowid, rowid, p->title.toLower(),
+                fulltext);
+
     if (err.isEmpty()) {
         if (!exists)
             err = deleteLinks(p->name);
@@ -1261,7 +2208,11 @@ QString DBRepository::savePackage(Package *p, bool replace)
             err = saveTags(p);
     }
 
-    packages.clear();
+    {
+        QMutexLocker cl(&cacheMutex);
+        invalidateReads();
+        packages.remove(p->name);
+    }
 
     return err;
 }
@@ -1270,6 +2221,9 @@ QList<Package*> DBRepository::findPackagesByShortName(const QString &name) const
 {
     QMutexLocker ml(&this->mutex);
 
+    if (snapshot)
+        return snapshot->findPackagesByShortName(name);
+
     QString err;
 
     QList<Package*> r;
@@ -1306,7 +2260,7 @@ QList<Package*> DBRepository::findPackagesByShortName(const QString &name) const
             p->categories.append(path);
 
         if (err.isEmpty())
-            err = readLinks(p);
+            err = readLinks(db, p);
 
         r.append(p);
     }
@@ -1314,15 +2268,13 @@ QList<Package*> DBRepository::findPackagesByShortName(const QString &name) const
     return r;
 }
 
-QString DBRepository::readLinks(Package* p) const
+QString DBRepository::readLinks(const QSqlDatabase& d, Package* p) const
 {
-    QMutexLocker ml(&this->mutex);
-
     QString err;
 
     QList<Package*> r;
 
-    MySQLQuery q(db);
+    MySQLQuery q(d);
     if (!q.prepare(QStringLiteral("SELECT REL, HREF "
             "FROM LINK WHERE PACKAGE = :PACKAGE "
             "ORDER BY INDEX_")))
@@ -1341,15 +2293,13 @@ QString DBRepository::readLinks(Package* p) const
     return err;
 }
 
-QString DBRepository::readTags(Package* p) const
+QString DBRepository::readTags(const QSqlDatabase& d, Package* p) const
 {
-    QMutexLocker ml(&this->mutex);
-
     QString err;
 
     QList<Package*> r;
 
-    MySQLQuery q(db);
+    MySQLQuery q(d);
     if (!q.prepare(QStringLiteral("SELECT VALUE "
             "FROM TAG WHERE PACKAGE = :PACKAGE "
             "ORDER BY VALUE")))
@@ -1381,10 +2331,10 @@ QString DBRepository::savePackageVersion(PackageVersion *p, bool replace)
 
         QString sql = QStringLiteral(" INTO PACKAGE_VERSION "
                 "(NAME, PACKAGE, URL, "
-                "CONTENT, DETECT_FILE_COUNT)"
+                "CONTENT, DETECT_FILE_COUNT, BINARY_CONTENT, REPOSITORY)"
                 "VALUES(:NAME, :PACKAGE, "
                 ":URL, :CONTENT, "
-                ":DETECT_FILE_COUNT)");
+                ":DETECT_FILE_COUNT, :BINARY_CONTENT, :REPOSITORY)");
 
         if (!replacePackageVersionQuery->prepare(
                 QStringLiteral("INSERT OR REPLACE ") + sql)) {
@@ -1423,11 +2373,14 @@ QString DBRepository::savePackageVersion(PackageVersion *p, bool replace)
         q->bindValue(QStringLiteral(":URL"), p->download.toString());
         q->bindValue(QStringLiteral(":DETECT_FILE_COUNT"), 0);
 
+        // older program versions only read the XML
         QByteArray file;
         file.reserve(1024);
         QXmlStreamWriter w(&file);
         p->toXML(&w);
         q->bindValue(QStringLiteral(":CONTENT"), QVariant(file));
+        q->bindValue(QStringLiteral(":BINARY_CONTENT"),
+                QVariant(p->toBinary()));
         if (!q->exec())
             err = SQLUtils::getErrorString(*q);
         modified = q->numRowsAffected() > 0;
@@ -1464,7 +2417,11 @@ QString DBRepository::savePackageVersion(PackageVersion *p, bool replace)
         q->finish();
     }
 
-    packageVersions.clear();
+    {
+        QMutexLocker cl(&cacheMutex);
+        invalidateReads();
+        packageVersions.remove(p->package);
+    }
 
     return err;
 }
@@ -1515,6 +2472,12 @@ QString DBRepository::clear()
             sub->completeWithProgress();
     }
 
+    if (job->shouldProceed() && fullTextIndex) {
+        QString err = exec(QStringLiteral("DELETE FROM PACKAGE_FTS"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.05,
                 QObject::tr("Clearing the tags table"));
@@ -1567,18 +2530,78 @@ QString DBRepository::clear()
 void DBRepository::clearCache()
 {
     this->mutex.lock();
+    titleIndex.reset();
+    this->categoriesMutex.lock();
     this->categories.clear();
+    this->categoriesMutex.unlock();
     this->licenses.clear();
+    this->cacheMutex.lock();
+    invalidateReads();
     this->packageVersions.clear();
     this->packages.clear();
+    this->cacheMutex.unlock();
     this->mutex.unlock();
 
     readCategories();
 }
 
-void DBRepository::load(Job* job, const QList<QUrl *> &repositories, bool useCache, bool interactive,
+QList<QTemporaryFile*> DBRepository::downloadRepositories(Job* job,
+        const QList<QUrl *> &repositories, bool useCache, bool interactive,
         const QString &user, const QString &password,
-        const QString &proxyUser, const QString &proxyPassword)
+        const QString &proxyUser, const QString &proxyPassword,
+        QStringList* sha1s)
+{
+    QList<QTemporaryFile*> r;
+
+    // SHA-1 is used to find out whether a repository has changed. It is
+    // computed while the data is downloaded.
+    typedef QPair<QTemporaryFile*, QString> Downloaded;
+    QList<QFuture<Downloaded> > files;
+    for (int i = 0; i < repositories.count(); i++) {
+        QUrl* url = repositories.at(i);
+        Job* s = job->newSubJob(1.0 / repositories.count(),
+                QObject::tr("Downloading %1").
+                arg(url->toDisplayString()), false, true);
+
+        Downloader::Request request(*url);
+        request.user = user;
+        request.password = password;
+        request.proxyUser = proxyUser;
+        request.proxyPassword = proxyPassword;
+        request.useCache = useCache;
+        request.interactive = interactive;
+        request.hashSum = true;
+        request.alg = QCryptographicHash::Sha1;
+        QFuture<Downloaded> future = QtConcurrent::run([s, request]() {
+            Downloader::Response response;
+            QTemporaryFile* f = Downloader::downloadToTemporary(s, request,
+                    &response);
+            return Downloaded(f, f ? response.hashSum : QString());
+        });
+        files.append(future);
+    }
+
+    for (int i = 0; i < repositories.count(); i++) {
+        files[i].waitForFinished();
+        r.append(files.at(i).result().first);
+        sha1s->append(files.at(i).result().second);
+
+        job->setProgress((i + 1.0) / repositories.count());
+    }
+
+    if (!job->shouldProceed()) {
+        qDeleteAll(r);
+        r.clear();
+        sha1s->clear();
+    }
+
+    job->complete();
+
+    return r;
+}
+
+void DBRepository::load(Job* job, const QList<QUrl *> &repositories,
+        const QList<QTemporaryFile *> &files, const QStringList &sha1s)
 {
     QString err;
     if (repositories.count() > 0) {
@@ -1588,47 +2611,71 @@ void DBRepository::load(Job* job, const QList<QUrl *> &repositories, bool useCac
         }
 
         err = saveRepositories(reps);
+        for (int i = 0; i < reps.size() && i < sha1s.size(); i++) {
+            if (!err.isEmpty())
+                break;
+
+            setRepositorySHA1(reps.at(i), sha1s.at(i), &err);
+        }
         if (!err.isEmpty())
             job->setErrorMessage(
                     QObject::tr("Error saving the list of repositories in the database: %1").arg(
                     err));
 
-        QList<QFuture<QTemporaryFile*> > files;
-        for (int i = 0; i < repositories.count(); i++) {
-            QUrl* url = repositories.at(i);
-            Job* s = job->newSubJob(0.1,
-                    QObject::tr("Downloading %1").
-                    arg(url->toDisplayString()), false, true);
-
-            Downloader::Request request(*url);
-            request.user = user;
-            request.password = password;
-            request.proxyUser = proxyUser;
-            request.proxyPassword = proxyPassword;
-            request.useCache = useCache;
-            request.interactive = interactive;
-            QFuture<QTemporaryFile*> future = QtConcurrent::run(
-                    Downloader::downloadToTemporary, s, request);
-            files.append(future);
-        }
-
-        for (int i = 0; i < repositories.count(); i++) {
-            files[i].waitForFinished();
-
-            job->setProgress((i + 1.0) / repositories.count() * 0.5);
-        }
-
+        // The repositories are parsed in parallel. The parsed objects are
+        // written to the database only from this thread as the database
+        // connection cannot be shared between threads. The repositories are
+        // written in the order of their definition as the first
+        // definition of a package wins.
+        QThreadPool parsers;
+        QList<RepositoryBatchQueue*> queues;
+        QList<Job*> parseJobs;
+        QList<QFuture<void> > parsed;
         for (int i = 0; i < repositories.count(); i++) {
             if (!job->shouldProceed())
                 break;
 
-            QTemporaryFile* tf = files.at(i).result();
-            Job* s = job->newSubJob(0.49 / repositories.count(), QString(
+            QTemporaryFile* tf = files.at(i);
+            if (!tf)
+                break;
+
+            Job* s = job->newSubJob(1.0 / repositories.count(), QString(
                     QObject::tr("Repository %1 of %2")).arg(i + 1).
                     arg(repositories.count()));
+            RepositoryBatchQueue* queue = new RepositoryBatchQueue();
+            queues.append(queue);
+            parseJobs.append(s);
+            parsed.append(QtConcurrent::run(&parsers, loadOne, s,
+                    static_cast<QFile*>(tf), *repositories.at(i),
+                    static_cast<AbstractRepository*>(queue), queue));
+        }
+
+        for (int i = 0; i < queues.count(); i++) {
+            RepositoryBatchQueue* queue = queues.at(i);
             this->currentRepository = i;
+
             // this is currently unnecessary clearRepository(i);
-            loadOne(s, tf, *repositories.at(i));
+            Repository* batch;
+            while (job->shouldProceed() && (batch = queue->take())) {
+                QString err = savePackages(batch, false);
+                if (err.isEmpty())
+                    err = savePackageVersions(batch, false);
+                if (err.isEmpty())
+                    err = saveLicenses(batch, false);
+                delete batch;
+
+                if (!err.isEmpty()) {
+                    job->setErrorMessage(QString(
+                            QObject::tr("Error loading the repository %1: %2")).arg(
+                            repositories.at(i)->toString()).arg(err));
+                }
+            }
+
+            if (!job->shouldProceed())
+                break;
+
+            parsed[i].waitForFinished();
+            Job* s = parseJobs.at(i);
             if (!s->getErrorMessage().isEmpty()) {
                 job->setErrorMessage(QString(
                         QObject::tr("Error loading the repository %1: %2")).arg(
@@ -1638,13 +2685,13 @@ void DBRepository::load(Job* job, const QList<QUrl *> &repositories, bool useCac
             }
         }
 
-        for (int i = 0; i < repositories.count(); i++) {
-            if (!job->shouldProceed())
-                break;
-
-            QTemporaryFile* tf = files.at(i).result();
-            delete tf;
+        // the parsers may be waiting for free space in the queues
+        for (int i = 0; i < queues.count(); i++) {
+            queues.at(i)->cancel();
         }
+        parsers.waitForDone();
+        qDeleteAll(queues);
+
     } else {
         job->setErrorMessage(QObject::tr("No repositories defined"));
         job->setProgress(1);
@@ -1655,44 +2702,38 @@ void DBRepository::load(Job* job, const QList<QUrl *> &repositories, bool useCac
     job->complete();
 }
 
-void DBRepository::loadOne(Job* job, QFile* f, const QUrl& url) {
-    QTemporaryDir* dir = nullptr;
-    QFile* xmlInZIP = nullptr;
+void DBRepository::loadOne(Job* job, QFile* f, const QUrl& url,
+        AbstractRepository* rep, RepositoryBatchQueue* queue) {
+    // Rep.xml is decompressed while it is parsed
+    QIODevice* xmlInZIP = nullptr;
+    QIODevice* in = f;
     if (job->shouldProceed()) {
         if (f->open(QFile::ReadOnly) &&
                 f->seek(0) && f->read(4) == QByteArray::fromRawData(
                 "PK\x03\x04", 4)) {
             f->close();
 
-            dir = new QTemporaryDir();
-            if (dir->isValid()) {
-                Job* sub = job->newSubJob(0.1, QObject::tr("Extracting"));
-                WPMUtils::unzip(sub, f->fileName(), dir->path() + "\\");
-                if (!sub->getErrorMessage().isEmpty()) {
-                    job->setErrorMessage(
-                            QObject::tr("Unzipping the repository %1 failed: %2").
-                            arg(f->fileName()).
-                            arg(sub->getErrorMessage()));
-                } else {
-                    QString repfn = dir->path() + QStringLiteral("\\Rep.xml");
-                    if (QFile::exists(repfn)) {
-                        xmlInZIP = new QFile(repfn);
-                        f = xmlInZIP;
-                    } else {
-                        job->setErrorMessage(QObject::tr(
-                                "Rep.xml is missing in a repository in ZIP format"));
-                    }
-                }
+            QString err;
+            xmlInZIP = WPMUtils::openZipEntry(f->fileName(),
+                    QStringLiteral("Rep.xml"), &err);
+            if (!err.isEmpty()) {
+                job->setErrorMessage(
+                        QObject::tr("Unzipping the repository %1 failed: %2").
+                        arg(f->fileName()).
+                        arg(err));
+            } else {
+                in = xmlInZIP;
             }
         }
         f->close();
     }
 
     if (job->shouldProceed()) {
-        f->open(QFile::ReadOnly);
+        if (in == f)
+            f->open(QFile::ReadOnly);
         Job* sub = job->newSubJob(0.9, QObject::tr("Parsing XML"));
-        QXmlStreamReader reader(f);
-        RepositoryXMLHandler handler(this, url, &reader);
+        QXmlStreamReader reader(in);
+        RepositoryXMLHandler handler(rep, url, &reader);
         QString err = handler.parse();
         if (!err.isEmpty())
             job->setErrorMessage(err);
@@ -1703,7 +2744,8 @@ void DBRepository::loadOne(Job* job, QFile* f, const QUrl& url) {
     }
 
     delete xmlInZIP;
-    delete dir;
+
+    queue->finish();
 
     job->complete();
 }
@@ -1713,6 +2755,32 @@ void DBRepository::clearAndDownloadRepositories(Job* job,
         bool interactive, const QString &user,
         const QString &password, const QString &proxyUser,
         const QString &proxyPassword, bool useCache, bool detect)
+{
+    QList<QTemporaryFile*> files;
+    QStringList sha1s;
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.15,
+                QObject::tr("Downloading the remote repositories"));
+        files = downloadRepositories(sub, repositories, useCache, interactive,
+                user, password, proxyUser, proxyPassword, &sha1s);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.85,
+                QObject::tr("Filling the local database"), true, true);
+        clearAndLoad(sub, repositories, files, sha1s, detect);
+    }
+
+    qDeleteAll(files);
+
+    job->complete();
+}
+
+void DBRepository::clearAndLoad(Job* job, const QList<QUrl *> &repositories,
+        const QList<QTemporaryFile *> &files, const QStringList &sha1s,
+        bool detect)
 {
     bool transactionStarted = false;
     if (job->shouldProceed()) {
@@ -1739,17 +2807,63 @@ void DBRepository::clearAndDownloadRepositories(Job* job,
 
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.27,
-                QObject::tr("Downloading the remote repositories and filling the local database (tempdb)"));
-        load(sub, repositories, useCache, interactive, user, password, proxyUser, proxyPassword);
+                QObject::tr("Filling the local database (tempdb)"));
+        load(sub, repositories, files, sha1s);
         if (!sub->getErrorMessage().isEmpty())
             job->setErrorMessage(sub->getErrorMessage());
     }
 
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.53,
+                QObject::tr("Refreshing the installation status (tempdb)"),
+                true, true);
+        updateInstallationStatus(sub, detect);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.03,
+                QObject::tr("Filling the full text index (tempdb)"));
+        QString err = updateSearchIndex();
+        if (err.isEmpty())
+            sub->completeWithProgress();
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.05,
+                QObject::tr("Commiting the SQL transaction (tempdb)"));
+        QString err = exec(QStringLiteral("COMMIT"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else
+            sub->completeWithProgress();
+    } else {
+        if (transactionStarted)
+            exec(QStringLiteral("ROLLBACK"));
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.1,
+                QObject::tr("Reading categories"));
+        QString err = readCategories();
+        if (err.isEmpty()) {
+            sub->completeWithProgress();
+            job->setProgress(1);
+        } else
+            job->setErrorMessage(err);
+    }
+
+    job->complete();
+}
+
+void DBRepository::updateInstallationStatus(Job* job, bool detect)
+{
     if (job->shouldProceed()) {
         InstalledPackages* def = InstalledPackages::getDefault();
         if (detect) {
-            Job* sub = job->newSubJob(0.4,
-                    QObject::tr("Refreshing the installation status (tempdb)"));
+            Job* sub = job->newSubJob(0.7,
+                    QObject::tr("Refreshing the installation status"));
             InstalledPackages ip;
             ip.refresh(this, sub);
             if (!sub->getErrorMessage().isEmpty())
@@ -1764,25 +2878,25 @@ void DBRepository::clearAndDownloadRepositories(Job* job,
             if (!err.isEmpty())
                 job->setErrorMessage(err);
             else
-                job->setProgress(job->getProgress() + 0.4);
+                job->setProgress(job->getProgress() + 0.7);
         }
     }
 
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.06,
-                QObject::tr("Updating the status for installed packages in the database (tempdb)"));
+        Job* sub = job->newSubJob(0.1,
+                QObject::tr("Updating the status for installed packages in the database"));
         updateStatusForInstalled(sub);
         if (!sub->getErrorMessage().isEmpty())
             job->setErrorMessage(sub->getErrorMessage());
     }
 
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.05,
+        Job* sub = job->newSubJob(0.1,
                 QObject::tr("Removing packages without versions"));
-        QString err = exec(QStringLiteral(
-                "DELETE FROM PACKAGE WHERE STATUS=0 AND NOT EXISTS "
-                "(SELECT 1 FROM PACKAGE_VERSION "
-                "WHERE PACKAGE = PACKAGE.NAME AND URL <>'')"));
+        this->mutex.lock();
+        titleIndex.reset();
+        this->mutex.unlock();
+        QString err = deletePackagesWithoutVersions();
         if (err.isEmpty())
             sub->completeWithProgress();
         else
@@ -1792,60 +2906,122 @@ void DBRepository::clearAndDownloadRepositories(Job* job,
     if (job->shouldProceed()) {
         QList<InstalledPackageVersion*> installed =
                 InstalledPackages::getDefault()->getAll();
-        QString err = saveInstalled(installed);
+        QString err = exec(QStringLiteral("DELETE FROM INSTALLED"));
+        if (err.isEmpty())
+            err = saveInstalled(installed);
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else
-            job->setProgress(0.85);
+            job->setProgress(1);
 
         qDeleteAll(installed);
     }
 
-    if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.05,
-                QObject::tr("Commiting the SQL transaction (tempdb)"));
-        QString err = exec(QStringLiteral("COMMIT"));
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-        else
-            sub->completeWithProgress();
-    } else {
-        if (transactionStarted)
-            exec(QStringLiteral("ROLLBACK"));
-    }
+    job->complete();
+}
 
-    /*QString error;
-    //tempFile.setAutoRemove(false);
-    qCDebug(npackd) << "packages in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << "package versions in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE_VERSION", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << tempFile.fileName();
-    */
+QString DBRepository::deleteDetectedPackageVersions()
+{
+    QMutexLocker ml(&this->mutex);
 
-    /*
-    qCDebug(npackd) << "packages in db" << count("SELECT COUNT(*) FROM PACKAGE", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << "package versions in db" << count("SELECT COUNT(*) FROM PACKAGE_VERSION", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << tempFile.fileName();
-    */
+    QStringList sql;
+    sql << QStringLiteral("DELETE FROM CMD_FILE WHERE EXISTS "
+            "(SELECT 1 FROM PACKAGE_VERSION PV "
+            "WHERE PV.REPOSITORY=%1 AND PV.URL='' "
+            "AND PV.PACKAGE=CMD_FILE.PACKAGE "
+            "AND PV.NAME=CMD_FILE.VERSION)").arg(DETECTED_REPOSITORY) <<
+            QStringLiteral("DELETE FROM PACKAGE_VERSION "
+            "WHERE REPOSITORY=%1 AND URL=''").arg(DETECTED_REPOSITORY);
+    QString err;
+    for (int i = 0; i < sql.count() && err.isEmpty(); i++)
+        err = exec(sql.at(i));
 
-    if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.1,
-                QObject::tr("Reading categories"));
-        QString err = readCategories();
-        if (err.isEmpty()) {
-            sub->completeWithProgress();
-            job->setProgress(1);
-        } else
-            job->setErrorMessage(err);
+    QMutexLocker cl(&cacheMutex);
+    invalidateReads();
+    packageVersions.clear();
+
+    return err;
+}
+
+QString DBRepository::deletePackagesWithoutVersions()
+{
+    QMutexLocker ml(&this->mutex);
+
+    QStringList sql;
+    sql << QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS "
+            "REMOVED_PACKAGE(NAME TEXT PRIMARY KEY)") <<
+            QStringLiteral("DELETE FROM temp.REMOVED_PACKAGE") <<
+            QStringLiteral("INSERT OR IGNORE INTO temp.REMOVED_PACKAGE(NAME) "
+            "SELECT NAME FROM PACKAGE WHERE STATUS=0 AND NOT EXISTS "
+            "(SELECT 1 FROM PACKAGE_VERSION "
+            "WHERE PACKAGE = PACKAGE.NAME AND URL <>'')") <<
+            QStringLiteral("DELETE FROM PACKAGE WHERE NAME IN "
+            "(SELECT NAME FROM temp.REMOVED_PACKAGE)") <<
+            QStringLiteral("DELETE FROM PACKAGE_VERSION WHERE PACKAGE IN "
+            "(SELECT NAME FROM temp.REMOVED_PACKAGE)") <<
+            QStringLiteral("DELETE FROM CMD_FILE WHERE PACKAGE IN "
+            "(SELECT NAME FROM temp.REMOVED_PACKAGE)") <<
+            QStringLiteral("DELETE FROM LINK WHERE PACKAGE IN "
+            "(SELECT NAME FROM temp.REMOVED_PACKAGE)") <<
+            QStringLiteral("DELETE FROM TAG WHERE PACKAGE IN "
+            "(SELECT NAME FROM temp.REMOVED_PACKAGE)");
+    QString err;
+    for (int i = 0; i < sql.count() && err.isEmpty(); i++)
+        err = exec(sql.at(i));
+
+    QMutexLocker cl(&cacheMutex);
+    invalidateReads();
+    packageVersions.clear();
+    packages.clear();
+
+    return err;
+}
+
+bool DBRepository::isUpToDate(const QList<QUrl *> &repositories,
+        const QStringList &sha1s, QString *err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    bool r = repositories.count() > 0 &&
+            repositories.count() == sha1s.count();
+
+    MySQLQuery q(db);
+    if (r) {
+        if (!q.prepare(QStringLiteral(
+                "SELECT URL, SHA1 FROM REPOSITORY ORDER BY ID")))
+            *err = SQLUtils::getErrorString(q);
+        else if (!q.exec())
+            *err = SQLUtils::getErrorString(q);
     }
 
-    job->complete();
+    if (r && err->isEmpty()) {
+        int i = 0;
+        while (r && q.next()) {
+            r = i < repositories.count() &&
+                    q.value(0).toString() == repositories.at(i)->toString(
+                    QUrl::FullyEncoded) &&
+                    !sha1s.at(i).isEmpty() &&
+                    q.value(1).toString() == sha1s.at(i);
+            i++;
+        }
+        r = r && i == repositories.count();
+    }
+
+    // package versions written by older program versions cannot be
+    // assigned to a repository
+    if (r && err->isEmpty()) {
+        if (!q.exec(QStringLiteral("SELECT 1 FROM PACKAGE_VERSION "
+                "WHERE REPOSITORY IS NULL LIMIT 1")))
+            *err = SQLUtils::getErrorString(q);
+        else
+            r = !q.next();
+    }
+
+    return r && err->isEmpty();
 }
 
-void DBRepository::updateF5Runnable(Job *job, bool useCache)
+void DBRepository::updateF5Runnable(Job *job, bool useCache,
+        bool skipIfUpToDate)
 {
     QThread::currentThread()->setPriority(QThread::LowestPriority);
 
@@ -1855,30 +3031,6 @@ void DBRepository::updateF5Runnable(Job *job, bool useCache)
             THREAD_MODE_BACKGROUND_BEGIN);
     */
 
-    DBRepository tempdb;
-
-    QTemporaryFile tempFile;
-    bool tempDatabaseOpen = false;
-    if (job->shouldProceed()) {
-        if (!tempFile.open()) {
-            job->setErrorMessage(QObject::tr("Error creating a temporary file"));
-        } else {
-            tempFile.close();
-            job->setProgress(0.01);
-        }
-    }
-
-    if (job->shouldProceed()) {
-        QString err = tempdb.open(QStringLiteral("tempdb"),
-                tempFile.fileName());
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-        else {
-            tempDatabaseOpen = true;
-            job->setProgress(0.02);
-        }
-    }
-
     QList<QUrl*> urls;
     if (job->shouldProceed()) {
         QString err;
@@ -1887,17 +3039,17 @@ void DBRepository::updateF5Runnable(Job *job, bool useCache)
             job->setErrorMessage(QObject::tr("Cannot load the list of repositories: %1").arg(err));
     }
 
+    QList<QTemporaryFile*> files;
+    QStringList sha1s;
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.77,
-                QObject::tr("Updating the temporary database"), true, true);
-        CoInitialize(nullptr);
-        tempdb.clearAndDownloadRepositories(sub, urls, true, "", "", "", "", useCache);
-        CoUninitialize();
+        Job* sub = job->newSubJob(0.15,
+                QObject::tr("Downloading the remote repositories"));
+        files = downloadRepositories(sub, urls, useCache, true, "", "", "", "",
+                &sha1s);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
     }
 
-    if (tempDatabaseOpen)
-        tempdb.db.close();
-
     // as this runs in a separate thread, we cannot use "this", instead
     // we create another connection to the same default database
     DBRepository dbr;
@@ -1908,21 +3060,146 @@ void DBRepository::updateF5Runnable(Job *job, bool useCache)
             job->setErrorMessage(QObject::tr("Error opening the database: %1").
                     arg(err));
         } else {
-            job->setProgress(0.8);
+            job->setProgress(0.16);
+        }
+    }
+
+    // nothing has changed in the repositories: only the installed software
+    // has to be detected again
+    bool upToDate = false;
+    if (job->shouldProceed() && skipIfUpToDate) {
+        QString err;
+        upToDate = dbr.isUpToDate(urls, sha1s, &err);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed() && upToDate) {
+        Job* sub = job->newSubJob(0.84,
+                QObject::tr("Refreshing the installation status"), true, true);
+
+        // the result should be the same as for a full rebuild where only
+        // the currently installed software is detected
+        QString err = dbr.exec(QStringLiteral("BEGIN TRANSACTION"));
+        if (err.isEmpty())
+            err = dbr.exec(QStringLiteral("UPDATE PACKAGE SET STATUS=0"));
+        if (err.isEmpty())
+            err = dbr.deleteDetectedPackageVersions();
+        if (!err.isEmpty())
+            sub->setErrorMessage(err);
+
+        CoInitialize(nullptr);
+        dbr.updateInstallationStatus(sub, true);
+        CoUninitialize();
+
+        // the detection may have added new packages
+        if (job->shouldProceed()) {
+            err = dbr.updateSearchIndex();
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+        }
+
+        if (job->shouldProceed()) {
+            err = dbr.exec(QStringLiteral("COMMIT"));
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+        } else {
+            dbr.exec(QStringLiteral("ROLLBACK"));
         }
     }
 
+    if (!upToDate) {
+        DBRepository tempdb;
+
+        // a full update builds a new generation of the database next to the
+        // current one. The readers continue to use the old generation until
+        // the new one is published. If the directory of the database cannot
+        // be written, the database is built in a temporary file and the
+        // changes are applied to the current database.
+        QTemporaryFile tempFile;
+        QString tempFileName;
+        bool generation = false;
+        bool tempDatabaseOpen = false;
+        if (job->shouldProceed()) {
+            tempFileName = createGenerationFile(getBaseFile());
+            QFile f(tempFileName);
+            if (f.open(QFile::WriteOnly)) {
+                f.close();
+                generation = true;
+            } else if (!tempFile.open()) {
+                job->setErrorMessage(QObject::tr("Error creating a temporary file"));
+            } else {
+                tempFile.close();
+                tempFileName = tempFile.fileName();
+            }
+            if (job->shouldProceed())
+                job->setProgress(0.17);
+        }
+
+        if (job->shouldProceed()) {
+            QString err = tempdb.open(QStringLiteral("tempdb"),
+                    tempFileName);
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+            else {
+                tempDatabaseOpen = true;
+                job->setProgress(0.18);
+            }
+        }
+
+        if (job->shouldProceed()) {
+            Job* sub = job->newSubJob(0.62,
+                    QObject::tr("Updating the temporary database"), true, true);
+            CoInitialize(nullptr);
+            tempdb.clearAndLoad(sub, urls, files, sha1s, true);
+            CoUninitialize();
+        }
+
+        if (tempDatabaseOpen)
+            tempdb.close();
+
+        bool published = false;
+        if (job->shouldProceed() && generation) {
+            QString err = publish(getBaseFile(), tempFileName);
+            if (err.isEmpty()) {
+                published = true;
+                err = dbr.reopenDefault();
+                if (err.isEmpty())
+                    job->setProgress(0.99);
+                else
+                    job->setErrorMessage(err);
+            } else {
+                qCWarning(npackd).noquote() << QObject::tr(
+                        "Cannot publish the new database: %1").arg(err);
+            }
+        }
+
+        if (job->shouldProceed() && !published) {
+            Job* sub = job->newSubJob(0.2,
+                    QObject::tr("Applying the changes from the temporary database"),
+                    true, true);
+            dbr.applyChangesFrom(sub, tempFileName);
+        }
+
+        // the new generation was not published
+        if (generation && !published && QFileInfo::exists(tempFileName))
+            QFile::remove(tempFileName);
+    }
+
+    // the snapshot is only an optimization for the command line
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.2,
-                QObject::tr("Transferring the data from the temporary database"),
-                true, true);
-        dbr.transferFrom(sub, tempFile.fileName());
+        QString err = dbr.updateSnapshot();
+        if (!err.isEmpty())
+            qCDebug(npackd) << err;
     }
 
     if (job->shouldProceed()) {
         job->setProgress(1);
     }
 
+    qDeleteAll(files);
+    files.clear();
+
     qDeleteAll(urls);
     urls.clear();
 
@@ -1969,6 +3246,145 @@ void DBRepository::saveAll(Job* job, Repository* r, bool replace)
     job->complete();
 }
 
+/**
+ * @brief decides whether a detected object should be written
+ * @param key key for the object
+ * @param index index of the package manager
+ * @param replace index of a package manager -> replace the existing objects
+ * @param writers key -> index of the package manager that has written the
+ *     object or -1 if the object existed before
+ * @param exists true if the object currently exists in the database. Only
+ *     called if necessary.
+ * @return 0 = do not write, 1 = insert if the object does not exist,
+ *     2 = replace
+ */
+static int getDetectedWriteMode(const QString& key, int index,
+        const QList<bool>& replace, QHash<QString, int>* writers,
+        const std::function<bool()>& exists)
+{
+    int r;
+    int w = writers->value(key, -2);
+    if (w == -2) {
+        // the first write in this sequence
+        if (replace.at(index)) {
+            r = 2;
+            writers->insert(key, index);
+        } else {
+            r = 1;
+            writers->insert(key, exists() ? -1 : index);
+        }
+    } else if (replace.at(index)) {
+        // the last replacing package manager wins
+        if (w < 0 || !replace.at(w) || index > w) {
+            r = 2;
+            writers->insert(key, index);
+        } else {
+            r = 0;
+        }
+    } else {
+        // the first inserting package manager wins if nothing was replaced
+        // and the object did not exist before
+        if (w >= 0 && !replace.at(w) && index < w) {
+            r = 2;
+            writers->insert(key, index);
+        } else {
+            r = 0;
+        }
+    }
+    return r;
+}
+
+void DBRepository::saveDetected(Job* job, Repository* r, int index,
+        const QList<bool>& replace, QHash<QString, int>* writers)
+{
+    bool savepoint = false;
+    if (job->shouldProceed()) {
+        QString err = exec(QStringLiteral("SAVEPOINT DETECTED"));
+        if (err.isEmpty())
+            savepoint = true;
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.07,
+                QObject::tr("Inserting data in the packages table"));
+        QString err;
+        for (int i = 0; i < r->packages.count(); i++) {
+            Package* p = r->packages.at(i);
+            int mode = getDetectedWriteMode(QStringLiteral("p:") + p->name,
+                    index, replace, writers, [this, p]() {
+                std::unique_ptr<Package> e(findPackage_(p->name));
+                return e.get() != nullptr;
+            });
+            if (mode != 0)
+                err = savePackage(p, mode == 2);
+            if (!err.isEmpty())
+                break;
+        }
+        if (err.isEmpty())
+            sub->completeWithProgress();
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.89,
+                QObject::tr("Inserting data in the package versions table"));
+        QString err;
+        for (int i = 0; i < r->packageVersions.count(); i++) {
+            PackageVersion* p = r->packageVersions.at(i);
+            int mode = getDetectedWriteMode(QStringLiteral("v:") +
+                    PackageVersion::getStringId(p->package, p->version),
+                    index, replace, writers, [this, p, &err]() {
+                std::unique_ptr<PackageVersion> e(findPackageVersion_(
+                        p->package, p->version, &err));
+                return e.get() != nullptr;
+            });
+            if (err.isEmpty() && mode != 0)
+                err = savePackageVersion(p, mode == 2);
+            if (!err.isEmpty())
+                break;
+        }
+        if (err.isEmpty())
+            sub->completeWithProgress();
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.04,
+                QObject::tr("Inserting data in the licenses table"));
+        QString err;
+        for (int i = 0; i < r->licenses.count(); i++) {
+            License* p = r->licenses.at(i);
+            int mode = getDetectedWriteMode(QStringLiteral("l:") + p->name,
+                    index, replace, writers, [this, p, &err]() {
+                std::unique_ptr<License> e(findLicense_(p->name, &err));
+                return e.get() != nullptr;
+            });
+            if (err.isEmpty() && mode != 0)
+                err = saveLicense(p, mode == 2);
+            if (!err.isEmpty())
+                break;
+        }
+        if (err.isEmpty())
+            sub->completeWithProgress();
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (savepoint) {
+        if (!job->shouldProceed())
+            exec(QStringLiteral("ROLLBACK TO DETECTED"));
+        QString err = exec(QStringLiteral("RELEASE DETECTED"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    job->complete();
+}
+
 void DBRepository::updateStatusForInstalled(Job* job)
 {
     QString initialTitle = job->getTitle();
@@ -2049,7 +3465,7 @@ QString DBRepository::readCategories()
 
     QString err;
 
-    this->categories.clear();
+    QMap<int, QString> cats;
 
     QString sql = QStringLiteral("SELECT ID, NAME FROM CATEGORY");
 
@@ -2063,12 +3479,15 @@ QString DBRepository::readCategories()
             err = SQLUtils::getErrorString(q);
         else {
             while (q.next()) {
-                categories.insert(q.value(0).toInt(),
+                cats.insert(q.value(0).toInt(),
                         q.value(1).toString());
             }
         }
     }
 
+    QMutexLocker cl(&this->categoriesMutex);
+    this->categories = cats;
+
     return err;
 }
 
@@ -2106,6 +3525,8 @@ QString DBRepository::getRepositorySHA1(const QString& url, QString* err)
 
     QString r;
 
+    *err = QString();
+
     QString sql = QStringLiteral("SELECT SHA1 FROM REPOSITORY WHERE URL=:URL");
 
     MySQLQuery q(db);
@@ -2120,7 +3541,7 @@ QString DBRepository::getRepositorySHA1(const QString& url, QString* err)
             *err = SQLUtils::getErrorString(q);
         else {
             if (q.next()) {
-                r = q.value(1).toString();
+                r = q.value(0).toString();
             }
         }
     }
@@ -2133,6 +3554,8 @@ void DBRepository::setRepositorySHA1(const QString& url, const QString& sha1,
 {
     QMutexLocker ml(&this->mutex);
 
+    *err = QString();
+
     MySQLQuery q(db);
 
     QString sql = QStringLiteral(
@@ -2207,7 +3630,8 @@ QString DBRepository::updateStatus(const QString& package)
 
     QString err;
 
-    QList<PackageVersion*> pvs = getPackageVersions_(package, &err);
+    // only the version number and the URL are necessary here
+    QList<PackageVersion*> pvs = getPackageVersionHeaders(package, &err);
     PackageVersion* newestInstallable = nullptr;
     PackageVersion* newestInstalled = nullptr;
     if (err.isEmpty()) {
@@ -2264,7 +3688,7 @@ QString DBRepository::updateStatus(const QString& package)
     return err;
 }
 
-void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
+void DBRepository::applyChangesFrom(Job* job, const QString& databaseFilename)
 {
     bool transactionStarted = false;
 
@@ -2276,20 +3700,11 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
         QString err = exec(QStringLiteral("ATTACH '") + databaseFilename +
                 QStringLiteral("' as tempdb"));
         if (err.isEmpty())
-            job->setProgress(0.10);
+            job->setProgress(0.05);
         else
             job->setErrorMessage(err);
     }
 
-    /*QString error;
-    //tempFile.setAutoRemove(false);
-    qCDebug(npackd) << "packages in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << "package versions in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE_VERSION", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << tempFile.fileName();
-    */
-
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + QStringLiteral(" / ") +
                 QObject::tr("Starting an SQL transaction"));
@@ -2297,70 +3712,169 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else {
-            job->setProgress(0.11);
+            job->setProgress(0.06);
             transactionStarted = true;
         }
     }
 
+    // small tables are simply replaced
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + QStringLiteral(" / ") +
-                QObject::tr("Clearing the database"));
-        QString err = clear();
+                QObject::tr("Transferring categories and repositories"));
+        QStringList sql;
+        sql << QStringLiteral("DELETE FROM CATEGORY") <<
+                QStringLiteral("INSERT INTO CATEGORY(ID, NAME, PARENT, LEVEL) "
+                "SELECT ID, NAME, PARENT, LEVEL FROM tempdb.CATEGORY") <<
+                QStringLiteral("DELETE FROM INSTALLED") <<
+                QStringLiteral("INSERT INTO INSTALLED(PACKAGE, VERSION, "
+                "CVERSION, WHEN_, WHERE_, DETECTION_INFO) "
+                "SELECT PACKAGE, VERSION, CVERSION, WHEN_, WHERE_, "
+                "DETECTION_INFO FROM tempdb.INSTALLED") <<
+                QStringLiteral("DELETE FROM REPOSITORY") <<
+                QStringLiteral("INSERT INTO REPOSITORY(ID, URL, SHA1) "
+                "SELECT ID, URL, SHA1 FROM tempdb.REPOSITORY") <<
+                QStringLiteral("DELETE FROM LICENSE WHERE NOT EXISTS "
+                "(SELECT 1 FROM tempdb.LICENSE t WHERE t.NAME=LICENSE.NAME "
+                "AND t.TITLE IS LICENSE.TITLE "
+                "AND t.DESCRIPTION IS LICENSE.DESCRIPTION "
+                "AND t.URL IS LICENSE.URL)") <<
+                QStringLiteral("INSERT INTO LICENSE(NAME, TITLE, DESCRIPTION, "
+                "URL) SELECT NAME, TITLE, DESCRIPTION, URL "
+                "FROM tempdb.LICENSE t WHERE NOT EXISTS "
+                "(SELECT 1 FROM LICENSE WHERE LICENSE.NAME=t.NAME)");
+        QString err;
+        for (int i = 0; i < sql.count() && err.isEmpty(); i++)
+            err = exec(sql.at(i));
         if (err.isEmpty())
-            job->setProgress(0.20);
+            job->setProgress(0.1);
         else
             job->setErrorMessage(err);
     }
 
+    // the category IDs are compared too as they are assigned in the order
+    // of appearance and may change
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + QStringLiteral(" / ") +
-                QObject::tr("Transferring the data from the temporary database"));
-
-        // exec("DROP INDEX PACKAGE_VERSION_PACKAGE_NAME");
-        QString err = exec(QStringLiteral(
-                "INSERT INTO PACKAGE(NAME, TITLE, URL, ICON, "
+                QObject::tr("Applying the changes in packages"));
+        QStringList sql;
+        sql << QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS "
+                "CHANGED_PACKAGE(NAME TEXT PRIMARY KEY)") <<
+                QStringLiteral("DELETE FROM temp.CHANGED_PACKAGE") <<
+                QStringLiteral("INSERT INTO temp.CHANGED_PACKAGE(NAME) "
+                "SELECT t.NAME FROM tempdb.PACKAGE t "
+                "LEFT JOIN main.PACKAGE m ON m.NAME=t.NAME "
+                "WHERE m.NAME IS NULL "
+                "OR m.CONTENT_HASH IS NOT t.CONTENT_HASH "
+                "OR m.REPOSITORY IS NOT t.REPOSITORY "
+                "OR m.CATEGORY0 IS NOT t.CATEGORY0 "
+                "OR m.CATEGORY1 IS NOT t.CATEGORY1 "
+                "OR m.CATEGORY2 IS NOT t.CATEGORY2 "
+                "OR m.CATEGORY3 IS NOT t.CATEGORY3 "
+                "OR m.CATEGORY4 IS NOT t.CATEGORY4") <<
+                QStringLiteral("INSERT INTO temp.CHANGED_PACKAGE(NAME) "
+                "SELECT NAME FROM main.PACKAGE m WHERE NOT EXISTS "
+                "(SELECT 1 FROM tempdb.PACKAGE t WHERE t.NAME=m.NAME)");
+
+        // PACKAGE_FTS.ROWID is the same as PACKAGE.ROWID. The entries are
+        // deleted before the packages and inserted after them.
+        if (fullTextIndex)
+            sql << QStringLiteral("DELETE FROM PACKAGE_FTS WHERE ROWID IN "
+                    "(SELECT m.ROWID FROM main.PACKAGE m "
+                    "JOIN temp.CHANGED_PACKAGE c ON c.NAME=m.NAME)");
+        sql << QStringLiteral("DELETE FROM PACKAGE WHERE NAME IN "
+                "(SELECT NAME FROM temp.CHANGED_PACKAGE)") <<
+                QStringLiteral("DELETE FROM LINK WHERE PACKAGE IN "
+                "(SELECT NAME FROM temp.CHANGED_PACKAGE)") <<
+                QStringLiteral("DELETE FROM TAG WHERE PACKAGE IN "
+                "(SELECT NAME FROM temp.CHANGED_PACKAGE)") <<
+                QStringLiteral("INSERT INTO PACKAGE(NAME, TITLE, URL, ICON, "
                 "DESCRIPTION, LICENSE, FULLTEXT, STATUS, SHORT_NAME, "
                 "REPOSITORY, CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, "
-                "CATEGORY4, TITLE_FULLTEXT, STARS) "
+                "CATEGORY4, TITLE_FULLTEXT, STARS, CONTENT_HASH) "
                 "SELECT NAME, TITLE, URL, ICON, DESCRIPTION, "
                 "LICENSE, FULLTEXT, STATUS, SHORT_NAME, REPOSITORY, "
                 "CATEGORY0, CATEGORY1, CATEGORY2, CATEGORY3, CATEGORY4, "
-                "TITLE_FULLTEXT, STARS "
-                "FROM tempdb.PACKAGE"));
-        if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO PACKAGE_VERSION(NAME, PACKAGE, URL, "
-                    "CONTENT, MSIGUID, DETECT_FILE_COUNT) SELECT NAME, "
-                    "PACKAGE, URL, CONTENT, MSIGUID, DETECT_FILE_COUNT "
-                    "FROM tempdb.PACKAGE_VERSION"));
-        if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO LICENSE(NAME, TITLE, DESCRIPTION, URL) "
-                    "SELECT NAME, TITLE, DESCRIPTION, URL FROM tempdb.LICENSE"));
-        if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO CATEGORY(ID, NAME, PARENT, LEVEL) "
-                    "SELECT ID, NAME, PARENT, LEVEL FROM tempdb.CATEGORY"));
-        if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO LINK(PACKAGE, INDEX_, REL, HREF) "
-                    "SELECT PACKAGE, INDEX_, REL, HREF FROM tempdb.LINK"));
-        if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO CMD_FILE(PACKAGE, VERSION, PATH, NAME) "
-                    "SELECT PACKAGE, VERSION, PATH, NAME FROM tempdb.CMD_FILE"));
-        if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO INSTALLED(PACKAGE, VERSION, CVERSION, "
-                    "WHEN_, WHERE_, DETECTION_INFO) "
-                    "SELECT PACKAGE, VERSION, CVERSION, WHEN_, WHERE_, "
-                    "DETECTION_INFO FROM tempdb.INSTALLED"));
+                "TITLE_FULLTEXT, STARS, CONTENT_HASH "
+                "FROM tempdb.PACKAGE WHERE NAME IN "
+                "(SELECT NAME FROM temp.CHANGED_PACKAGE)") <<
+                QStringLiteral("INSERT INTO LINK(PACKAGE, INDEX_, REL, HREF) "
+                "SELECT PACKAGE, INDEX_, REL, HREF FROM tempdb.LINK "
+                "WHERE PACKAGE IN (SELECT NAME FROM temp.CHANGED_PACKAGE)") <<
+                QStringLiteral("INSERT INTO TAG(PACKAGE, VALUE) "
+                "SELECT PACKAGE, VALUE FROM tempdb.TAG "
+                "WHERE PACKAGE IN (SELECT NAME FROM temp.CHANGED_PACKAGE)");
+        if (fullTextIndex)
+            sql << QStringLiteral("INSERT INTO PACKAGE_FTS(ROWID, NAME, TITLE, "
+                    "TEXT) SELECT m.ROWID, t.NAME, t.TITLE, t.TEXT "
+                    "FROM tempdb.PACKAGE_FTS t "
+                    "JOIN main.PACKAGE m ON m.NAME=t.NAME "
+                    "WHERE t.NAME IN (SELECT NAME FROM temp.CHANGED_PACKAGE)");
+        sql <<
+
+                // the status depends on the detected software and not only
+                // on the package content
+                QStringLiteral("UPDATE PACKAGE SET STATUS=(SELECT t.STATUS "
+                "FROM tempdb.PACKAGE t WHERE t.NAME=PACKAGE.NAME) "
+                "WHERE STATUS IS NOT (SELECT t.STATUS "
+                "FROM tempdb.PACKAGE t WHERE t.NAME=PACKAGE.NAME)");
+        QString err;
+        for (int i = 0; i < sql.count() && err.isEmpty(); i++)
+            err = exec(sql.at(i));
         if (err.isEmpty())
-            err = exec(QStringLiteral(
-                    "INSERT INTO TAG(PACKAGE, VALUE) "
-                    "SELECT PACKAGE, VALUE FROM tempdb.TAG"));
+            job->setProgress(0.4);
+        else
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + QStringLiteral(" / ") +
+                QObject::tr("Applying the changes in package versions"));
+        QStringList sql;
+        sql << QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS "
+                "CHANGED_VERSION(PACKAGE TEXT, NAME TEXT, "
+                "PRIMARY KEY(PACKAGE, NAME))") <<
+                QStringLiteral("DELETE FROM temp.CHANGED_VERSION") <<
+                QStringLiteral("INSERT INTO temp.CHANGED_VERSION(PACKAGE, NAME) "
+                "SELECT t.PACKAGE, t.NAME FROM tempdb.PACKAGE_VERSION t "
+                "LEFT JOIN main.PACKAGE_VERSION m "
+                "ON m.PACKAGE=t.PACKAGE AND m.NAME=t.NAME "
+                "WHERE m.NAME IS NULL "
+                "OR m.CONTENT IS NOT t.CONTENT "
+                "OR m.BINARY_CONTENT IS NOT t.BINARY_CONTENT "
+                "OR m.REPOSITORY IS NOT t.REPOSITORY "
+                "OR m.URL IS NOT t.URL "
+                "OR m.MSIGUID IS NOT t.MSIGUID "
+                "OR m.DETECT_FILE_COUNT IS NOT t.DETECT_FILE_COUNT") <<
+                QStringLiteral("INSERT INTO temp.CHANGED_VERSION(PACKAGE, NAME) "
+                "SELECT PACKAGE, NAME FROM main.PACKAGE_VERSION m "
+                "WHERE NOT EXISTS (SELECT 1 FROM tempdb.PACKAGE_VERSION t "
+                "WHERE t.PACKAGE=m.PACKAGE AND t.NAME=m.NAME)") <<
+                QStringLiteral("DELETE FROM PACKAGE_VERSION WHERE EXISTS "
+                "(SELECT 1 FROM temp.CHANGED_VERSION c "
+                "WHERE c.PACKAGE=PACKAGE_VERSION.PACKAGE "
+                "AND c.NAME=PACKAGE_VERSION.NAME)") <<
+                QStringLiteral("DELETE FROM CMD_FILE WHERE EXISTS "
+                "(SELECT 1 FROM temp.CHANGED_VERSION c "
+                "WHERE c.PACKAGE=CMD_FILE.PACKAGE "
+                "AND c.NAME=CMD_FILE.VERSION)") <<
+                QStringLiteral("INSERT INTO PACKAGE_VERSION(NAME, PACKAGE, "
+                "URL, CONTENT, MSIGUID, DETECT_FILE_COUNT, BINARY_CONTENT, "
+                "REPOSITORY) "
+                "SELECT t.NAME, t.PACKAGE, t.URL, t.CONTENT, t.MSIGUID, "
+                "t.DETECT_FILE_COUNT, t.BINARY_CONTENT, t.REPOSITORY "
+                "FROM tempdb.PACKAGE_VERSION t "
+                "JOIN temp.CHANGED_VERSION c "
+                "ON c.PACKAGE=t.PACKAGE AND c.NAME=t.NAME") <<
+                QStringLiteral("INSERT INTO CMD_FILE(PACKAGE, VERSION, PATH, "
+                "NAME) SELECT t.PACKAGE, t.VERSION, t.PATH, t.NAME "
+                "FROM tempdb.CMD_FILE t "
+                "JOIN temp.CHANGED_VERSION c "
+                "ON c.PACKAGE=t.PACKAGE AND c.NAME=t.VERSION");
+        QString err;
+        for (int i = 0; i < sql.count() && err.isEmpty(); i++)
+            err = exec(sql.at(i));
         if (err.isEmpty())
-            job->setProgress(0.90);
+            job->setProgress(0.9);
         else
             job->setErrorMessage(err);
     }
@@ -2378,13 +3892,11 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
             exec(QStringLiteral("ROLLBACK"));
     }
 
-    /*
-    qCDebug(npackd) << "packages in db" << count("SELECT COUNT(*) FROM PACKAGE", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << "package versions in db" << count("SELECT COUNT(*) FROM PACKAGE_VERSION", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << tempFile.fileName();
-    */
+    clearCache();
+
+    // the lists of changed rows are only necessary during the update
+    exec(QStringLiteral("DROP TABLE IF EXISTS temp.CHANGED_PACKAGE"));
+    exec(QStringLiteral("DROP TABLE IF EXISTS temp.CHANGED_VERSION"));
 
     if (job->shouldProceed()) {
         job->setTitle(initialTitle + QStringLiteral(" / ") +
@@ -2399,19 +3911,11 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
         }
 
         if (err.isEmpty())
-            job->setProgress(0.99);
+            job->setProgress(1);
         else
             job->setErrorMessage(err);
-    }
-
-    if (job->shouldProceed()) {
-        job->setTitle(initialTitle + QStringLiteral(" / ") +
-                QObject::tr("Reorganizing the database"));
-        QString err = exec(QStringLiteral("VACUUM"));
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-        else
-            job->setProgress(1);
+    } else {
+        exec(QStringLiteral("DETACH tempdb"));
     }
 
     job->setTitle(initialTitle);
@@ -2419,20 +3923,381 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
     job->complete();
 }
 
-QString DBRepository::openDefault(const QString& databaseName, bool readOnly)
+QString DBRepository::getBaseFile()
 {
     QString dir = WPMUtils::getShellDir(PackageUtils::globalMode ?
             CSIDL_COMMON_APPDATA : CSIDL_APPDATA) +
             QStringLiteral("\\Npackd");
+
+    return QDir::toNativeSeparators(dir + QStringLiteral("\\Data.db"));
+}
+
+QString DBRepository::getDefaultFile()
+{
+    return getCurrentFile(getBaseFile());
+}
+
+QString DBRepository::getCurrentFile(const QString& baseFile)
+{
+    QString r = baseFile;
+
+    QFile f(baseFile + QStringLiteral(".current"));
+    if (f.open(QIODevice::ReadOnly)) {
+        QString name = QString::fromUtf8(f.readAll()).trimmed();
+        f.close();
+
+        // only file names in the same directory are accepted
+        if (!name.isEmpty() && !name.contains('\\') && !name.contains('/')) {
+            QString file = QFileInfo(baseFile).absolutePath() +
+                    QStringLiteral("/") + name;
+            if (QFileInfo::exists(file))
+                r = QDir::toNativeSeparators(file);
+        }
+    }
+
+    return r;
+}
+
+QString DBRepository::createGenerationFile(const QString& baseFile)
+{
+    QFileInfo fi(baseFile);
+    QString prefix = fi.absolutePath() + QStringLiteral("/") +
+            fi.completeBaseName() + QStringLiteral(".");
+
+    // the time makes the names unique and sortable
+    qint64 gen = QDateTime::currentMSecsSinceEpoch();
+    QString r;
+    while (true) {
+        r = prefix + QString::number(gen) + QStringLiteral(".db");
+        if (!QFileInfo::exists(r) &&
+                !QFileInfo::exists(r + QStringLiteral(".part")))
+            break;
+        gen++;
+    }
+
+    return QDir::toNativeSeparators(r + QStringLiteral(".part"));
+}
+
+QString DBRepository::publish(const QString& baseFile, const QString& file)
+{
+    QString err;
+
+    QString target = file;
+    if (target.endsWith(QStringLiteral(".part")))
+        target.chop(5);
+
+    if (QFileInfo(target).absolutePath() !=
+            QFileInfo(baseFile).absolutePath())
+        err = QString(QObject::tr(
+                "The new database %1 is not in the directory of %2")).
+                arg(file, baseFile);
+
+    // renaming a closed file in the same directory does not copy the data
+    if (err.isEmpty() && target != file && !QFile::rename(file, target))
+        err = QString(QObject::tr("Cannot rename %1 to %2")).
+                arg(file, target);
+
+    // the readers see either the old or the new file name
+    if (err.isEmpty()) {
+        QSaveFile f(baseFile + QStringLiteral(".current"));
+        if (!f.open(QIODevice::WriteOnly) ||
+                f.write(QFileInfo(target).fileName().toUtf8()) < 0 ||
+                !f.commit())
+            err = f.errorString();
+    }
+
+    if (err.isEmpty())
+        removeOldGenerations(baseFile);
+
+    return err;
+}
+
+/**
+ * @brief deletes a file only if no process has it open. SQLite and the
+ *     memory-mapped snapshots do not allow deleting the files while they are
+ *     open.
+ * @param path a file
+ */
+static void removeUnusedFile(const QString& path)
+{
+    // nobody can open the file after this call until it is deleted
+    HANDLE h = CreateFileW(WPMUtils::toLPWSTR(QDir::toNativeSeparators(path)),
+            DELETE, 0, nullptr, OPEN_EXISTING, FILE_FLAG_DELETE_ON_CLOSE,
+            nullptr);
+    if (h != INVALID_HANDLE_VALUE)
+        CloseHandle(h);
+}
+
+void DBRepository::removeOldGenerations(const QString& baseFile)
+{
+    QFileInfo base(baseFile);
+    QString current = QFileInfo(getCurrentFile(baseFile)).fileName();
+    QString prefix = base.completeBaseName() + QStringLiteral(".");
+
+    QDir d(base.absolutePath());
+    QStringList files = d.entryList(QStringList() <<
+            prefix + QStringLiteral("*"), QDir::Files);
+
+    // the files created by SQLite and the snapshot are deleted after the
+    // database. Data.db is used by older versions and is never deleted.
+    QStringList suffixes;
+    suffixes << QStringLiteral(".snapshot") << QStringLiteral("-journal") <<
+            QStringLiteral("-wal") << QStringLiteral("-shm");
+    QDateTime old = QDateTime::currentDateTimeUtc().addDays(-1);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < files.size(); i++) {
+            const QString& name = files.at(i);
+            QString path = d.absoluteFilePath(name);
+
+            if (name.startsWith(base.fileName(), Qt::CaseInsensitive))
+                continue;
+
+            bool isDatabase = name.endsWith(QStringLiteral(".db"));
+            if (pass == 0 && isDatabase) {
+                if (name.compare(current, Qt::CaseInsensitive) != 0)
+                    removeUnusedFile(path);
+            } else if (pass == 0 && name.endsWith(QStringLiteral(".part"))) {
+                // left over from a process that was terminated
+                if (QFileInfo(path).lastModified().toUTC() < old)
+                    removeUnusedFile(path);
+            } else if (pass == 1) {
+                for (int j = 0; j < suffixes.size(); j++) {
+                    const QString& suffix = suffixes.at(j);
+                    if (name.endsWith(suffix)) {
+                        QString db = path.left(path.length() - suffix.length());
+                        if (db.endsWith(QStringLiteral(".db")) &&
+                                !QFileInfo::exists(db))
+                            removeUnusedFile(path);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+QString DBRepository::openDefault(const QString& databaseName, bool readOnly)
+{
+    QString path = getDefaultFile();
+
     QDir d;
+    QString dir = QFileInfo(path).absolutePath();
     if (!d.exists(dir))
         d.mkpath(dir);
 
-    QString path = dir + QStringLiteral("\\Data.db");
+    QString err = open(databaseName, path, readOnly);
+
+    // another process may have published a new generation and deleted this
+    // one while it was being opened
+    for (int i = 0; i < 10; i++) {
+        QString current = getDefaultFile();
+        if (current == path)
+            break;
 
-    path = QDir::toNativeSeparators(path);
+        close();
+        path = current;
+        err = open(databaseName, path, readOnly);
+    }
 
-    QString err = open(databaseName, path, readOnly);
+    return err;
+}
+
+QString DBRepository::reopenDefault()
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    QString current = getDefaultFile();
+    if (db.isOpen() && !snapshot &&
+            QFileInfo(db.databaseName()) != QFileInfo(current)) {
+        QString connectionName = db.connectionName();
+        bool readOnly = db.connectOptions().contains(
+                QStringLiteral("QSQLITE_OPEN_READONLY"));
+        close();
+        err = openDefault(connectionName, readOnly);
+        if (err.isEmpty())
+            clearCache();
+    }
+
+    return err;
+}
+
+bool DBRepository::isNewGenerationPublished()
+{
+    QMutexLocker ml(&this->mutex);
+
+    return db.isOpen() && !snapshot &&
+            QFileInfo(db.databaseName()) != QFileInfo(getDefaultFile());
+}
+
+void DBRepository::close()
+{
+    QMutexLocker ml(&this->mutex);
+
+    readPoolMutex.lock();
+    readPoolFile.clear();
+    readPoolMutex.unlock();
+    removeReadConnection();
+
+    // closing the connection rolls back an unfinished transaction
+    cacheMutex.lock();
+    transactionDepth = 0;
+    transactionThread = nullptr;
+    invalidateReads();
+    cacheMutex.unlock();
+
+    deleteQueries();
+    db.close();
+}
+
+void DBRepository::deleteQueries()
+{
+    delete insertInstalledQuery;
+    insertInstalledQuery = nullptr;
+    delete selectCategoryQuery;
+    selectCategoryQuery = nullptr;
+    delete deleteLinkQuery;
+    deleteLinkQuery = nullptr;
+    delete insertLinkQuery;
+    insertLinkQuery = nullptr;
+    delete insertPackageQuery;
+    insertPackageQuery = nullptr;
+    delete replacePackageQuery;
+    replacePackageQuery = nullptr;
+    delete replacePackageVersionQuery;
+    replacePackageVersionQuery = nullptr;
+    delete insertPackageVersionQuery;
+    insertPackageVersionQuery = nullptr;
+    insertCmdFileQuery.reset();
+    insertTagQuery.reset();
+    deleteTagQuery.reset();
+    deleteCmdFilesQuery.reset();
+    selectPackageRowidQuery.reset();
+    deleteSearchEntryQuery.reset();
+    insertSearchEntryQuery.reset();
+}
+
+QString DBRepository::openDefaultSnapshot(bool readOnly)
+{
+    QString path = getDefaultFile();
+
+    std::unique_ptr<DBSnapshot> s(new DBSnapshot());
+    QString err = s->open(DBSnapshot::getFile(path), path);
+    if (err.isEmpty()) {
+        QMutexLocker ml(&this->mutex);
+        snapshot = std::move(s);
+    } else {
+        qCDebug(npackd) << err;
+        err = openDefault(QStringLiteral("default"), readOnly);
+    }
+
+    return err;
+}
+
+QString DBRepository::updateSnapshot()
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    QString dbFile = db.databaseName();
+    QString file = DBSnapshot::getFile(dbFile);
+    if (!db.isOpen() || snapshot ||
+            db.connectOptions().contains(
+            QStringLiteral("QSQLITE_OPEN_READONLY")))
+        return err;
+
+    // the committed changes are moved from the write-ahead log to the
+    // database. The empty log is deleted when the database is closed and
+    // the snapshot stays valid.
+    MySQLQuery q(db);
+    if (!q.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)")))
+        qCDebug(npackd) << "cannot checkpoint the database" <<
+                SQLUtils::getErrorString(q);
+
+    if (DBSnapshot::isUpToDate(file, dbFile))
+        return err;
+
+    // the stamp is read first and all tables are read in one transaction.
+    // A commit from another process either happens before the reading
+    // starts or changes the stamp so that the snapshot is not up-to-date.
+    DBSnapshot s;
+    s.readDatabaseStamp(dbFile);
+
+    err = exec(QStringLiteral("BEGIN TRANSACTION"));
+    bool transactionStarted = err.isEmpty();
+
+    if (err.isEmpty() &&
+            !q.prepare(QStringLiteral("SELECT NAME FROM PACKAGE")))
+        err = SQLUtils::getErrorString(q);
+    if (err.isEmpty() && !q.exec())
+        err = SQLUtils::getErrorString(q);
+    while (err.isEmpty() && q.next()) {
+        Package* p = findPackage_(q.value(0).toString());
+        if (p)
+            s.addPackage(p);
+        delete p;
+    }
+
+    // the binary content is missing for the rows written by older program
+    // versions
+    if (err.isEmpty()) {
+        if (!q.prepare(QStringLiteral(
+                "SELECT PACKAGE, IFNULL(BINARY_CONTENT, CONTENT) "
+                "FROM PACKAGE_VERSION")))
+            err = SQLUtils::getErrorString(q);
+    }
+    if (err.isEmpty() && !q.exec())
+        err = SQLUtils::getErrorString(q);
+    while (err.isEmpty() && q.next()) {
+        QByteArray content = q.value(1).toByteArray();
+        if (!PackageVersion::isBinary(content)) {
+            std::unique_ptr<PackageVersion> pv(
+                    PackageVersion::parse(content, &err, false));
+            if (pv)
+                content = pv->toBinary();
+        }
+        if (err.isEmpty())
+            s.add(DBSnapshot::PACKAGE_VERSION, q.value(0).toString(),
+                    content);
+    }
+
+    if (err.isEmpty()) {
+        if (!q.prepare(QStringLiteral(
+                "SELECT NAME, PACKAGE, VERSION FROM CMD_FILE")))
+            err = SQLUtils::getErrorString(q);
+    }
+    if (err.isEmpty() && !q.exec())
+        err = SQLUtils::getErrorString(q);
+    while (err.isEmpty() && q.next()) {
+        s.add(DBSnapshot::CMD_FILE, q.value(0).toString(),
+                q.value(1).toString().toUtf8() + '\0' +
+                q.value(2).toString().toUtf8());
+    }
+
+    if (err.isEmpty()) {
+        if (!q.prepare(QStringLiteral(
+                "SELECT NAME, TITLE, DESCRIPTION, URL FROM LICENSE")))
+            err = SQLUtils::getErrorString(q);
+    }
+    if (err.isEmpty() && !q.exec())
+        err = SQLUtils::getErrorString(q);
+    while (err.isEmpty() && q.next()) {
+        License lic(q.value(0).toString(), q.value(1).toString());
+        lic.description = q.value(2).toString();
+        lic.url = q.value(3).toString();
+        s.addLicense(&lic);
+    }
+    q.finish();
+
+    if (err.isEmpty())
+        err = exec(QStringLiteral("COMMIT"));
+    else if (transactionStarted)
+        exec(QStringLiteral("ROLLBACK"));
+
+    if (err.isEmpty())
+        err = s.save(file);
 
     return err;
 }
@@ -2487,7 +4352,8 @@ QString DBRepository::updateDatabase()
                     "CATEGORY3 INTEGER, "
                     "CATEGORY4 INTEGER, "
                     "TITLE_FULLTEXT TEXT, "
-                    "STARS INTEGER"
+                    "STARS INTEGER, "
+                    "CONTENT_HASH BLOB"
                     ")"));
             err = toString(db.lastError());
         }
@@ -2506,6 +4372,54 @@ QString DBRepository::updateDatabase()
             err = toString(db.lastError());
         }
     }
+    if (err.isEmpty()) {
+        if (e) {
+            // PACKAGE.CONTENT_HASH is new in 1.27. Packages without a hash
+            // are always considered changed by applyChangesFrom().
+            if (!SQLUtils::columnExists(&db, "PACKAGE",
+                    "CONTENT_HASH", &err) && err.isEmpty()) {
+                db.exec(QStringLiteral(
+                        "ALTER TABLE PACKAGE ADD COLUMN CONTENT_HASH BLOB"));
+                err = toString(db.lastError());
+            }
+        }
+    }
+
+    // PACKAGE_FTS is new in 1.27. The full text index is optional as the
+    // SQLite library may be compiled without FTS5 or may not support the
+    // trigram tokenizer (SQLite 3.34).
+    bool packageCreated = !e;
+    bool ftsExists = false;
+    if (err.isEmpty()) {
+        ftsExists = SQLUtils::tableExists(&db, QStringLiteral("PACKAGE_FTS"),
+                &err);
+    }
+    bool trigram = false;
+    if (err.isEmpty() && ftsExists)
+        trigram = isTrigramSearchIndex(&err);
+    if (err.isEmpty()) {
+        if (ftsExists && (packageCreated || !trigram)) {
+            db.exec(QStringLiteral("DROP TABLE PACKAGE_FTS"));
+            err = toString(db.lastError());
+            ftsExists = false;
+        }
+    }
+    if (err.isEmpty()) {
+        if (!ftsExists) {
+            db.exec(QStringLiteral("CREATE VIRTUAL TABLE PACKAGE_FTS "
+                    "USING fts5(NAME UNINDEXED, TITLE, TEXT, "
+                    "tokenize='trigram')"));
+            QString ftsErr = toString(db.lastError());
+            if (!ftsErr.isEmpty())
+                qCDebug(npackd) << "full text index is not available:" <<
+                        ftsErr;
+            else
+                ftsExists = true;
+            fullTextIndex = ftsExists;
+            if (ftsExists)
+                err = updateSearchIndex();
+        }
+    }
 
     // REPOSITORY
     if (err.isEmpty()) {
@@ -2566,7 +4480,8 @@ QString DBRepository::updateDatabase()
             db.exec(QStringLiteral(
                     "CREATE TABLE PACKAGE_VERSION(NAME TEXT, "
                     "PACKAGE TEXT, URL TEXT, "
-                    "CONTENT BLOB, MSIGUID TEXT, DETECT_FILE_COUNT INTEGER)"));
+                    "CONTENT BLOB, MSIGUID TEXT, DETECT_FILE_COUNT INTEGER, "
+                    "BINARY_CONTENT BLOB, REPOSITORY INTEGER)"));
             err = toString(db.lastError());
         }
     }
@@ -2606,6 +4521,32 @@ QString DBRepository::updateDatabase()
         }
     }
 
+    // PACKAGE_VERSION.BINARY_CONTENT is new in 1.27. PACKAGE_VERSION.CONTENT
+    // always contains XML as older program versions use the same database.
+    if (err.isEmpty()) {
+        if (e) {
+            bool ce = SQLUtils::columnExists(&db,
+                    QStringLiteral("PACKAGE_VERSION"),
+                    QStringLiteral("BINARY_CONTENT"), &err);
+            if (err.isEmpty() && !ce)
+                err = convertPackageVersionsToBinary();
+        }
+    }
+
+    // PACKAGE_VERSION.REPOSITORY is new in 1.27. Rows without a repository
+    // cause a full rebuild of the database during the next refresh (see
+    // isUpToDate()).
+    if (err.isEmpty()) {
+        if (e) {
+            bool ce = SQLUtils::columnExists(&db,
+                    QStringLiteral("PACKAGE_VERSION"),
+                    QStringLiteral("REPOSITORY"), &err);
+            if (err.isEmpty() && !ce)
+                err = exec(QStringLiteral("ALTER TABLE PACKAGE_VERSION "
+                        "ADD COLUMN REPOSITORY INTEGER"));
+        }
+    }
+
     if (err.isEmpty()) {
         e = SQLUtils::tableExists(&db, QStringLiteral("LICENSE"), &err);
     }
@@ -2726,11 +4667,92 @@ QString DBRepository::updateDatabase()
     return err;
 }
 
+QString DBRepository::convertPackageVersionsToBinary()
+{
+    QString err = exec(QStringLiteral("BEGIN TRANSACTION"));
+
+    if (err.isEmpty())
+        err = exec(QStringLiteral(
+                "ALTER TABLE PACKAGE_VERSION ADD COLUMN BINARY_CONTENT BLOB"));
+
+    MySQLQuery select(db);
+    if (err.isEmpty() && !select.prepare(QStringLiteral(
+            "SELECT ROWID, CONTENT FROM PACKAGE_VERSION "
+            "WHERE ROWID > :ROWID ORDER BY ROWID LIMIT 500")))
+        err = SQLUtils::getErrorString(select);
+
+    MySQLQuery update(db);
+    if (err.isEmpty() && !update.prepare(QStringLiteral(
+            "UPDATE PACKAGE_VERSION SET BINARY_CONTENT = :BINARY_CONTENT "
+            "WHERE ROWID = :ROWID")))
+        err = SQLUtils::getErrorString(update);
+
+    // the rows are read in blocks so that the table is not modified while
+    // it is being scanned
+    qlonglong last = -1;
+    int converted = 0;
+    while (err.isEmpty()) {
+        select.bindValue(QStringLiteral(":ROWID"), last);
+        if (!select.exec()) {
+            err = SQLUtils::getErrorString(select);
+            break;
+        }
+
+        QList<QPair<qlonglong, QByteArray> > block;
+        while (select.next()) {
+            block.append(qMakePair(select.value(0).toLongLong(),
+                    select.value(1).toByteArray()));
+        }
+        select.finish();
+
+        if (block.isEmpty())
+            break;
+
+        for (int i = 0; i < block.size(); i++) {
+            QByteArray& content = block[i].second;
+            last = block.at(i).first;
+
+            // rows that cannot be parsed are only available as XML and will
+            // be replaced during the next repository update
+            QString parseErr;
+            std::unique_ptr<PackageVersion> pv(PackageVersion::parse(content,
+                    &parseErr, false));
+            if (!pv)
+                continue;
+
+            update.bindValue(QStringLiteral(":BINARY_CONTENT"),
+                    QVariant(pv->toBinary()));
+            update.bindValue(QStringLiteral(":ROWID"), last);
+            if (!update.exec()) {
+                err = SQLUtils::getErrorString(update);
+                break;
+            }
+            converted++;
+        }
+        update.finish();
+    }
+
+    if (err.isEmpty()) {
+        err = exec(QStringLiteral("COMMIT"));
+        qCDebug(npackd) << "converted" << converted <<
+                "package versions to the binary format";
+    } else {
+        exec(QStringLiteral("ROLLBACK"));
+    }
+
+    return err;
+}
+
 QString DBRepository::open(const QString& connectionName, const QString& file,
-        bool readOnly)
+        bool readOnly, bool wal)
 {
     QString err;
 
+    readPoolMutex.lock();
+    readPoolFile.clear();
+    readPoolMutex.unlock();
+    removeReadConnection();
+
     // if we cannot write the file, we still try to open in read-only mode.
     // Opening a not writable file in r/w mode is slow.
     if (!readOnly) {
@@ -2762,9 +4784,23 @@ QString DBRepository::open(const QString& connectionName, const QString& file,
     if (err.isEmpty())
         err = exec(QStringLiteral("PRAGMA busy_timeout = 30000"));
 
+    // in the WAL mode the readers do not wait for the writer and see the
+    // last committed state of the database. The default database is
+    // shared with read-only connections and stays in the DELETE mode.
+    // The mode cannot be changed while another process uses the database.
+    if (err.isEmpty() && !readOnly) {
+        QString e = exec(wal ? QStringLiteral("PRAGMA journal_mode = WAL") :
+                QStringLiteral("PRAGMA journal_mode = DELETE"));
+        if (!e.isEmpty())
+            qCDebug(npackd) << "cannot change the journal mode" << e;
+    }
+
+    wal = false;
     if (err.isEmpty()) {
-        if (!readOnly)
-            err = exec(QStringLiteral("PRAGMA journal_mode = DELETE"));
+        MySQLQuery q(db);
+        if (q.exec(QStringLiteral("PRAGMA journal_mode")) && q.next())
+            wal = q.value(0).toString().compare(QStringLiteral("wal"),
+                    Qt::CaseInsensitive) == 0;
     }
 
     if (err.isEmpty()) {
@@ -2776,14 +4812,24 @@ QString DBRepository::open(const QString& connectionName, const QString& file,
             err = updateDatabase();
     }
 
+    // an index without the trigram tokenizer only finds word prefixes and
+    // is only replaced by updateDatabase()
+    if (err.isEmpty()) {
+        fullTextIndex = SQLUtils::tableExists(&db,
+                QStringLiteral("PACKAGE_FTS"), &err);
+    }
+    if (err.isEmpty() && fullTextIndex)
+        fullTextIndex = isTrigramSearchIndex(&err);
+
     if (err.isEmpty()) {
         err = readCategories();
     }
 
-    return err;
-}
+    if (err.isEmpty() && wal) {
+        QMutexLocker pl(&readPoolMutex);
+        readPoolFile = file;
+        readPoolEpoch = nextReadPoolEpoch++;
+    }
 
-DBRepository::PackageVersionList::~PackageVersionList()
-{
-    qDeleteAll(data);
+    return err;
 }
@@ -2,17 +2,22 @@
 #define DBREPOSITORY_H
 
 #include <memory>
+#include <atomic>
 
 #include <QString>
 #include <QSqlError>
 #include <QSqlDatabase>
 #include <QSharedPointer>
 #include <QMap>
+#include <QHash>
 #include <QWeakPointer>
 #include <QMultiMap>
 #include <QCache>
 #include <QList>
 #include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
+#include <QTemporaryFile>
 
 #include "package.h"
 #include "repository.h"
@@ -21,6 +26,77 @@
 #include "abstractrepository.h"
 #include "mysqlquery.h"
 #include "installedpackageversion.h"
+#include "dbsnapshot.h"
+#include "titleindex.h"
+#include "objectcache.h"
+
+/**
+ * @brief receives the objects parsed by RepositoryXMLHandler on a parser
+ *     thread and passes them in batches to the thread that writes them to the
+ *     database. The parser thread blocks if MAX_QUEUED batches are waiting.
+ *     The "replace" parameter is ignored: the objects are always inserted
+ *     only if they do not exist yet.
+ */
+class RepositoryBatchQueue: public Repository
+{
+private:
+    /** number of objects in one batch */
+    static const int BATCH_SIZE = 500;
+
+    /** maximum number of batches waiting for the writer */
+    static const int MAX_QUEUED = 4;
+
+    QMutex mutex;
+
+    QWaitCondition changed;
+
+    QQueue<Repository*> queue;
+
+    /** batch that is currently being filled or 0 */
+    Repository* current = nullptr;
+
+    /** number of objects in "current" */
+    int currentSize = 0;
+
+    bool finished = false;
+
+    bool cancelled = false;
+
+    /**
+     * @brief moves the current batch to the queue if it is full. The mutex
+     *     must be locked.
+     * @param force true = move the current batch even if it is not full
+     * @return error message
+     */
+    QString flush(bool force);
+public:
+    virtual ~RepositoryBatchQueue();
+
+    QString savePackage(Package* p, bool replace) override;
+
+    QString savePackageVersion(PackageVersion* p, bool replace) override;
+
+    QString saveLicense(License* p, bool replace) override;
+
+    /**
+     * @brief should be called by the parser at the end. The last incomplete
+     *     batch will be queued.
+     */
+    void finish();
+
+    /**
+     * @brief discards all queued batches. All further calls to save*() will
+     *     fail.
+     */
+    void cancel();
+
+    /**
+     * @brief waits for the next batch
+     * @return [move] next batch or 0 if the parser has finished or the queue
+     *     was cancelled
+     */
+    Repository* take();
+};
 
 /**
  * @brief A repository stored in an SQLite database.
@@ -28,22 +104,93 @@
 class DBRepository: public AbstractRepository
 {
 private:
+    /** all versions of a package sorted by packageVersionLessThan3 */
     class PackageVersionList {
     public:
-        QList<PackageVersion*> data;
+        QList<std::shared_ptr<const PackageVersion> > data;
+    };
+
+    /**
+     * @brief connection for reading chosen by beginRead()
+     */
+    class ReadConnection {
+    public:
+        /** the connection */
+        QSqlDatabase db;
+
+        /**
+         * true = "db" is a connection from the read pool and the
+         * results can only be cached if canCache() returns true
+         */
+        bool pooled = false;
 
-        virtual ~PackageVersionList();
+        /** the locked mutex if "db" is the main connection */
+        std::unique_ptr<QMutexLocker> locker;
+
+        /** value of cacheVersion before the read access */
+        quint64 cacheVersion = 0;
     };
 
     static DBRepository def;
 
     static QString toString(const QSqlError& e);
 
+    /**
+     * protects the main connection "db". The mutex is not needed for
+     * reading from the read pool (see beginRead()).
+     */
     mutable QMutex mutex;
 
+    /** protects "categories" */
+    mutable QMutex categoriesMutex;
+
+    /** protects readPoolFile and readPoolEpoch */
+    mutable QMutex readPoolMutex;
+
+    /**
+     * the database file for the read pool or "" if the pool is not used.
+     * The pool is only used for databases in the WAL mode where readers do
+     * not wait for the writer (see open()).
+     */
+    QString readPoolFile;
+
+    /**
+     * unique number of the last open(). The connections of the read pool
+     * for older numbers are not used anymore.
+     */
+    quint64 readPoolEpoch;
+
+    /**
+     * protects the comparison of cacheVersion and the following update of
+     * the caches by pooled readers
+     */
+    mutable QMutex cacheMutex;
+
+    /**
+     * incremented under cacheMutex each time a change is made that could make
+     * an object read by a pooled reader outdated
+     */
+    std::atomic<quint64> cacheVersion;
+
+    /**
+     * the thread that started a transaction or a savepoint using exec() or
+     * nullptr. This thread has to read from the main connection to see its
+     * own changes.
+     */
+    std::atomic<Qt::HANDLE> transactionThread;
+
+    /**
+     * number of transactions and savepoints started using exec() that are
+     * not yet finished. Access only while "mutex" is locked.
+     */
+    int transactionDepth;
+
     QCache<QString, License> licenses;
-    mutable QCache<QString, PackageVersionList> packageVersions;
-    mutable QCache<QString, Package> packages;
+    /** full package name -> all versions of the package */
+    mutable ObjectCache<PackageVersionList> packageVersions;
+
+    /** full package name -> package */
+    mutable ObjectCache<Package> packages;
 
     QMap<int, QString> categories;
 
@@ -59,9 +206,33 @@ private:
     std::unique_ptr<MySQLQuery> deleteTagQuery;
     std::unique_ptr<MySQLQuery> deleteCmdFilesQuery;
     MySQLQuery* insertInstalledQuery;
+    std::unique_ptr<MySQLQuery> selectPackageRowidQuery;
+    std::unique_ptr<MySQLQuery> deleteSearchEntryQuery;
+    std::unique_ptr<MySQLQuery> insertSearchEntryQuery;
 
     QStringList stopWords;
 
+    /** true = the table PACKAGE_FTS (SQLite FTS5) is available */
+    bool fullTextIndex;
+
+    /** true = PACKAGE_FTS will be used for searching */
+    bool useFullTextIndex;
+
+    /**
+     * if not null, the lookups for packages, package versions and licenses
+     * are done using the snapshot instead of SQLite
+     */
+    std::unique_ptr<DBSnapshot> snapshot;
+
+    /** true = findBetterPackages() uses "titleIndex" */
+    bool useTitleIndex;
+
+    /**
+     * index for findBetterPackages() or nullptr if it was not yet created or
+     * the packages were changed
+     */
+    std::unique_ptr<TitleIndex> titleIndex;
+
     QSqlDatabase db;
 
     QString readCategories();
@@ -107,11 +278,32 @@ private:
      */
     QString saveLicenses(Repository* r, bool replace);
 
+    /**
+     * @brief executes an SQL statement on the main connection. Transactions
+     *     have to be started and finished here ("BEGIN", "SAVEPOINT",
+     *     "RELEASE", "COMMIT", "END", "ROLLBACK") and not using
+     *     QSqlDatabase::transaction() so that the current thread reads its own
+     *     changes (see beginRead()).
+     * @param sql SQL statement
+     * @return error message
+     */
     QString exec(const QString& sql);
 
     /**
-     * Loads the content from the URLs. None of the packages has the information
-     * about installation path after this method was called.
+     * @brief deletes the prepared queries so that the database can be closed
+     */
+    void deleteQueries();
+
+    /**
+     * @brief deletes the files of the older generations of a database (see
+     *     publish()). Files that are still used are deleted next time.
+     * @param baseFile base database file
+     */
+    static void removeOldGenerations(const QString& baseFile);
+
+    /**
+     * @brief downloads the repositories. This function can be called from any
+     *     thread.
      *
      * @param job job for this method
      * @param repositories URLs for the repositories
@@ -119,39 +311,231 @@ private:
      * @param interactive true = allow the interaction with the user
      * @param user user name for the HTTP authentication or ""
      * @param password password for the HTTP authentication or ""
-     * @param user user name for the HTTP proxy authentication or ""
-     * @param password password for the HTTP proxy authentication or ""
+     * @param proxyUser user name for the HTTP proxy authentication or ""
+     * @param proxyPassword password for the HTTP proxy authentication or ""
+     * @param sha1s SHA-1 for each downloaded file will be stored here
+     * @return [move] downloaded files in the same order as the repositories.
+     *     An entry may be nullptr if the download failed.
      */
-    void load(Job *job, const QList<QUrl *>& repositories, bool useCache, bool interactive, const QString& user,
-            const QString& password,
-            const QString& proxyUser, const QString& proxyPassword);
+    static QList<QTemporaryFile*> downloadRepositories(Job *job,
+            const QList<QUrl *>& repositories, bool useCache,
+            bool interactive, const QString& user, const QString& password,
+            const QString& proxyUser, const QString& proxyPassword,
+            QStringList* sha1s);
+
+    /**
+     * Loads the content from the downloaded files. None of the packages has
+     * the information about installation path after this method was called.
+     *
+     * @param job job for this method
+     * @param repositories URLs for the repositories
+     * @param files downloaded repositories (see downloadRepositories())
+     * @param sha1s SHA-1 for each file. These values are stored in the
+     *     REPOSITORY table.
+     */
+    void load(Job *job, const QList<QUrl *>& repositories,
+            const QList<QTemporaryFile *>& files, const QStringList& sha1s);
 
     /**
-     * @brief loadOne
-     * @param job
-     * @param f
+     * @brief clears the database and fills it from the downloaded
+     *     repositories. The installed software is detected afterwards.
+     * @param job job
+     * @param repositories URLs for the repositories
+     * @param files downloaded repositories (see downloadRepositories())
+     * @param sha1s SHA-1 for each file
+     * @param detect true = detect software
+     */
+    void clearAndLoad(Job *job, const QList<QUrl *>& repositories,
+            const QList<QTemporaryFile *>& files, const QStringList& sha1s,
+            bool detect);
+
+    /**
+     * @brief detects the installed software and updates the INSTALLED table
+     *     and PACKAGE.STATUS. Should be called in a transaction.
+     * @param job job
+     * @param detect true = detect software, false = only read the registry
+     */
+    void updateInstallationStatus(Job *job, bool detect);
+
+    /**
+     * @brief checks whether the list of repositories and their content is the
+     *     same as in the last refresh
+     * @param repositories URLs for the repositories
+     * @param sha1s SHA-1 for the downloaded repositories
+     * @param err error message will be stored here
+     * @return true = nothing has changed
+     */
+    bool isUpToDate(const QList<QUrl *>& repositories,
+            const QStringList& sha1s, QString* err);
+
+    /**
+     * @brief parses one repository. This function can be called from any
+     *     thread.
+     * @param job job
+     * @param f repository file (XML or ZIP)
      * @param url URL of the repository. This value will be used for resolving
      *     relative URLs.
+     * @param rep the parsed objects will be stored here
+     * @param queue the same object as rep. It will be marked as finished at
+     *     the end.
      */
-    void loadOne(Job *job, QFile *f, const QUrl &url);
+    static void loadOne(Job *job, QFile *f, const QUrl &url,
+            AbstractRepository *rep, RepositoryBatchQueue *queue);
 
     int count(const QString &sql, QString *err);
     QString getRepositorySHA1(const QString &url, QString *err);
     void setRepositorySHA1(const QString &url, const QString &sha1, QString *err);
     QString clearRepository(int id);
     QString saveLinks(Package *p);
-    QString readLinks(Package *p) const;
+    QString readLinks(const QSqlDatabase& d, Package *p) const;
     QString deleteLinks(const QString &name);
     QString updateDatabase();
-    void transferFrom(Job *job, const QString &databaseFilename);
+
+    /**
+     * @brief adds the column PACKAGE_VERSION.BINARY_CONTENT and fills it
+     *     with the binary format (see PackageVersion::toBinary()) of the XML
+     *     in PACKAGE_VERSION.CONTENT. The XML is not changed.
+     * @return error message
+     */
+    QString convertPackageVersionsToBinary();
+
+    /**
+     * @brief returns all versions of a package with only the header
+     *     information decoded (see PackageVersion::parseBinary())
+     * @param package full package name
+     * @param err error message will be stored here
+     * @return [move] list of package versions
+     */
+    QList<PackageVersion*> getPackageVersionHeaders(const QString& package,
+            QString *err) const;
+    /**
+     * @brief applies only the differences between this database and another
+     *     one. Packages are compared using PACKAGE.CONTENT_HASH and package
+     *     versions using PACKAGE_VERSION.CONTENT.
+     * @param job job
+     * @param databaseFilename the other database
+     */
+    void applyChangesFrom(Job *job, const QString &databaseFilename);
+
+    /**
+     * @brief computes the value for PACKAGE.CONTENT_HASH
+     * @param p a package
+     * @return SHA-1 over all fields stored for a package
+     */
+    static QByteArray computeContentHash(const Package* p);
     QString deleteCmdFiles(const QString &name, const Version &version);
     QStringList tokenizeTitle(const QString &title);
     QString deleteTags(const QString &name);
     QString saveTags(Package *p);
-    QString readTags(Package *p) const;
+
+    /**
+     * @param name full package name
+     * @param err error message will be stored here
+     * @return ROWID of the package or -1 if it does not exist
+     */
+    qint64 findPackageRowid(const QString& name, QString* err);
+
+    /**
+     * @brief replaces the entry for a package in the full text index. The
+     *     entries in PACKAGE_FTS have the same ROWID as the packages.
+     * @param name full package name
+     * @param oldRowid ROWID of the replaced package or -1
+     * @param rowid ROWID of the saved package
+     * @param title lower case PACKAGE.TITLE. This is always a part of
+     *     PACKAGE.FULLTEXT.
+     * @param text PACKAGE.FULLTEXT
+     * @return error message
+     */
+    QString saveSearchEntry(const QString& name, qint64 oldRowid,
+            qint64 rowid, const QString& title, const QString& text);
+    QString readTags(const QSqlDatabase& d, Package *p) const;
+
+    /**
+     * @brief chooses the connection for reading. Each thread reads using its
+     *     own read-only connection from the read pool. The pooled
+     *     connections see the last committed state of the database and do
+     *     not wait for the mutex or the writer. The main connection "db" and
+     *     the mutex are used if the pool is not available (e.g. not in the
+     *     WAL mode, snapshot) or if the current thread has started a
+     *     transaction.
+     * @param rc the connection will be stored here
+     */
+    void beginRead(ReadConnection* rc) const;
+
+    /**
+     * @param rc connection from beginRead()
+     * @return true if the objects read using the connection can be stored in
+     *     the caches. cacheMutex must be locked.
+     */
+    bool canCache(const ReadConnection& rc) const;
+
+    /**
+     * @brief marks the cached objects as possibly outdated for the pooled
+     *     readers. cacheMutex must be locked.
+     */
+    void invalidateReads();
+
+    /**
+     * @brief removes the pooled read connection of the current thread
+     */
+    void removeReadConnection();
+
+    /**
+     * @brief creates the WHERE part of an SQL query for searching packages
+     * @param minStatus minimum status
+     * @param maxStatus maximum status (exclusive)
+     * @param query search query
+     * @param cat0 filter for the level 0 of categories. -1 means "All",
+     *     0 means "Uncategorized"
+     * @param cat1 filter for the level 1 of categories. -1 means "All",
+     *     0 means "Uncategorized"
+     * @param params parameters for the query will be stored here
+     * @param joined true = PACKAGE_FTS is joined in the query. If false, a
+     *     sub-query will be used for the full text search.
+     * @return WHERE part without the keyword WHERE
+     */
     QString createQuery(Package::Status minStatus, Package::Status maxStatus,
-            const QString &query, int cat0, int cat1, QList<QVariant> &params) const;
+            const QString &query, int cat0, int cat1, QList<QVariant> &params,
+            bool joined=false) const;
+
+    /**
+     * @brief converts a search query in an FTS5 query. The trigram tokenizer
+     *     finds the same substrings as "FULLTEXT LIKE '%keyword%'", but only
+     *     for keywords with at least 3 characters.
+     * @param query search query as entered by the user
+     * @return FTS5 query or "" if the full text index cannot be used for
+     *     this query. The keywords that are not part of the FTS5 query (see
+     *     isMatchKeyword()) should be searched using LIKE.
+     */
+    QString createMatchExpression(const QString& query) const;
+
+    /**
+     * @param keyword lower case keyword from the search query without the
+     *     leading "-"
+     * @return true if the keyword can be searched using PACKAGE_FTS
+     */
+    static bool isMatchKeyword(const QString& keyword);
+
+    /**
+     * @param err error message will be stored here
+     * @return true if PACKAGE_FTS exists and uses the trigram tokenizer
+     */
+    bool isTrigramSearchIndex(QString* err) const;
+
+    /**
+     * @brief returns the normalized form of a word
+     * @param word a lower case word like "x64"
+     * @return synonym like "x86_64" or "" if the word has no synonym
+     */
+    static QString getSynonym(const QString& word);
+
 public:
+    /**
+     * index of the repository for the detected packages and package versions
+     * (see InstalledPackages::refresh())
+     */
+    static const int DETECTED_REPOSITORY = 10000;
+
     /** index of the current repository used for saving the packages */
     int currentRepository;
 
@@ -193,15 +577,100 @@ public:
     QString openDefault(const QString &databaseName="default",
             bool readOnly=false);
 
+    /**
+     * @brief opens the snapshot of the default database (see DBSnapshot) if
+     *     it is up-to-date and the default database otherwise. Only
+     *     findPackage_(), findPackagesByShortName(), getPackageVersions_(),
+     *     findPackageVersion_(), findPackageVersionsWithCmdFile() and
+     *     findLicense_() can be used if the snapshot was opened.
+     * @param readOnly true = open the database in read-only mode if the
+     *     snapshot cannot be used
+     * @return error
+     */
+    QString openDefaultSnapshot(bool readOnly=true);
+
+    /**
+     * @brief writes the snapshot (see DBSnapshot) for this database if it is
+     *     missing or outdated. Nothing is done for read-only databases.
+     * @return error message
+     */
+    QString updateSnapshot();
+
+    /**
+     * @return path to the current generation of the default database file
+     */
+    static QString getDefaultFile();
+
+    /**
+     * @return path to the default database file without generations
+     *     (...\Npackd\Data.db)
+     */
+    static QString getBaseFile();
+
+    /**
+     * @brief returns the current generation of a database. The name of the
+     *     current file is stored in "<baseFile>.current" by publish().
+     * @param baseFile base database file, e.g. getBaseFile()
+     * @return the current file or baseFile if no generation was published
+     */
+    static QString getCurrentFile(const QString& baseFile);
+
+    /**
+     * @brief chooses a file for a new generation of a database. The new
+     *     database should be built in this file and published using
+     *     publish().
+     * @param baseFile base database file, e.g. getBaseFile()
+     * @return path to a new file in the same directory ending with ".part"
+     */
+    static QString createGenerationFile(const QString& baseFile);
+
+    /**
+     * @brief makes a completely built and closed database the current
+     *     generation. Only the small file "<baseFile>.current" is replaced,
+     *     so this takes the same time for every size of the database.
+     *     Connections to the previous generation keep seeing its data until
+     *     they are opened again (see reopenDefault()).
+     * @param baseFile base database file, e.g. getBaseFile()
+     * @param file the new database from createGenerationFile()
+     * @return error message
+     */
+    static QString publish(const QString& baseFile, const QString& file);
+
+    /**
+     * @brief opens the current generation of the default database again if
+     *     a newer one was published. The caches are cleared in this case.
+     * @return error message
+     */
+    QString reopenDefault();
+
+    /**
+     * @return true if the default database is open and a newer generation
+     *     was published since it was opened (see reopenDefault())
+     */
+    bool isNewGenerationPublished();
+
+    /**
+     * @brief closes the database
+     */
+    void close();
+
     /**
      * @brief opens the database
      * @param connectionName name for the database connection
      * @param file database file
      * @param readOnly true = open in read-only mode
+     * @param wal true = switch the database to the WAL mode if it is opened
+     *     for writing. This enables the read pool. A read-only connection
+     *     cannot read a WAL database if the "-wal" and "-shm" files do not
+     *     exist and cannot be created, e.g. for non-admin users. Older
+     *     versions of Npackd also switch the database back. So this must
+     *     only be used for databases that no such connections open.
+     *     false = the rollback journal (DELETE mode) is used. A database
+     *     in the WAL mode is switched back.
      * @return error
      */
     QString open(const QString &connectionName, const QString &file,
-            bool readOnly=false);
+            bool readOnly=false, bool wal=false);
 
     /**
      * @brief update the status for the specified package
@@ -222,6 +691,24 @@ public:
      */
     void saveAll(Job* job, Repository* r, bool replace=false);
 
+    /**
+     * @brief inserts the data detected by one of several third party package
+     *     managers. The result is the same as if saveAll() would be called
+     *     for the package managers in the order of their indexes, regardless
+     *     of the order of the calls to this method. All objects are written in
+     *     one SQL savepoint.
+     * @param job job
+     * @param r the repository
+     * @param index index of the package manager
+     * @param replace index of a package manager -> what to do if an entry
+     *     already exists: true = replace, false = ignore
+     * @param writers key for an object -> index of the package manager that
+     *     has written it or -1 if the object existed before. This should be
+     *     empty for the first call and is updated by this method.
+     */
+    void saveDetected(Job* job, Repository* r, int index,
+            const QList<bool>& replace, QHash<QString, int>* writers);
+
     /**
      * @brief updates the status for currently installed packages in
      *     PACKAGE.STATUS
@@ -229,11 +716,77 @@ public:
      */
     void updateStatusForInstalled(Job *job);
 
+    /**
+     * @brief deletes the package versions without a download that were
+     *     created by the last detection together with their CMD_FILE entries.
+     *     The detection creates them again if the software is still
+     *     installed.
+     * @return error message
+     */
+    QString deleteDetectedPackageVersions();
+
+    /**
+     * @brief deletes the packages that are not installed and have no version
+     *     with a download together with their versions, links, tags and
+     *     CMD_FILE entries
+     * @return error message
+     */
+    QString deletePackagesWithoutVersions();
+
     Package* findPackage_(const QString& name) const override;
 
+    /**
+     * @brief searches for a package. The returned object is shared with the
+     *     cache and should not be changed.
+     * @param name full package name
+     * @return found package or nullptr
+     */
+    std::shared_ptr<const Package> findPackageShared(const QString& name) const;
+
+    /**
+     * @brief returns all versions of a package. The returned objects are
+     *     shared with the cache and should not be changed.
+     * @param package full package name
+     * @param err error message will be stored here
+     * @return the list of package versions. The first returned object has
+     *     the highest version number.
+     */
+    QList<std::shared_ptr<const PackageVersion> > getPackageVersionsShared(
+            const QString& package, QString* err) const;
+
+    /**
+     * @brief reads packages and all their versions into the cache using one
+     *     query per table for up to 500 packages. This is much faster than
+     *     reading the packages one by one. Already cached packages are
+     *     skipped.
+     * @param packages full package names
+     * @return error message
+     */
+    QString prefetchPackages(const QStringList& packages) const;
+
+    /**
+     * @return counters for the cache of packages
+     */
+    ObjectCacheStatistics getPackageCacheStatistics() const;
+
+    /**
+     * @return counters for the cache of package versions
+     */
+    ObjectCacheStatistics getPackageVersionCacheStatistics() const;
+
     QList<PackageVersion*> getPackageVersions_(const QString& package,
             QString *err) const override;
 
+    /**
+     * @brief see AbstractRepository::findNewestAndInstalled_. The versions
+     *     of all packages are read using one query per 500 packages and only
+     *     the found versions are parsed.
+     */
+    QString findNewestAndInstalled_(const QStringList& packages,
+            const QMap<QString, Version>& installed,
+            QMap<QString, PackageVersion*>* newest,
+            QMap<QString, PackageVersion*>* installedVersions) const override;
+
     /**
      * @brief returns all package versions with a <cmd-file> entry with the
      *     specified path
@@ -287,8 +840,14 @@ public:
      * @brief updateF5() that can be used with QtConcurrent::Run
      * @param job job
      * @param useCache true = cache will be used
+     * @param skipIfUpToDate true = if no repository has changed since the
+     *     last refresh, only the installation status is updated in the
+     *     current database. Otherwise a new generation of the database is
+     *     built and published (see publish()). If the new generation cannot
+     *     be created or published, the differences are applied to the
+     *     current database instead (see applyChangesFrom()).
      */
-    void updateF5Runnable(Job* job, bool useCache);
+    void updateF5Runnable(Job* job, bool useCache, bool skipIfUpToDate=true);
 
     PackageVersion* findPackageVersion_(const QString& package,
             const Version& version, QString *err) const override;
@@ -362,11 +921,49 @@ public:
      */
     QStringList findBetterPackages(const QString &title, QString *err);
 
+    /**
+     * @brief enables or disables the in-memory index used by
+     *     findBetterPackages(). The index is created on the first search and
+     *     re-created after the packages are changed. This should be enabled
+     *     while many packages are searched, e.g. during the detection of the
+     *     installed software.
+     * @param v true = use the index
+     */
+    void setTitleIndexEnabled(bool v);
+
+    /**
+     * @brief creates the index for findBetterPackages()
+     * @param index the packages will be added here
+     * @return error message
+     */
+    QString createTitleIndex(TitleIndex* index) const;
+
     /**
      * @return maximum number of stars for a package
      * @param err error message will be stored here
      */
     int getMaxStars(QString *err);
+
+    /**
+     * @brief enables or disables the usage of the full text index for
+     *     searching. The index is used by default if SQLite supports FTS5.
+     * @param v true = use the index, false = use LIKE
+     */
+    void setFullTextIndexEnabled(bool v);
+
+    /**
+     * @brief adds the missing entries to the full text index and removes the
+     *     entries for deleted or replaced packages. savePackage() updates the
+     *     index itself. This function is called automatically after the
+     *     repositories are loaded.
+     * @return error message
+     */
+    QString updateSearchIndex();
+
+    /**
+     * @return true if the full text index exists and is used for searching
+     */
+    bool isFullTextIndexEnabled() const;
 };
 
 #endif // DBREPOSITORY_H
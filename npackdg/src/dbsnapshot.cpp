@@ -0,0 +1,457 @@
+#include "dbsnapshot.h"
+
+#include <algorithm>
+
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QObject>
+
+static const char SNAPSHOT_MAGIC[] = {'N', 'P', 'S', 'N'};
+
+DBSnapshot::DBSnapshot(): data(nullptr), size(0), dbSize(0), dbModified(0),
+        walSize(0), walModified(0)
+{
+    for (int i = 0; i < TABLE_COUNT; i++) {
+        indexOffsets[i] = 0;
+        counts[i] = 0;
+    }
+}
+
+DBSnapshot::~DBSnapshot()
+{
+    if (data)
+        file.unmap(const_cast<uchar*>(data));
+}
+
+QString DBSnapshot::getFile(const QString &databaseFile)
+{
+    return databaseFile + QStringLiteral(".snapshot");
+}
+
+void DBSnapshot::getDatabaseStamp(const QString &databaseFile, qint64 *dbSize,
+        qint64 *dbModified, qint64 *walSize, qint64 *walModified)
+{
+    QFileInfo fi(databaseFile);
+    *dbSize = fi.size();
+    *dbModified = fi.lastModified().toMSecsSinceEpoch();
+
+    // an empty log is deleted when the last connection is closed
+    QFileInfo wal(databaseFile + QStringLiteral("-wal"));
+    *walSize = wal.size();
+    if (*walSize > 0)
+        *walModified = wal.lastModified().toMSecsSinceEpoch();
+    else
+        *walSize = *walModified = 0;
+}
+
+bool DBSnapshot::isUpToDate(const QString &file, const QString &databaseFile)
+{
+    QFile f(file);
+    if (!f.open(QFile::ReadOnly))
+        return false;
+
+    QByteArray header = f.read(HEADER_SIZE);
+    if (header.size() != HEADER_SIZE ||
+            memcmp(header.constData(), SNAPSHOT_MAGIC, 4) != 0)
+        return false;
+
+    const uchar* h = reinterpret_cast<const uchar*>(header.constData());
+
+    qint64 dbSize, dbModified, walSize, walModified;
+    getDatabaseStamp(databaseFile, &dbSize, &dbModified, &walSize,
+            &walModified);
+
+    return qFromLittleEndian<quint32>(h + 4) == FORMAT_VERSION &&
+            qFromLittleEndian<qint64>(h + 8) == dbSize &&
+            qFromLittleEndian<qint64>(h + 16) == dbModified &&
+            qFromLittleEndian<qint64>(h + 24) == walSize &&
+            qFromLittleEndian<qint64>(h + 32) == walModified;
+}
+
+QString DBSnapshot::open(const QString &file, const QString &databaseFile)
+{
+    QString err;
+
+    if (!isUpToDate(file, databaseFile))
+        err = QObject::tr("The snapshot %1 is missing or outdated").arg(file);
+
+    if (err.isEmpty()) {
+        this->file.setFileName(file);
+        if (!this->file.open(QFile::ReadOnly))
+            err = this->file.errorString();
+    }
+
+    if (err.isEmpty()) {
+        size = this->file.size();
+        data = this->file.map(0, size);
+        if (!data)
+            err = this->file.errorString();
+    }
+
+    if (err.isEmpty()) {
+        if (size < HEADER_SIZE + TABLE_COUNT * 8 ||
+                readUInt32(40) != TABLE_COUNT)
+            err = QObject::tr("Invalid snapshot file %1").arg(file);
+    }
+
+    if (err.isEmpty()) {
+        for (int i = 0; i < TABLE_COUNT; i++) {
+            indexOffsets[i] = readUInt32(HEADER_SIZE + i * 8);
+            counts[i] = readUInt32(HEADER_SIZE + i * 8 + 4);
+            if (indexOffsets[i] + static_cast<qint64>(counts[i]) *
+                    ENTRY_SIZE > size) {
+                err = QObject::tr("Invalid snapshot file %1").arg(file);
+                break;
+            }
+        }
+    }
+
+    if (!err.isEmpty()) {
+        if (data)
+            this->file.unmap(const_cast<uchar*>(data));
+        data = nullptr;
+        size = 0;
+        this->file.close();
+    }
+
+    return err;
+}
+
+quint32 DBSnapshot::readUInt32(qint64 offset) const
+{
+    return qFromLittleEndian<quint32>(data + offset);
+}
+
+QByteArray DBSnapshot::readBytes(qint64 offset) const
+{
+    quint32 start = readUInt32(offset);
+    quint32 length = readUInt32(offset + 4);
+    if (static_cast<qint64>(start) + length > size)
+        return QByteArray();
+
+    return QByteArray::fromRawData(
+            reinterpret_cast<const char*>(data + start),
+            static_cast<int>(length));
+}
+
+QByteArray DBSnapshot::getKey(Table t, quint32 index) const
+{
+    return readBytes(indexOffsets[t] +
+            static_cast<qint64>(index) * ENTRY_SIZE);
+}
+
+QByteArray DBSnapshot::getValue(Table t, quint32 index) const
+{
+    return readBytes(indexOffsets[t] +
+            static_cast<qint64>(index) * ENTRY_SIZE + 8);
+}
+
+void DBSnapshot::add(Table t, const QString &key, const QByteArray &value)
+{
+    Entry e;
+    e.key = key.toUtf8();
+    e.value = value;
+    entries[t].append(e);
+}
+
+void DBSnapshot::readDatabaseStamp(const QString &databaseFile)
+{
+    getDatabaseStamp(databaseFile, &dbSize, &dbModified, &walSize,
+            &walModified);
+}
+
+QString DBSnapshot::save(const QString &file)
+{
+    QString err;
+
+    // keys must be sorted for the binary search. The order of the values
+    // for the same key is preserved.
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        std::stable_sort(entries[t].begin(), entries[t].end(),
+                [](const Entry& a, const Entry& b) {
+            return a.key < b.key;
+        });
+    }
+
+    QByteArray header(HEADER_SIZE + TABLE_COUNT * 8, '\0');
+    uchar* h = reinterpret_cast<uchar*>(header.data());
+    memcpy(h, SNAPSHOT_MAGIC, 4);
+    qToLittleEndian<quint32>(FORMAT_VERSION, h + 4);
+    qToLittleEndian<qint64>(dbSize, h + 8);
+    qToLittleEndian<qint64>(dbModified, h + 16);
+    qToLittleEndian<qint64>(walSize, h + 24);
+    qToLittleEndian<qint64>(walModified, h + 32);
+    qToLittleEndian<quint32>(TABLE_COUNT, h + 40);
+
+    qint64 pos = header.size();
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        qToLittleEndian<quint32>(static_cast<quint32>(pos),
+                h + HEADER_SIZE + t * 8);
+        qToLittleEndian<quint32>(static_cast<quint32>(entries[t].size()),
+                h + HEADER_SIZE + t * 8 + 4);
+        pos += static_cast<qint64>(entries[t].size()) * ENTRY_SIZE;
+    }
+
+    QByteArray index;
+    for (int t = 0; t < TABLE_COUNT; t++) {
+        for (int i = 0; i < entries[t].size(); i++) {
+            const Entry& e = entries[t].at(i);
+            uchar entry[ENTRY_SIZE];
+            qToLittleEndian<quint32>(static_cast<quint32>(pos), entry);
+            qToLittleEndian<quint32>(static_cast<quint32>(e.key.size()),
+                    entry + 4);
+            pos += e.key.size();
+            qToLittleEndian<quint32>(static_cast<quint32>(pos), entry + 8);
+            qToLittleEndian<quint32>(static_cast<quint32>(e.value.size()),
+                    entry + 12);
+            pos += e.value.size();
+            index.append(reinterpret_cast<const char*>(entry), ENTRY_SIZE);
+        }
+    }
+
+    if (pos > 0xFFFFFFFFLL)
+        err = QObject::tr("The snapshot is too big");
+
+    // the file is first written under another name and then renamed
+    QSaveFile f(file);
+    if (err.isEmpty()) {
+        if (!f.open(QFile::WriteOnly))
+            err = f.errorString();
+    }
+
+    if (err.isEmpty()) {
+        bool ok = f.write(header) == header.size() &&
+                f.write(index) == index.size();
+        for (int t = 0; ok && t < TABLE_COUNT; t++) {
+            for (int i = 0; ok && i < entries[t].size(); i++) {
+                const Entry& e = entries[t].at(i);
+                ok = f.write(e.key) == e.key.size() &&
+                        f.write(e.value) == e.value.size();
+            }
+        }
+        if (!ok) {
+            err = f.errorString();
+            f.cancelWriting();
+        }
+    }
+
+    if (err.isEmpty()) {
+        if (!f.commit())
+            err = f.errorString();
+    }
+
+    return err;
+}
+
+QList<QByteArray> DBSnapshot::find(Table t, const QString &key) const
+{
+    QList<QByteArray> r;
+
+    if (!data)
+        return r;
+
+    QByteArray k = key.toUtf8();
+
+    // lower bound
+    quint32 first = 0;
+    quint32 count = counts[t];
+    while (count > 0) {
+        quint32 step = count / 2;
+        quint32 middle = first + step;
+        if (getKey(t, middle) < k) {
+            first = middle + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+
+    for (quint32 i = first; i < counts[t] && getKey(t, i) == k; i++) {
+        r.append(getValue(t, i));
+    }
+
+    return r;
+}
+
+QByteArray DBSnapshot::toBinary(const Package *p)
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << p->name << p->title << p->url << p->description << p->license <<
+            p->categories << p->tags << p->links <<
+            static_cast<qint32>(p->stars) << p->getIcon();
+    return r;
+}
+
+Package *DBSnapshot::parsePackage(const QByteArray &data)
+{
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    QString name, title;
+    in >> name >> title;
+    Package* p = new Package(name, title);
+    qint32 stars;
+    QString icon;
+    in >> p->url >> p->description >> p->license >> p->categories >>
+            p->tags >> p->links >> stars >> icon;
+    p->stars = stars;
+
+    // the order of the values for the same key in "links" is not preserved
+    p->setIcon(icon);
+
+    if (in.status() != QDataStream::Ok) {
+        delete p;
+        p = nullptr;
+    }
+
+    return p;
+}
+
+QByteArray DBSnapshot::toBinary(const License *p)
+{
+    QByteArray r;
+    QDataStream out(&r, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << p->name << p->title << p->description << p->url;
+    return r;
+}
+
+License *DBSnapshot::parseLicense(const QByteArray &data)
+{
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    QString name, title;
+    in >> name >> title;
+    License* p = new License(name, title);
+    in >> p->description >> p->url;
+
+    if (in.status() != QDataStream::Ok) {
+        delete p;
+        p = nullptr;
+    }
+
+    return p;
+}
+
+void DBSnapshot::addPackage(const Package *p)
+{
+    add(PACKAGE, p->name, toBinary(p));
+    add(SHORT_NAME, p->getShortName(), p->name.toUtf8());
+}
+
+void DBSnapshot::addLicense(const License *p)
+{
+    add(LICENSE, p->name, toBinary(p));
+}
+
+Package *DBSnapshot::findPackage(const QString &name) const
+{
+    Package* r = nullptr;
+    QList<QByteArray> values = find(PACKAGE, name);
+    if (values.size() > 0)
+        r = parsePackage(values.at(0));
+    return r;
+}
+
+QList<Package *> DBSnapshot::findPackagesByShortName(const QString &name) const
+{
+    QList<Package*> r;
+    QList<QByteArray> names = find(SHORT_NAME, name);
+    for (int i = 0; i < names.size(); i++) {
+        Package* p = findPackage(QString::fromUtf8(names.at(i)));
+        if (p)
+            r.append(p);
+    }
+    return r;
+}
+
+QList<PackageVersion *> DBSnapshot::getPackageVersions(const QString &package,
+        QString *err) const
+{
+    *err = QString();
+
+    QList<PackageVersion*> r;
+    QList<QByteArray> values = find(PACKAGE_VERSION, package);
+    for (int i = 0; i < values.size(); i++) {
+        PackageVersion* pv = PackageVersion::parseBinary(values.at(i), err);
+        if (!err->isEmpty())
+            break;
+        r.append(pv);
+    }
+
+    return r;
+}
+
+PackageVersion *DBSnapshot::findPackageVersion(const QString &package,
+        const Version &version, QString *err) const
+{
+    *err = QString();
+
+    PackageVersion* r = nullptr;
+    QList<QByteArray> values = find(PACKAGE_VERSION, package);
+    for (int i = 0; i < values.size(); i++) {
+        // only the header is decoded for the comparison
+        PackageVersion* pv = PackageVersion::parseBinary(values.at(i), err,
+                false);
+        if (!err->isEmpty())
+            break;
+
+        bool found = pv->version == version;
+        delete pv;
+
+        if (found) {
+            r = PackageVersion::parseBinary(values.at(i), err);
+            break;
+        }
+    }
+
+    return r;
+}
+
+QList<PackageVersion *> DBSnapshot::findPackageVersionsWithCmdFile(
+        const QString &name, QString *err) const
+{
+    *err = QString();
+
+    QList<PackageVersion*> r;
+    QList<QByteArray> values = find(CMD_FILE, name.toLower());
+    for (int i = 0; i < values.size(); i++) {
+        QList<QByteArray> parts = values.at(i).split('\0');
+        if (parts.size() != 2)
+            continue;
+
+        Version v;
+        if (!v.setVersion(QString::fromUtf8(parts.at(1))))
+            continue;
+
+        PackageVersion* pv = findPackageVersion(
+                QString::fromUtf8(parts.at(0)), v, err);
+        if (!err->isEmpty())
+            break;
+        if (pv)
+            r.append(pv);
+    }
+
+    return r;
+}
+
+License *DBSnapshot::findLicense(const QString &name, QString *err) const
+{
+    *err = QString();
+
+    License* r = nullptr;
+    QList<QByteArray> values = find(LICENSE, name);
+    if (values.size() > 0) {
+        r = parseLicense(values.at(0));
+        if (!r)
+            *err = QObject::tr("Invalid license data in the snapshot: %1").
+                    arg(name);
+    }
+    return r;
+}
@@ -0,0 +1,236 @@
+#ifndef DBSNAPSHOT_H
+#define DBSNAPSHOT_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QList>
+#include <QFile>
+
+#include "package.h"
+#include "packageversion.h"
+#include "license.h"
+#include "version.h"
+
+/**
+ * @brief immutable snapshot of the package database. The file is mapped in
+ *     memory and the data is found using binary search without SQLite.
+ *     This is used by the command line commands that only read the data.
+ *
+ * A snapshot is only valid for the database file it was created from. The
+ * size and the modification time of the database and of its write-ahead log
+ * ("-wal" file) are stored in the snapshot and compared in open(). In the
+ * WAL mode the commits only change the write-ahead log.
+ *
+ * File format (little-endian):
+ *     magic "NPSN", quint32 format version,
+ *     qint64 database size, qint64 database modification time in ms,
+ *     qint64 WAL size, qint64 WAL modification time in ms,
+ *     quint32 number of tables,
+ *     for each table: quint32 offset of the index, quint32 number of entries,
+ *     for each table: index entries sorted by key (UTF-8, byte-wise):
+ *         quint32 key offset, quint32 key length,
+ *         quint32 value offset, quint32 value length,
+ *     keys and values.
+ */
+class DBSnapshot
+{
+public:
+    /** tables in a snapshot */
+    enum Table {
+        /** full package name -> Package */
+        PACKAGE,
+
+        /** short package name -> full package name */
+        SHORT_NAME,
+
+        /** full package name -> PackageVersion in binary format */
+        PACKAGE_VERSION,
+
+        /**
+         * command line tool name in lower case -> full package name + '\0' +
+         * version
+         */
+        CMD_FILE,
+
+        /** license name -> License */
+        LICENSE,
+
+        TABLE_COUNT
+    };
+private:
+    static const quint32 FORMAT_VERSION = 3;
+
+    /** size of the header before the table directory */
+    static const int HEADER_SIZE = 44;
+
+    /** size of an index entry */
+    static const int ENTRY_SIZE = 16;
+
+    class Entry {
+    public:
+        QByteArray key;
+        QByteArray value;
+    };
+
+    /** entries that will be written by save() */
+    QList<Entry> entries[TABLE_COUNT];
+
+    QFile file;
+    const uchar* data;
+    qint64 size;
+    quint32 indexOffsets[TABLE_COUNT];
+    quint32 counts[TABLE_COUNT];
+
+    /** database stamp read by readDatabaseStamp() and written by save() */
+    qint64 dbSize, dbModified, walSize, walModified;
+
+    quint32 readUInt32(qint64 offset) const;
+
+    /**
+     * @param offset offset and length of a key or a value
+     * @return the data without copying or an empty array if the offsets
+     *     are invalid
+     */
+    QByteArray readBytes(qint64 offset) const;
+
+    QByteArray getKey(Table t, quint32 index) const;
+    QByteArray getValue(Table t, quint32 index) const;
+
+    /**
+     * @brief reads the database file stamp
+     * @param databaseFile database file
+     * @param dbSize size will be stored here
+     * @param dbModified modification time will be stored here
+     * @param walSize size of the write-ahead log will be stored here or 0 if
+     *     the log does not exist or is empty
+     * @param walModified modification time of the write-ahead log will be
+     *     stored here or 0 if the log does not exist or is empty
+     */
+    static void getDatabaseStamp(const QString& databaseFile, qint64* dbSize,
+            qint64* dbModified, qint64* walSize, qint64* walModified);
+
+    static QByteArray toBinary(const Package* p);
+    static Package* parsePackage(const QByteArray& data);
+    static QByteArray toBinary(const License* p);
+    static License* parseLicense(const QByteArray& data);
+public:
+    DBSnapshot();
+
+    ~DBSnapshot();
+
+    /**
+     * @param databaseFile database file
+     * @return path to the snapshot for the specified database
+     */
+    static QString getFile(const QString& databaseFile);
+
+    /**
+     * @brief checks the header of a snapshot without mapping it
+     * @param file snapshot file
+     * @param databaseFile database file
+     * @return true if the snapshot exists and was created from the current
+     *     state of the database
+     */
+    static bool isUpToDate(const QString& file, const QString& databaseFile);
+
+    /**
+     * @brief opens and maps a snapshot
+     * @param file snapshot file
+     * @param databaseFile the database the snapshot was created from
+     * @return error message. An error is also returned if the database was
+     *     changed after the snapshot was created.
+     */
+    QString open(const QString& file, const QString& databaseFile);
+
+    /**
+     * @brief reads the stamp of the database file. This must be called
+     *     before the data is read from the database. A commit after this
+     *     call changes the stamp and the saved snapshot will be out of date.
+     * @param databaseFile the database the snapshot is created from
+     */
+    void readDatabaseStamp(const QString& databaseFile);
+
+    /**
+     * @brief adds an entry. The entries will be written by save().
+     * @param t table
+     * @param key key
+     * @param value value
+     */
+    void add(Table t, const QString& key, const QByteArray& value);
+
+    /**
+     * @brief adds a package
+     * @param p package
+     */
+    void addPackage(const Package* p);
+
+    /**
+     * @brief adds a license
+     * @param p license
+     */
+    void addLicense(const License* p);
+
+    /**
+     * @brief writes all added entries and the stamp read by
+     *     readDatabaseStamp(). The file is replaced atomically.
+     * @param file snapshot file
+     * @return error message
+     */
+    QString save(const QString& file);
+
+    /**
+     * @brief returns all values for a key
+     * @param t table
+     * @param key key
+     * @return values. The data is not copied and is only valid while this
+     *     object exists.
+     */
+    QList<QByteArray> find(Table t, const QString& key) const;
+
+    /**
+     * @param name full package name
+     * @return [move] found package or nullptr
+     */
+    Package* findPackage(const QString& name) const;
+
+    /**
+     * @param name short package name
+     * @return [move] found packages
+     */
+    QList<Package*> findPackagesByShortName(const QString& name) const;
+
+    /**
+     * @param package full package name
+     * @param err error message will be stored here
+     * @return [move] package versions
+     */
+    QList<PackageVersion*> getPackageVersions(const QString& package,
+            QString* err) const;
+
+    /**
+     * @param package full package name
+     * @param version version number
+     * @param err error message will be stored here
+     * @return [move] found package version or nullptr
+     */
+    PackageVersion* findPackageVersion(const QString& package,
+            const Version& version, QString* err) const;
+
+    /**
+     * @param name name of the command line tool
+     * @param err error message will be stored here
+     * @return [move] package versions defining the tool
+     */
+    QList<PackageVersion*> findPackageVersionsWithCmdFile(const QString& name,
+            QString* err) const;
+
+    /**
+     * @param name license name
+     * @param err error message will be stored here
+     * @return [move] found license or nullptr
+     */
+    License* findLicense(const QString& name, QString* err) const;
+};
+
+#endif // DBSNAPSHOT_H
@@ -0,0 +1,352 @@
+#include "dependencysolver.h"
+
+#include <algorithm>
+
+#include <QObject>
+
+#include "abstractrepository.h"
+#include "installedpackages.h"
+#include "installoperation.h"
+#include "wpmutils.h"
+
+DependencySolver::DependencySolver(AbstractRepository *rep,
+        InstalledPackages &installed): rep(rep), installed(installed)
+{
+}
+
+DependencySolver::~DependencySolver()
+{
+    for (int i = 0; i < nodes.size(); i++) {
+        delete nodes.at(i).pv;
+    }
+    for (int i = 0; i < ranges.size(); i++) {
+        delete ranges.at(i).dep;
+    }
+}
+
+QString DependencySolver::getKey(const QString &package,
+        const Version &version)
+{
+    Version v(version);
+    v.normalize();
+    return package + QLatin1Char(' ') + v.getVersionString();
+}
+
+quint64 DependencySolver::mix(quint64 v)
+{
+    // splitmix64 finalizer
+    v += 0x9E3779B97F4A7C15ULL;
+    v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    v = (v ^ (v >> 27)) * 0x94D049BB133111EBULL;
+    return v ^ (v >> 31);
+}
+
+int DependencySolver::getPackage(const QString &name)
+{
+    int r = packageIndexes.value(name, -1);
+    if (r < 0) {
+        PackageInfo p;
+        p.name = name;
+        p.loaded = false;
+        p.stateHash = 0;
+        r = packages.size();
+        packages.append(p);
+        packageIndexes.insert(name, r);
+    }
+    return r;
+}
+
+int DependencySolver::addNode(PackageVersion *pv)
+{
+    QString key = getKey(pv->package, pv->version);
+    int r = nodeIndexes.value(key, -1);
+    if (r >= 0) {
+        delete pv;
+    } else {
+        Node n;
+        n.package = getPackage(pv->package);
+        n.pv = pv;
+        n.installable = pv->download.isValid();
+        n.reachableComputed = false;
+        for (int i = 0; i < pv->dependencies.size(); i++) {
+            n.ranges.append(getRange(*pv->dependencies.at(i)));
+        }
+
+        r = nodes.size();
+        nodes.append(n);
+        nodeIndexes.insert(key, r);
+        avoided.append(initiallyAvoided.contains(key));
+    }
+    return r;
+}
+
+int DependencySolver::getRange(const Dependency &dep)
+{
+    QString key = dep.package + QLatin1Char(' ') + dep.versionsToString();
+    int r = rangeIndexes.value(key, -1);
+    if (r < 0) {
+        Range range;
+        range.package = getPackage(dep.package);
+        range.dep = dep.clone();
+        range.installed = -1;
+        r = ranges.size();
+        ranges.append(range);
+        rangeIndexes.insert(key, r);
+    }
+    return r;
+}
+
+QString DependencySolver::loadPackage(int package)
+{
+    QString err;
+
+    if (!packages.at(package).loaded) {
+        packages[package].loaded = true;
+
+        QList<PackageVersion*> pvs = rep->getPackageVersions_(
+                packages.at(package).name, &err);
+        for (int i = 0; i < pvs.size(); i++) {
+            int node = addNode(pvs.at(i));
+            packages[package].versions.append(node);
+        }
+    }
+
+    return err;
+}
+
+bool DependencySolver::isFulfilled(int range)
+{
+    Range& r = ranges[range];
+    if (r.installed < 0)
+        r.installed = installed.isInstalled(*r.dep) ? 1 : 0;
+
+    bool res = r.installed == 1;
+    if (!res) {
+        const QVector<int>& planned = packages.at(r.package).planned;
+        for (int i = 0; i < planned.size(); i++) {
+            if (r.dep->test(nodes.at(planned.at(i)).pv->version)) {
+                res = true;
+                break;
+            }
+        }
+    }
+
+    return res;
+}
+
+void DependencySolver::computeReachable(int node)
+{
+    if (nodes.at(node).reachableComputed)
+        return;
+
+    QSet<int> visited;
+    QList<int> queue;
+    const QVector<int>& rs = nodes.at(node).ranges;
+    for (int i = 0; i < rs.size(); i++) {
+        int p = ranges.at(rs.at(i)).package;
+        if (!visited.contains(p)) {
+            visited.insert(p);
+            queue.append(p);
+        }
+    }
+
+    while (!queue.isEmpty() && fatal.isEmpty()) {
+        int p = queue.takeFirst();
+        fatal = loadPackage(p);
+
+        const QVector<int>& versions = packages.at(p).versions;
+        for (int i = 0; i < versions.size(); i++) {
+            const QVector<int>& rs2 = nodes.at(versions.at(i)).ranges;
+            for (int j = 0; j < rs2.size(); j++) {
+                int p2 = ranges.at(rs2.at(j)).package;
+                if (!visited.contains(p2)) {
+                    visited.insert(p2);
+                    queue.append(p2);
+                }
+            }
+        }
+    }
+
+    QVector<int> reachable = visited.values().toVector();
+    std::sort(reachable.begin(), reachable.end());
+
+    Node& n = nodes[node];
+    n.reachable = reachable;
+    n.reachableComputed = true;
+}
+
+quint64 DependencySolver::getStateHash(int node)
+{
+    computeReachable(node);
+
+    quint64 r = mix(static_cast<quint64>(node));
+    const QVector<int>& reachable = nodes.at(node).reachable;
+    for (int i = 0; i < reachable.size(); i++) {
+        r = mix(r + packages.at(reachable.at(i)).stateHash);
+    }
+    return r;
+}
+
+void DependencySolver::setAvoided(int node)
+{
+    avoided[node] = true;
+    avoidOrder.append(node);
+    packages[nodes.at(node).package].stateHash ^=
+            mix(static_cast<quint64>(node) * 2);
+
+    Change c;
+    c.planned = false;
+    c.node = node;
+    undoLog.append(c);
+}
+
+void DependencySolver::setPlanned(int node)
+{
+    plan.append(node);
+    PackageInfo& p = packages[nodes.at(node).package];
+    p.planned.append(node);
+    p.stateHash ^= mix(static_cast<quint64>(node) * 2 + 1);
+
+    Change c;
+    c.planned = true;
+    c.node = node;
+    undoLog.append(c);
+}
+
+void DependencySolver::rollback(int undoLogSize)
+{
+    while (undoLog.size() > undoLogSize) {
+        Change c = undoLog.takeLast();
+        PackageInfo& p = packages[nodes.at(c.node).package];
+        if (c.planned) {
+            plan.removeLast();
+            p.planned.removeLast();
+            p.stateHash ^= mix(static_cast<quint64>(c.node) * 2 + 1);
+        } else {
+            avoided[c.node] = false;
+            avoidOrder.removeLast();
+            p.stateHash ^= mix(static_cast<quint64>(c.node) * 2);
+        }
+    }
+}
+
+QString DependencySolver::solve(int node)
+{
+    QString res;
+
+    setAvoided(node);
+
+    // a copy as "nodes" may grow
+    QVector<int> rs = nodes.at(node).ranges;
+    for (int i = 0; i < rs.size(); i++) {
+        if (isFulfilled(rs.at(i)))
+            continue;
+
+        // "ranges" may grow while loading the versions
+        int package = ranges.at(rs.at(i)).package;
+        const Dependency* dep = ranges.at(rs.at(i)).dep;
+
+        fatal = loadPackage(package);
+        if (!fatal.isEmpty())
+            break;
+
+        // the state is the same for every candidate as a failed candidate
+        // is rolled back
+        QVector<int> candidates;
+        const QVector<int>& versions = packages.at(package).versions;
+        for (int j = 0; j < versions.size(); j++) {
+            int c = versions.at(j);
+            if (nodes.at(c).installable && !avoided.at(c) &&
+                    dep->test(nodes.at(c).pv->version))
+                candidates.append(c);
+        }
+
+        bool found = false;
+        for (int j = 0; j < candidates.size() && fatal.isEmpty(); j++) {
+            int c = candidates.at(j);
+
+            if (failedNodes.contains(c) &&
+                    failed.contains(qMakePair(c, getStateHash(c))))
+                continue;
+
+            int undoLogSize = undoLog.size();
+            QString err = solve(c);
+            if (!fatal.isEmpty())
+                break;
+
+            if (err.isEmpty()) {
+                found = true;
+                break;
+            }
+
+            rollback(undoLogSize);
+            failedNodes.insert(c);
+            failed.insert(qMakePair(c, getStateHash(c)));
+        }
+
+        if (!fatal.isEmpty())
+            break;
+
+        if (!found) {
+            res = QObject::tr("Unsatisfied dependency: %1").
+                    arg(rep->toString(*dep));
+            break;
+        }
+    }
+
+    if (!fatal.isEmpty())
+        res = QObject::tr("Error searching for the dependency matches: %1").
+                arg(fatal);
+
+    if (res.isEmpty()) {
+        const PackageVersion* pv = nodes.at(node).pv;
+        if (!installed.isInstalled(pv->package, pv->version))
+            setPlanned(node);
+    }
+
+    return res;
+}
+
+QString DependencySolver::planInstallation(const PackageVersion *pv,
+        QList<InstallOperation *> &ops, QList<PackageVersion *> &avoid,
+        const QString &where)
+{
+    for (int i = 0; i < avoid.size(); i++) {
+        PackageVersion* a = avoid.at(i);
+        initiallyAvoided.insert(getKey(a->package, a->version));
+    }
+
+    // the version may differ from the one in the repository (e.g. it was
+    // loaded from a file) and is always used as passed
+    int root = addNode(pv->clone());
+
+    QString res = solve(root);
+
+    for (int i = 0; i < avoidOrder.size(); i++) {
+        avoid.append(nodes.at(avoidOrder.at(i)).pv->clone());
+    }
+
+    if (res.isEmpty()) {
+        for (int i = 0; i < plan.size(); i++) {
+            int node = plan.at(i);
+            PackageVersion* p = nodes.at(node).pv;
+
+            QString w = node == root ? where : QString();
+
+            InstallOperation* io = new InstallOperation();
+            io->install = true;
+            io->package = p->package;
+            io->version = p->version;
+            io->where = w;
+            ops.append(io);
+
+            if (w.isEmpty()) {
+                w = p->getIdealInstallationDirectory();
+                w = WPMUtils::findNonExistingFile(w, "");
+            }
+            installed.setPackageVersionPath(p->package, p->version, w, false);
+        }
+    }
+
+    return res;
+}
@@ -0,0 +1,206 @@
+#ifndef DEPENDENCYSOLVER_H
+#define DEPENDENCYSOLVER_H
+
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+
+#include "packageversion.h"
+#include "dependency.h"
+
+class AbstractRepository;
+class InstalledPackages;
+class InstallOperation;
+
+/**
+ * @brief plans the installation of a package version together with all
+ *     dependencies. This is a replacement for the recursive search in
+ *     PackageVersion::planInstallationRecursive() that produces the same
+ *     list of operations.
+ *
+ * Package versions and dependencies are numbered. The versions of a package
+ * are only read once from the repository. The set of planned and the set of
+ * excluded package versions are not copied, but changed in place and
+ * restored using an undo log if a variant fails. A failed package version is
+ * remembered together with the state of all packages it can reach through
+ * its dependencies and is not tried again while this state does not change.
+ */
+class DependencySolver
+{
+private:
+    /** package version */
+    class Node {
+    public:
+        /** index of the package */
+        int package;
+
+        /** package version. Owned by the solver. */
+        PackageVersion* pv;
+
+        /** indexes of the dependencies */
+        QVector<int> ranges;
+
+        /** true = this version can be chosen for a dependency */
+        bool installable;
+
+        /** true = the packages reachable from this version were computed */
+        bool reachableComputed;
+
+        /** sorted indexes of the packages reachable through dependencies */
+        QVector<int> reachable;
+    };
+
+    /** dependency */
+    class Range {
+    public:
+        /** index of the package */
+        int package;
+
+        /** dependency. Owned by the solver. */
+        Dependency* dep;
+
+        /** -1 = unknown, 0 = no, 1 = fulfilled by an installed version */
+        int installed;
+    };
+
+    /** package */
+    class PackageInfo {
+    public:
+        QString name;
+
+        /** true = the versions were read from the repository */
+        bool loaded;
+
+        /** indexes of the versions in the order of the repository */
+        QVector<int> versions;
+
+        /** indexes of the planned versions */
+        QVector<int> planned;
+
+        /** hash of the planned and excluded versions */
+        quint64 stateHash;
+    };
+
+    /** entry in the undo log */
+    class Change {
+    public:
+        /** true = a version was planned, false = a version was excluded */
+        bool planned;
+
+        /** index of the version */
+        int node;
+    };
+
+    AbstractRepository* rep;
+    InstalledPackages& installed;
+
+    QVector<Node> nodes;
+    QVector<Range> ranges;
+    QVector<PackageInfo> packages;
+
+    /** package name -> index */
+    QHash<QString, int> packageIndexes;
+
+    /** package name + version -> index of the version */
+    QHash<QString, int> nodeIndexes;
+
+    /** package name + versions -> index of the dependency */
+    QHash<QString, int> rangeIndexes;
+
+    /** package versions that cannot be used. Index: version. */
+    QVector<bool> avoided;
+
+    /** versions excluded by the caller */
+    QSet<QString> initiallyAvoided;
+
+    /** planned versions in the order of installation */
+    QVector<int> plan;
+
+    /** excluded versions in the order of exclusion */
+    QVector<int> avoidOrder;
+
+    QVector<Change> undoLog;
+
+    /** versions that failed: (version, state hash) */
+    QSet<QPair<int, quint64>> failed;
+
+    /** versions that are present in "failed" */
+    QSet<int> failedNodes;
+
+    /** database error. The search is stopped if not empty. */
+    QString fatal;
+
+    static QString getKey(const QString& package, const Version& version);
+
+    static quint64 mix(quint64 v);
+
+    int getPackage(const QString& name);
+
+    /**
+     * @brief adds a package version if it does not exist yet
+     * @param pv [ownership:take] package version
+     * @return index of the version
+     */
+    int addNode(PackageVersion* pv);
+
+    int getRange(const Dependency& dep);
+
+    /**
+     * @brief reads the versions of a package from the repository
+     * @param package index of the package
+     * @return error message
+     */
+    QString loadPackage(int package);
+
+    bool isFulfilled(int range);
+
+    /**
+     * @param node index of a version
+     * @return state of all packages reachable from this version
+     */
+    quint64 getStateHash(int node);
+
+    void computeReachable(int node);
+
+    void setAvoided(int node);
+
+    void setPlanned(int node);
+
+    void rollback(int undoLogSize);
+
+    /**
+     * @brief plans the installation of a version and all the dependencies
+     * @param node index of the version
+     * @return error message
+     */
+    QString solve(int node);
+public:
+    /**
+     * @param rep repository
+     * @param installed installed package versions. This object will be
+     *     updated after a successful planning.
+     */
+    DependencySolver(AbstractRepository* rep, InstalledPackages& installed);
+
+    ~DependencySolver();
+
+    /**
+     * @brief plans the installation of a package version and all the
+     *     dependencies. See PackageVersion::planInstallation()
+     * @param pv package version that should be installed
+     * @param ops necessary operations will be appended here
+     * @param avoid package versions that cannot be installed. The package
+     *     versions excluded during the search will be appended here.
+     * @param where target directory for the installation or "" if the
+     *     directory should be chosen automatically
+     * @return error message or ""
+     */
+    QString planInstallation(const PackageVersion* pv,
+            QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
+            const QString& where);
+};
+
+#endif // DEPENDENCYSOLVER_H
@@ -0,0 +1,397 @@
+#include "directorycopier.h"
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include "wpmutils.h"
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#endif
+
+/**
+ * @brief a file that should be copied
+ */
+class CopyItem
+{
+public:
+    QString src;
+    QString dest;
+
+    /** size of the file in bytes */
+    qint64 size;
+};
+
+/**
+ * @brief state shared by the threads of one DirectoryCopier::copy() call
+ */
+class CopyTask
+{
+public:
+    DirectoryCopier::Mode mode;
+
+    std::vector<CopyItem> files;
+
+    /** index of the next file in "files" */
+    std::atomic<int> next;
+
+    /** number of copied bytes */
+    std::atomic<qint64> copied;
+
+    /** true = the threads should end because of an error or cancellation */
+    std::atomic<bool> stop;
+
+    /** number of threads that did not finish yet */
+    std::atomic<int> running;
+
+    /** the first error */
+    QMutex errMutex;
+    QString err;
+
+    /** the calling thread waits here for the end */
+    QMutex finishedMutex;
+    QWaitCondition finished;
+
+    CopyTask(): mode(DirectoryCopier::COPY), next(0), copied(0), stop(false),
+            running(0)
+    {
+    }
+
+    /**
+     * @brief stores the first error and stops all threads
+     * @param msg error message
+     */
+    void fail(const QString& msg)
+    {
+        errMutex.lock();
+        if (err.isEmpty())
+            err = msg;
+        errMutex.unlock();
+
+        stop = true;
+    }
+
+    /**
+     * @brief copies files until all are copied or the task is stopped
+     */
+    void run()
+    {
+        while (!stop) {
+            int i = next++;
+            if (i >= static_cast<int>(files.size()))
+                break;
+
+            const CopyItem& item = files.at(i);
+            QString e = copyFile(item);
+            if (!e.isEmpty())
+                fail(QString(QObject::tr("Cannot copy %1 to %2: %3")).
+                        arg(item.src, item.dest, e));
+        }
+
+        QMutexLocker ml(&finishedMutex);
+        if (--running == 0)
+            finished.wakeAll();
+    }
+
+#ifdef Q_OS_WIN
+    /**
+     * @brief data for copyProgress()
+     */
+    class Progress
+    {
+    public:
+        CopyTask* task;
+
+        /** number of bytes already added to CopyTask::copied */
+        qint64 reported;
+    };
+
+    static DWORD CALLBACK copyProgress(LARGE_INTEGER /*totalFileSize*/,
+            LARGE_INTEGER totalBytesTransferred,
+            LARGE_INTEGER /*streamSize*/,
+            LARGE_INTEGER /*streamBytesTransferred*/,
+            DWORD /*dwStreamNumber*/, DWORD /*dwCallbackReason*/,
+            HANDLE /*hSourceFile*/, HANDLE /*hDestinationFile*/,
+            LPVOID lpData)
+    {
+        Progress* p = static_cast<Progress*>(lpData);
+        qint64 t = totalBytesTransferred.QuadPart;
+        p->task->copied += t - p->reported;
+        p->reported = t;
+
+        return p->task->stop ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+    }
+
+    /**
+     * @param item a file
+     * @return error message
+     */
+    QString copyFile(const CopyItem& item)
+    {
+        // deep trees are longer than MAX_PATH
+        QString srcPath = WPMUtils::toLongPath(item.src);
+        QString destPath = WPMUtils::toLongPath(item.dest);
+        LPCWSTR src = reinterpret_cast<LPCWSTR>(srcPath.utf16());
+        LPCWSTR dest = reinterpret_cast<LPCWSTR>(destPath.utf16());
+
+        if (mode == DirectoryCopier::HARD_LINK &&
+                CreateHardLinkW(dest, src, nullptr)) {
+            copied += item.size;
+            return QString();
+        }
+
+        // CopyFileEx clones the data on ReFS and copies it on the server
+        // for network shares. There is no separate call for CLONE.
+        // A cancelled copy is deleted by CopyFileEx.
+        Progress p;
+        p.task = this;
+        p.reported = 0;
+        if (!CopyFileExW(src, dest, copyProgress, &p, nullptr,
+                COPY_FILE_FAIL_IF_EXISTS))
+            return qt_error_string();
+
+        copied += item.size - p.reported;
+
+        return QString();
+    }
+#else
+    /**
+     * @param in source file
+     * @param out destination file
+     * @return error message. An incomplete copy because of stop is also an
+     *     error.
+     */
+    QString copyData(int in, int out)
+    {
+        bool kernel = true;
+        qint64 offset = 0;
+
+#ifdef Q_OS_LINUX
+        // the data is copied (or shared) by the file system
+        if (mode == DirectoryCopier::CLONE && ioctl(out, FICLONE, in) == 0) {
+            struct stat st;
+            if (fstat(in, &st) == 0)
+                copied += st.st_size;
+            return QString();
+        }
+
+        while (!stop) {
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr,
+                    8 * 1024 * 1024, 0);
+            if (n < 0) {
+                if (offset == 0 && (errno == EXDEV || errno == ENOSYS ||
+                        errno == EINVAL || errno == EOPNOTSUPP)) {
+                    kernel = false;
+                    break;
+                }
+                return qt_error_string(errno);
+            }
+            if (n == 0)
+                break;
+            offset += n;
+            copied += n;
+        }
+#else
+        kernel = false;
+#endif
+
+        if (!kernel) {
+            std::vector<char> buffer(1024 * 1024);
+            while (!stop) {
+                ssize_t n = read(in, buffer.data(), buffer.size());
+                if (n < 0)
+                    return qt_error_string(errno);
+                if (n == 0)
+                    break;
+
+                ssize_t written = 0;
+                while (written < n) {
+                    ssize_t w = write(out, buffer.data() + written,
+                            n - written);
+                    if (w < 0)
+                        return qt_error_string(errno);
+                    written += w;
+                }
+                copied += n;
+            }
+        }
+
+        if (stop)
+            return QObject::tr("Cancelled");
+
+        return QString();
+    }
+
+    /**
+     * @param item a file
+     * @return error message
+     */
+    QString copyFile(const CopyItem& item)
+    {
+        QByteArray src = QFile::encodeName(item.src);
+        QByteArray dest = QFile::encodeName(item.dest);
+
+        if (mode == DirectoryCopier::HARD_LINK &&
+                link(src.constData(), dest.constData()) == 0) {
+            copied += item.size;
+            return QString();
+        }
+
+        QString r;
+
+        int in = open(src.constData(), O_RDONLY | O_CLOEXEC);
+        if (in < 0)
+            return qt_error_string(errno);
+
+        struct stat st;
+        int out = -1;
+        if (fstat(in, &st) != 0)
+            r = qt_error_string(errno);
+        else {
+            out = open(dest.constData(), O_WRONLY | O_CREAT | O_EXCL |
+                    O_CLOEXEC, st.st_mode & 07777);
+            if (out < 0)
+                r = qt_error_string(errno);
+        }
+
+        if (r.isEmpty())
+            r = copyData(in, out);
+
+        if (out >= 0 && close(out) != 0 && r.isEmpty())
+            r = qt_error_string(errno);
+        close(in);
+
+        // an incomplete file must not look like a copy
+        if (out >= 0 && !r.isEmpty())
+            unlink(dest.constData());
+
+        return r;
+    }
+#endif
+};
+
+DirectoryCopier::DirectoryCopier(int threads): threads(threads), mode(COPY)
+{
+    // several small files are copied at the same time. The number is
+    // limited so that the disk is not overloaded.
+    if (this->threads <= 0)
+        this->threads = std::min<int>(4,
+                std::max<int>(2, QThread::idealThreadCount()));
+}
+
+void DirectoryCopier::setMode(Mode mode)
+{
+    this->mode = mode;
+}
+
+DirectoryCopier::Mode DirectoryCopier::getMode() const
+{
+    return mode;
+}
+
+void DirectoryCopier::copy(Job* job, const QString& src, const QString& dest)
+{
+    CopyTask task;
+    task.mode = mode;
+
+    QDir srcDir(src);
+    QDir destDir(dest);
+
+    if (job->shouldProceed()) {
+        if (!srcDir.exists())
+            job->setErrorMessage(QString(QObject::tr(
+                    "The directory %1 does not exist")).arg(src));
+        else if (!destDir.mkpath(destDir.absolutePath()))
+            job->setErrorMessage(QString(QObject::tr(
+                    "Cannot create the directory %1")).arg(dest));
+    }
+
+    // the directories are created while the tree is listed. The files are
+    // copied later so that the number of bytes is known.
+    qint64 total = 0;
+    if (job->shouldProceed()) {
+        QDirIterator it(srcDir.absolutePath(), QDir::AllEntries |
+                QDir::Hidden | QDir::System | QDir::NoDotAndDotDot |
+                QDir::NoSymLinks, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            QString relPath = srcDir.relativeFilePath(it.next());
+            QFileInfo fi = it.fileInfo();
+            if (fi.isDir()) {
+                if (!destDir.mkpath(relPath)) {
+                    job->setErrorMessage(QString(QObject::tr(
+                            "Cannot create the directory %1")).arg(
+                            QDir::toNativeSeparators(
+                            destDir.filePath(relPath))));
+                    break;
+                }
+            } else {
+                CopyItem item;
+                item.src = QDir::toNativeSeparators(fi.absoluteFilePath());
+                item.dest = QDir::toNativeSeparators(
+                        destDir.absoluteFilePath(relPath));
+                item.size = fi.size();
+                total += item.size;
+                task.files.push_back(item);
+            }
+
+            if ((task.files.size() & 1023) == 0 && !job->shouldProceed())
+                break;
+        }
+    }
+
+    if (job->shouldProceed() && !task.files.empty()) {
+        int n = std::min<int>(threads, static_cast<int>(task.files.size()));
+        task.running = n;
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(n);
+        for (int i = 0; i < n; i++) {
+            QtConcurrent::run(&pool, [&task]() {
+                task.run();
+            });
+        }
+
+        // the progress is only reported from this thread
+        task.finishedMutex.lock();
+        while (task.running > 0) {
+            task.finished.wait(&task.finishedMutex, 100);
+
+            if (!job->shouldProceed())
+                task.stop = true;
+
+            if (total > 0)
+                job->setProgress(std::min<double>(0.99,
+                        static_cast<double>(task.copied) / total));
+        }
+        task.finishedMutex.unlock();
+        pool.waitForDone();
+
+        if (!task.err.isEmpty())
+            job->setErrorMessage(task.err);
+    }
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
+    job->complete();
+}
@@ -0,0 +1,79 @@
+#ifndef DIRECTORYCOPIER_H
+#define DIRECTORYCOPIER_H
+
+#include <QString>
+
+#include "job.h"
+
+/**
+ * @brief copies a directory tree using several threads.
+ *
+ * The source tree is listed first so that the progress can be computed from
+ * the number of copied bytes. The directories are created in the
+ * destination and the files are copied by a bounded number of threads. The
+ * copying itself is done by the OS where possible: CopyFileEx on Windows
+ * (which also uses block cloning on ReFS and server-side copies on network
+ * shares) and copy_file_range() on Linux. Otherwise a large buffer is used.
+ * Paths longer than MAX_PATH are supported on Windows.
+ *
+ * Existing files in the destination are not overwritten. Files that were
+ * not completely copied because of an error or cancellation are deleted.
+ */
+class DirectoryCopier
+{
+public:
+    /**
+     * @brief how the files are transferred
+     */
+    enum Mode {
+        /** the data is copied */
+        COPY,
+
+        /**
+         * hard links are created. The files in both directories share the
+         * same data and should not be changed. Files that cannot be linked
+         * (e.g. on another volume) are copied.
+         */
+        HARD_LINK,
+
+        /**
+         * the data is cloned (copy-on-write) if the file system supports it
+         * (e.g. Btrfs, XFS using FICLONE) and copied otherwise. On Windows
+         * this is the same as COPY: the files are only cloned by CopyFileEx
+         * itself (e.g. on ReFS volumes that support block cloning).
+         */
+        CLONE
+    };
+private:
+    int threads;
+    Mode mode;
+public:
+    /**
+     * @param threads number of threads. 0 = depending on the number of CPUs
+     */
+    explicit DirectoryCopier(int threads=0);
+
+    /**
+     * @param mode how the files are transferred. The default value is COPY.
+     */
+    void setMode(Mode mode);
+
+    /**
+     * @return how the files are transferred
+     */
+    Mode getMode() const;
+
+    /**
+     * @brief copies a directory with all files and subdirectories. The
+     *     copying stops at the first error. The progress of the job is
+     *     updated from the calling thread using the number of copied bytes
+     *     and the copying is stopped if the job is cancelled.
+     * @param job progress for this task
+     * @param src source directory
+     * @param dest destination directory. It will be created if it does not
+     *     exist.
+     */
+    void copy(Job* job, const QString& src, const QString& dest);
+};
+
+#endif // DIRECTORYCOPIER_H
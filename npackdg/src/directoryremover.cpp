@@ -0,0 +1,404 @@
+#include "directoryremover.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include "wpmutils.h"
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief a directory that is being deleted
+ */
+class RemoveNode
+{
+public:
+    QString path;
+
+    /** parent directory or nullptr for the root */
+    RemoveNode* parent;
+
+    /**
+     * number of subdirectories that are not yet removed + 1 while the
+     * directory itself is being listed
+     */
+    std::atomic<int> remaining;
+
+    RemoveNode(const QString& path, RemoveNode* parent): path(path),
+            parent(parent), remaining(1)
+    {
+    }
+};
+
+/**
+ * @brief the queue of one thread
+ */
+class RemoveQueue
+{
+public:
+    QMutex mutex;
+
+    /** the owner takes from the back, other threads from the front */
+    std::deque<RemoveNode*> queue;
+
+    /** all directories found by the owner */
+    std::vector<std::unique_ptr<RemoveNode> > nodes;
+};
+
+/**
+ * @brief state shared by the threads of one DirectoryRemover::remove() call
+ */
+class RemoveTask
+{
+public:
+    std::vector<std::unique_ptr<RemoveQueue> > queues;
+
+    /** number of directories in the queues */
+    std::atomic<int> queued;
+
+    /** number of threads that did not finish yet */
+    std::atomic<int> running;
+
+    /** true = the threads should end because of an error or cancellation */
+    std::atomic<bool> stop;
+
+    /** true = the root directory was removed */
+    std::atomic<bool> done;
+
+    /** number of found files and directories */
+    std::atomic<qint64> found;
+
+    /** number of removed files and directories */
+    std::atomic<qint64> removed;
+
+    /** the first error */
+    QMutex errMutex;
+    QString err;
+
+    /** idle threads wait here for new directories */
+    QMutex idleMutex;
+    QWaitCondition idle;
+
+    /** the calling thread waits here for the end */
+    QMutex finishedMutex;
+    QWaitCondition finished;
+
+    explicit RemoveTask(int threads): queued(0), running(threads),
+            stop(false), done(false), found(1), removed(0)
+    {
+        for (int i = 0; i < threads; i++) {
+            queues.push_back(std::unique_ptr<RemoveQueue>(new RemoveQueue()));
+        }
+    }
+
+    /**
+     * @brief stores the first error and stops all threads
+     * @param msg error message
+     */
+    void fail(const QString& msg)
+    {
+        errMutex.lock();
+        if (err.isEmpty())
+            err = msg;
+        errMutex.unlock();
+
+        stop = true;
+        idle.wakeAll();
+    }
+
+    /**
+     * @brief adds a directory to the queue of a thread
+     * @param thread index of the thread
+     * @param n the directory
+     */
+    void push(int thread, RemoveNode* n)
+    {
+        RemoveQueue* q = queues.at(thread).get();
+        q->mutex.lock();
+        q->queue.push_back(n);
+        q->mutex.unlock();
+
+        queued++;
+        idle.wakeOne();
+    }
+
+    /**
+     * @brief takes a directory from the own queue or from another thread
+     * @param thread index of the thread
+     * @return the directory or nullptr
+     */
+    RemoveNode* take(int thread)
+    {
+        RemoveNode* r = nullptr;
+
+        // depth first for the own queue keeps the queues short
+        RemoveQueue* own = queues.at(thread).get();
+        own->mutex.lock();
+        if (!own->queue.empty()) {
+            r = own->queue.back();
+            own->queue.pop_back();
+        }
+        own->mutex.unlock();
+
+        const int n = static_cast<int>(queues.size());
+        for (int i = 1; i < n && !r; i++) {
+            RemoveQueue* q = queues.at((thread + i) % n).get();
+            q->mutex.lock();
+            if (!q->queue.empty()) {
+                r = q->queue.front();
+                q->queue.pop_front();
+            }
+            q->mutex.unlock();
+        }
+
+        if (r)
+            queued--;
+
+        return r;
+    }
+
+    /**
+     * @brief removes a directory with a removed content and all parent
+     *     directories that became empty
+     * @param n the directory
+     */
+    void removeEmpty(RemoveNode* n)
+    {
+        while (n) {
+            if (!removeDir(n->path)) {
+                fail(QString(QObject::tr(
+                        "Cannot delete the directory: %1")).arg(n->path));
+                break;
+            }
+            removed++;
+
+            RemoveNode* p = n->parent;
+            if (!p) {
+                done = true;
+                idle.wakeAll();
+                break;
+            }
+
+            n = (--p->remaining == 0) ? p : nullptr;
+        }
+    }
+
+    /**
+     * @brief deletes the files in a directory and queues the subdirectories
+     * @param thread index of the thread
+     * @param n the directory
+     */
+    void list(int thread, RemoveNode* n)
+    {
+        RemoveQueue* own = queues.at(thread).get();
+
+#ifdef Q_OS_WIN
+        // deep trees are longer than MAX_PATH
+        QString pattern = WPMUtils::toLongPath(n->path) +
+                QStringLiteral("\\*");
+        WIN32_FIND_DATAW fd;
+        HANDLE h = FindFirstFileExW(
+                reinterpret_cast<LPCWSTR>(pattern.utf16()), FindExInfoBasic,
+                &fd, FindExSearchNameMatch, nullptr,
+                FIND_FIRST_EX_LARGE_FETCH);
+
+        // a directory that cannot be listed is reported by RemoveDirectory
+        if (h != INVALID_HANDLE_VALUE) {
+            do {
+                QString name = QString::fromWCharArray(fd.cFileName);
+                if (name == QStringLiteral(".") || name == QStringLiteral(".."))
+                    continue;
+
+                QString path = n->path + QStringLiteral("\\") + name;
+                found++;
+                if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+                        !(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                    RemoveNode* sub = new RemoveNode(path, n);
+                    own->nodes.push_back(std::unique_ptr<RemoveNode>(sub));
+                    n->remaining++;
+                    push(thread, sub);
+                } else if (removeEntry(path,
+                        (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)) {
+                    removed++;
+                } else {
+                    fail(QString(QObject::tr("Cannot delete the file: %1")).
+                            arg(path));
+                }
+            } while (!stop && FindNextFileW(h, &fd));
+            FindClose(h);
+        }
+#else
+        DIR* d = opendir(QFile::encodeName(n->path).constData());
+        if (d) {
+            struct dirent* e;
+            while (!stop && (e = readdir(d)) != nullptr) {
+                QString name = QFile::decodeName(e->d_name);
+                if (name == QStringLiteral(".") || name == QStringLiteral(".."))
+                    continue;
+
+                QString path = n->path + QStringLiteral("/") + name;
+                bool isDir = e->d_type == DT_DIR;
+                if (e->d_type == DT_UNKNOWN) {
+                    struct stat st;
+                    isDir = lstat(QFile::encodeName(path).constData(),
+                            &st) == 0 && S_ISDIR(st.st_mode);
+                }
+
+                found++;
+                if (isDir) {
+                    RemoveNode* sub = new RemoveNode(path, n);
+                    own->nodes.push_back(std::unique_ptr<RemoveNode>(sub));
+                    n->remaining++;
+                    push(thread, sub);
+                } else if (removeEntry(path, false)) {
+                    removed++;
+                } else {
+                    fail(QString(QObject::tr("Cannot delete the file: %1")).
+                            arg(path));
+                }
+            }
+            closedir(d);
+        }
+#endif
+
+        if (!stop && --n->remaining == 0)
+            removeEmpty(n);
+    }
+
+    /**
+     * @param path a file or a directory link
+     * @param link true = directory link
+     * @return true if the entry does not exist anymore
+     */
+    static bool removeEntry(const QString& path, bool link)
+    {
+#ifdef Q_OS_WIN
+        QString lp = WPMUtils::toLongPath(path);
+        LPCWSTR p = reinterpret_cast<LPCWSTR>(lp.utf16());
+        bool r = link ? RemoveDirectoryW(p) : DeleteFileW(p);
+        return r || GetFileAttributesW(p) == INVALID_FILE_ATTRIBUTES;
+#else
+        Q_UNUSED(link)
+        QByteArray p = QFile::encodeName(path);
+        return unlink(p.constData()) == 0 || errno == ENOENT;
+#endif
+    }
+
+    /**
+     * @param path an empty directory
+     * @return true if the directory was removed
+     */
+    static bool removeDir(const QString& path)
+    {
+#ifdef Q_OS_WIN
+        return RemoveDirectoryW(reinterpret_cast<LPCWSTR>(
+                WPMUtils::toLongPath(path).utf16()));
+#else
+        return rmdir(QFile::encodeName(path).constData()) == 0;
+#endif
+    }
+
+    /**
+     * @brief processes directories until the tree is removed or the task is
+     *     stopped
+     * @param thread index of the thread
+     */
+    void run(int thread)
+    {
+        while (!stop && !done) {
+            RemoveNode* n = take(thread);
+            if (n) {
+                list(thread, n);
+            } else {
+                // the timeout covers a wake-up between take() and wait()
+                QMutexLocker ml(&idleMutex);
+                if (!stop && !done && queued == 0)
+                    idle.wait(&idleMutex, 10);
+            }
+        }
+
+        QMutexLocker ml(&finishedMutex);
+        if (--running == 0)
+            finished.wakeAll();
+    }
+};
+
+DirectoryRemover::DirectoryRemover(int threads): threads(threads)
+{
+    // deleting is limited by the file system and not by the CPU
+    if (this->threads <= 0)
+        this->threads = std::min<int>(8,
+                std::max<int>(2, QThread::idealThreadCount()));
+}
+
+void DirectoryRemover::remove(Job* job, const QString& dir)
+{
+    QFileInfo fi(dir);
+    if (!fi.isDir()) {
+        job->setProgress(1);
+        job->complete();
+        return;
+    }
+
+    RemoveTask task(threads);
+    RemoveQueue* first = task.queues.at(0).get();
+    RemoveNode* root = new RemoveNode(QDir::toNativeSeparators(
+            fi.absoluteFilePath()), nullptr);
+    first->nodes.push_back(std::unique_ptr<RemoveNode>(root));
+    task.push(0, root);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < threads; i++) {
+        QtConcurrent::run(&pool, [&task, i]() {
+            task.run(i);
+        });
+    }
+
+    // the progress is only reported from this thread
+    double progress = 0;
+    task.finishedMutex.lock();
+    while (task.running > 0) {
+        task.finished.wait(&task.finishedMutex, 100);
+
+        if (!job->shouldProceed()) {
+            task.stop = true;
+            task.idle.wakeAll();
+        }
+
+        // the number of found entries grows during the deletion
+        double p = static_cast<double>(task.removed) / task.found;
+        if (p > progress && p < 1) {
+            progress = p;
+            job->setProgress(progress);
+        }
+    }
+    task.finishedMutex.unlock();
+    pool.waitForDone();
+
+    if (!task.err.isEmpty())
+        job->setErrorMessage(task.err);
+    else if (task.done)
+        job->setProgress(1);
+
+    job->complete();
+}
@@ -0,0 +1,41 @@
+#ifndef DIRECTORYREMOVER_H
+#define DIRECTORYREMOVER_H
+
+#include <QString>
+
+#include "job.h"
+
+/**
+ * @brief deletes a directory tree using several threads.
+ *
+ * Every thread has its own queue of directories. A thread lists a
+ * directory, deletes the files and adds the subdirectories to its queue. An
+ * idle thread takes directories from the queues of the other threads. A
+ * directory is removed by the thread that finishes its last subdirectory.
+ * The entries are listed without reading the file information where the
+ * OS supports it (FindFirstFileEx on Windows, readdir on other systems).
+ *
+ * Directory links (junctions, symbolic links) are removed without deleting
+ * the files in the target directory.
+ */
+class DirectoryRemover
+{
+    int threads;
+public:
+    /**
+     * @param threads number of threads. 0 = depending on the number of CPUs
+     */
+    explicit DirectoryRemover(int threads=0);
+
+    /**
+     * @brief deletes a directory with all files and subdirectories. The
+     *     deletion stops at the first error. The progress of the job is
+     *     updated from the calling thread and the deletion is stopped if the
+     *     job is cancelled.
+     * @param job progress for this task
+     * @param dir this directory will be deleted
+     */
+    void remove(Job* job, const QString& dir);
+};
+
+#endif // DIRECTORYREMOVER_H
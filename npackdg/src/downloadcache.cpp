@@ -0,0 +1,335 @@
+#include "downloadcache.h"
+
+#include <windows.h>
+#include <shlobj.h>
+#include <algorithm>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QVector>
+
+#include "wpmutils.h"
+#include "packageutils.h"
+#include "windowsregistry.h"
+
+DownloadCache::DownloadCache(const QString &dir, const QString &sharedDir,
+        qint64 maxSize): dir(dir), sharedDir(sharedDir), maxSize(maxSize)
+{
+}
+
+DownloadCache* DownloadCache::getDefault()
+{
+    static DownloadCache* def = nullptr;
+    static QMutex defMutex;
+
+    QMutexLocker ml(&defMutex);
+    if (!def) {
+        QString dir = WPMUtils::getShellDir(PackageUtils::globalMode ?
+                CSIDL_COMMON_APPDATA : CSIDL_LOCAL_APPDATA) +
+                QStringLiteral("\\Npackd\\Cache\\Downloads");
+
+        QString shared;
+        qint64 maxSize = DEFAULT_MAX_SIZE;
+        bool maxSizeFound = false;
+
+        // the policies have priority
+        WindowsRegistry npackd;
+        QString err = npackd.open(HKEY_LOCAL_MACHINE,
+                QStringLiteral("SOFTWARE\\Policies\\Npackd"), false, KEY_READ);
+        if (err.isEmpty()) {
+            shared = npackd.get(QStringLiteral("downloadCacheSharedDir"),
+                    &err);
+            DWORD v = npackd.getDWORD(QStringLiteral("downloadCacheMaxSize"),
+                    &err);
+            if (err.isEmpty()) {
+                maxSize = static_cast<qint64>(v) * 1024 * 1024;
+                maxSizeFound = true;
+            }
+        }
+
+        err = npackd.open(
+                PackageUtils::globalMode ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER,
+                QStringLiteral("Software\\Npackd\\Npackd"), false, KEY_READ);
+        if (err.isEmpty()) {
+            if (shared.isEmpty())
+                shared = npackd.get(QStringLiteral("downloadCacheSharedDir"),
+                        &err);
+            if (!maxSizeFound) {
+                DWORD v = npackd.getDWORD(
+                        QStringLiteral("downloadCacheMaxSize"), &err);
+                if (err.isEmpty())
+                    maxSize = static_cast<qint64>(v) * 1024 * 1024;
+            }
+        }
+
+        def = new DownloadCache(QDir::toNativeSeparators(dir),
+                QDir::toNativeSeparators(shared), maxSize);
+    }
+
+    return def;
+}
+
+QString DownloadCache::saveSettings() const
+{
+    WindowsRegistry m(
+            PackageUtils::globalMode ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER,
+            false, KEY_ALL_ACCESS);
+    QString err;
+    WindowsRegistry npackd = m.createSubKey(
+            QStringLiteral("Software\\Npackd\\Npackd"), &err,
+            KEY_ALL_ACCESS);
+    if (err.isEmpty())
+        err = npackd.set(QStringLiteral("downloadCacheSharedDir"),
+                getSharedDir());
+    if (err.isEmpty())
+        err = npackd.setDWORD(QStringLiteral("downloadCacheMaxSize"),
+                static_cast<DWORD>(getMaxSize() / (1024 * 1024)));
+
+    return err;
+}
+
+QString DownloadCache::getDir() const
+{
+    return dir;
+}
+
+QString DownloadCache::getSharedDir() const
+{
+    QMutexLocker ml(&mutex);
+    return sharedDir;
+}
+
+void DownloadCache::setSharedDir(const QString &sharedDir)
+{
+    QMutexLocker ml(&mutex);
+    this->sharedDir = QDir::toNativeSeparators(sharedDir);
+}
+
+qint64 DownloadCache::getMaxSize() const
+{
+    QMutexLocker ml(&mutex);
+    return maxSize;
+}
+
+void DownloadCache::setMaxSize(qint64 maxSize)
+{
+    QMutexLocker ml(&mutex);
+    this->maxSize = maxSize;
+}
+
+QString DownloadCache::getRelativePath(QCryptographicHash::Algorithm alg,
+        const QString &hashSum)
+{
+    QString a;
+    switch (alg) {
+        case QCryptographicHash::Sha1:
+            a = QStringLiteral("sha1");
+            break;
+        case QCryptographicHash::Sha256:
+            a = QStringLiteral("sha256");
+            break;
+        default:
+            return QString();
+    }
+
+    // the hash sum comes from a repository and becomes a part of a path
+    QString h = hashSum.toLower();
+    if (h.isEmpty())
+        return QString();
+    for (int i = 0; i < h.length(); i++) {
+        QChar c = h.at(i);
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return QString();
+    }
+
+    return a + QStringLiteral("\\") + h;
+}
+
+QString DownloadCache::find(QCryptographicHash::Algorithm alg,
+        const QString &hashSum)
+{
+    QString rel = getRelativePath(alg, hashSum);
+    if (rel.isEmpty() || getMaxSize() == 0)
+        return QString();
+
+    QString path = dir + QStringLiteral("\\") + rel;
+    QFile f(path);
+    if (f.exists()) {
+        // the modification time is used to find the least recently used files
+        if (f.open(QIODevice::Append)) {
+            f.setFileTime(QDateTime::currentDateTimeUtc(),
+                    QFileDevice::FileModificationTime);
+            f.close();
+        }
+        return path;
+    }
+
+    QString shared = getSharedDir();
+    if (!shared.isEmpty()) {
+        path = shared + QStringLiteral("\\") + rel;
+        if (QFileInfo::exists(path))
+            return path;
+    }
+
+    return QString();
+}
+
+QString DownloadCache::add(const QString &file,
+        QCryptographicHash::Algorithm alg, const QString &hashSum)
+{
+    QString rel = getRelativePath(alg, hashSum);
+    qint64 max = getMaxSize();
+    if (rel.isEmpty() || max == 0)
+        return QString();
+
+    QString err;
+
+    QString path = dir + QStringLiteral("\\") + rel;
+    if (QFileInfo::exists(path))
+        return err;
+
+    if (QFileInfo(file).size() > max)
+        return err;
+
+    QDir d;
+    QString parent = QFileInfo(path).absolutePath();
+    if (!d.mkpath(parent))
+        err = QString(QObject::tr("Cannot create directory: %0")).arg(parent);
+
+    // the file is only visible under its final name when it is complete
+    QString tmp = path + QStringLiteral(".%1_%2.part").
+            arg(GetCurrentProcessId()).arg(GetCurrentThreadId());
+    if (err.isEmpty()) {
+        QFile::remove(tmp);
+
+        // a hard link does not need any additional space if the file is on
+        // the same volume
+        if (!CreateHardLinkW(WPMUtils::toLPWSTR(tmp),
+                WPMUtils::toLPWSTR(file), nullptr) &&
+                !QFile::copy(file, tmp)) {
+            err = QString(QObject::tr("Cannot copy %1 to %2")).
+                    arg(file, tmp);
+        }
+    }
+
+    if (err.isEmpty()) {
+        if (!MoveFileExW(WPMUtils::toLPWSTR(tmp), WPMUtils::toLPWSTR(path),
+                MOVEFILE_REPLACE_EXISTING)) {
+            WPMUtils::formatMessage(GetLastError(), &err);
+            QFile::remove(tmp);
+        }
+    }
+
+    if (err.isEmpty())
+        err = prune(max);
+
+    return err;
+}
+
+QString DownloadCache::getPartialDownloadPath(const QUrl &url) const
+{
+    if (getMaxSize() == 0)
+        return QString();
+
+    QString partial = dir + QStringLiteral("\\partial");
+    QDir d;
+    if (!d.mkpath(partial))
+        return QString();
+
+    QString name = QString::fromLatin1(QCryptographicHash::hash(
+            url.toString(QUrl::FullyEncoded).toUtf8(),
+            QCryptographicHash::Sha1).toHex());
+    return partial + QStringLiteral("\\") + name +
+            QStringLiteral(".download");
+}
+
+void DownloadCache::remove(QCryptographicHash::Algorithm alg,
+        const QString &hashSum)
+{
+    QString rel = getRelativePath(alg, hashSum);
+    if (!rel.isEmpty()) {
+        QMutexLocker ml(&mutex);
+        QFile::remove(dir + QStringLiteral("\\") + rel);
+    }
+}
+
+QString DownloadCache::prune(qint64 maxSize, int* removed)
+{
+    QMutexLocker ml(&mutex);
+
+    QString err;
+    if (removed)
+        *removed = 0;
+
+    QVector<QFileInfo> files;
+    qint64 size = 0;
+    QDateTime old = QDateTime::currentDateTimeUtc().addDays(-1);
+    QDateTime oldPartial = QDateTime::currentDateTimeUtc().addDays(-7);
+    QString partial = QDir(dir + QStringLiteral("\\partial")).absolutePath();
+    QDirIterator it(dir, QDir::Files | QDir::Hidden | QDir::System,
+            QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        QFileInfo fi = it.fileInfo();
+        if (fi.suffix() == QStringLiteral("part")) {
+            // left over from a process that was terminated
+            if (fi.lastModified().toUTC() < old)
+                QFile::remove(fi.absoluteFilePath());
+        } else if (fi.absolutePath() == partial) {
+            // incomplete downloads that were not resumed
+            if (fi.lastModified().toUTC() < oldPartial)
+                QFile::remove(fi.absoluteFilePath());
+        } else {
+            files.append(fi);
+            size += fi.size();
+        }
+    }
+
+    // the least recently used files first
+    std::sort(files.begin(), files.end(),
+            [](const QFileInfo& a, const QFileInfo& b) {
+        return a.lastModified() < b.lastModified();
+    });
+
+    for (int i = 0; i < files.size() && size > maxSize; i++) {
+        const QFileInfo& fi = files.at(i);
+        if (QFile::remove(fi.absoluteFilePath())) {
+            size -= fi.size();
+            if (removed)
+                (*removed)++;
+        } else if (err.isEmpty()) {
+            err = QString(QObject::tr("Cannot delete the file %1")).
+                    arg(fi.absoluteFilePath());
+        }
+    }
+
+    return err;
+}
+
+DownloadCacheStatistics DownloadCache::getStatistics() const
+{
+    DownloadCacheStatistics r;
+    r.dir = dir;
+    r.sharedDir = getSharedDir();
+    r.maxSize = getMaxSize();
+
+    QMutexLocker ml(&mutex);
+    QString partial = QDir(dir + QStringLiteral("\\partial")).absolutePath();
+    QDirIterator it(dir, QDir::Files | QDir::Hidden | QDir::System,
+            QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        QFileInfo fi = it.fileInfo();
+        if (fi.suffix() != QStringLiteral("part") &&
+                fi.absolutePath() != partial) {
+            r.files++;
+            r.size += fi.size();
+        }
+    }
+
+    return r;
+}
@@ -0,0 +1,177 @@
+#ifndef DOWNLOADCACHE_H
+#define DOWNLOADCACHE_H
+
+#include <QString>
+#include <QMutex>
+#include <QUrl>
+#include <QCryptographicHash>
+
+/**
+ * @brief statistics for a DownloadCache
+ */
+class DownloadCacheStatistics
+{
+public:
+    /** local cache directory */
+    QString dir;
+
+    /** read-only shared directory or "" */
+    QString sharedDir;
+
+    /** number of files in the local directory */
+    int files = 0;
+
+    /** size of the files in the local directory in bytes */
+    qint64 size = 0;
+
+    /** maximum size in bytes */
+    qint64 maxSize = 0;
+};
+
+/**
+ * @brief content-addressed cache for downloaded package binaries. A file is
+ *     stored under its hash sum and can be used by every package version
+ *     with the same hash sum.
+ *
+ * The files are stored in the local directory as
+ * <dir>\<algorithm>\<hash sum>. A file is copied to a temporary name first
+ * and renamed after that so that an incomplete file is never found. The
+ * least recently used files are removed if the size of the directory exceeds
+ * the maximum size.
+ *
+ * Incomplete downloads are stored in <dir>\partial so that they can be
+ * resumed later. They are not counted as cached files and are removed after
+ * 7 days.
+ *
+ * The optional shared directory (e.g. a network share) has the same layout,
+ * is only read and is used if a file is not available locally. The files
+ * from the cache should always be verified by the caller.
+ */
+class DownloadCache
+{
+private:
+    static const qint64 DEFAULT_MAX_SIZE = 4096LL * 1024 * 1024;
+
+    QString dir;
+    QString sharedDir;
+    qint64 maxSize;
+
+    /** serializes removing files */
+    mutable QMutex mutex;
+
+    /**
+     * @param alg algorithm
+     * @param hashSum hash sum
+     * @return path relative to the cache directory or "" if the hash sum is
+     *     not valid
+     */
+    static QString getRelativePath(QCryptographicHash::Algorithm alg,
+            const QString& hashSum);
+public:
+    /**
+     * @param dir local cache directory
+     * @param sharedDir read-only shared directory or ""
+     * @param maxSize maximum size of the local directory in bytes. 0 means
+     *     that the cache is disabled.
+     */
+    DownloadCache(const QString& dir, const QString& sharedDir,
+            qint64 maxSize);
+
+    DownloadCache(const DownloadCache&) = delete;
+    DownloadCache& operator=(const DownloadCache&) = delete;
+
+    /**
+     * @brief returns the default cache. The settings are read from the
+     *     registry on the first call.
+     * @return [ownership:this] the cache
+     */
+    static DownloadCache* getDefault();
+
+    /**
+     * @brief stores the shared directory and the maximum size in the registry
+     * @return error message
+     */
+    QString saveSettings() const;
+
+    /**
+     * @return local cache directory
+     */
+    QString getDir() const;
+
+    /**
+     * @return read-only shared directory or ""
+     */
+    QString getSharedDir() const;
+
+    /**
+     * @param sharedDir read-only shared directory or ""
+     */
+    void setSharedDir(const QString& sharedDir);
+
+    /**
+     * @return maximum size of the local directory in bytes. 0 means that the
+     *     cache is disabled.
+     */
+    qint64 getMaxSize() const;
+
+    /**
+     * @param maxSize maximum size of the local directory in bytes. 0 means
+     *     that the cache is disabled.
+     */
+    void setMaxSize(qint64 maxSize);
+
+    /**
+     * @brief searches for a file in the local and the shared directory. A
+     *     file found in the local directory is marked as recently used.
+     * @param alg algorithm
+     * @param hashSum hash sum
+     * @return full path to the file or "" if it is not cached
+     */
+    QString find(QCryptographicHash::Algorithm alg, const QString& hashSum);
+
+    /**
+     * @brief adds a file to the local directory. The file is not changed. The
+     *     least recently used files are removed if the maximum size is
+     *     exceeded.
+     * @param file the file. The hash sum should already be verified.
+     * @param alg algorithm
+     * @param hashSum hash sum of the file
+     * @return error message
+     */
+    QString add(const QString& file, QCryptographicHash::Algorithm alg,
+            const QString& hashSum);
+
+    /**
+     * @brief returns the path for an incomplete download. The same URL
+     *     always uses the same file.
+     * @param url URL of the file
+     * @return full path or "" if the cache is disabled or the directory
+     *     cannot be created
+     */
+    QString getPartialDownloadPath(const QUrl& url) const;
+
+    /**
+     * @brief removes a file from the local directory, e.g. because its
+     *     content does not match the hash sum
+     * @param alg algorithm
+     * @param hashSum hash sum
+     */
+    void remove(QCryptographicHash::Algorithm alg, const QString& hashSum);
+
+    /**
+     * @brief removes the least recently used files from the local directory
+     * @param maxSize maximum size of the local directory after pruning in
+     *     bytes
+     * @param removed if not null, the number of removed files will be
+     *     stored here
+     * @return error message
+     */
+    QString prune(qint64 maxSize, int* removed=nullptr);
+
+    /**
+     * @return statistics for the local directory
+     */
+    DownloadCacheStatistics getStatistics() const;
+};
+
+#endif // DOWNLOADCACHE_H
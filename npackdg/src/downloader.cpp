@@ -1,8 +1,6 @@
 #include <math.h>
 #include <stdint.h>
-
-#include <windows.h>
-#include <wininet.h>
+#include <algorithm>
 
 #include <zlib.h>
 
@@ -11,35 +9,35 @@
 #include <QMutex>
 #include <QCryptographicHash>
 #include <QLoggingCategory>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QVector>
+#include <QThreadPool>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "downloader.h"
+#include "httptransport.h"
 #include "job.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
 #include "wpmutils.h"
 
 HWND defaultPasswordWindow = nullptr;
-QMutex loginDialogMutex;
+#else
+Q_DECLARE_LOGGING_CATEGORY(npackd)
+#endif
 
-DWORD __stdcall myInternetAuthNotifyCallback(DWORD_PTR /* dwContext */,
-        DWORD dwReturn, LPVOID /* lpReserved */) {
-    qCDebug(npackd) << "myInternetAuthNotifyCallback" << dwReturn;
-    return 0;
-}
+QMutex loginDialogMutex;
 
-int64_t Downloader::downloadWin(Job* job, const Request& request,
+int64_t Downloader::downloadHTTP(Job* job, const Request& request,
         Downloader::Response* response)
 {
-    QUrl url = request.url;
-    QString verb = request.httpMethod;
-    QFile* file = request.file;
-    QString* mime = &response->mimeType;
-    QString* contentDisposition = &response->contentDisposition;
-    HWND parentWindow = defaultPasswordWindow;
     QString* sha1 = &response->hashSum;
-    bool useCache = request.useCache;
-    QCryptographicHash::Algorithm alg = request.alg;
-    bool keepConnection = request.keepConnection;
-    bool interactive = request.interactive;
-
     QString initialTitle = job->getTitle();
 
     job->setTitle(initialTitle + " / " + QObject::tr("Connecting"));
@@ -47,394 +45,44 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
     if (sha1)
         sha1->clear();
 
-    QString server = url.host();
-    QString resource = url.path();
-    QString encQuery = url.query(QUrl::FullyEncoded);
-    if (!encQuery.isEmpty())
-        resource.append('?').append(encQuery);
-
-    QString agent("Npackd/");
-    agent.append(NPACKD_VERSION);
-
-    agent += " (compatible; MSIE 9.0)";
-
-    HINTERNET internet = InternetOpenW(WPMUtils::toLPWSTR(agent),
-            INTERNET_OPEN_TYPE_PRECONFIG,
-            nullptr, nullptr, 0);
+    HttpTransport* transport = request.transport ? request.transport :
+            HttpTransport::getDefault();
 
-    if (internet == nullptr) {
-        QString errMsg;
-        WPMUtils::formatMessage(GetLastError(), &errMsg);
-        job->setErrorMessage(errMsg);
-    }
+    bool gzip = false;
+    HttpConnection* connection = transport->open(job, request, response,
+            &gzip);
 
     if (job->shouldProceed()) {
-        // change the timeout to 5 minutes
-        DWORD rec_timeout = static_cast<DWORD>(request.timeout) * 1000;
-        InternetSetOption(internet, INTERNET_OPTION_RECEIVE_TIMEOUT,
-                &rec_timeout, sizeof(rec_timeout));
-        InternetSetOption(internet, INTERNET_OPTION_SEND_TIMEOUT,
-                &rec_timeout, sizeof(rec_timeout));
-
-        // enable automatic gzip decoding
-#ifndef INTERNET_OPTION_HTTP_DECODING
-        const DWORD INTERNET_OPTION_HTTP_DECODING = 65;
-#endif
-        BOOL b = TRUE;
-        InternetSetOption(internet, INTERNET_OPTION_HTTP_DECODING,
-                &b, sizeof(b));
+        int status = response->statusCode;
 
-        job->setProgress(0.01);
-    }
-
-    // here "internet" cannot be 0, but we add the comparison to silence
-    // Coverity
-    HINTERNET hConnectHandle = nullptr;
-    if (job->shouldProceed() && internet != nullptr) {
-        INTERNET_PORT port = static_cast<INTERNET_PORT>(
-                url.port(url.scheme() == "https" ?
-                INTERNET_DEFAULT_HTTPS_PORT: INTERNET_DEFAULT_HTTP_PORT));
-        hConnectHandle = InternetConnectW(internet,
-                WPMUtils::toLPWSTR(server), port, nullptr, nullptr, INTERNET_SERVICE_HTTP, 0, 0);
-
-        if (hConnectHandle == nullptr) {
-            QString errMsg;
-            WPMUtils::formatMessage(GetLastError(), &errMsg);
-            job->setErrorMessage(errMsg);
+        // 2XX
+        if (status / 100 != 2) {
+            job->setErrorMessage(QString(
+                    QObject::tr("HTTP status code %1")).arg(status));
+        } else if (request.rangeStart >= 0 && status != 206) {
+            job->setErrorMessage(QObject::tr(
+                    "The server does not support HTTP Range requests"));
         }
     }
 
-
     if (job->shouldProceed()) {
-        if (!request.user.isEmpty()) {
-            setStringOption(hConnectHandle, INTERNET_OPTION_USERNAME,
-                    request.user);
-
-            if (!request.password.isEmpty()) {
-                setStringOption(hConnectHandle, INTERNET_OPTION_PASSWORD,
-                        request.password);
-            }
-        }
+        job->setProgress(0.05);
+        job->setTitle(initialTitle + " / " + QObject::tr("Downloading"));
     }
 
     if (job->shouldProceed()) {
-        if (!request.proxyUser.isEmpty()) {
-            setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_USERNAME,
-                    request.proxyUser);
-
-            if (!request.proxyPassword.isEmpty()) {
-                setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_PASSWORD,
-                        request.proxyPassword);
-            }
-        }
-    }
-
-    // flags: http://msdn.microsoft.com/en-us/library/aa383661(v=vs.85).aspx
-    // We support accepting any mime file type since this is a simple download
-    // of a file
-    //
-    // hConnectHandle is only checked here to silence Coverity
-    HINTERNET hResourceHandle = nullptr;
-    if (job->shouldProceed() && hConnectHandle != nullptr) {
-        LPCTSTR ppszAcceptTypes[2];
-        ppszAcceptTypes[0] = L"*/*";
-        ppszAcceptTypes[1] = nullptr;
-        DWORD flags = (url.scheme() == "https" ? INTERNET_FLAG_SECURE : 0);
-        if (keepConnection)
-            flags |= INTERNET_FLAG_KEEP_CONNECTION;
-        if (!request.useInternet)
-            flags |= INTERNET_FLAG_FROM_CACHE;
-        flags |= INTERNET_FLAG_RESYNCHRONIZE;
-        if (!useCache)
-            flags |= INTERNET_FLAG_DONT_CACHE | INTERNET_FLAG_PRAGMA_NOCACHE |
-                    INTERNET_FLAG_RELOAD;
-        hResourceHandle = HttpOpenRequestW(hConnectHandle,
-                WPMUtils::toLPWSTR(verb),
-                WPMUtils::toLPWSTR(resource),
-                nullptr, nullptr, ppszAcceptTypes,
-                flags, 0);
-        if (hResourceHandle == nullptr) {
-            QString errMsg;
-            WPMUtils::formatMessage(GetLastError(), &errMsg);
-            job->setErrorMessage(errMsg);
-        }
-    }
-
-    qCDebug(npackd) << "HttpOpenRequestW succeeded";
-
-    int64_t contentLength = -1;
-
-    if (hResourceHandle != nullptr && hConnectHandle != nullptr) {
-        if (job->shouldProceed()) {
-            // do not check for errors here
-            HttpAddRequestHeadersW(hResourceHandle,
-                    L"Accept-Encoding: gzip, deflate",
-                    static_cast<DWORD>(-1),
-                    HTTP_ADDREQ_FLAG_ADD);
-        }
-
-        // qCDebug(npackd) << "download.5";
-        int callNumber = 0;
-        while (job->shouldProceed()) {
-            // qCDebug(npackd) << "download.5.1";
-
-            // NOTE: dwStatus is only valid if sendRequestError == 0
-            DWORD dwStatus = 0, dwStatusSize = sizeof(dwStatus);
-
-            DWORD sendRequestError = 0;
-
-            // the following call uses NULL for headers in case there are no headers
-            // because Windows 2003 generates the error 12150 otherwise
-            if (!HttpSendRequestW(hResourceHandle,
-                    request.headers.length() == 0 ? nullptr : WPMUtils::toLPWSTR(request.headers),
-                    static_cast<DWORD>(-1),
-                    request.postData.length() == 0 ? nullptr : const_cast<char*>(request.postData.data()),
-                    static_cast<DWORD>(request.postData.length()))) {
-                sendRequestError = GetLastError();
-            }
-
-            // http://msdn.microsoft.com/en-us/library/aa384220(v=vs.85).aspx
-            if (sendRequestError == 0) {
-                if (!HttpQueryInfo(hResourceHandle, HTTP_QUERY_FLAG_NUMBER |
-                        HTTP_QUERY_STATUS_CODE, &dwStatus, &dwStatusSize, nullptr)) {
-                    QString errMsg;
-                    WPMUtils::formatMessage(GetLastError(), &errMsg);
-                    job->setErrorMessage(errMsg);
-                    break;
-                }
-            }
-
-            qCDebug(npackd) << "Downloader::downloadWin callNumber="
-                    << callNumber << ", sendRequestError="
-                    << sendRequestError << ", dwStatus=" << dwStatus;
-
-            // 2XX
-            if (sendRequestError == 0) {
-                DWORD hundreds = dwStatus / 100;
-                if (hundreds == 2 || hundreds == 5)
-                    break;
-            }
-
-            // the InternetErrorDlg calls below can either handle
-            // sendRequestError <> 0 or HTTP error code <> 2xx
-
-            void* p = nullptr;
-
-            // both calls to InternetErrorDlg should be enclosed by one
-            // mutex, so that only one dialog will be shown
-            loginDialogMutex.lock();
-
-            DWORD r;
-
-            // first call is processed differently
-            if (callNumber == 0) {
-                r = InternetErrorDlg(nullptr,
-                       hResourceHandle, sendRequestError,
-                        FLAGS_ERROR_UI_FILTER_FOR_ERRORS |
-                        FLAGS_ERROR_UI_FLAGS_CHANGE_OPTIONS |
-                        FLAGS_ERROR_UI_FLAGS_GENERATE_DATA |
-                        FLAGS_ERROR_UI_FLAGS_NO_UI, &p);
-                if ((r == ERROR_SUCCESS || r == ERROR_INTERNET_INTERNAL_ERROR) && interactive)
-                    r = ERROR_INTERNET_FORCE_RETRY;
-            } else {
-                if (interactive) {
-                    if (parentWindow) {
-                        r = InternetErrorDlg(parentWindow,
-                                hResourceHandle, sendRequestError,
-                                FLAGS_ERROR_UI_FILTER_FOR_ERRORS |
-                                FLAGS_ERROR_UI_FLAGS_CHANGE_OPTIONS |
-                                FLAGS_ERROR_UI_FLAGS_GENERATE_DATA, &p);
-                    } else {
-                        if (sendRequestError == 0) {
-                            QString e = inputPassword(hConnectHandle, dwStatus);
-
-                            //qCDebug(npackd) << "inputPassword: " << e;
-                            if (!e.isEmpty()) {
-                                job->setErrorMessage(e);
-                                r = ERROR_CANCELLED;
-                            } else {
-                                r = ERROR_INTERNET_FORCE_RETRY;
-                            }
-                        } else {
-                            // cannot help
-                            r = ERROR_SUCCESS;
-                        }
-                    }
-                } else {
-                    if (sendRequestError == 0) {
-                        QString e = setPassword(hConnectHandle, dwStatus,
-                                request);
-
-                        if (!e.isEmpty()) {
-                            job->setErrorMessage(e);
-                            r = ERROR_CANCELLED;
-                        } else {
-                            r = ERROR_INTERNET_FORCE_RETRY;
-                        }
-                    } else {
-                        // cannot help
-                        r = ERROR_SUCCESS;
-                    }
-                }
-            }
-
-            //qCDebug(npackd) << callNumber << r << dwStatus << url.toString();
-
-            if (job->shouldProceed()) {
-                if (r == ERROR_SUCCESS) {
-                    if (sendRequestError) {
-                        QString errMsg;
-                        WPMUtils::formatMessage(sendRequestError, &errMsg);
-                        job->setErrorMessage(errMsg);
-                    } else {
-                        job->setErrorMessage(QString(
-                                QObject::tr("HTTP status code %1")).arg(dwStatus));
-                    }
-                } else if (r == ERROR_INTERNET_FORCE_RETRY) {
-                    // nothing
-                } else if (r == ERROR_CANCELLED) {
-                    job->setErrorMessage(QObject::tr("Cancelled by the user"));
-                } else if (r == ERROR_INVALID_HANDLE) {
-                    job->setErrorMessage(QObject::tr("Invalid handle"));
-                } else {
-                    job->setErrorMessage(QString(
-                            QObject::tr("Unknown error %1 from InternetErrorDlg in attempt %2")).arg(r).arg(callNumber + 1));
-                }
-            }
-
-            loginDialogMutex.unlock();
-
-            if (!job->shouldProceed())
-                break;
-
-            // read all the data before re-sending the request
-            char smallBuffer[4 * 1024];
-            while (true) {
-                DWORD read;
-                if (!InternetReadFile(hResourceHandle, &smallBuffer,
-                        sizeof(smallBuffer), &read)) {
-                    QString errMsg;
-                    WPMUtils::formatMessage(GetLastError(), &errMsg);
-                    job->setErrorMessage(errMsg);
-                    goto out;
-                }
-
-                // qCDebug(npackd) << "read some bytes " << read;
-                if (read == 0)
-                    break;
-            }
-
-            callNumber++;
-        }; // while (job->shouldProceed())
-
-    out:
-        if (job->shouldProceed()) {
-            DWORD dwStatus, dwStatusSize = sizeof(dwStatus);
-
-            // http://msdn.microsoft.com/en-us/library/aa384220(v=vs.85).aspx
-            if (!HttpQueryInfo(hResourceHandle, HTTP_QUERY_FLAG_NUMBER |
-                    HTTP_QUERY_STATUS_CODE, &dwStatus, &dwStatusSize, nullptr)) {
-                QString errMsg;
-                WPMUtils::formatMessage(GetLastError(), &errMsg);
-                job->setErrorMessage(errMsg);
-            } else {
-                // 2XX
-                if (dwStatus / 100 != 2) {
-                    job->setErrorMessage(QString(
-                            QObject::tr("HTTP status code %1")).arg(dwStatus));
-                }
-            }
-        }
-
-        if (job->shouldProceed()) {
-            job->setProgress(0.03);
-            job->setTitle(initialTitle + " / " + QObject::tr("Downloading"));
-        }
-
-        // MIME type
-        if (job->shouldProceed()) {
-            if (mime) {
-                WCHAR mimeBuffer[1024];
-                DWORD bufferLength = sizeof(mimeBuffer);
-                DWORD index = 0;
-                if (!HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_TYPE,
-                        &mimeBuffer, &bufferLength, &index)) {
-                    *mime = "application/octet-stream";
-                } else {
-                    *mime = QString::fromWCharArray(
-                            mimeBuffer, bufferLength / 2);
-                }
-            }
-        }
-
-        bool gzip = false;
-
-        // Content-Encoding
-        if (job->shouldProceed()) {
-            WCHAR contentEncodingBuffer[1024];
-            DWORD bufferLength = sizeof(contentEncodingBuffer);
-            DWORD index = 0;
-            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_ENCODING,
-                    &contentEncodingBuffer, &bufferLength, &index)) {
-                QString contentEncoding = QString::fromWCharArray(
-                        contentEncodingBuffer, bufferLength / 2);
-                gzip = contentEncoding == "gzip" || contentEncoding == "deflate";
-            }
-
-            job->setProgress(0.04);
-        }
-
-        // Content-Disposition
-        if (job->shouldProceed()) {
-            if (contentDisposition) {
-                WCHAR cdBuffer[1024];
-                wcscpy(cdBuffer, L"Content-Disposition");
-                DWORD bufferLength = sizeof(cdBuffer);
-                DWORD index = 0;
-                if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CUSTOM,
-                        &cdBuffer, &bufferLength, &index)) {
-                    *contentDisposition = QString::fromWCharArray(
-                            cdBuffer, bufferLength / 2);
-                }
-            }
-        }
-
-        // content length
-        if (job->shouldProceed()) {
-            WCHAR contentLengthBuffer[100];
-            DWORD bufferLength = sizeof(contentLengthBuffer);
-            DWORD index = 0;
-            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_LENGTH,
-                    contentLengthBuffer, &bufferLength, &index)) {
-                QString s = QString::fromWCharArray(
-                        contentLengthBuffer, bufferLength / 2);
-                bool ok;
-                contentLength = s.toLongLong(&ok, 10);
-                if (!ok)
-                    contentLength = 0;
-            }
-
-            job->setProgress(0.05);
-        }
-
-        if (job->shouldProceed()) {
-            if (!request.ignoreContent) {
-                Job* sub = job->newSubJob(0.95, QObject::tr("Reading the data"));
-                readData(sub, hResourceHandle, file, sha1, gzip, contentLength, alg);
-                if (!sub->getErrorMessage().isEmpty())
-                    job->setErrorMessage(sub->getErrorMessage());
-            } else {
-                job->setProgress(job->getProgress() + 0.95);
-            }
+        if (!request.ignoreContent) {
+            Job* sub = job->newSubJob(0.95, QObject::tr("Reading the data"));
+            readData(sub, connection, request.file, sha1, gzip,
+                    response->contentLength, request.alg);
+            if (!sub->getErrorMessage().isEmpty())
+                job->setErrorMessage(sub->getErrorMessage());
+        } else {
+            job->setProgress(job->getProgress() + 0.95);
         }
-
-        InternetCloseHandle(hResourceHandle);
     }
 
-    if (hConnectHandle)
-        InternetCloseHandle(hConnectHandle);
-    if (internet)
-        InternetCloseHandle(internet);
+    delete connection;
 
     if (job->shouldProceed())
         job->setProgress(1);
@@ -443,142 +91,13 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
 
     job->complete();
 
-    qCDebug(npackd) << request.url << job->getErrorMessage() << contentLength;
-
-    return contentLength;
-}
+    qCDebug(npackd) << request.url << job->getErrorMessage() <<
+            response->contentLength;
 
-QString Downloader::setStringOption(HINTERNET hInternet, DWORD dwOption,
-        const QString& value)
-{
-    QString result;
-    if (!InternetSetOptionW(hInternet,
-            dwOption, WPMUtils::toLPWSTR(value),
-            static_cast<DWORD>(value.length() + 1))) {
-        WPMUtils::formatMessage(GetLastError(), &result);
-    }
-    return result;
+    return response->contentLength;
 }
 
-QString Downloader::setPassword(HINTERNET hConnectHandle,
-        DWORD dwStatus, const Request& request)
-{
-    QString result;
-
-    if (dwStatus == HTTP_STATUS_PROXY_AUTH_REQ) {
-        if (request.proxyUser.isEmpty()) {
-            result = QString(QObject::tr("Cannot handle HTTP status code %1")).
-                    arg(dwStatus);
-        }
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                    INTERNET_OPTION_PROXY_USERNAME, request.proxyUser);
-        }
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_PROXY_PASSWORD, request.proxyPassword);
-        }
-    } else if (dwStatus == HTTP_STATUS_DENIED) {
-        if (request.user.isEmpty()) {
-            result = QString(QObject::tr("Cannot handle HTTP status code %1")).
-                    arg(dwStatus);
-        }
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_USERNAME, request.user);
-        }
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_PASSWORD, request.password);
-        }
-    } else {
-        result = QString(QObject::tr("Cannot handle HTTP status code %1")).
-                arg(dwStatus);
-    }
-
-    return result;
-}
-
-QString Downloader::inputPassword(HINTERNET hConnectHandle,
-        DWORD dwStatus)
-{
-    QString result;
-
-    QString username, password;
-    if (dwStatus == HTTP_STATUS_PROXY_AUTH_REQ) {
-        WPMUtils::writeln("\r\n" +
-                QObject::tr("The HTTP proxy requires authentication."));
-        WPMUtils::outputTextConsole(QObject::tr("Username") + ": ");
-        username = WPMUtils::inputTextConsole();
-        WPMUtils::outputTextConsole(QObject::tr("Password") + ": ");
-        password = WPMUtils::inputPasswordConsole();
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_PROXY_USERNAME, username);
-        }
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_PROXY_PASSWORD, password);
-        }
-    } else if (dwStatus == HTTP_STATUS_DENIED) {
-        WPMUtils::writeln("\r\n" +
-                QObject::tr("The HTTP server requires authentication.")
-                );
-        WPMUtils::outputTextConsole(QObject::tr("Username") + ": ");
-        username = WPMUtils::inputTextConsole();
-        WPMUtils::outputTextConsole(QObject::tr("Password") + ": ");
-        password = WPMUtils::inputPasswordConsole();
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_USERNAME, username);
-        }
-
-        if (result.isEmpty()) {
-            result = setStringOption(hConnectHandle,
-                INTERNET_OPTION_PASSWORD, password);
-        }
-    } else {
-        result = QString(QObject::tr("Cannot handle HTTP status code %1")).
-                arg(dwStatus);
-    }
-
-    return result;
-}
-
-bool Downloader::internetReadFileFully(HINTERNET resourceHandle,
-        PVOID buffer, DWORD bufferSize, PDWORD bufferLength)
-{
-    DWORD alreadyRead = 0;
-    bool result;
-    while (true) {
-        DWORD len;
-        result = InternetReadFile(resourceHandle,
-                static_cast<uint8_t*>(buffer) + alreadyRead,
-                bufferSize - alreadyRead, &len);
-
-        if (!result) {
-            *bufferLength = alreadyRead;
-            break;
-        } else {
-            alreadyRead += len;
-
-            if (alreadyRead == bufferSize || len == 0) {
-                *bufferLength = alreadyRead;
-                break;
-            }
-        }
-    }
-    return result;
-}
-
-void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
+void Downloader::readDataGZip(Job* job, HttpConnection* connection, QFile* file,
         QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg)
 {
     QString initialTitle = job->getTitle();
@@ -595,12 +114,12 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
 
     int err = 0;
     int64_t alreadyRead = 0;
-    DWORD bufferLength;
+    int bufferLength;
     do {
-        if (!internetReadFileFully(hResourceHandle, buffer,
-                bufferSize, &bufferLength)) {
-            QString errMsg;
-            WPMUtils::formatMessage(GetLastError(), &errMsg);
+        QString errMsg;
+        bufferLength = connection->readFully(reinterpret_cast<char*>(buffer),
+                bufferSize, &errMsg);
+        if (!errMsg.isEmpty()) {
             job->setErrorMessage(errMsg);
             break;
         }
@@ -685,7 +204,7 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
             d_stream.opaque = nullptr;
 
             d_stream.next_in = buffer + cur;
-            d_stream.avail_in = bufferLength - cur;
+            d_stream.avail_in = static_cast<uInt>(bufferLength) - cur;
             d_stream.avail_out = buffer2Size;
             d_stream.next_out = buffer2;
             zlibStreamInitialized = true;
@@ -699,7 +218,7 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
             }
         } else {
             d_stream.next_in = buffer;
-            d_stream.avail_in = bufferLength;
+            d_stream.avail_in = static_cast<uInt>(bufferLength);
         }
 
         // see http://zlib.net/zpipe.c
@@ -766,7 +285,7 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
     job->complete();
 }
 
-void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
+void Downloader::readDataFlat(Job* job, HttpConnection* connection, QFile* file,
         QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg)
 {
     qCDebug(npackd) << "Downloader::readDataFlat";
@@ -779,18 +298,18 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
     unsigned char* buffer = new unsigned char[bufferSize];
 
     int64_t alreadyRead = 0;
-    DWORD bufferLength;
+    int bufferLength;
     do {
-        if (!InternetReadFile(hResourceHandle, buffer,
-                bufferSize, &bufferLength)) {
-            QString errMsg;
-            WPMUtils::formatMessage(GetLastError(), &errMsg);
+        QString errMsg;
+        bufferLength = connection->read(reinterpret_cast<char*>(buffer),
+                bufferSize, &errMsg);
+        if (!errMsg.isEmpty()) {
             job->setErrorMessage(errMsg);
             break;
         }
 
         qCDebug(npackd) <<
-                "Downloader::readDataFlat InternetReadFile bufferLength=" <<
+                "Downloader::readDataFlat bufferLength=" <<
                 bufferLength;
 
         if (bufferLength == 0)
@@ -799,7 +318,7 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
         // update SHA1 if necessary
         if (sha1)
             hash.addData(reinterpret_cast<char*>(buffer),
-                    static_cast<int>(bufferLength));
+                    bufferLength);
 
         if (file) {
             if (file->write(reinterpret_cast<char*>(buffer), bufferLength) < 0) {
@@ -835,14 +354,14 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
     job->complete();
 }
 
-void Downloader::readData(Job* job, HINTERNET hResourceHandle, QFile* file,
+void Downloader::readData(Job* job, HttpConnection* connection, QFile* file,
         QString* sha1, bool gzip, int64_t contentLength,
         QCryptographicHash::Algorithm alg)
 {
     if (gzip && file)
-        readDataGZip(job, hResourceHandle, file, sha1, contentLength, alg);
+        readDataGZip(job, connection, file, sha1, contentLength, alg);
     else
-        readDataFlat(job, hResourceHandle, file, sha1, contentLength, alg);
+        readDataFlat(job, connection, file, sha1, contentLength, alg);
 }
 
 void Downloader::copyFile(Job* job, const QString& source, QFile* file,
@@ -853,31 +372,58 @@ void Downloader::copyFile(Job* job, const QString& source, QFile* file,
                 arg(source));
     } else {
         qint64 srcSize = srcFile.size();
-        const int SZ = 8192;
-        char* data = new char[SZ];
+
+        // the file is mapped in parts so that the address space is not
+        // exhausted for big files in 32 bit processes. A read error in a
+        // mapped view of a file on a network drive would terminate the
+        // process, so these files are read as usual.
+        const qint64 SZ = 64 * 1024 * 1024;
+        QByteArray buffer;
+#ifdef Q_OS_WIN
+        QString root = QDir::toNativeSeparators(source).left(3);
+        bool map = !root.startsWith(QStringLiteral("\\\\")) &&
+                GetDriveTypeW(WPMUtils::toLPWSTR(root)) != DRIVE_REMOTE;
+#else
+        bool map = true;
+#endif
 
         qint64 progress = 0;
         QCryptographicHash crypto(alg);
-        while(true) {
-            qint64 c = srcFile.read(data, SZ);
-            if (c <= 0)
-                break;
+        while (progress < srcSize && job->shouldProceed()) {
+            qint64 len = std::min<qint64>(SZ, srcSize - progress);
+            uchar* view = map ? srcFile.map(progress, len) : nullptr;
+
+            // a file that cannot be mapped is read
+            const char* data;
+            if (view) {
+                data = reinterpret_cast<const char*>(view);
+            } else {
+                buffer.resize(static_cast<int>(len));
+                srcFile.seek(progress);
+                len = srcFile.read(buffer.data(), len);
+                if (len <= 0) {
+                    job->setErrorMessage(srcFile.errorString());
+                    break;
+                }
+                data = buffer.constData();
+            }
 
             if (sha1)
-                crypto.addData(data, static_cast<int>(c));
-            if (file)
-                file->write(data, c);
+                crypto.addData(data, static_cast<int>(len));
+            if (file && file->write(data, len) < 0)
+                job->setErrorMessage(file->errorString());
+
+            if (view)
+                srcFile.unmap(view);
 
-            progress += c;
-            if (srcSize != 0)
-                job->setProgress((static_cast<double>(progress)) / srcSize);
+            progress += len;
+            job->setProgress((static_cast<double>(progress)) / srcSize);
         }
 
-        if (sha1)
+        if (sha1 && job->shouldProceed())
             *sha1 = crypto.result().toHex().toLower();
 
         srcFile.close();
-        delete[] data;
     }
     job->complete();
 }
@@ -888,8 +434,14 @@ Downloader::Response Downloader::download(Job *job,
     Downloader::Response r;
 
     QString* sha1 = request.hashSum ? &r.hashSum : nullptr;
-    if (request.url.scheme() == "https" || request.url.scheme() == "http")
-        downloadWin(job, request, &r);
+    if (request.url.scheme() == "https" || request.url.scheme() == "http") {
+        if (request.segments > 1 && request.file && request.rangeStart < 0 &&
+                request.httpMethod == "GET" && request.postData.isEmpty() &&
+                !request.ignoreContent)
+            downloadSegmented(job, request, &r);
+        else
+            downloadHTTP(job, request, &r);
+    }
     else if (request.url.toString().startsWith("data:image/png;base64,")) {
         if (request.file) {
             QString dataURL_ = request.url.toString().mid(22);
@@ -921,7 +473,7 @@ Downloader::Response Downloader::download(Job *job,
 }
 
 int64_t Downloader::getContentLength(Job* job, const QUrl &url,
-        HWND parentWindow)
+        void* parentWindow)
 {
     int64_t result = -1;
     if (url.scheme() == "file") {
@@ -944,7 +496,7 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
 
         Job* sub = job->newSubJob(1, QObject::tr("Using the HEAD HTTP method"));
         Response resp;
-        result = downloadWin(sub, req, &resp);
+        result = downloadHTTP(sub, req, &resp);
 
         if (!sub->getErrorMessage().isEmpty()) {
             Request req2(url);
@@ -957,7 +509,7 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
             Response resp2;
             Job* sub2 = job->newSubJob(1 - job->getProgress(),
                     QObject::tr("Using the GET HTTP method"));
-            result = downloadWin(sub2, req2, &resp2);
+            result = downloadHTTP(sub2, req2, &resp2);
             if (!sub2->getErrorMessage().isEmpty())
                 job->setErrorMessage(sub2->getErrorMessage());
         }
@@ -967,14 +519,16 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
 }
 
 QTemporaryFile* Downloader::downloadToTemporary(Job* job,
-        const Downloader::Request &request)
+        const Downloader::Request &request, Response* response)
 {
     QTemporaryFile* file = new QTemporaryFile();
     Downloader::Request r2(request);
     r2.file = file;
 
     if (file->open()) {
-        download(job, r2);
+        Response resp = download(job, r2);
+        if (response)
+            *response = resp;
         file->close();
 
         if (!job->shouldProceed()) {
@@ -992,3 +546,352 @@ QTemporaryFile* Downloader::downloadToTemporary(Job* job,
     return file;
 }
 
+
+/**
+ * @brief a part of a file downloaded over one connection
+ */
+class DownloadSegment
+{
+public:
+    /** first byte */
+    int64_t start = 0;
+
+    /** last byte (inclusive) */
+    int64_t end = -1;
+
+    /** number of bytes already downloaded */
+    int64_t done = 0;
+
+    /** true = the server ignored the Range header */
+    bool rangeIgnored = false;
+
+    QString error;
+
+    int64_t remaining() const
+    {
+        return end - start + 1 - done;
+    }
+};
+
+/**
+ * @brief state of a segmented download stored next to the file
+ */
+class SegmentedDownloadState
+{
+public:
+    QString url;
+    int64_t length = -1;
+    QString eTag;
+    QString lastModified;
+    QVector<DownloadSegment> segments;
+
+    /**
+     * @param path state file
+     * @return true if the file could be read
+     */
+    bool load(const QString& path)
+    {
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly))
+            return false;
+
+        QJsonObject o = QJsonDocument::fromJson(f.readAll()).object();
+        url = o.value(QStringLiteral("url")).toString();
+        length = static_cast<int64_t>(
+                o.value(QStringLiteral("length")).toDouble(-1));
+        eTag = o.value(QStringLiteral("eTag")).toString();
+        lastModified = o.value(QStringLiteral("lastModified")).toString();
+        QJsonArray a = o.value(QStringLiteral("segments")).toArray();
+        segments.clear();
+        for (int i = 0; i < a.size(); i++) {
+            QJsonObject so = a.at(i).toObject();
+            DownloadSegment s;
+            s.start = static_cast<int64_t>(
+                    so.value(QStringLiteral("start")).toDouble());
+            s.end = static_cast<int64_t>(
+                    so.value(QStringLiteral("end")).toDouble());
+            s.done = static_cast<int64_t>(
+                    so.value(QStringLiteral("done")).toDouble());
+            if (s.done < 0 || s.remaining() < 0)
+                return false;
+            segments.append(s);
+        }
+        return !segments.isEmpty();
+    }
+
+    /**
+     * @param path state file
+     * @return error message
+     */
+    QString save(const QString& path) const
+    {
+        QJsonObject o;
+        o[QStringLiteral("url")] = url;
+        o[QStringLiteral("length")] = static_cast<double>(length);
+        o[QStringLiteral("eTag")] = eTag;
+        o[QStringLiteral("lastModified")] = lastModified;
+        QJsonArray a;
+        for (int i = 0; i < segments.size(); i++) {
+            const DownloadSegment& s = segments.at(i);
+            QJsonObject so;
+            so[QStringLiteral("start")] = static_cast<double>(s.start);
+            so[QStringLiteral("end")] = static_cast<double>(s.end);
+            so[QStringLiteral("done")] = static_cast<double>(s.done);
+            a.append(so);
+        }
+        o[QStringLiteral("segments")] = a;
+
+        QString err;
+        QFile f(path);
+        if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+                f.write(QJsonDocument(o).toJson()) < 0)
+            err = f.errorString();
+        return err;
+    }
+};
+
+void Downloader::downloadSegmented(Job* job, const Request& request,
+        Response* response)
+{
+    // every segment should have at least 1 MiB
+    const int64_t MIN_SEGMENT = 1024 * 1024;
+
+    QString initialTitle = job->getTitle();
+    QString path = request.file->fileName();
+    QString statePath = path + QStringLiteral(".segments");
+
+    Response probe;
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.01,
+                QObject::tr("Checking the support for HTTP Range requests"),
+                true, false);
+        Request head(request);
+        head.httpMethod = QStringLiteral("HEAD");
+        head.file = nullptr;
+        head.hashSum = false;
+        head.segments = 1;
+        head.ignoreContent = true;
+        downloadHTTP(sub, head, &probe);
+        if (!sub->getErrorMessage().isEmpty())
+            probe.acceptRanges = false;
+    }
+
+    int n = 0;
+    if (probe.acceptRanges && probe.contentLength > 0)
+        n = static_cast<int>(std::min<int64_t>(request.segments,
+                probe.contentLength / MIN_SEGMENT));
+
+    // one connection for servers without ranges and small files
+    bool fallback = n < 2;
+
+    // true = the state file is kept because the download can be resumed
+    bool resumable = false;
+
+    SegmentedDownloadState state;
+    if (job->shouldProceed() && !fallback) {
+        // the data is only reused if the file on the server did not change
+        if (!state.load(statePath) ||
+                state.url != request.url.toString(QUrl::FullyEncoded) ||
+                state.length != probe.contentLength ||
+                state.eTag != probe.eTag ||
+                state.lastModified != probe.lastModified ||
+                request.file->size() != probe.contentLength) {
+            state.url = request.url.toString(QUrl::FullyEncoded);
+            state.length = probe.contentLength;
+            state.eTag = probe.eTag;
+            state.lastModified = probe.lastModified;
+            state.segments.clear();
+            int64_t size = (state.length + n - 1) / n;
+            for (int64_t start = 0; start < state.length; start += size) {
+                DownloadSegment s;
+                s.start = start;
+                s.end = std::min<int64_t>(start + size, state.length) - 1;
+                state.segments.append(s);
+            }
+
+            // the space is reserved at once to reduce fragmentation
+            if (!request.file->resize(state.length))
+                job->setErrorMessage(request.file->errorString());
+        } else {
+            qCDebug(npackd) << "resuming the download of" << request.url;
+        }
+    }
+
+    if (job->shouldProceed() && !fallback) {
+        QString err = state.save(statePath);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed() && !fallback) {
+        job->setTitle(initialTitle + " / " + QString(
+                QObject::tr("Downloading over %1 connections")).
+                arg(state.segments.size()));
+
+        HttpTransport* transport = request.transport ? request.transport :
+                HttpTransport::getDefault();
+        transport->reserveConnections(state.segments.size());
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(state.segments.size());
+
+        // dropped connections are opened again
+        const int ATTEMPTS = 3;
+        for (int attempt = 0; attempt < ATTEMPTS; attempt++) {
+            // the segments are only changed by the threads until they finish
+            QVector<Job*> jobs(state.segments.size());
+            QVector<int64_t> doneBefore(state.segments.size());
+            int64_t remainingBefore = 0;
+            for (int i = 0; i < state.segments.size(); i++) {
+                DownloadSegment& s = state.segments[i];
+                s.error.clear();
+                doneBefore[i] = s.done;
+                if (s.remaining() > 0) {
+                    remainingBefore += s.remaining();
+                    jobs[i] = job->newSubJob(0, QString(
+                            QObject::tr("Segment %1")).arg(i + 1),
+                            false, false);
+                }
+            }
+
+            if (remainingBefore == 0)
+                break;
+
+            for (int i = 0; i < state.segments.size(); i++) {
+                Job* sjob = jobs.at(i);
+                if (!sjob)
+                    continue;
+
+                DownloadSegment* s = &state.segments[i];
+                QtConcurrent::run(&pool, [sjob, s, path, request]() {
+                    QFile f(path);
+                    int64_t from = s->start + s->done;
+                    if (!f.open(QIODevice::ReadWrite) || !f.seek(from)) {
+                        s->error = f.errorString();
+                        sjob->complete();
+                        return;
+                    }
+
+                    Request r(request);
+                    r.file = &f;
+                    r.hashSum = false;
+                    r.segments = 1;
+                    r.rangeStart = from;
+                    r.rangeEnd = s->end;
+
+                    Response resp;
+                    downloadHTTP(sjob, r, &resp);
+
+                    // the data received before an error is kept
+                    int64_t written = f.pos() - from;
+                    f.close();
+                    s->done += std::min<int64_t>(written, s->remaining());
+                    s->rangeIgnored = resp.statusCode == 200;
+                    if (!sjob->getErrorMessage().isEmpty())
+                        s->error = sjob->getErrorMessage();
+                    else if (s->remaining() > 0 && !sjob->isCancelled())
+                        s->error = QString(QObject::tr(
+                                "The connection was closed after %L1 bytes")).
+                                arg(written);
+                });
+            }
+
+            // the progress is computed from the segments
+            while (true) {
+                bool done = pool.waitForDone(200);
+
+                int64_t downloaded = 0;
+                for (int i = 0; i < state.segments.size(); i++) {
+                    const DownloadSegment& s = state.segments.at(i);
+                    if (done) {
+                        downloaded += s.done;
+                    } else {
+                        int64_t rest = s.end - s.start + 1 - doneBefore.at(i);
+                        downloaded += doneBefore.at(i);
+                        if (jobs.at(i))
+                            downloaded += static_cast<int64_t>(
+                                    jobs.at(i)->getProgress() * rest);
+                    }
+                }
+                job->setProgress(0.01 + 0.98 * downloaded / state.length);
+
+                if (done)
+                    break;
+            }
+
+            bool rangeIgnored = false;
+            QString err;
+            for (int i = 0; i < state.segments.size(); i++) {
+                const DownloadSegment& s = state.segments.at(i);
+                rangeIgnored = rangeIgnored || s.rangeIgnored;
+                if (err.isEmpty() && !s.error.isEmpty())
+                    err = s.error;
+            }
+
+            if (rangeIgnored) {
+                fallback = true;
+                break;
+            }
+
+            if (job->isCancelled() || err.isEmpty())
+                break;
+
+            qCWarning(npackd).noquote() << QString(QObject::tr(
+                    "Segmented download of %1, attempt %2: %3")).
+                    arg(request.url.toDisplayString()).arg(attempt + 1).
+                    arg(err);
+
+            if (attempt == ATTEMPTS - 1)
+                job->setErrorMessage(err);
+        }
+
+        transport->releaseConnections(state.segments.size());
+
+        if (!fallback && !job->shouldProceed()) {
+            // the state is kept for resuming the download later
+            QString err = state.save(statePath);
+            if (!err.isEmpty())
+                qCWarning(npackd).noquote() << err;
+            else
+                resumable = true;
+        }
+    }
+
+    if (!resumable)
+        QFile::remove(statePath);
+
+    if (job->shouldProceed() && fallback) {
+        request.file->resize(0);
+        request.file->seek(0);
+
+        Job* sub = job->newSubJob(0.99 - job->getProgress(),
+                QObject::tr("Downloading over one connection"), true, true);
+        Request r(request);
+        r.segments = 1;
+        downloadHTTP(sub, r, response);
+    } else if (job->shouldProceed()) {
+        response->statusCode = 200;
+        response->contentLength = state.length;
+        response->acceptRanges = true;
+        response->eTag = probe.eTag;
+        response->lastModified = probe.lastModified;
+        response->mimeType = probe.mimeType;
+        response->contentDisposition = probe.contentDisposition;
+
+        request.file->seek(state.length);
+
+        // the segments were written in parallel
+        if (request.hashSum) {
+            Job* sub = job->newSubJob(0.01,
+                    QObject::tr("Computing the hash sum"), true, true);
+            copyFile(sub, path, nullptr, &response->hashSum, request.alg);
+        }
+    }
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
+    job->setTitle(initialTitle);
+
+    job->complete();
+}
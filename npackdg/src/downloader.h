@@ -1,8 +1,6 @@
 #ifndef DOWNLOADER_H
 #define DOWNLOADER_H
 
-#include <windows.h>
-#include <wininet.h>
 #include <stdint.h>
 
 #include <QTemporaryFile>
@@ -14,9 +12,17 @@
 
 #include "job.h"
 
+#ifdef Q_OS_WIN
+#include <windows.h>
+
 extern HWND defaultPasswordWindow;
+#endif
+
 extern QMutex loginDialogMutex;
 
+class HttpTransport;
+class HttpConnection;
+
 /**
  * Blocks execution and downloads a file over http.
  */
@@ -27,39 +33,37 @@ class Downloader: public QObject
     /**
      * @brief readDataFlat
      * @param job
-     * @param hResourceHandle
+     * @param connection response body
      * @param file 0 = ignore the read data
      * @param sha1
      * @param contentLength
      * @param alg
      */
-    static void readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
+    static void readDataFlat(Job* job, HttpConnection* connection, QFile* file,
             QString* sha1, int64_t contentLength,
             QCryptographicHash::Algorithm alg);
 
-    static void readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
+    static void readDataGZip(Job* job, HttpConnection* connection, QFile* file,
             QString* sha1, int64_t contentLength,
             QCryptographicHash::Algorithm alg);
 
     /**
      * @brief readData
      * @param job
-     * @param hResourceHandle
+     * @param connection response body
      * @param file 0 = ignore the read data
      * @param sha1
      * @param gzip
      * @param contentLength
      * @param alg
      */
-    static void readData(Job* job, HINTERNET hResourceHandle, QFile* file,
+    static void readData(Job* job, HttpConnection* connection, QFile* file,
             QString* sha1, bool gzip, int64_t contentLength,
             QCryptographicHash::Algorithm alg);
 
-    static bool internetReadFileFully(HINTERNET resourceHandle,
-            PVOID buffer, DWORD bufferSize, PDWORD bufferLength);
-
     /**
-     * Copies a file.
+     * Copies a file. The source file is mapped into memory and read only once
+     * for copying and computing the hash sum.
      *
      * This functionality also offers the possibility to have a full
      * offline support. Which means that Npackd can rely on only local files
@@ -78,7 +82,6 @@ class Downloader: public QObject
             QString *sha1,
                          QCryptographicHash::Algorithm alg);
 
-    static QString inputPassword(HINTERNET hConnectHandle, DWORD dwStatus);
 public:
     /**
      * @brief a download request
@@ -96,8 +99,8 @@ public:
         /** true = ask the user for passwords */
         bool interactive;
 
-        /** parent window handle or 0 */
-        HWND parentWindow;
+        /** parent window handle (HWND on Windows) or 0 */
+        void* parentWindow;
 
         /** http:/https:/file:/data:image/png;base64 URL*/
         QUrl url;
@@ -174,6 +177,35 @@ public:
          */
         bool ignoreContent;
 
+        /**
+         * @brief maximum number of parallel connections for a GET request.
+         * A big file is downloaded in segments using HTTP Range requests if
+         * the server supports them. If the download fails or is cancelled,
+         * the state is stored next to the file in "<file>.segments" and the
+         * download is resumed by the next request with the same file and
+         * URL. The state file is removed in all other cases.
+         * 1 = one connection.
+         */
+        int segments;
+
+        /**
+         * @brief first byte for an HTTP Range request or -1 for the whole
+         * content. The data is written at the current position of "file".
+         */
+        int64_t rangeStart;
+
+        /**
+         * @brief last byte (inclusive) for an HTTP Range request
+         */
+        int64_t rangeEnd;
+
+        /**
+         * @brief the HTTP implementation or 0 for
+         * HttpTransport::getDefault(). This is only applicable to http: and
+         * https:.
+         */
+        HttpTransport* transport;
+
         /**
          * @param url http:/https:/file: URL
          */
@@ -182,7 +214,8 @@ public:
                 alg(QCryptographicHash::Sha256), useCache(true),
                 useInternet(true),
                 keepConnection(true), httpMethod("GET"),
-                timeout(600), ignoreContent(false) {
+                timeout(600), ignoreContent(false), segments(1),
+                rangeStart(-1), rangeEnd(-1), transport(nullptr) {
         }
     };
 
@@ -200,6 +233,21 @@ public:
 
         /** if not null, Content-Disposition will be stored here */
         QString contentDisposition;
+
+        /** HTTP status code or 0 */
+        int statusCode = 0;
+
+        /** Content-Length or -1 if unknown */
+        int64_t contentLength = -1;
+
+        /** true = the server supports HTTP Range requests */
+        bool acceptRanges = false;
+
+        /** ETag header or "" */
+        QString eTag;
+
+        /** Last-Modified header or "" */
+        QString lastModified;
     };
 
     /**
@@ -213,43 +261,49 @@ public:
      * @brief retrieves the content-length header for an URL.
      * @param job job object
      * @param url http:, https: or file:
-     * @param parentWindow window handle or 0 if not UI is required
+     * @param parentWindow window handle (HWND on Windows) or 0 if not UI is
+     *     required
      * @return the content-length header value or -1 if unknown
      */
     static int64_t getContentLength(Job *job, const QUrl &url,
-                                    HWND parentWindow);
+                                    void* parentWindow);
 
     /**
      * @brief HTTP download to a temporary file
      * @param job job
      * @param request HTTP request
+     * @param response if not null, the response will be stored here. The
+     *     hash sum is computed while the data is downloaded if
+     *     request.hashSum is true.
      * @return the created temporary file or 0 if an error occured
      */
     static QTemporaryFile *downloadToTemporary(Job *job,
-            const Downloader::Request &request);
+            const Downloader::Request &request, Response* response=nullptr);
 private:
     /**
-     * It would be nice to handle redirects explicitely so
-     *    that the file name could be derived
-     *    from the last URL:
-     *    http://www.experts-exchange.com/Programming/System/Windows__Programming/MFC/Q_20096714.html
-     * Manual authentication:
-     *    http://msdn.microsoft.com/en-us/library/aa384220(v=vs.85).aspx
+     * @brief sends an HTTP request using request.transport and reads the
+     *     response
      *
      * @param job job object
      * @param request HTTP request
      * @param response HTTP response
      * @return "content-length" or -1 if unknown
      */
-    static int64_t downloadWin(Job* job, const Downloader::Request& request,
-                               Response *response);
+    static int64_t downloadHTTP(Job* job, const Downloader::Request& request,
+                                Response *response);
 
-    static QString setPassword(HINTERNET hConnectHandle, DWORD dwStatus,
-                               const Request &request);
+    /**
+     * @brief downloads a file over several connections using HTTP Range
+     *     requests. Falls back to one connection if the server does not
+     *     support ranges or the file is too small.
+     *
+     * @param job job object
+     * @param request HTTP GET request with a file and segments > 1
+     * @param response HTTP response
+     */
+    static void downloadSegmented(Job* job, const Downloader::Request& request,
+            Response *response);
 
-protected:
-    static QString setStringOption(HINTERNET hInternet, DWORD dwOption,
-        const QString &value);
 };
 
 #endif // DOWNLOADER_H
@@ -0,0 +1,45 @@
+#include "httptransport.h"
+
+#ifdef Q_OS_WIN
+#include "wininettransport.h"
+#else
+#include "sockettransport.h"
+#endif
+
+HttpConnection::~HttpConnection()
+{
+}
+
+int HttpConnection::readFully(char *buffer, int size, QString *err)
+{
+    int alreadyRead = 0;
+    while (alreadyRead < size) {
+        int len = read(buffer + alreadyRead, size - alreadyRead, err);
+        if (len == 0)
+            break;
+        alreadyRead += len;
+    }
+    return alreadyRead;
+}
+
+HttpTransport::~HttpTransport()
+{
+}
+
+void HttpTransport::reserveConnections(int /* n */)
+{
+}
+
+void HttpTransport::releaseConnections(int /* n */)
+{
+}
+
+HttpTransport* HttpTransport::getDefault()
+{
+#ifdef Q_OS_WIN
+    static WinINetTransport def;
+#else
+    static SocketTransport def;
+#endif
+    return &def;
+}
@@ -0,0 +1,84 @@
+#ifndef HTTPTRANSPORT_H
+#define HTTPTRANSPORT_H
+
+#include <QString>
+
+#include "job.h"
+#include "downloader.h"
+
+/**
+ * @brief the body of an HTTP response. Deleting the object closes the
+ *     connection.
+ */
+class HttpConnection
+{
+public:
+    virtual ~HttpConnection();
+
+    /**
+     * @brief reads the next part of the response body. The data is returned
+     *     as it was sent by the server, e.g. still compressed with gzip.
+     * @param buffer the data will be stored here
+     * @param size size of the buffer
+     * @param err error message will be stored here
+     * @return number of bytes read. 0 means the end of the body or an error.
+     */
+    virtual int read(char* buffer, int size, QString* err) = 0;
+
+    /**
+     * @brief reads until the buffer is full or the body ends
+     * @param buffer the data will be stored here
+     * @param size size of the buffer
+     * @param err error message will be stored here
+     * @return number of bytes read
+     */
+    int readFully(char* buffer, int size, QString* err);
+};
+
+/**
+ * @brief sends HTTP requests. Downloader decodes, hashes and stores the
+ *     response body independently of the transport.
+ */
+class HttpTransport
+{
+public:
+    virtual ~HttpTransport();
+
+    /**
+     * @brief sends a request and reads the response headers. Authentication,
+     *     redirects and timeouts are handled here. The job is not completed.
+     * @param job the error message is stored here
+     * @param request request. request.file and request.hashSum are not used.
+     * @param response the status code, MIME type, Content-Disposition,
+     *     Content-Length, Accept-Ranges, ETag and Last-Modified are stored
+     *     here
+     * @param gzip true will be stored here if the body is compressed with
+     *     gzip or deflate
+     * @return [move] the response body or nullptr if an error occured
+     */
+    virtual HttpConnection* open(Job* job, const Downloader::Request& request,
+            Downloader::Response* response, bool* gzip) = 0;
+
+    /**
+     * @brief called before the given number of parallel requests to the same
+     *     server are sent
+     * @param n number of connections
+     */
+    virtual void reserveConnections(int n);
+
+    /**
+     * @brief called after the parallel requests reserved by
+     *     reserveConnections() are finished
+     * @param n number of connections
+     */
+    virtual void releaseConnections(int n);
+
+    /**
+     * @return [ownership:this] the transport used if Request::transport is
+     *     not set. This is WinINet on Windows and SocketTransport on other
+     *     systems.
+     */
+    static HttpTransport* getDefault();
+};
+
+#endif // HTTPTRANSPORT_H
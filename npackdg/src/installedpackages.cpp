@@ -3,6 +3,7 @@
 #include <windows.h>
 #include <msi.h>
 #include <memory>
+#include <algorithm>
 #include <shlobj.h>
 
 #include <QtGlobal>
@@ -98,9 +99,163 @@ InstalledPackages &InstalledPackages::operator=(const InstalledPackages &other)
 InstalledPackages::~InstalledPackages()
 {
     this->mutex.lock();
+    clearNoCopy();
+    this->mutex.unlock();
+}
+
+InstalledPackages::PathNode::~PathNode()
+{
+    qDeleteAll(children);
+}
+
+QStringList InstalledPackages::splitPath(const QString &path)
+{
+    QString p = path;
+    WPMUtils::normalizePath2(&p, true);
+    return p.split('\\');
+}
+
+void InstalledPackages::insertNoCopy(InstalledPackageVersion *ipv)
+{
+    // internal method, mutex is not used
+
+    QString key = PackageVersion::getStringId(ipv->package, ipv->version);
+    InstalledPackageVersion* old = this->data.value(key);
+    if (old) {
+        removeNoCopy(old);
+        delete old;
+    }
+
+    this->data.insert(key, ipv);
+
+    QList<InstalledPackageVersion*>& list = this->byPackage[ipv->package];
+    auto it = std::upper_bound(list.begin(), list.end(), ipv,
+            [](const InstalledPackageVersion* a,
+            const InstalledPackageVersion* b) {
+        return a->version < b->version;
+    });
+    list.insert(it, ipv);
+
+    addPath(ipv);
+}
+
+void InstalledPackages::removeNoCopy(InstalledPackageVersion *ipv)
+{
+    // internal method, mutex is not used
+
+    removePath(ipv);
+
+    this->data.remove(PackageVersion::getStringId(ipv->package,
+            ipv->version));
+
+    auto it = this->byPackage.find(ipv->package);
+    if (it != this->byPackage.end()) {
+        it.value().removeOne(ipv);
+        if (it.value().isEmpty())
+            this->byPackage.erase(it);
+    }
+}
+
+void InstalledPackages::clearNoCopy()
+{
+    // internal method, mutex is not used
+
     qDeleteAll(this->data);
     this->data.clear();
-    this->mutex.unlock();
+    this->byPackage.clear();
+    qDeleteAll(this->paths.children);
+    this->paths.children.clear();
+    this->paths.owners.clear();
+    this->paths.count = 0;
+}
+
+void InstalledPackages::addPath(InstalledPackageVersion *ipv)
+{
+    // internal method, mutex is not used
+
+    QString dir = ipv->getDirectory();
+    if (dir.isEmpty())
+        return;
+
+    QStringList parts = splitPath(dir);
+    PathNode* node = &this->paths;
+    node->count++;
+    for (int i = 0; i < parts.size(); i++) {
+        PathNode*& child = node->children[parts.at(i)];
+        if (!child)
+            child = new PathNode();
+        node = child;
+        node->count++;
+    }
+    node->owners.append(ipv);
+}
+
+void InstalledPackages::removePath(InstalledPackageVersion *ipv)
+{
+    // internal method, mutex is not used
+
+    QString dir = ipv->getDirectory();
+    if (dir.isEmpty())
+        return;
+
+    QStringList parts = splitPath(dir);
+    QList<PathNode*> nodes;
+    PathNode* node = &this->paths;
+    nodes.append(node);
+    for (int i = 0; i < parts.size(); i++) {
+        node = node->children.value(parts.at(i));
+        if (!node)
+            return;
+        nodes.append(node);
+    }
+
+    if (!node->owners.removeOne(ipv))
+        return;
+
+    for (int i = 0; i < nodes.size(); i++) {
+        nodes.at(i)->count--;
+    }
+
+    // empty nodes are removed starting from the top-most one
+    for (int i = 1; i < nodes.size(); i++) {
+        if (nodes.at(i)->count == 0) {
+            nodes.at(i - 1)->children.remove(parts.at(i - 1));
+            delete nodes.at(i);
+            break;
+        }
+    }
+}
+
+InstalledPackageVersion *InstalledPackages::findOwnerNoCopy(
+        const QString &filePath) const
+{
+    // internal method, mutex is not used
+
+    // all directories on the path to the file are owners. The one with the
+    // smallest key in "data" is returned for compatibility with the previous
+    // linear search.
+    InstalledPackageVersion* r = nullptr;
+    QString rkey;
+
+    QStringList parts = splitPath(filePath);
+    const PathNode* node = &this->paths;
+    for (int i = 0; i < parts.size(); i++) {
+        node = node->children.value(parts.at(i));
+        if (!node)
+            break;
+
+        for (int j = 0; j < node->owners.size(); j++) {
+            InstalledPackageVersion* ipv = node->owners.at(j);
+            QString key = PackageVersion::getStringId(ipv->package,
+                    ipv->version);
+            if (!r || key < rkey) {
+                r = ipv;
+                rkey = key;
+            }
+        }
+    }
+
+    return r;
 }
 
 InstalledPackageVersion* InstalledPackages::findNoCopy(const QString& package,
@@ -131,16 +286,20 @@ InstalledPackageVersion* InstalledPackages::find(const QString& package,
 
 QList<InstalledPackageVersion *> InstalledPackages::findAllInstalledMatches(const Dependency &dep) const
 {
+    this->mutex.lock();
+
     QList<InstalledPackageVersion*> r;
-    QList<InstalledPackageVersion*> installed = getAll();
+    const QList<InstalledPackageVersion*> installed =
+            this->byPackage.value(dep.package);
     for (int i = 0; i < installed.count(); i++) {
         InstalledPackageVersion* ipv = installed.at(i);
-        if (ipv->package == dep.package &&
-                dep.test(ipv->version)) {
+        if (ipv->installed() && dep.test(ipv->version)) {
             r.append(ipv->clone());
         }
     }
-    qDeleteAll(installed);
+
+    this->mutex.unlock();
+
     return r;
 }
 
@@ -254,8 +413,8 @@ void InstalledPackages::detect3rdParty(Job* job, DBRepository* r,
 
 void InstalledPackages::addPackages(Job* job, DBRepository* r,
         Repository* rep,
-        const QList<InstalledPackageVersion*>& installed,
-        bool replace)
+        const QList<InstalledPackageVersion*>& installed, int index,
+        const QList<bool>& replace, QHash<QString, int>* writers)
 {
     // this method does not manipulate "data" directly => no locking
 
@@ -293,7 +452,7 @@ void InstalledPackages::addPackages(Job* job, DBRepository* r,
 
     // save all detected packages and versions
     if (job->shouldProceed()) {
-        r->saveAll(job, rep, replace);
+        r->saveDetected(job, rep, index, replace, writers);
     }
 
     job->complete();
@@ -439,40 +598,33 @@ void InstalledPackages::processOneInstalled3rdParty(DBRepository *r,
     // we cannot handle nested directories
     if (err.isEmpty()) {
         if (!d.isEmpty()) {
-            QList<InstalledPackageVersion*> all = this->getAll();
+            this->mutex.lock();
 
-            for (int i = 0; i < all.size(); i++) {
-                InstalledPackageVersion* v = all.at(i);
-
-                // e.g. an MSI package and a package from the Control Panel
-                // "Software" have the same path
-                /* not yet ready
-                 *
-                 * It makes sense to only consider versions > 1.0 as "1.0" is
-                 * often used instead of an actual version number.
-                 *
-                 * if (WPMUtils::pathEquals(d, v->getDirectory()) &&
-                        //ipv.package == v->package &&
-                        (detectionInfoPrefix == "msi:" ||
-                         detectionInfoPrefix == "control-panel:")) {
-                    qCDebug(npackd) << "Found update from" <<
-                            ipv.package << ipv.version.getVersionString() <<
-                            "to" << v->package << v->version.getVersionString();
-                    //setPackageVersionPath(v->package, v->version, "", false);
-                }*/
-
-                if (WPMUtils::isUnderOrEquals(d, v->getDirectory())) {
-                    err = "Cannot handle nested directories";
-                    break;
-                }
-
-                if (WPMUtils::isUnderOrEquals(v->getDirectory(), d)) {
-                    d = "";
-                    break;
-                }
-            }
+            // another package version is installed in this directory or
+            // above
+            if (findOwnerNoCopy(d))
+                err = "Cannot handle nested directories";
+            else if (isUsedBelow(d))
+                d = "";
 
-            qDeleteAll(all);
+            this->mutex.unlock();
+
+            // e.g. an MSI package and a package from the Control Panel
+            // "Software" have the same path
+            /* not yet ready
+             *
+             * It makes sense to only consider versions > 1.0 as "1.0" is
+             * often used instead of an actual version number.
+             *
+             * if (WPMUtils::pathEquals(d, v->getDirectory()) &&
+                    //ipv.package == v->package &&
+                    (detectionInfoPrefix == "msi:" ||
+                     detectionInfoPrefix == "control-panel:")) {
+                qCDebug(npackd) << "Found update from" <<
+                        ipv.package << ipv.version.getVersionString() <<
+                        "to" << v->package << v->version.getVersionString();
+                //setPackageVersionPath(v->package, v->version, "", false);
+            }*/
         }
     }
 
@@ -534,13 +686,16 @@ void InstalledPackages::processOneInstalled3rdParty(DBRepository *r,
     InstalledPackageVersion* ipv2 = nullptr;
     if (err.isEmpty()) {
         // qCDebug(npackd) << "    4";
+        this->mutex.lock();
         ipv2 = this->findOrCreate(ipv.package, ipv.version, &err);
-    }
-
-    if (err.isEmpty()) {
-        // qCDebug(npackd) << "    5";
-        ipv2->detectionInfo = ipv.detectionInfo;
-        ipv2->setPath(d);
+        if (err.isEmpty()) {
+            // qCDebug(npackd) << "    5";
+            ipv2->detectionInfo = ipv.detectionInfo;
+            removePath(ipv2);
+            ipv2->setPath(d);
+            addPath(ipv2);
+        }
+        this->mutex.unlock();
     }
 
     // this is a consistent output place for all packages detected by
@@ -567,7 +722,7 @@ InstalledPackageVersion* InstalledPackages::findOrCreate(const QString& package,
     InstalledPackageVersion* r = this->data.value(key);
     if (!r) {
         r = new InstalledPackageVersion(package, version, "");
-        this->data.insert(key, r);
+        insertNoCopy(r);
     }
 
     return r;
@@ -586,11 +741,13 @@ QString InstalledPackages::setPackageVersionPath(const QString& package,
     InstalledPackageVersion* ipv = this->findNoCopy(package, version);
     if (!ipv) {
         ipv = new InstalledPackageVersion(package, version, directory);
-        this->data.insert(package + "/" + version.getVersionString(), ipv);
+        insertNoCopy(ipv);
         changed = true;
     } else {
         if (ipv->getDirectory() != directory) {
+            removePath(ipv);
             ipv->setPath(directory);
+            addPath(ipv);
             changed = true;
         }
     }
@@ -610,18 +767,7 @@ InstalledPackageVersion *InstalledPackages::findOwner(
 {
     this->mutex.lock();
 
-    InstalledPackageVersion* f = nullptr;
-    QList<InstalledPackageVersion*> ipvs = this->data.values();
-    for (int i = 0; i < ipvs.count(); ++i) {
-        InstalledPackageVersion* ipv = ipvs.at(i);
-        QString dir = ipv->getDirectory();
-        if (!dir.isEmpty() && (WPMUtils::pathEquals(filePath, dir) ||
-                WPMUtils::isUnder(filePath, dir))) {
-            f = ipv;
-            break;
-        }
-    }
-
+    InstalledPackageVersion* f = findOwnerNoCopy(filePath);
     if (f)
         f = f->clone();
 
@@ -652,11 +798,11 @@ QList<InstalledPackageVersion *> InstalledPackages::getByPackage(
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    const QList<InstalledPackageVersion*> all = this->byPackage.value(package);
     QList<InstalledPackageVersion*> r;
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
-        if (ipv->installed() && ipv->package == package)
+        if (ipv->installed())
             r.append(ipv->clone());
     }
 
@@ -669,13 +815,11 @@ void InstalledPackages::remove(const QString &package)
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    const QList<InstalledPackageVersion*> all = this->byPackage.value(package);
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
-        if (ipv->package == package) {
-            data.remove(PackageVersion::getStringId(package, ipv->version));
-            delete ipv;
-        }
+        removeNoCopy(ipv);
+        delete ipv;
     }
 
     this->mutex.unlock();
@@ -686,13 +830,14 @@ InstalledPackageVersion* InstalledPackages::getNewestInstalled(
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    // the versions are sorted
+    const QList<InstalledPackageVersion*> all = this->byPackage.value(package);
     InstalledPackageVersion* r = nullptr;
-    for (int i = 0; i < all.count(); i++) {
+    for (int i = all.count() - 1; i >= 0; i--) {
         InstalledPackageVersion* ipv = all.at(i);
-        if (ipv->package == package && ipv->installed()) {
-            if (!r || r->version < ipv->version)
-                r = ipv;
+        if (ipv->installed()) {
+            r = ipv;
+            break;
         }
     }
 
@@ -706,30 +851,54 @@ InstalledPackageVersion* InstalledPackages::getNewestInstalled(
 
 bool InstalledPackages::isInstalled(const Dependency& dep) const
 {
-    QList<InstalledPackageVersion*> installed = getAll();
+    this->mutex.lock();
+
+    const QList<InstalledPackageVersion*> installed =
+            this->byPackage.value(dep.package);
     bool res = false;
     for (int i = 0; i < installed.count(); i++) {
         InstalledPackageVersion* ipv = installed.at(i);
-        if (ipv->package == dep.package &&
-                dep.test(ipv->version)) {
+        if (ipv->installed() && dep.test(ipv->version)) {
             res = true;
             break;
         }
     }
-    qDeleteAll(installed);
+
+    this->mutex.unlock();
+
     return res;
 }
 
+bool InstalledPackages::isUsedBelow(const QString &dir) const
+{
+    this->mutex.lock();
+
+    QStringList parts = splitPath(dir);
+    const PathNode* node = &this->paths;
+    for (int i = 0; i < parts.size() && node; i++) {
+        node = node->children.value(parts.at(i));
+    }
+    bool r = node && node->count > 0;
+
+    this->mutex.unlock();
+
+    return r;
+}
+
 QSet<QString> InstalledPackages::getPackages() const
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
     QSet<QString> r;
-    for (int i = 0; i < all.count(); i++) {
-        InstalledPackageVersion* ipv = all.at(i);
-        if (ipv->installed())
-            r.insert(ipv->package);
+    for (auto it = this->byPackage.cbegin(); it != this->byPackage.cend();
+            ++it) {
+        const QList<InstalledPackageVersion*>& list = it.value();
+        for (int i = 0; i < list.count(); i++) {
+            if (list.at(i)->installed()) {
+                r.insert(it.key());
+                break;
+            }
+        }
     }
 
     this->mutex.unlock();
@@ -836,7 +1005,11 @@ QStringList InstalledPackages::getAllInstalledPackagePaths() const
 
 void InstalledPackages::refresh(DBRepository *rep, Job *job)
 {
-    rep->currentRepository = 10000;
+    rep->currentRepository = DBRepository::DETECTED_REPOSITORY;
+
+    // findBetterPackageName() is called for every MSI package and every
+    // program from the control panel
+    rep->setTitleIndexEnabled(true);
 
     // no direct usage of "data" here => no mutex
 
@@ -889,31 +1062,60 @@ void InstalledPackages::refresh(DBRepository *rep, Job *job)
 
         // detect everything in threads
         QList<QFuture<void> > futures;
+        QList<Job*> scanJobs;
+
+        // indexes of the completed scans in the order of completion
+        QMutex scannedMutex;
+        QQueue<int> scannedQueue;
+        QSemaphore scanned;
         for (int i = 0; i < tpms.count(); i++) {
             AbstractThirdPartyPM* tpm = tpms.at(i);
             Job* s = job->newSubJob(0.1,
                     jobTitles.at(i), false, tpm->detectionPrefix != "wua:"); // Windows Updates are not important
-
-            QFuture<void> future = QtConcurrent::run(
-                    tpm,
-                    &AbstractThirdPartyPM::scan, s,
-                    installeds.at(i), repositories.at(i));
+            scanJobs.append(s);
+
+            QList<InstalledPackageVersion*>* installed = installeds.at(i);
+            Repository* repository = repositories.at(i);
+            QMutex* m = &scannedMutex;
+            QQueue<int>* queue = &scannedQueue;
+            QSemaphore* finished = &scanned;
+            QFuture<void> future = QtConcurrent::run([=]() {
+                tpm->scan(s, installed, repository);
+
+                m->lock();
+                queue->enqueue(i);
+                m->unlock();
+                finished->release();
+            });
             futures.append(future);
         }
 
-        // waiting for threads to end and store the detected
-        // packages, versions and licenses
-        for (int i = 0; i < futures.count(); i++) {
+        // store the detected packages, versions and licenses in the order
+        // the scans are completed. The result of saveDetected() does not
+        // depend on this order.
+        QHash<QString, int> writers;
+        for (int n = 0; n < futures.count(); n++) {
+            scanned.acquire();
+
+            scannedMutex.lock();
+            int i = scannedQueue.dequeue();
+            scannedMutex.unlock();
+
             futures[i].waitForFinished();
 
             Job* sub = job->newSubJob(0.1,
                     QObject::tr("Saving detected packages %1").arg(i),
                     false, true);
             addPackages(sub, rep, repositories.at(i),
-                    *installeds.at(i),
-                    replace.at(i));
+                    *installeds.at(i), i, replace, &writers);
+
+            qCDebug(npackd).noquote() << QString(
+                    "%1: scanning %2 ms, saving %3 ms").
+                    arg(scanJobs.at(i)->getTitle()).
+                    arg(scanJobs.at(i)->getDuration()).
+                    arg(sub->getDuration());
 
-            job->setProgress(0.2 + (i + 1.0) / futures.count() * 0.4);
+            job->setProgress(0.2 + (n + 1.0) / futures.count() * 0.4);
         }
 
         for (int i = 0; i < futures.count(); i++) {
@@ -952,6 +1154,8 @@ void InstalledPackages::refresh(DBRepository *rep, Job *job)
             sub->completeWithProgress();
     }
 
+    rep->setTitleIndexEnabled(false);
+
     job->complete();
 }
 
@@ -1032,7 +1236,9 @@ QString InstalledPackages::setOne(const InstalledPackageVersion& other)
     InstalledPackageVersion* ipv =
             this->findOrCreate(other.package, other.version, &err);
     if (*ipv != other) {
+        removePath(ipv);
         *ipv = other;
+        addPath(ipv);
         changed = true;
     }
     this->mutex.unlock();
@@ -1160,12 +1366,9 @@ QString InstalledPackages::readRegistryDatabase()
     }
 
     this->mutex.lock();
-    qDeleteAll(this->data);
-    this->data.clear();
+    clearNoCopy();
     for (int i = 0; i < ipvs.count(); i++) {
-        InstalledPackageVersion* ipv = ipvs.at(i);
-        this->data.insert(PackageVersion::getStringId(ipv->package,
-                ipv->version), ipv->clone());
+        insertNoCopy(ipvs.at(i)->clone());
     }
     this->mutex.unlock();
 
@@ -1183,8 +1386,7 @@ QString InstalledPackages::readRegistryDatabase()
 void InstalledPackages::clear()
 {
     this->mutex.lock();
-    qDeleteAll(this->data);
-    this->data.clear();
+    clearNoCopy();
     this->mutex.unlock();
 }
 
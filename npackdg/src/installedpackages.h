@@ -5,6 +5,8 @@
 #include <memory>
 
 #include <QMap>
+#include <QHash>
+#include <QStringList>
 #include <QObject>
 #include <QSet>
 #include <QString>
@@ -34,6 +36,89 @@ private:
     /** please use the mutex to access the data */
     QMap<QString, InstalledPackageVersion*> data;
 
+    /** node in the index for the installation directories */
+    class PathNode {
+    public:
+        /** path component in lower case -> child node */
+        QHash<QString, PathNode*> children;
+
+        /** package versions installed in exactly this directory */
+        QList<InstalledPackageVersion*> owners;
+
+        /** number of package versions in this directory and below */
+        int count = 0;
+
+        ~PathNode();
+    };
+
+    /**
+     * index for "data": trie with the installation directories of all
+     * installed package versions. Please use the mutex to access it.
+     */
+    PathNode paths;
+
+    /**
+     * index for "data": full package name -> all objects for this package
+     * sorted by the version number. Please use the mutex to access it.
+     */
+    QHash<QString, QList<InstalledPackageVersion*>> byPackage;
+
+    /**
+     * @param path file or directory path
+     * @return components of the normalized path in lower case
+     */
+    static QStringList splitPath(const QString& path);
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief adds an object to "data" and the indexes
+     * @param ipv [ownership:take] new object
+     */
+    void insertNoCopy(InstalledPackageVersion* ipv);
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief removes an object from "data" and the indexes. The object is
+     *     not deleted.
+     * @param ipv an object from "data"
+     */
+    void removeNoCopy(InstalledPackageVersion* ipv);
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief deletes all objects in "data" and clears the indexes
+     */
+    void clearNoCopy();
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief adds the directory of an installed package version to "paths"
+     * @param ipv an object from "data"
+     */
+    void addPath(InstalledPackageVersion* ipv);
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief removes the directory of an installed package version from
+     *     "paths". This must be called before the directory is changed.
+     * @param ipv an object from "data"
+     */
+    void removePath(InstalledPackageVersion* ipv);
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @param filePath file or directory
+     * @return the owner of the specified file or directory that would be
+     *     found first in "data" or 0
+     */
+    InstalledPackageVersion* findOwnerNoCopy(const QString& filePath) const;
+
     /**
      * @brief processOneInstalled3rdParty
      * @param r database repository
@@ -114,7 +199,20 @@ private:
 
     QString findBetterPackageName(DBRepository *r, const QString &package);
 
-    void addPackages(Job *job, DBRepository *r, Repository *rep, const QList<InstalledPackageVersion *> &installed, bool replace);
+    /**
+     * @brief saves the packages detected by a third party package manager
+     * @param job job
+     * @param r database
+     * @param rep detected objects. Packages and package versions that are
+     *     not installed are removed.
+     * @param installed detected installed package versions
+     * @param index index of the package manager
+     * @param replace see DBRepository::saveDetected()
+     * @param writers see DBRepository::saveDetected()
+     */
+    void addPackages(Job *job, DBRepository *r, Repository *rep,
+            const QList<InstalledPackageVersion *> &installed, int index,
+            const QList<bool>& replace, QHash<QString, int>* writers);
 
     void dump() const;
 
@@ -225,6 +323,13 @@ public:
      */
     InstalledPackageVersion* findOwner(const QString& filePath) const;
 
+    /**
+     * @param dir a directory
+     * @return true if a package version is installed in the specified
+     *     directory or in a directory under it
+     */
+    bool isUsedBelow(const QString& dir) const;
+
     /**
      * @return [move] installed packages
      */
@@ -233,7 +338,7 @@ public:
     /**
      * Searches for installed versions of a package.
      *
-     * @return [move] installed packages
+     * @return [move] installed packages sorted by the version number
      */
     QList<InstalledPackageVersion*> getByPackage(const QString& package) const;
 
@@ -5,22 +5,33 @@
 
 #include "qmutex.h"
 
+#include "job.h"
+
+#ifdef Q_OS_WIN
 #include "wpmutils.h"
+#else
+// wpmutils.cpp defines the logging category on Windows
+Q_LOGGING_CATEGORY(npackd, "npackd")
+#endif
 
-#include "job.h"
+std::atomic<int> Job::notificationInterval(100);
 
 Job::Job(const QString &title, Job *parent):
-        mutex(QMutex::Recursive), parentJob(parent)
+        mutex(QMutex::Recursive), progress(0.0), notified(0),
+        changePending(false), cancelRequested(false), completed(false),
+        parentJob(parent)
 {
     this->title = title;
-    this->progress = 0.0;
     this->subJobStart = 0;
     this->subJobSteps = -1;
-    this->cancelRequested = false;
-    this->completed = false;
     this->started = 0;
+    this->duration = -1;
+    this->timer.start();
     this->uparentProgress = true;
     this->updateParentErrorMessage = false;
+
+    // the first change is reported immediately
+    this->notified = -notificationInterval;
 }
 
 Job::~Job()
@@ -32,8 +43,8 @@ time_t Job::remainingTime()
 {
     this->mutex.lock();
     time_t started_ = this->started;
-    double progress_ = this->progress;
     this->mutex.unlock();
+    double progress_ = this->progress;
 
     time_t result;
     if (started != 0) {
@@ -62,39 +73,53 @@ time_t Job::getStarted()
 void Job::waitFor()
 {
     waitForChildren();
+
+    completedMutex.lock();
     while (!isCompleted()) {
-        Sleep(100);
+        completedCondition.wait(&completedMutex);
     }
+    completedMutex.unlock();
 }
 
 void Job::waitForChildren()
 {
-    this->mutex.lock();
-    for (int i = 0; i < this->childJobs.count(); i++) {
-        Job* ch = this->childJobs.at(i);
-        if (!ch->isCompleted()) {
-            ch->waitFor();
-        }
+    // the mutex is not held while waiting so that the children can change
+    // this job
+    for (int i = 0; ; i++) {
+        this->mutex.lock();
+        Job* ch = i < this->childJobs.count() ? this->childJobs.at(i) : nullptr;
+        this->mutex.unlock();
+
+        if (!ch)
+            break;
+
+        ch->waitFor();
     }
-    this->mutex.unlock();
 }
 
 void Job::complete()
 {
     // waitForChildren();
 
-    bool completed_;
+    // the last change that was not reported because of the notification rate
+    if (!this->completed && changePending.exchange(false))
+        fireChange();
+
     this->mutex.lock();
-    bool f = false;
-    completed_ = this->completed;
-    if (!completed_) {
+    bool f = !this->completed;
+    if (f) {
+        this->duration = this->timer.elapsed();
         this->completed = true;
-        f = true;
     }
     this->mutex.unlock();
 
-    if (f)
+    if (f) {
+        completedMutex.lock();
+        completedCondition.wakeAll();
+        completedMutex.unlock();
+
         emit jobCompleted();
+    }
 }
 
 void Job::completeWithProgress()
@@ -105,12 +130,7 @@ void Job::completeWithProgress()
 
 bool Job::isCancelled() const
 {
-    bool cancelRequested_;
-    this->mutex.lock();
-    cancelRequested_ = this->cancelRequested;
-    this->mutex.unlock();
-
-    return cancelRequested_;
+    return this->cancelRequested;
 }
 
 void Job::cancel()
@@ -155,7 +175,9 @@ Job* Job::newSubJob(double part, const QString &title,
             r, SLOT(parentJobChanged(Job*)),
             Qt::DirectConnection);
 
+    this->mutex.lock();
     this->childJobs.append(r);
+    this->mutex.unlock();
 
     //qCDebug(npackd) << "subJobCreated" << r->title;
 
@@ -173,37 +195,44 @@ void Job::fireSubJobCreated(Job* sub)
     emit subJobCreated(sub);
 }
 
-bool Job::isCompleted()
+qint64 Job::getDuration() const
 {
-    bool completed_;
     this->mutex.lock();
-    completed_ = this->completed;
+    qint64 r = this->duration >= 0 ? this->duration : this->timer.elapsed();
     this->mutex.unlock();
-    return completed_;
+
+    return r;
 }
 
-void Job::fireChange()
+bool Job::isCompleted()
 {
-    this->mutex.lock();
-    if (this->started == 0)
-        time(&this->started);
+    return this->completed;
+}
 
-    bool t = false;
-    if (this->timeout > 0) {
-        time_t now;
-        time(&now);
-        double d = difftime(now, this->started);
-        if (d > this->timeout) {
-            t = true;
-        }
-    }
-    this->mutex.unlock();
+bool Job::startAndCheckTimeout()
+{
+    time_t now = time(nullptr);
+    time_t notStarted = 0;
+    this->started.compare_exchange_strong(notStarted, now);
 
+    int t = this->timeout;
+    return t > 0 && difftime(now, this->started) > t;
+}
+
+void Job::notify()
+{
     Job* top = this;
     while (top->parentJob)
         top = top->parentJob;
 
     top->fireChange(this);
+}
+
+void Job::fireChange()
+{
+    bool t = startAndCheckTimeout();
+
+    notify();
 
     if (t)
         this->cancel();
@@ -214,58 +243,92 @@ void Job::fireChange(Job* s)
     emit changed(s);
 }
 
-void Job::setProgress(double progress)
+void Job::fireChangeRateLimited()
 {
-    bool changed = false;
+    // the start time and the timeout do not depend on the notifications
+    bool t = startAndCheckTimeout();
+
+    qint64 now = this->timer.elapsed();
+    qint64 last = this->notified;
+
+    // only one thread reports the change
+    if (now - last >= notificationInterval &&
+            this->notified.compare_exchange_strong(last, now)) {
+        changePending = false;
+        notify();
+    } else {
+        changePending = true;
+    }
+
+    if (t)
+        this->cancel();
+}
+
+void Job::flushChange()
+{
+    if (changePending.exchange(false)) {
+        this->notified = this->timer.elapsed();
+        notify();
+    }
 
     this->mutex.lock();
+    QList<Job*> children = this->childJobs;
+    this->mutex.unlock();
+
+    for (int i = 0; i < children.size(); i++) {
+        children.at(i)->flushChange();
+    }
+}
+
+void Job::setNotificationInterval(int ms)
+{
+    notificationInterval = ms;
+}
+
+int Job::getNotificationInterval()
+{
+    return notificationInterval;
+}
+
+void Job::setProgress(double progress)
+{
+    double old = this->progress.exchange(progress);
+
     if (progress > 1.0001) {
-        qCDebug(npackd) << "Job: progress =" << progress << "in" << this->title;
+        qCDebug(npackd) << "Job: progress =" << progress << "in" << getTitle();
     }
-    if (progress < this->progress) {
-        qCDebug(npackd) << "Job: stepping back from" << this->progress <<
+    if (progress < old) {
+        qCDebug(npackd) << "Job: stepping back from" << old <<
                 "to" << progress << "in" << getFullTitle();
     }
-    if (fabs(progress - this->progress) > 0.005) {
-        this->progress = progress;
-        changed = true;
-    }
-    this->mutex.unlock();
-
-    if (changed) {
-        fireChange();
 
+    if (progress != old) {
         if (uparentProgress)
             updateParentProgress();
+
+        // the end of a job is always reported
+        if (progress >= 1) {
+            this->notified = this->timer.elapsed();
+            changePending = false;
+            fireChange();
+        } else {
+            fireChangeRateLimited();
+        }
     }
 }
 
 void Job::updateParentProgress()
 {
-    Job* parentJob_;
-    double d;
-    this->mutex.lock();
-    parentJob_ = parentJob;
-    if (parentJob_) {
-        d = this->subJobStart +
-                this->getProgress() * this->subJobSteps;
-    } else {
-        d = 0.0;
-    }
-    this->mutex.unlock();
-
-    if (parentJob_)
-        parentJob_->setProgress(d);
+    // "parentJob", "subJobStart" and "subJobSteps" do not change after the
+    // creation of a sub-job
+    if (parentJob)
+        parentJob->setProgress(this->subJobStart +
+                this->getProgress() * this->subJobSteps);
 }
 
 double Job::getProgress() const
 {
-    double progress_;
-    this->mutex.lock();
-    progress_ = this->progress;
-    this->mutex.unlock();
-
-    return progress_;
+    return this->progress;
 }
 
 int Job::getLevel() const
@@ -338,6 +401,7 @@ void Job::setTitle(const QString &title)
     fireChange();
 }
 
+#ifdef Q_OS_WIN
 void Job::checkOSCall(bool v)
 {
     if (!v) {
@@ -355,6 +419,7 @@ void Job::checkHResult(HRESULT v)
         setErrorMessage(err);
     }
 }
+#endif
 
 QString Job::getErrorMessage() const
 {
@@ -1,16 +1,22 @@
 #ifndef JOB_H
 #define JOB_H
 
-#include <windows.h>
+#include <atomic>
 
 #include <QString>
 #include <QObject>
 #include <QMetaType>
 #include <QMutex>
+#include <QWaitCondition>
 #include <QQueue>
 #include <QTime>
+#include <QElapsedTimer>
 #include <QList>
 
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
 class Job;
 
 /**
@@ -41,20 +47,46 @@ class Job;
  * } else {
  *     ....
  * }
+ *
+ * The progress and the state flags are stored in atomic variables and can be
+ * read and changed without locking. Changes of the progress are reported by
+ * the signal changed() at most once per notification interval (see
+ * setNotificationInterval()). Other changes like the title are always
+ * reported. A change that was held back is reported by flushChange() that
+ * should be called regularly by the views and at the latest when the job is
+ * completed.
  */
 class Job: public QObject
 {
     Q_OBJECT
 private:
+    /** minimum time between 2 notifications in milliseconds */
+    static std::atomic<int> notificationInterval;
+
     mutable QMutex mutex;
 
+    /** used together with "completedCondition" */
+    QMutex completedMutex;
+
+    /** signalled when this job is completed */
+    QWaitCondition completedCondition;
+
     /** timeout in seconds or 0 or "unlimited" */
-    int timeout = 0;
+    std::atomic<int> timeout{0};
 
     QList<Job*> childJobs;
 
     /** progress 0...1 */
-    double progress;
+    std::atomic<double> progress;
+
+    /**
+     * time of the last notification in milliseconds since the creation of
+     * this job
+     */
+    std::atomic<qint64> notified;
+
+    /** true = a change was not reported because of the notification rate */
+    std::atomic<bool> changePending;
 
     QString title;
 
@@ -64,12 +96,18 @@ private:
     double subJobStart;
 
     /** true if the user presses the "cancel" button. */
-    bool cancelRequested;
+    std::atomic<bool> cancelRequested;
 
-    bool completed;
+    std::atomic<bool> completed;
 
     /** time when this job was started or 0 */
-    time_t started;
+    std::atomic<time_t> started;
+
+    /** measures the time since the creation of this job */
+    QElapsedTimer timer;
+
+    /** duration in milliseconds or -1 if this job is not yet completed */
+    qint64 duration;
 
     /** should the parent progress be updated? */
     bool uparentProgress;
@@ -86,6 +124,27 @@ private:
      */
     void fireChange();
 
+    /**
+     * @brief emits changed() for the top-level job
+     * @threadsafe
+     */
+    void notify();
+
+    /**
+     * @brief stores the start time if it is not yet set and checks the
+     *     timeout
+     * @return true if the timeout is exceeded
+     * @threadsafe
+     */
+    bool startAndCheckTimeout();
+
+    /**
+     * @brief reports a change if the last notification is older than the
+     *     notification interval. Otherwise the change will be reported later.
+     * @threadsafe
+     */
+    void fireChangeRateLimited();
+
     void fireSubJobCreated(Job *sub);
 
     void fireChange(Job *s);
@@ -115,6 +174,13 @@ public:
      */
     bool isCompleted();
 
+    /**
+     * @threadsafe
+     * @return time in milliseconds between the creation and the completion of
+     *     this job or since the creation if the job is not yet completed
+     */
+    qint64 getDuration() const;
+
     /**
      * This must be called in order to complete the job regardless of
      * setProgress, errors or cancellation state.
@@ -246,6 +312,7 @@ public:
      */
     void setTitle(const QString &title);
 
+#ifdef Q_OS_WIN
     /**
      * @brief checks the value returned by a Windows API function and sets
      *     the error message to the formatted value of GetLastError() if the
@@ -264,6 +331,7 @@ public:
      *     CoCreateInstance
      */
     void checkHResult(HRESULT v);
+#endif
 
     /**
      * @return the approximate time necessary to complete the rest of this task
@@ -277,14 +345,36 @@ public:
 
     /**
      * @brief waitFor waits till this job and all its children are completed
+     * @threadsafe
      */
     void waitFor();
 
     /**
-     * @brief waitFor waits till all children are completed
+     * @brief waitFor waits till all children are completed. Sub-jobs created
+     *     while waiting are also waited for.
+     * @threadsafe
      */
     void waitForChildren();
 
+    /**
+     * @brief changes the minimum time between 2 notifications about the
+     *     changed progress or title for all jobs
+     * @param ms time in milliseconds. 0 means that every change is reported.
+     */
+    static void setNotificationInterval(int ms);
+
+    /**
+     * @return minimum time between 2 notifications in milliseconds
+     */
+    static int getNotificationInterval();
+
+    /**
+     * @brief reports the changes of this job and its sub-jobs that were held
+     *     back because of the notification interval
+     * @threadsafe
+     */
+    void flushChange();
+
     /**
      * @brief checks the timeout and cancells this job, if necessary. This call
      *     also propagates to the parent job.
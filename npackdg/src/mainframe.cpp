@@ -8,6 +8,7 @@
 #include <QListWidget>
 #include <QDialogButtonBox>
 #include <QAction>
+#include <QScrollBar>
 
 #include "dbrepository.h"
 #include "mainwindow.h"
@@ -59,6 +60,12 @@ MainFrame::MainFrame(QWidget *parent) :
             SIGNAL(selectionChanged(QItemSelection,QItemSelection)),
             this,
             SLOT(tableWidget_selectionChanged()));
+
+    // the model loads the rows around the visible part in the background
+    connect(t->verticalScrollBar(), SIGNAL(valueChanged(int)), this,
+            SLOT(tableWidget_viewportChanged()));
+    connect(t->verticalScrollBar(), SIGNAL(rangeChanged(int,int)), this,
+            SLOT(tableWidget_viewportChanged()));
 }
 
 MainFrame::~MainFrame()
@@ -336,6 +343,19 @@ void MainFrame::on_lineEditText_textChanged(QString )
     selectSomething();
 }
 
+void MainFrame::tableWidget_viewportChanged()
+{
+    QTableView* t = this->ui->tableWidget;
+    PackageItemModel* m = static_cast<PackageItemModel*>(t->model());
+
+    int first = t->rowAt(0);
+    int last = t->rowAt(t->viewport()->height() - 1);
+    if (last < 0)
+        last = m->rowCount(QModelIndex()) - 1;
+    if (first >= 0)
+        m->setVisibleRows(first, last);
+}
+
 void MainFrame::tableWidget_selectionChanged()
 {
     qDeleteAll(this->selectedPackages);
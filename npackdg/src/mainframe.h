@@ -117,6 +117,7 @@ private slots:
     void on_tableWidget_doubleClicked(QModelIndex index);
     void on_lineEditText_textChanged(QString );
     void tableWidget_selectionChanged();
+    void tableWidget_viewportChanged();
     void on_radioButtonAll_toggled(bool checked);
     void on_radioButtonInstalled_toggled(bool checked);
     void on_radioButtonUpdateable_toggled(bool checked);
@@ -38,6 +38,7 @@
 #include <QtConcurrent/QtConcurrentRun>
 #include <QDialogButtonBox>
 #include <QHeaderView>
+#include <QFileInfo>
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
@@ -222,6 +223,14 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(VisibleJobs::getDefault(), SIGNAL(changed()),
             this, SLOT(visibleJobsChanged()));
 
+    // other processes (e.g. "ncl detect") may publish a new generation of
+    // the database
+    QString dbDir = QFileInfo(DBRepository::getBaseFile()).absolutePath();
+    if (QFileInfo(dbDir).isDir())
+        databaseWatcher.addPath(dbDir);
+    connect(&databaseWatcher, SIGNAL(directoryChanged(QString)),
+            this, SLOT(databaseDirectoryChanged(QString)));
+
     this->mainFrame->getFilterLineEdit()->setFocus();
 
     InstalledPackages* ip = InstalledPackages::getDefault();
@@ -985,6 +994,10 @@ void MainWindow::process(QList<InstallOperation*> &install,
 {
     QString err;
 
+    // the operations are executed on the current generation of the database
+    if (DBRepository::getDefault()->isNewGenerationPublished())
+        reloadDatabase();
+
     bool confirmed = false;
     QString title;
     if (err.isEmpty())
@@ -1577,7 +1590,7 @@ void MainWindow::recognizeAndLoadRepositories(bool useCache)
 
     QtConcurrent::run(DBRepository::getDefault(),
             &DBRepository::updateF5Runnable,
-            job, useCache);
+            job, useCache, true);
 }
 
 void MainWindow::setMenuAccelerators(){
@@ -1643,6 +1656,28 @@ void MainWindow::reloadTabs()
 
 void MainWindow::recognizeAndLoadRepositoriesThreadFinished()
 {
+    reloadDatabase();
+
+    this->reloadRepositoriesThreadRunning = false;
+    updateActions();
+}
+
+void MainWindow::databaseDirectoryChanged(const QString& /*path*/)
+{
+    // the database is not switched while the jobs of this process use it
+    if (!this->reloadRepositoriesThreadRunning &&
+            VisibleJobs::getDefault()->runningJobs.isEmpty() &&
+            DBRepository::getDefault()->isNewGenerationPublished())
+        reloadDatabase();
+}
+
+void MainWindow::reloadDatabase()
+{
+    // a new generation of the database may have been published
+    QString err = DBRepository::getDefault()->reopenDefault();
+    if (!err.isEmpty())
+        addErrorMessage(err, err, true, QMessageBox::Critical);
+
     DBRepository::getDefault()->clearCache();
 
     QTableView* t = this->mainFrame->getTableWidget();
@@ -1662,9 +1697,6 @@ void MainWindow::recognizeAndLoadRepositoriesThreadFinished()
     selectPackages(sel);
     qDeleteAll(sel);
     reloadTabs();
-
-    this->reloadRepositoriesThreadRunning = false;
-    updateActions();
 }
 
 QList<void*> MainWindow::getSelected(const QString& type) const
@@ -17,6 +17,7 @@
 #include <QString>
 #include <QCache>
 #include <QList>
+#include <QFileSystemWatcher>
 
 #include "packageversion.h"
 #include "package.h"
@@ -58,6 +59,12 @@ private:
     QWidget* jobsTab;
     MainFrame* mainFrame;
 
+    /**
+     * @brief watches the directory of the database for new generations
+     *     published by other processes (see DBRepository::publish())
+     */
+    QFileSystemWatcher databaseWatcher;
+
     UINT taskbarMessageId;
     ITaskbarList3* taskbarInterface;
 
@@ -287,6 +294,12 @@ public:
      * @brief start filling the list asnchronously
      */
     void fillListInBackground();
+
+    /**
+     * @brief opens the current generation of the database if a newer one
+     *     was published and reloads the package list and the tabs
+     */
+    void reloadDatabase();
 protected:
     void changeEvent(QEvent *e);
 
@@ -301,6 +314,7 @@ public slots:
 private slots:
     void processThreadFinished();
     void recognizeAndLoadRepositoriesThreadFinished();
+    void databaseDirectoryChanged(const QString& path);
     void on_actionShow_Details_triggered();
     void on_tabWidget_currentChanged(int index);
     void on_tabWidget_tabCloseRequested(int index);
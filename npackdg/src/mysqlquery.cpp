@@ -1,26 +1,94 @@
 #include "QLoggingCategory"
 
+#include <QElapsedTimer>
+#include <QMapIterator>
+#include <QSqlError>
+
 #include "mysqlquery.h"
 #include "wpmutils.h"
+#include "sqlprofiler.h"
 
-MySQLQuery::MySQLQuery(QSqlDatabase db) : QSqlQuery(db)
+MySQLQuery::MySQLQuery(QSqlDatabase db) : QSqlQuery(db), db(db),
+        profiling(false), duration(0), rows(0)
 {
 }
 
+void MySQLQuery::startProfiling(const QString& query, qint64 ns)
+{
+    // prepared statements are executed many times with the same SQL
+    if (query != profiledQuery) {
+        profiledQuery = query;
+        statement = SQLProfiler::normalize(query);
+    }
+    profiledValues = boundValues();
+    duration = ns;
+    rows = 0;
+    profiling = true;
+
+    // there are no rows to wait for
+    if (!isSelect())
+        endProfiling();
+}
+
+void MySQLQuery::endProfiling()
+{
+    if (!profiling)
+        return;
+
+    profiling = false;
+
+    SQLProfiler* p = SQLProfiler::getDefault();
+    if (p->record(statement, duration, rows)) {
+        QString plan;
+
+        QSqlQuery q(db);
+        if (q.prepare(QStringLiteral("EXPLAIN QUERY PLAN ") + profiledQuery)) {
+            // the values of the measured execution, not the ones bound for
+            // the next execution
+            QMapIterator<QString, QVariant> it(profiledValues);
+            while (it.hasNext()) {
+                it.next();
+                q.bindValue(it.key(), it.value());
+            }
+        }
+        if (q.exec()) {
+            QStringList lines;
+            while (q.next()) {
+                // columns: id, parent, notused, detail
+                lines.append(q.value(3).toString());
+            }
+            plan = lines.join('\n');
+        } else {
+            plan = q.lastError().text();
+        }
+
+        if (plan.isEmpty())
+            plan = QStringLiteral("(no plan)");
+        p->setPlan(statement, plan);
+    }
+}
+
 bool MySQLQuery::exec(const QString &query)
 {
+    endProfiling();
+
     qCDebug(npackd) << query;
 
     bool e = npackd().isDebugEnabled();
+    bool profile = SQLProfiler::getDefault()->isEnabled();
 
-    DWORD start = 0;
-    if (e)
-        start = GetTickCount();
+    QElapsedTimer timer;
+    if (e || profile)
+        timer.start();
 
     bool r = QSqlQuery::exec(query);
 
-    if (e) {
-        qCDebug(npackd) << (GetTickCount() - start) << "ms";
+    if (e || profile) {
+        qint64 ns = timer.nsecsElapsed();
+        if (e)
+            qCDebug(npackd) << (ns / 1000000.0) << "ms";
+        if (profile)
+            startProfiling(query, ns);
     }
 
     return r;
@@ -28,18 +96,25 @@ bool MySQLQuery::exec(const QString &query)
 
 bool MySQLQuery::exec()
 {
+    endProfiling();
+
     qCDebug(npackd) << this->lastQuery();
 
     bool e = npackd().isDebugEnabled();
+    bool profile = SQLProfiler::getDefault()->isEnabled();
 
-    DWORD start = 0;
-    if (e)
-        start = GetTickCount();
+    QElapsedTimer timer;
+    if (e || profile)
+        timer.start();
 
     bool r = QSqlQuery::exec();
 
-    if (e) {
-        qCDebug(npackd) << (GetTickCount() - start) << "ms";
+    if (e || profile) {
+        qint64 ns = timer.nsecsElapsed();
+        if (e)
+            qCDebug(npackd) << (ns / 1000000.0) << "ms";
+        if (profile)
+            startProfiling(this->lastQuery(), ns);
     }
 
     return r;
@@ -47,11 +122,32 @@ bool MySQLQuery::exec()
 
 bool MySQLQuery::prepare(const QString& query)
 {
+    endProfiling();
+
     return QSqlQuery::prepare(query);
 }
 
 bool MySQLQuery::next()
 {
-    return QSqlQuery::next();
+    if (!profiling)
+        return QSqlQuery::next();
+
+    // SQLite computes the rows while they are fetched
+    QElapsedTimer timer;
+    timer.start();
+    bool r = QSqlQuery::next();
+    duration += timer.nsecsElapsed();
+    if (r)
+        rows++;
+    else
+        endProfiling();
+
+    return r;
 }
 
+void MySQLQuery::finish()
+{
+    endProfiling();
+
+    QSqlQuery::finish();
+}
@@ -3,17 +3,55 @@
 
 #include <QSqlQuery>
 #include <QSqlDatabase>
+#include <QMap>
+#include <QVariant>
 
 /**
- * @brief SQL query
+ * @brief SQL query. The executions are reported to SQLProfiler if it is
+ *     enabled. An execution is reported after next() returned false, or by
+ *     the following exec(), prepare() or finish(). Statements that do not
+ *     return rows are reported directly by exec(). An execution whose rows
+ *     were not all read is not reported if the query is destroyed.
  */
 class MySQLQuery: public QSqlQuery {
+    QSqlDatabase db;
+
+    /** true = the current execution is measured */
+    bool profiling;
+
+    /** the SQL for "statement" */
+    QString profiledQuery;
+
+    /** the values bound for the current execution */
+    QMap<QString, QVariant> profiledValues;
+
+    /** normalized "profiledQuery" */
+    QString statement;
+
+    /** time spent in exec() and next() for the current execution in ns */
+    qint64 duration;
+
+    /** number of rows returned by next() for the current execution */
+    quint64 rows;
+
+    /**
+     * @brief starts the measurement for a new execution
+     * @param query SQL
+     * @param ns duration of exec() in nanoseconds
+     */
+    void startProfiling(const QString& query, qint64 ns);
+
+    /**
+     * @brief reports the current execution to SQLProfiler
+     */
+    void endProfiling();
 public:
     explicit MySQLQuery(QSqlDatabase db);
     bool exec(const QString& query);
     bool exec();
     bool next();
     bool prepare(const QString &query);
+    void finish();
 };
 
 
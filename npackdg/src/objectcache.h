@@ -0,0 +1,234 @@
+#ifndef OBJECTCACHE_H
+#define OBJECTCACHE_H
+
+#include <atomic>
+#include <list>
+#include <memory>
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+/**
+ * @brief counters for an ObjectCache
+ */
+class ObjectCacheStatistics
+{
+public:
+    /** number of successful lookups */
+    quint64 hits = 0;
+
+    /** number of failed lookups */
+    quint64 misses = 0;
+
+    /** number of objects removed because the cache was full */
+    quint64 evictions = 0;
+
+    /** number of cached objects */
+    int count = 0;
+
+    /** sum of the costs of the cached objects in bytes */
+    qint64 cost = 0;
+
+    /** maximum cost in bytes */
+    qint64 maxCost = 0;
+};
+
+/**
+ * @brief thread-safe LRU cache for immutable objects. The objects are shared
+ *     with the callers and are not copied. An object stays valid as long as
+ *     a caller holds a reference to it even if it was removed from the
+ *     cache.
+ *
+ * The keys are distributed between several shards with their own mutex so
+ * that lookups from different threads do not block each other. Each shard
+ * gets an equal part of the maximum cost and removes the least recently used
+ * objects if this part is exceeded. The cost of an object is an estimation
+ * of the used memory in bytes.
+ */
+template <typename T>
+class ObjectCache
+{
+private:
+    static const int SHARDS = 16;
+
+    class Entry {
+    public:
+        QString key;
+        std::shared_ptr<const T> value;
+        qint64 cost;
+    };
+
+    class Shard {
+    public:
+        mutable QMutex mutex;
+
+        /** the most recently used entries first */
+        std::list<Entry> lru;
+
+        QHash<QString, typename std::list<Entry>::iterator> index;
+
+        qint64 cost = 0;
+    };
+
+    Shard shards[SHARDS];
+
+    /** maximum cost for one shard */
+    qint64 maxShardCost;
+
+    std::atomic<quint64> hits;
+    std::atomic<quint64> misses;
+    std::atomic<quint64> evictions;
+
+    Shard& getShard(const QString& key)
+    {
+        return shards[qHash(key) % SHARDS];
+    }
+
+    /**
+     * @brief removes the least recently used entries until the cost of the
+     *     shard is not above the limit. The mutex should be locked.
+     * @param s a shard
+     */
+    void evict(Shard& s)
+    {
+        while (s.cost > maxShardCost && !s.lru.empty()) {
+            const Entry& e = s.lru.back();
+            s.cost -= e.cost;
+            s.index.remove(e.key);
+            s.lru.pop_back();
+            evictions++;
+        }
+    }
+public:
+    /**
+     * @param maxCost maximum sum of the object costs in bytes
+     */
+    explicit ObjectCache(qint64 maxCost): maxShardCost(maxCost / SHARDS),
+            hits(0), misses(0), evictions(0)
+    {
+    }
+
+    ObjectCache(const ObjectCache&) = delete;
+    ObjectCache& operator=(const ObjectCache&) = delete;
+
+    /**
+     * @brief searches for an object and marks it as recently used
+     * @param key key
+     * @return found object or nullptr
+     */
+    std::shared_ptr<const T> get(const QString& key)
+    {
+        Shard& s = getShard(key);
+        QMutexLocker ml(&s.mutex);
+
+        std::shared_ptr<const T> r;
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            s.lru.splice(s.lru.begin(), s.lru, it.value());
+            r = it.value()->value;
+            hits++;
+        } else {
+            misses++;
+        }
+        return r;
+    }
+
+    /**
+     * @brief checks whether an object is cached. The order of the objects
+     *     and the counters are not changed.
+     * @param key key
+     * @return true if the object is cached
+     */
+    bool contains(const QString& key) const
+    {
+        const Shard& s = shards[qHash(key) % SHARDS];
+        QMutexLocker ml(&s.mutex);
+        return s.index.contains(key);
+    }
+
+    /**
+     * @brief adds or replaces an object. Objects that are bigger than a
+     *     shard are not stored.
+     * @param key key
+     * @param value the object
+     * @param cost estimated size of the object in bytes
+     */
+    void put(const QString& key, const std::shared_ptr<const T>& value,
+            qint64 cost)
+    {
+        Shard& s = getShard(key);
+        QMutexLocker ml(&s.mutex);
+
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            s.cost -= it.value()->cost;
+            s.lru.erase(it.value());
+            s.index.erase(it);
+        }
+
+        if (cost <= maxShardCost) {
+            Entry e;
+            e.key = key;
+            e.value = value;
+            e.cost = cost;
+            s.lru.push_front(e);
+            s.index.insert(key, s.lru.begin());
+            s.cost += cost;
+            evict(s);
+        }
+    }
+
+    /**
+     * @brief removes an object
+     * @param key key
+     */
+    void remove(const QString& key)
+    {
+        Shard& s = getShard(key);
+        QMutexLocker ml(&s.mutex);
+
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            s.cost -= it.value()->cost;
+            s.lru.erase(it.value());
+            s.index.erase(it);
+        }
+    }
+
+    /**
+     * @brief removes all objects. The counters are not changed.
+     */
+    void clear()
+    {
+        for (int i = 0; i < SHARDS; i++) {
+            Shard& s = shards[i];
+            QMutexLocker ml(&s.mutex);
+            s.lru.clear();
+            s.index.clear();
+            s.cost = 0;
+        }
+    }
+
+    /**
+     * @return current counters
+     */
+    ObjectCacheStatistics getStatistics() const
+    {
+        ObjectCacheStatistics r;
+        r.hits = hits;
+        r.misses = misses;
+        r.evictions = evictions;
+        r.maxCost = maxShardCost * SHARDS;
+        for (int i = 0; i < SHARDS; i++) {
+            const Shard& s = shards[i];
+            QMutexLocker ml(&s.mutex);
+            r.count += s.index.size();
+            r.cost += s.cost;
+        }
+        return r;
+    }
+};
+
+#endif // OBJECTCACHE_H
@@ -0,0 +1,276 @@
+#include "packageinfoloader.h"
+
+#include <memory>
+#include <algorithm>
+
+#include <QtConcurrent/QtConcurrent>
+#include <QSharedPointer>
+
+#include "dbrepository.h"
+#include "license.h"
+#include "packageversion.h"
+#include "wpmutils.h"
+
+PackageInfoLoader::PackageInfoLoader(DBRepository *rep, bool async,
+        QObject *parent): QObject(parent), rep(rep), async(async),
+        cache(5000), firstVisible(0), lastVisible(-1), generation(0),
+        scheduled(false), running(false)
+{
+    // one batch at a time
+    threadPool.setMaxThreadCount(1);
+
+    connect(&watcher, SIGNAL(finished()), this, SLOT(batchFinished()));
+}
+
+PackageInfoLoader::~PackageInfoLoader()
+{
+    if (running) {
+        watcher.waitForFinished();
+        qDeleteAll(watcher.result().infos);
+    }
+}
+
+PackageRowInfo* PackageInfoLoader::createInfo(DBRepository* rep,
+        const Package* p)
+{
+    PackageRowInfo* r = new PackageRowInfo();
+
+    if (!p)
+        return r;
+
+    // error is ignored here
+    QString err;
+    QList<std::shared_ptr<const PackageVersion> > pvs =
+            rep->getPackageVersionsShared(p->name, &err);
+
+    const PackageVersion* newestInstallable = nullptr;
+    const PackageVersion* newestInstalled = nullptr;
+    for (int j = 0; j < pvs.count(); j++) {
+        const PackageVersion* pv = pvs.at(j).get();
+        if (pv->installed()) {
+            if (!r->installed.isEmpty())
+                r->installed.append(", ");
+            r->installed.append(pv->version.getVersionString());
+            if (!newestInstalled ||
+                    newestInstalled->version.compare(pv->version) < 0)
+                newestInstalled = pv;
+        }
+
+        if (pv->download.isValid()) {
+            if (!newestInstallable ||
+                    newestInstallable->version.compare(pv->version) < 0)
+                newestInstallable = pv;
+        }
+    }
+
+    if (newestInstallable) {
+        r->avail = newestInstallable->version.getVersionString();
+        r->newestDownloadURL = newestInstallable->download.toString(
+                QUrl::FullyEncoded);
+    }
+
+    r->up2date = !(newestInstalled && newestInstallable &&
+            newestInstallable->version.compare(
+            newestInstalled->version) > 0);
+
+    QString s = p->description;
+    if (s.length() > 200) {
+        s = s.left(200) + "...";
+    }
+    r->shortenDescription = s;
+
+    r->title = p->title;
+
+    // the error message is ignored
+    QSharedPointer<License> lic(rep->findLicense_(
+            p->license, &err));
+    if (lic)
+        r->licenseTitle = lic->title;
+
+    r->icon = p->getIcon();
+
+    if (p->categories.size() > 0) {
+        r->category = p->categories.at(0);
+    } else {
+        r->category.clear();
+    }
+
+    r->tags = p->tags.join(QStringLiteral(", "));
+
+    r->stars = p->stars;
+
+    return r;
+}
+
+PackageInfoLoader::Batch PackageInfoLoader::load(DBRepository *rep,
+        Batch batch)
+{
+    // the packages that cannot be read are loaded one by one below
+    QString err = rep->prefetchPackages(batch.names);
+    if (!err.isEmpty())
+        qCWarning(npackd) << err;
+
+    for (int i = 0; i < batch.names.size(); i++) {
+        std::shared_ptr<const Package> p = rep->findPackageShared(
+                batch.names.at(i));
+        batch.infos.append(createInfo(rep, p.get()));
+    }
+
+    return batch;
+}
+
+void PackageInfoLoader::setPackages(const QStringList &packages)
+{
+    this->packages = packages;
+    rows.clear();
+    for (int i = 0; i < packages.size(); i++) {
+        rows.insert(packages.at(i), i);
+    }
+    requested.clear();
+    firstVisible = 0;
+    lastVisible = -1;
+}
+
+bool PackageInfoLoader::isMissing(int row) const
+{
+    const QString& p = packages.at(row);
+    return !cache.contains(p) && !loading.contains(p);
+}
+
+const PackageRowInfo* PackageInfoLoader::get(int row)
+{
+    const QString& p = packages.at(row);
+    PackageRowInfo* r = cache.object(p);
+    if (!r) {
+        if (async) {
+            if (!loading.contains(p) && !requested.contains(row)) {
+                requested.append(row);
+                schedule();
+            }
+        } else {
+            std::shared_ptr<const Package> pk = rep->findPackageShared(p);
+            r = createInfo(rep, pk.get());
+            cache.insert(p, r);
+        }
+    }
+    return r;
+}
+
+void PackageInfoLoader::setVisibleRows(int first, int last)
+{
+    firstVisible = first;
+    lastVisible = last;
+    if (async)
+        schedule();
+}
+
+void PackageInfoLoader::remove(const QString &package)
+{
+    cache.remove(package);
+    generation++;
+}
+
+void PackageInfoLoader::clear()
+{
+    cache.clear();
+    generation++;
+}
+
+bool PackageInfoLoader::isLoading() const
+{
+    return running || scheduled;
+}
+
+void PackageInfoLoader::schedule()
+{
+    if (!scheduled && !running) {
+        scheduled = true;
+        QMetaObject::invokeMethod(this, "startBatch", Qt::QueuedConnection);
+    }
+}
+
+void PackageInfoLoader::startBatch()
+{
+    scheduled = false;
+    if (running)
+        return;
+
+    Batch batch;
+    batch.generation = generation;
+
+    QList<int> candidates = requested;
+    int nrequested = requested.size();
+    requested.clear();
+
+    // the visible rows, one page below and one page above
+    int first = std::max<int>(firstVisible, 0);
+    int last = std::min<int>(lastVisible, packages.size() - 1);
+    if (first <= last) {
+        int page = last - first + 1;
+        int below = std::min<int>(last + page, packages.size() - 1);
+        int above = std::max<int>(first - page, 0);
+        for (int i = first; i <= below; i++) {
+            candidates.append(i);
+        }
+        for (int i = first - 1; i >= above; i--) {
+            candidates.append(i);
+        }
+    }
+
+    for (int i = 0; i < candidates.size(); i++) {
+        int row = candidates.at(i);
+        if (batch.names.size() < BATCH_SIZE) {
+            if (row < packages.size() && isMissing(row)) {
+                batch.names.append(packages.at(row));
+                loading.insert(packages.at(row));
+            }
+        } else if (i < nrequested) {
+            // the requested rows that do not fit are loaded later
+            requested.append(row);
+        }
+    }
+
+    if (!batch.names.isEmpty()) {
+        running = true;
+        watcher.setFuture(QtConcurrent::run(&threadPool,
+                &PackageInfoLoader::load, rep, batch));
+    }
+}
+
+void PackageInfoLoader::batchFinished()
+{
+    running = false;
+
+    Batch batch = watcher.result();
+    for (int i = 0; i < batch.names.size(); i++) {
+        loading.remove(batch.names.at(i));
+    }
+
+    if (batch.generation == generation) {
+        int first = packages.size();
+        int last = -1;
+        for (int i = 0; i < batch.names.size(); i++) {
+            const QString& p = batch.names.at(i);
+            cache.insert(p, batch.infos.at(i));
+
+            int row = rows.value(p, -1);
+            if (row >= 0) {
+                first = std::min<int>(first, row);
+                last = std::max<int>(last, row);
+            }
+        }
+
+        if (first <= last)
+            emit rowsLoaded(first, last);
+    } else {
+        // the information may be outdated and is loaded again
+        qDeleteAll(batch.infos);
+        for (int i = 0; i < batch.names.size(); i++) {
+            int row = rows.value(batch.names.at(i), -1);
+            if (row >= 0 && !requested.contains(row))
+                requested.append(row);
+        }
+    }
+
+    startBatch();
+}
@@ -0,0 +1,196 @@
+#ifndef PACKAGEINFOLOADER_H
+#define PACKAGEINFOLOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QCache>
+#include <QThreadPool>
+#include <QFutureWatcher>
+
+#include "package.h"
+
+class DBRepository;
+
+/**
+ * @brief package information for one row in a list of packages
+ */
+class PackageRowInfo
+{
+public:
+    QString avail;
+    QString installed;
+    bool up2date = true;
+    QString newestDownloadURL;
+    QString shortenDescription;
+    QString title;
+    QString licenseTitle;
+    QString icon;
+    QString category;
+    QString tags;
+    int stars = 0;
+};
+
+/**
+ * @brief loads PackageRowInfo for the rows of a package list.
+ *
+ * In the asynchronous mode get() never blocks. Missing rows are loaded in
+ * batches on a worker thread using DBRepository::prefetchPackages(). The
+ * rows requested by get() are loaded first, followed by the visible rows and
+ * one page before and after them (see setVisibleRows()). rowsLoaded() is
+ * emitted for every finished batch.
+ *
+ * In the synchronous mode get() computes a missing row immediately.
+ */
+class PackageInfoLoader: public QObject
+{
+    Q_OBJECT
+private:
+    /** maximum number of packages loaded by one batch */
+    static const int BATCH_SIZE = 100;
+
+    /** a set of rows loaded on the worker thread */
+    class Batch {
+    public:
+        /** value of "generation" when the batch was started */
+        int generation;
+
+        QStringList names;
+
+        /** [ownership:take] information for every package in "names" */
+        QList<PackageRowInfo*> infos;
+    };
+
+    DBRepository* rep;
+
+    bool async;
+
+    QStringList packages;
+
+    /** full package name -> row */
+    QHash<QString, int> rows;
+
+    /** full package name -> loaded information */
+    QCache<QString, PackageRowInfo> cache;
+
+    /** rows requested by get() that are not yet loaded */
+    QList<int> requested;
+
+    /** packages in the current batch */
+    QSet<QString> loading;
+
+    int firstVisible;
+    int lastVisible;
+
+    /**
+     * changed whenever the cached information becomes invalid. The results
+     * of a batch started before are discarded.
+     */
+    int generation;
+
+    /** true = startBatch() will be called from the event loop */
+    bool scheduled;
+
+    /** true = a batch is being loaded */
+    bool running;
+
+    QThreadPool threadPool;
+
+    QFutureWatcher<Batch> watcher;
+
+    /**
+     * @brief loads the information for a batch. This function runs on the
+     *     worker thread.
+     * @param rep repository
+     * @param batch the batch with the package names
+     * @return the batch with the loaded information
+     */
+    static Batch load(DBRepository* rep, Batch batch);
+
+    /**
+     * @param row a row
+     * @return true if the row is neither cached nor being loaded
+     */
+    bool isMissing(int row) const;
+
+    /**
+     * @brief calls startBatch() from the event loop so that all rows
+     *     requested while painting are loaded together
+     */
+    void schedule();
+public:
+    /**
+     * @param rep repository
+     * @param async true = load the rows on a worker thread
+     * @param parent parent object
+     */
+    PackageInfoLoader(DBRepository* rep, bool async,
+            QObject* parent = nullptr);
+
+    ~PackageInfoLoader();
+
+    /**
+     * @brief computes the information for a package. This function is
+     *     thread-safe.
+     * @param rep repository
+     * @param p a package or nullptr
+     * @return [move] information for the package
+     */
+    static PackageRowInfo* createInfo(DBRepository* rep, const Package* p);
+
+    /**
+     * @brief changes the list of packages. The cached information is kept.
+     * @param packages full package names
+     */
+    void setPackages(const QStringList& packages);
+
+    /**
+     * @brief returns the information for a row. In the asynchronous mode
+     *     the row will be loaded if it is not available.
+     * @param row a row
+     * @return the information or nullptr if the row is not loaded yet. The
+     *     object is only valid until the next call to a method of this
+     *     class.
+     */
+    const PackageRowInfo* get(int row);
+
+    /**
+     * @brief changes the range of the visible rows. The rows in and around
+     *     this range will be loaded in the asynchronous mode.
+     * @param first first visible row
+     * @param last last visible row
+     */
+    void setVisibleRows(int first, int last);
+
+    /**
+     * @brief removes the information for a package
+     * @param package full package name
+     */
+    void remove(const QString& package);
+
+    /**
+     * @brief removes the information for all packages
+     */
+    void clear();
+
+    /**
+     * @return true if rows are being loaded
+     */
+    bool isLoading() const;
+signals:
+    /**
+     * @brief rows were loaded. The rows between "first" and "last" that
+     *     were not loaded are unchanged.
+     * @param first first loaded row
+     * @param last last loaded row
+     */
+    void rowsLoaded(int first, int last);
+private slots:
+    void startBatch();
+    void batchFinished();
+};
+
+#endif // PACKAGEINFOLOADER_H
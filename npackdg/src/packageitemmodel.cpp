@@ -13,9 +13,13 @@
 
 PackageItemModel::PackageItemModel(const QStringList& packages) :
         obsoleteBrush(QColor(255, 0xc7, 0xc7)),
-        maxStars(-1)
+        maxStars(-1), loader(DBRepository::getDefault(), true)
 {
     this->packages = packages;
+    loader.setPackages(packages);
+
+    connect(&loader, SIGNAL(rowsLoaded(int,int)), this,
+            SLOT(rowsLoaded(int,int)));
 }
 
 PackageItemModel::~PackageItemModel()
@@ -32,79 +36,6 @@ int PackageItemModel::columnCount(const QModelIndex &/*parent*/) const
     return 10;
 }
 
-PackageItemModel::Info* PackageItemModel::createInfo(
-        Package* p) const
-{
-    Info* r = new Info();
-
-    DBRepository* rep = DBRepository::getDefault();
-
-    // error is ignored here
-    QString err;
-    QList<PackageVersion*> pvs = rep->getPackageVersions_(p->name, &err);
-
-    PackageVersion* newestInstallable = nullptr;
-    PackageVersion* newestInstalled = nullptr;
-    for (int j = 0; j < pvs.count(); j++) {
-        PackageVersion* pv = pvs.at(j);
-        if (pv->installed()) {
-            if (!r->installed.isEmpty())
-                r->installed.append(", ");
-            r->installed.append(pv->version.getVersionString());
-            if (!newestInstalled ||
-                    newestInstalled->version.compare(pv->version) < 0)
-                newestInstalled = pv;
-        }
-
-        if (pv->download.isValid()) {
-            if (!newestInstallable ||
-                    newestInstallable->version.compare(pv->version) < 0)
-                newestInstallable = pv;
-        }
-    }
-
-    if (newestInstallable) {
-        r->avail = newestInstallable->version.getVersionString();
-        r->newestDownloadURL = newestInstallable->download.toString(
-                QUrl::FullyEncoded);
-    }
-
-    r->up2date = !(newestInstalled && newestInstallable &&
-            newestInstallable->version.compare(
-            newestInstalled->version) > 0);
-
-    qDeleteAll(pvs);
-    pvs.clear();
-
-    QString s = p->description;
-    if (s.length() > 200) {
-        s = s.left(200) + "...";
-    }
-    r->shortenDescription = s;
-
-    r->title = p->title;
-
-    // the error message is ignored
-    QSharedPointer<License> lic(rep->findLicense_(
-            p->license, &err));
-    if (lic)
-        r->licenseTitle = lic->title;
-
-    r->icon = p->getIcon();
-
-    if (p->categories.size() > 0) {
-        r->category = p->categories.at(0);
-    } else {
-        r->category.clear();
-    }
-
-    r->tags = p->tags.join(QStringLiteral(", "));
-
-    r->stars = p->stars;
-
-    return r;
-}
-
 QVariant PackageItemModel::data(const QModelIndex &index, int role) const
 {
     QString p = this->packages.at(index.row());
@@ -116,18 +47,19 @@ QVariant PackageItemModel::data(const QModelIndex &index, int role) const
 
     QVariant r;
     DBRepository* rep = DBRepository::getDefault();
-    Info* cached = this->cache.object(p);
-    bool insertIntoCache = false;
-    if (!cached) {
-        Package* pk = rep->findPackage_(p);
-        cached = createInfo(pk);
-        delete pk;
-        insertIntoCache = true;
-    }
+
+    // an empty row with the package name as title is shown until the row
+    // is loaded
+    static const PackageRowInfo placeholder;
+    const PackageRowInfo* cached = loader.get(index.row());
+    bool loaded = cached != nullptr;
+    if (!loaded)
+        cached = &placeholder;
+
     if (role == Qt::DisplayRole) {
         switch (index.column()) {
             case 1:
-                r = cached->title;
+                r = loaded ? cached->title : p;
                 break;
             case 2: {
                 r = cached->shortenDescription;
@@ -240,9 +172,6 @@ QVariant PackageItemModel::data(const QModelIndex &index, int role) const
         }
     }
 
-    if (insertIntoCache)
-        this->cache.insert(p, cached);
-
     return r;
 }
 
@@ -295,9 +224,20 @@ void PackageItemModel::setPackages(const QStringList& packages)
 {
     this->beginResetModel();
     this->packages = packages;
+    loader.setPackages(packages);
     this->endResetModel();
 }
 
+void PackageItemModel::setVisibleRows(int first, int last)
+{
+    loader.setVisibleRows(first, last);
+}
+
+void PackageItemModel::rowsLoaded(int first, int last)
+{
+    this->dataChanged(this->index(first, 0), this->index(last, 9));
+}
+
 void PackageItemModel::iconUpdated(const QString &/*url*/)
 {
     this->dataChanged(this->index(0, 0), this->index(
@@ -315,7 +255,7 @@ void PackageItemModel::installedStatusChanged(const QString& package,
 {
     //qCDebug(npackd) << "PackageItemModel::installedStatusChanged" << package <<
     //        version.getVersionString();
-    this->cache.remove(package);
+    loader.remove(package);
     for (int i = 0; i < this->packages.count(); i++) {
         QString p = this->packages.at(i);
         if (p == package) {
@@ -326,7 +266,7 @@ void PackageItemModel::installedStatusChanged(const QString& package,
 
 void PackageItemModel::clearCache()
 {
-    this->cache.clear();
+    loader.clear();
     this->dataChanged(this->index(0, 3),
             this->index(this->packages.count() - 1, 4));
 }
@@ -4,44 +4,28 @@
 #include <stdint.h>
 
 #include <QAbstractTableModel>
-#include <QCache>
 #include <QBrush>
 
 #include "package.h"
 #include "version.h"
+#include "packageinfoloader.h"
 
 /**
- * @brief shows packages
+ * @brief shows packages. The information for the rows is loaded in the
+ *     background (see PackageInfoLoader). The package name is shown until
+ *     a row is loaded.
  */
 class PackageItemModel: public QAbstractTableModel
 {
+    Q_OBJECT
+
     QBrush obsoleteBrush;
 
     mutable int maxStars;
 
     QStringList packages;
 
-    /**
-     * @brief package information for one row
-     */
-    class Info {
-    public:
-        QString avail;
-        QString installed;
-        bool up2date;
-        QString newestDownloadURL;
-        QString shortenDescription;
-        QString title;
-        QString licenseTitle;
-        QString icon;
-        QString category;
-        QString tags;
-        int stars;
-    };
-
-    mutable QCache<QString, Info> cache;
-
-    Info *createInfo(Package *p) const;
+    mutable PackageInfoLoader loader;
 public:
     /**
      * @param packages list of package names
@@ -88,6 +72,16 @@ public:
      * @param url URL of the binary
      */
     void downloadSizeUpdated(const QString &url);
+
+    /**
+     * @brief should be called if the visible part of the view has changed.
+     *     The rows in and around this range will be loaded.
+     * @param first first visible row
+     * @param last last visible row
+     */
+    void setVisibleRows(int first, int last);
+private slots:
+    void rowsLoaded(int first, int last);
 };
 
 #endif // PACKAGEITEMMODEL_H
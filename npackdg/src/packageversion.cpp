@@ -20,6 +20,7 @@
 #include <QJsonArray>
 #include <QBuffer>
 #include <QDataStream>
+#include <QLockFile>
 
 #include <zlib.h>
 
@@ -39,10 +40,13 @@
 #include "dbrepository.h"
 #include "repositoryxmlhandler.h"
 #include "packageutils.h"
+#include "dependencysolver.h"
+#include "downloadcache.h"
 
 QSemaphore PackageVersion::httpConnections(3);
 QSet<QString> PackageVersion::lockedPackageVersions;
 QMutex PackageVersion::lockedPackageVersionsMutex(QMutex::Recursive);
+bool PackageVersion::useRecursivePlanner = false;
 
 /**
  * Creates an instance of IAttachmentExecute
@@ -723,6 +727,18 @@ void PackageVersion::removeDirectory(Job* job, const QString& dir,
 QString PackageVersion::planInstallation(AbstractRepository* rep, InstalledPackages &installed,
         QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
         const QString& where)
+{
+    if (useRecursivePlanner)
+        return planInstallationRecursive(rep, installed, ops, avoid, where);
+
+    DependencySolver solver(rep, installed);
+    return solver.planInstallation(this, ops, avoid, where);
+}
+
+QString PackageVersion::planInstallationRecursive(AbstractRepository* rep,
+        InstalledPackages &installed,
+        QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
+        const QString& where)
 {
     QString res;
 
@@ -779,7 +795,8 @@ QString PackageVersion::planInstallation(AbstractRepository* rep, InstalledPacka
                     int opsCount = ops.count();
                     int avoidCount = avoid.count();
 
-                    res = pv->planInstallation(rep, installed2, ops, avoid);
+                    res = pv->planInstallationRecursive(rep, installed2, ops,
+                            avoid);
                     if (!res.isEmpty()) {
                         // rollback
                         while (ops.count() > opsCount) {
@@ -862,6 +879,7 @@ void PackageVersion::downloadTo(Job& job, const QString& filename, bool interact
                 request.hashSum = true;
             request.alg = this->hashSumType;
             request.interactive = interactive;
+            request.segments = DOWNLOAD_SEGMENTS;
             Downloader::Response response = Downloader::download(djob, request);
             dsha1 = response.hashSum;
             downloadOK = djob->shouldProceed();
@@ -884,6 +902,7 @@ void PackageVersion::downloadTo(Job& job, const QString& filename, bool interact
                     request.hashSum = true;
                 request.alg = this->hashSumType;
                 request.interactive = interactive;
+                request.segments = DOWNLOAD_SEGMENTS;
                 Downloader::Response response =
                         Downloader::download(djob, request);
                 dsha1 = response.hashSum;
@@ -898,6 +917,15 @@ void PackageVersion::downloadTo(Job& job, const QString& filename, bool interact
         }
     }
 
+    // the hash sum was computed while downloading
+    if (job.shouldProceed() && !this->sha1.isEmpty()) {
+        if (dsha1.toLower() != this->sha1.toLower()) {
+            job.setErrorMessage(QString(
+                    QObject::tr("Hash sum %1 found, but %2 was expected. The file has changed.")).arg(dsha1).
+                    arg(this->sha1));
+        }
+    }
+
     delete f;
 
     if (job.shouldProceed())
@@ -912,12 +940,12 @@ QString PackageVersion::getPackageTitle(
     DBRepository* rep = DBRepository::getDefault();
 
     QString pn;
-    Package* package = rep->findPackage_(this->package);
+    std::shared_ptr<const Package> package = rep->findPackageShared(
+            this->package);
     if (package)
         pn = package->title;
     else
         pn = this->package;
-    delete package;
 
     if (includeFullPackageName)
         pn += " (" + this->package + ")";
@@ -1351,9 +1379,54 @@ QString PackageVersion::download_(Job* job, const QString& where,
     }
     job->setTitle(initialTitle);
 
+    // qCDebug(npackd) << "install.3";
+    QFile* f = new QFile(npackdDir + "\\__NpackdPackageDownload");
+
+    bool downloadOK = false;
+    QString dsha1;
+
+    // the same binary may have already been downloaded for another package
+    // version or on another computer
+    DownloadCache* cache = DownloadCache::getDefault();
+    bool fromCache = false;
+    if (job->shouldProceed() && !this->sha1.isEmpty()) {
+        QString cached = cache->find(this->hashSumType, this->sha1);
+        if (!cached.isEmpty() && f->open(QIODevice::ReadWrite)) {
+            Job* cjob = job->newSubJob(0.85,
+                    QObject::tr("Copying from the download cache"), false);
+            Downloader::Request request(QUrl::fromLocalFile(cached));
+            request.file = f;
+            request.hashSum = true;
+            request.alg = this->hashSumType;
+            request.interactive = false;
+            Downloader::Response response = Downloader::download(cjob,
+                    request);
+            f->close();
+
+            fromCache = !cjob->isCancelled() &&
+                    cjob->getErrorMessage().isEmpty() &&
+                    response.hashSum.toLower() == this->sha1.toLower();
+            if (fromCache) {
+                dsha1 = response.hashSum;
+                downloadOK = true;
+                job->setProgress(0.9);
+            } else if (!cjob->isCancelled()) {
+                // a damaged file is replaced by the next download
+                QString reason = cjob->getErrorMessage();
+                if (reason.isEmpty())
+                    reason = QObject::tr("the hash sum does not match");
+                qCWarning(npackd).noquote() << QString(QObject::tr(
+                        "Cannot use the cached file %1: %2")).arg(cached).
+                        arg(reason);
+                cache->remove(this->hashSumType, this->sha1);
+                f->remove();
+            }
+        }
+    }
+
     bool httpConnectionAcquired = false;
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !fromCache) {
         job->setTitle(initialTitle + " / " +
                 QObject::tr("Waiting for a free HTTP connection"));
 
@@ -1373,22 +1446,33 @@ QString PackageVersion::download_(Job* job, const QString& where,
     }
     job->setTitle(initialTitle);
 
-    // qCDebug(npackd) << "install.3";
-    QFile* f = new QFile(npackdDir + "\\__NpackdPackageDownload");
-
-    bool downloadOK = false;
-    QString dsha1;
+    // an incomplete download is stored in the download cache and resumed by
+    // the next installation, even if this directory is removed
+    QFile* dl = f;
+    std::unique_ptr<QLockFile> partialLock;
+    if (job->shouldProceed() && !fromCache) {
+        QString partial = cache->getPartialDownloadPath(this->download);
+        if (!partial.isEmpty()) {
+            // the same URL may be downloaded by another process
+            partialLock.reset(new QLockFile(partial +
+                    QStringLiteral(".lock")));
+            if (partialLock->tryLock(0))
+                dl = new QFile(partial);
+            else
+                partialLock.reset();
+        }
+    }
 
-    if (job->shouldProceed()) {
-        if (!f->open(QIODevice::ReadWrite)) {
+    if (job->shouldProceed() && !fromCache) {
+        if (!dl->open(QIODevice::ReadWrite)) {
             job->setErrorMessage(QString(QObject::tr("Cannot open the file: %0")).
-                    arg(f->fileName()));
+                    arg(dl->fileName()));
         } else {
             Job* djob = job->newSubJob(0.8,
                     QObject::tr("Downloading & computing hash sum"));
 
             Downloader::Request request(this->download);
-            request.file = f;
+            request.file = dl;
             if (!this->sha1.isEmpty())
                 request.hashSum = true;
             request.user = user;
@@ -1397,25 +1481,26 @@ QString PackageVersion::download_(Job* job, const QString& where,
             request.proxyPassword = proxyPassword;
             request.alg = this->hashSumType;
             request.interactive = interactive;
+            request.segments = DOWNLOAD_SEGMENTS;
             Downloader::Response response = Downloader::download(djob, request);
             dsha1 = response.hashSum;
             downloadOK = !djob->isCancelled() &&
                     djob->getErrorMessage().isEmpty();
-            f->close();
+            dl->close();
         }
     }
 
     if (job->shouldProceed()) {
         if (!downloadOK) {
-            if (!f->open(QIODevice::ReadWrite)) {
+            if (!dl->open(QIODevice::ReadWrite)) {
                 job->setErrorMessage(QObject::tr("Cannot open the file: %0").
-                        arg(f->fileName()));
+                        arg(dl->fileName()));
             } else {
                 double rest = 0.9 - job->getProgress();
                 Job* djob = job->newSubJob(rest,
                         QObject::tr("Downloading & computing hash sum (2nd try)"));
                 Downloader::Request request(this->download);
-                request.file = f;
+                request.file = dl;
                 if (!this->sha1.isEmpty())
                     request.hashSum = true;
                 request.user = user;
@@ -1424,6 +1509,7 @@ QString PackageVersion::download_(Job* job, const QString& where,
                 request.proxyPassword = proxyPassword;
                 request.alg = this->hashSumType;
                 request.interactive = interactive;
+                request.segments = DOWNLOAD_SEGMENTS;
                 Downloader::Response response =
                         Downloader::download(djob, request);
                 dsha1 = response.hashSum;
@@ -1431,13 +1517,25 @@ QString PackageVersion::download_(Job* job, const QString& where,
                     job->setErrorMessage(QObject::tr("Error downloading %1: %2").
                         arg(this->download.toString()).arg(
                         djob->getErrorMessage()));
-                f->close();
+                dl->close();
             }
         } else {
             job->setProgress(0.9);
         }
     }
 
+    if (dl != f) {
+        if (job->shouldProceed() && !fromCache) {
+            // QFile::rename() copies the file to another volume
+            if (!dl->rename(f->fileName()))
+                job->setErrorMessage(QString(QObject::tr(
+                        "Cannot rename %0 to %1")).
+                        arg(dl->fileName(), f->fileName()));
+        }
+        delete dl;
+    }
+    partialLock.reset();
+
     if (httpConnectionAcquired)
         httpConnections.release();
 
@@ -1455,6 +1553,15 @@ QString PackageVersion::download_(Job* job, const QString& where,
         }
     }
 
+    if (job->shouldProceed() && !fromCache && !this->sha1.isEmpty()) {
+        QString err = cache->add(f->fileName(), this->hashSumType,
+                this->sha1);
+        if (!err.isEmpty())
+            qCWarning(npackd).noquote() << QString(QObject::tr(
+                    "Cannot add %1 to the download cache: %2")).
+                    arg(this->download.toString(), err);
+    }
+
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.01,
                 QObject::tr("Checking for viruses"));
@@ -1961,6 +2068,9 @@ PackageVersion* PackageVersion::clone() const
 PackageVersion *PackageVersion::parse(QByteArray &xml, QString *err,
         bool /*validate*/)
 {
+    if (isBinary(xml))
+        return parseBinary(xml, err);
+
     PackageVersion* r = nullptr;
 
     QBuffer buf(&xml);
@@ -1987,6 +2097,134 @@ bool PackageVersion::contains(const QList<PackageVersion *> &list,
     return indexOf(list, pv) >= 0;
 }
 
+/**
+ * Prefix for the binary format. XML never starts with a 0 byte.
+ */
+static const char BINARY_MAGIC[] = {'\0', 'N', 'P', 'V'};
+
+bool PackageVersion::isBinary(const QByteArray &data)
+{
+    return data.size() > static_cast<int>(sizeof(BINARY_MAGIC)) &&
+            memcmp(data.constData(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+QByteArray PackageVersion::toBinary() const
+{
+    QByteArray r;
+    r.reserve(512);
+    QDataStream s(&r, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_5_6);
+
+    s.writeRawData(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    s << BINARY_FORMAT_VERSION;
+
+    // header
+    s << this->package;
+    s << this->version.getVersionString();
+    s << static_cast<quint8>(this->type);
+    s << this->download.toString(QUrl::FullyEncoded);
+    s << this->sha1;
+    s << static_cast<qint32>(this->hashSumType);
+
+    // body
+    s << this->importantFiles;
+    s << this->importantFilesTitles;
+    s << this->cmdFiles;
+    s << static_cast<qint32>(this->files.count());
+    for (int i = 0; i < this->files.count(); i++) {
+        PackageVersionFile* f = this->files.at(i);
+        s << f->path << f->content;
+    }
+    s << static_cast<qint32>(this->dependencies.count());
+    for (int i = 0; i < this->dependencies.count(); i++) {
+        Dependency* d = this->dependencies.at(i);
+        s << d->package << d->minIncluded << d->min.getVersionString() <<
+                d->maxIncluded << d->max.getVersionString() << d->var;
+    }
+
+    return r;
+}
+
+PackageVersion* PackageVersion::parseBinary(const QByteArray &data,
+        QString *err, bool full)
+{
+    *err = "";
+
+    if (!isBinary(data)) {
+        *err = QObject::tr("Invalid binary package version data");
+        return nullptr;
+    }
+
+    QDataStream s(data);
+    s.setVersion(QDataStream::Qt_5_6);
+    s.skipRawData(sizeof(BINARY_MAGIC));
+
+    quint8 formatVersion;
+    s >> formatVersion;
+    if (formatVersion != BINARY_FORMAT_VERSION) {
+        *err = QObject::tr("Unsupported binary package version format: %1").
+                arg(formatVersion);
+        return nullptr;
+    }
+
+    PackageVersion* r = new PackageVersion();
+
+    // header
+    QString version, url;
+    quint8 type;
+    qint32 hashSumType;
+    s >> r->package >> version >> type >> url >> r->sha1 >> hashSumType;
+    if (s.status() != QDataStream::Ok || !r->version.setVersion(version) ||
+            type > PackageVersion::Type::NSIS) {
+        *err = QObject::tr("Invalid binary package version data");
+    } else {
+        r->type = static_cast<PackageVersion::Type>(type);
+        r->hashSumType = static_cast<QCryptographicHash::Algorithm>(
+                hashSumType);
+        if (!url.isEmpty())
+            r->download = QUrl(url, QUrl::StrictMode);
+    }
+
+    // body
+    if (err->isEmpty() && full) {
+        s >> r->importantFiles >> r->importantFilesTitles >> r->cmdFiles;
+
+        qint32 n = 0;
+        s >> n;
+        for (int i = 0; i < n && s.status() == QDataStream::Ok; i++) {
+            QString path, content;
+            s >> path >> content;
+            r->files.append(new PackageVersionFile(path, content));
+        }
+
+        n = 0;
+        s >> n;
+        for (int i = 0; i < n && s.status() == QDataStream::Ok; i++) {
+            Dependency* d = new Dependency();
+            QString min, max;
+            s >> d->package >> d->minIncluded >> min >> d->maxIncluded >>
+                    max >> d->var;
+            r->dependencies.append(d);
+            if (!d->min.setVersion(min) || !d->max.setVersion(max)) {
+                *err = QObject::tr("Invalid binary package version data");
+                break;
+            }
+        }
+
+        if (err->isEmpty() && (s.status() != QDataStream::Ok ||
+                r->importantFiles.count() !=
+                r->importantFilesTitles.count()))
+            *err = QObject::tr("Invalid binary package version data");
+    }
+
+    if (!err->isEmpty()) {
+        delete r;
+        r = nullptr;
+    }
+
+    return r;
+}
+
 void PackageVersion::toXML(QXmlStreamWriter *w) const
 {
     w->writeStartElement("version");
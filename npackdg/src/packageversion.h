@@ -36,13 +36,23 @@ class InstalledPackages;
  * - add the variable definition
  * - update toXML
  * - update toJSON
+ * - update toBinary and parseBinary (increase BINARY_FORMAT_VERSION)
  * - update clone
  */
 class PackageVersion
 {
-private:    
+private:
+    /**
+     * version of the format created by toBinary(). Data with another version
+     * is rejected by parseBinary().
+     */
+    static const quint8 BINARY_FORMAT_VERSION = 1;
+
     static QSemaphore httpConnections;
 
+    /** maximum number of connections for downloading one binary */
+    static const int DOWNLOAD_SEGMENTS = 4;
+
     /**
      * Set of PackageVersion::getStringId() for the locked package versions.
      * A locked package version cannot be installed or uninstalled.
@@ -116,6 +126,12 @@ private:
 
     void installWith(Job *job);
 public:
+    /**
+     * true = planInstallation() uses the old recursive search
+     * planInstallationRecursive() instead of DependencySolver
+     */
+    static bool useRecursivePlanner;
+
     /** package version type */
     enum Type {
         /** .zip file */
@@ -163,6 +179,23 @@ public:
     static PackageVersion* parse(QByteArray &xml, QString* err,
             bool validate=true);
 
+    /**
+     * @param data data created by toBinary()
+     * @param err error message will be stored here
+     * @param full true = decode everything, false = only decode the header
+     *     (package, version, type, URL and hash sum). Important files,
+     *     command line tools, text files and dependencies are skipped.
+     * @return [move] created object or 0
+     */
+    static PackageVersion* parseBinary(const QByteArray& data, QString* err,
+            bool full=true);
+
+    /**
+     * @param data serialized package version
+     * @return true if the data was created by toBinary() and false for XML
+     */
+    static bool isBinary(const QByteArray& data);
+
     /**
      * @brief searches for a package version only using the package name and
      *     version number
@@ -313,7 +346,8 @@ public:
     QString getFileExtension();
 
     /**
-     * Plans installation of this package and all the dependencies recursively.
+     * Plans installation of this package and all the dependencies. See
+     * useRecursivePlanner.
      *
      * @param rep repository
      * @param installed list of installed packages.
@@ -335,6 +369,18 @@ public:
             QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
             const QString &where="");
 
+    /**
+     * Plans installation of this package and all the dependencies using a
+     * recursive search that copies the list of installed packages for every
+     * variant. The parameters are the same as for planInstallation().
+     *
+     * @return error message or ""
+     */
+    QString planInstallationRecursive(AbstractRepository *rep,
+            InstalledPackages& installed,
+            QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
+            const QString &where="");
+
     /**
      * @param includeFullPackageName true = full package name will be added
      * @return package title
@@ -441,6 +487,15 @@ public:
      */
     void toXML(QXmlStreamWriter* w) const;
 
+    /**
+     * Stores this object in the compact binary format that is used for
+     * PACKAGE_VERSION.BINARY_CONTENT. Parsing this format is much faster than
+     * parsing the XML.
+     *
+     * @return serialized data
+     */
+    QByteArray toBinary() const;
+
     /**
      * Stores this object as JSON
      *
@@ -60,7 +60,12 @@ ProgressTree2::ProgressTree2(QWidget *parent) :
 
 void ProgressTree2::timerTimeout()
 {
-
+    // the last progress change may be held back by the notification interval
+    for (int i = 0; i < this->topLevelItemCount(); i++) {
+        Job* job = getJob(*this->topLevelItem(i));
+        if (job)
+            job->flushChange();
+    }
 }
 
 QTreeWidgetItem* ProgressTree2::findItem(Job* job, bool create)
@@ -0,0 +1,522 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "sockettransport.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include <QObject>
+#include <QUrl>
+#include <QByteArray>
+#include <QList>
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+
+static void closeSocket(Socket s)
+{
+    closesocket(s);
+}
+
+static int lastSocketError()
+{
+    return WSAGetLastError();
+}
+
+static bool isTimeout(int err)
+{
+    return err == WSAETIMEDOUT;
+}
+#else
+typedef int Socket;
+
+static const Socket INVALID_SOCKET = -1;
+
+static void closeSocket(Socket s)
+{
+    ::close(s);
+}
+
+static int lastSocketError()
+{
+    return errno;
+}
+
+static bool isTimeout(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+#endif
+
+// a closed connection returns an error instead of raising SIGPIPE
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * @param err error code from the socket API
+ * @return error message
+ */
+static QString socketErrorMessage(int err)
+{
+    if (isTimeout(err))
+        return QObject::tr("The operation timed out");
+    else
+        return QString(QObject::tr("Socket error %1")).arg(err);
+}
+
+/**
+ * @brief an open connection to an HTTP server
+ */
+class SocketConnection: public HttpConnection
+{
+public:
+    Socket s = INVALID_SOCKET;
+
+    /** received, but not yet returned data */
+    QByteArray pending;
+
+    /** true = Transfer-Encoding: chunked */
+    bool chunked = false;
+
+    /**
+     * remaining bytes in the body or in the current chunk. -1 means that
+     * the body ends when the connection is closed.
+     */
+    int64_t remaining = -1;
+
+    /** true = the data of a chunk was read and its CRLF is expected */
+    bool chunkRead = false;
+
+    /** true = the last chunk was read */
+    bool finished = false;
+
+    ~SocketConnection() override
+    {
+        if (s != INVALID_SOCKET)
+            closeSocket(s);
+    }
+
+    /**
+     * @brief receives data from the server
+     * @param buffer the data will be stored here
+     * @param size size of the buffer
+     * @param err error message will be stored here
+     * @return number of bytes or 0 if the connection was closed or an error
+     *     occured
+     */
+    int receive(char* buffer, int size, QString* err)
+    {
+        if (!pending.isEmpty()) {
+            int n = std::min<int>(size, pending.size());
+            memcpy(buffer, pending.constData(), static_cast<size_t>(n));
+            pending.remove(0, n);
+            return n;
+        }
+
+        int r = static_cast<int>(recv(s, buffer, size, 0));
+        if (r < 0) {
+            *err = socketErrorMessage(lastSocketError());
+            r = 0;
+        }
+        return r;
+    }
+
+    /**
+     * @brief reads one line of the header
+     * @param line the line without CR LF will be stored here
+     * @param err error message will be stored here
+     * @return true if a line was read
+     */
+    bool readLine(QByteArray* line, QString* err)
+    {
+        while (true) {
+            int p = pending.indexOf("\r\n");
+            if (p >= 0) {
+                *line = pending.left(p);
+                pending.remove(0, p + 2);
+                return true;
+            }
+
+            if (pending.size() > 64 * 1024) {
+                *err = QObject::tr("The HTTP header is too long");
+                return false;
+            }
+
+            char buffer[4096];
+            int r = static_cast<int>(recv(s, buffer, sizeof(buffer), 0));
+            if (r < 0) {
+                *err = socketErrorMessage(lastSocketError());
+                return false;
+            } else if (r == 0) {
+                *err = QObject::tr("The connection was closed by the server");
+                return false;
+            }
+            pending.append(buffer, r);
+        }
+    }
+
+    int read(char* buffer, int size, QString* err) override
+    {
+        if (finished)
+            return 0;
+
+        if (chunked && remaining == 0) {
+            QByteArray line;
+
+            // the data of a chunk is followed by CR LF
+            if (chunkRead && !readLine(&line, err))
+                return 0;
+
+            if (!readLine(&line, err))
+                return 0;
+
+            bool ok;
+            remaining = line.split(';').at(0).trimmed().toLongLong(&ok, 16);
+            if (!ok || remaining < 0) {
+                *err = QObject::tr("Invalid chunk size in the HTTP response");
+                return 0;
+            }
+            chunkRead = true;
+
+            if (remaining == 0) {
+                // optional trailer headers
+                do {
+                    if (!readLine(&line, err))
+                        return 0;
+                } while (!line.isEmpty());
+
+                finished = true;
+                return 0;
+            }
+        }
+
+        if (remaining == 0)
+            return 0;
+
+        int n = remaining > 0 ? static_cast<int>(
+                std::min<int64_t>(size, remaining)) : size;
+        int r = receive(buffer, n, err);
+        if (r == 0) {
+            if (err->isEmpty() && (chunked || remaining > 0))
+                *err = QObject::tr(
+                        "The connection was closed before the end of the data");
+        } else if (remaining > 0) {
+            remaining -= r;
+        }
+
+        return r;
+    }
+};
+
+/**
+ * @param host host name
+ * @param port port number
+ * @param timeout timeout for sending and receiving data in seconds
+ * @param err error message will be stored here
+ * @return connected socket or INVALID_SOCKET
+ */
+static Socket connectTo(const QString& host, int port, int timeout,
+        QString* err)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* result = nullptr;
+    int r = getaddrinfo(host.toUtf8().constData(),
+            QByteArray::number(port).constData(), &hints, &result);
+    if (r != 0) {
+        *err = QString(QObject::tr("Cannot resolve the host name %1")).
+                arg(host);
+        return INVALID_SOCKET;
+    }
+
+    Socket s = INVALID_SOCKET;
+    for (addrinfo* a = result; a; a = a->ai_next) {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s == INVALID_SOCKET)
+            continue;
+
+        if (connect(s, a->ai_addr, static_cast<int>(a->ai_addrlen)) == 0)
+            break;
+
+        *err = socketErrorMessage(lastSocketError());
+        closeSocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+
+    if (s != INVALID_SOCKET) {
+        err->clear();
+
+#ifdef _WIN32
+        DWORD t = static_cast<DWORD>(timeout) * 1000;
+#else
+        timeval t = {};
+        t.tv_sec = timeout;
+#endif
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO,
+                reinterpret_cast<const char*>(&t), sizeof(t));
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO,
+                reinterpret_cast<const char*>(&t), sizeof(t));
+    } else if (err->isEmpty()) {
+        *err = QString(QObject::tr("Cannot connect to %1")).arg(host);
+    }
+
+    return s;
+}
+
+/**
+ * @param s socket
+ * @param data data that should be sent
+ * @return error message
+ */
+static QString sendAll(Socket s, const QByteArray& data)
+{
+    int sent = 0;
+    while (sent < data.size()) {
+        int r = static_cast<int>(send(s, data.constData() + sent,
+                data.size() - sent, MSG_NOSIGNAL));
+        if (r <= 0)
+            return socketErrorMessage(lastSocketError());
+        sent += r;
+    }
+    return QString();
+}
+
+SocketTransport::SocketTransport()
+{
+#ifdef _WIN32
+    WSADATA data;
+    WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+SocketTransport::~SocketTransport()
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+HttpConnection* SocketTransport::open(Job* job,
+        const Downloader::Request& request, Downloader::Response* response,
+        bool* gzip)
+{
+    const int MAX_REDIRECTS = 10;
+
+    *gzip = false;
+
+    if (!request.useInternet)
+        job->setErrorMessage(QObject::tr(
+                "Only the Internet can be used for downloading over sockets"));
+
+    QUrl url = request.url;
+    bool authorize = false;
+    int redirects = 0;
+    SocketConnection* c = nullptr;
+    while (job->shouldProceed()) {
+        delete c;
+        c = nullptr;
+
+        if (url.scheme() != QStringLiteral("http")) {
+            job->setErrorMessage(QString(QObject::tr(
+                    "Unsupported URL scheme: %1")).
+                    arg(url.toDisplayString()));
+            break;
+        }
+
+        QString err;
+        Socket s = connectTo(url.host(), url.port(80), request.timeout, &err);
+        if (s == INVALID_SOCKET) {
+            job->setErrorMessage(err);
+            break;
+        }
+        c = new SocketConnection();
+        c->s = s;
+
+        QByteArray resource = url.path(QUrl::FullyEncoded).toUtf8();
+        if (resource.isEmpty())
+            resource = "/";
+        if (url.hasQuery())
+            resource += "?" + url.query(QUrl::FullyEncoded).toUtf8();
+
+        QByteArray host = url.host(QUrl::FullyEncoded).toUtf8();
+        if (url.port() > 0 && url.port() != 80)
+            host += ":" + QByteArray::number(url.port());
+
+        QByteArray req = request.httpMethod.toLatin1() + " " + resource +
+                " HTTP/1.1\r\n"
+                "Host: " + host + "\r\n"
+                "User-Agent: Npackd/" NPACKD_VERSION "\r\n"
+                "Accept: */*\r\n"
+                "Connection: close\r\n";
+
+        if (request.rangeStart >= 0) {
+            // the ranges refer to the uncompressed data
+            req += "Range: bytes=" + QByteArray::number(
+                    static_cast<qlonglong>(request.rangeStart)) + "-";
+            if (request.rangeEnd >= 0)
+                req += QByteArray::number(
+                        static_cast<qlonglong>(request.rangeEnd));
+            req += "\r\n";
+        } else {
+            req += "Accept-Encoding: gzip, deflate\r\n";
+        }
+
+        if (!request.useCache)
+            req += "Cache-Control: no-cache\r\nPragma: no-cache\r\n";
+
+        if (authorize)
+            req += "Authorization: Basic " + (request.user + ":" +
+                    request.password).toUtf8().toBase64() + "\r\n";
+
+        if (!request.postData.isEmpty())
+            req += "Content-Length: " +
+                    QByteArray::number(request.postData.size()) + "\r\n";
+
+        QByteArray headers = request.headers.trimmed().toUtf8();
+        if (!headers.isEmpty())
+            req += headers + "\r\n";
+
+        req += "\r\n" + request.postData;
+
+        err = sendAll(s, req);
+        if (!err.isEmpty()) {
+            job->setErrorMessage(err);
+            break;
+        }
+
+        // status line, e.g. "HTTP/1.1 200 OK". Interim responses like
+        // "100 Continue" are followed by the final response.
+        QByteArray line;
+        int status = 0;
+        while (true) {
+            if (!c->readLine(&line, &err)) {
+                job->setErrorMessage(err);
+                break;
+            }
+            QList<QByteArray> parts = line.split(' ');
+            status = parts.size() > 1 ? parts.at(1).toInt() : 0;
+            if (!line.startsWith("HTTP/") || status < 100) {
+                job->setErrorMessage(QObject::tr("Invalid HTTP response"));
+                break;
+            }
+
+            if (status >= 200)
+                break;
+
+            // the headers of an interim response are ignored
+            do {
+                if (!c->readLine(&line, &err)) {
+                    job->setErrorMessage(err);
+                    break;
+                }
+            } while (!line.isEmpty());
+
+            if (!job->shouldProceed())
+                break;
+        }
+
+        if (!job->shouldProceed())
+            break;
+
+        QByteArray location;
+        *response = Downloader::Response();
+        response->statusCode = status;
+        response->mimeType = QStringLiteral("application/octet-stream");
+        while (true) {
+            if (!c->readLine(&line, &err)) {
+                job->setErrorMessage(err);
+                break;
+            }
+            if (line.isEmpty())
+                break;
+
+            int p = line.indexOf(':');
+            if (p < 0)
+                continue;
+            QByteArray name = line.left(p).trimmed().toLower();
+            QByteArray value = line.mid(p + 1).trimmed();
+
+            if (name == "content-type") {
+                response->mimeType = QString::fromLatin1(value);
+            } else if (name == "content-disposition") {
+                response->contentDisposition = QString::fromUtf8(value);
+            } else if (name == "content-length") {
+                bool ok;
+                response->contentLength = value.toLongLong(&ok);
+                if (!ok)
+                    response->contentLength = 0;
+            } else if (name == "content-encoding") {
+                *gzip = value == "gzip" || value == "deflate";
+            } else if (name == "transfer-encoding") {
+                c->chunked = value.toLower().contains("chunked");
+            } else if (name == "accept-ranges") {
+                response->acceptRanges = value.toLower() == "bytes";
+            } else if (name == "etag") {
+                response->eTag = QString::fromLatin1(value);
+            } else if (name == "last-modified") {
+                response->lastModified = QString::fromLatin1(value);
+            } else if (name == "location") {
+                location = value;
+            }
+        }
+
+        if (!job->shouldProceed())
+            break;
+
+        // the credentials are only sent if the server asks for them
+        if (status == 401 && !authorize && !request.user.isEmpty()) {
+            authorize = true;
+            continue;
+        }
+
+        if ((status == 301 || status == 302 || status == 303 ||
+                status == 307 || status == 308) && !location.isEmpty() &&
+                (request.httpMethod == QStringLiteral("GET") ||
+                request.httpMethod == QStringLiteral("HEAD"))) {
+            redirects++;
+            if (redirects > MAX_REDIRECTS) {
+                job->setErrorMessage(QObject::tr("Too many HTTP redirects"));
+                break;
+            }
+            url = url.resolved(QUrl::fromEncoded(location));
+            authorize = false;
+            continue;
+        }
+
+        // responses without a body
+        if (request.httpMethod == QStringLiteral("HEAD") ||
+                status == 204 || status == 304) {
+            c->chunked = false;
+            c->remaining = 0;
+        } else if (c->chunked) {
+            c->remaining = 0;
+        } else {
+            c->remaining = response->contentLength;
+        }
+
+        break;
+    }
+
+    if (!job->shouldProceed()) {
+        delete c;
+        c = nullptr;
+    }
+
+    return c;
+}
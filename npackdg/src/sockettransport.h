@@ -0,0 +1,32 @@
+#ifndef SOCKETTRANSPORT_H
+#define SOCKETTRANSPORT_H
+
+#include "httptransport.h"
+
+/**
+ * @brief HTTP/1.1 over plain sockets without WinINet. Only http: URLs are
+ *     supported. The connection is made directly without a proxy, there is
+ *     no cache and the user and password from the request are sent using the
+ *     basic authentication if the server asks for them. Redirects, chunked
+ *     responses and interim 1xx responses are handled. The code only depends
+ *     on Berkeley sockets (Winsock on Windows) so that the download code can
+ *     be measured on other systems too. This is the default transport on
+ *     systems without WinINet.
+ *
+ * The object has no state and can be used from several threads at once.
+ */
+class SocketTransport: public HttpTransport
+{
+public:
+    SocketTransport();
+
+    ~SocketTransport() override;
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    HttpConnection* open(Job* job, const Downloader::Request& request,
+            Downloader::Response* response, bool* gzip) override;
+};
+
+#endif // SOCKETTRANSPORT_H
@@ -0,0 +1,213 @@
+#include "sqlprofiler.h"
+
+#include <algorithm>
+
+#include <QRegularExpression>
+#include <QMutexLocker>
+
+qint64 SQLStatementStatistics::percentile(double p) const
+{
+    if (samples.isEmpty())
+        return 0;
+
+    QVector<qint64> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    int index = std::min<int>(sorted.size() - 1,
+            static_cast<int>(p * sorted.size()));
+    return sorted.at(index);
+}
+
+SQLProfiler::SQLProfiler(): enabled(false), explainThreshold(-1)
+{
+}
+
+SQLProfiler* SQLProfiler::getDefault()
+{
+    // never deleted so that the queries of static objects like
+    // DBRepository::def can still use it at exit
+    static SQLProfiler* def = new SQLProfiler();
+    return def;
+}
+
+void SQLProfiler::setEnabled(bool v)
+{
+    enabled = v;
+}
+
+bool SQLProfiler::isEnabled() const
+{
+    return enabled;
+}
+
+void SQLProfiler::setExplainThreshold(qint64 ns)
+{
+    explainThreshold = ns;
+}
+
+qint64 SQLProfiler::getExplainThreshold() const
+{
+    return explainThreshold;
+}
+
+QString SQLProfiler::normalize(const QString& sql)
+{
+    QString r;
+    r.reserve(sql.size());
+
+    const int n = sql.size();
+    int i = 0;
+    bool space = false;
+    while (i < n) {
+        QChar c = sql.at(i);
+        if (c.isSpace()) {
+            space = true;
+            i++;
+            continue;
+        }
+
+        if (space && !r.isEmpty())
+            r.append(' ');
+        space = false;
+
+        QChar prev = r.isEmpty() ? QChar(' ') : r.at(r.size() - 1);
+        if (c == '\'') {
+            // string literal. '' is an escaped quote.
+            i++;
+            while (i < n) {
+                if (sql.at(i) == '\'') {
+                    if (i + 1 < n && sql.at(i + 1) == '\'') {
+                        i += 2;
+                    } else {
+                        i++;
+                        break;
+                    }
+                } else {
+                    i++;
+                }
+            }
+            r.append('?');
+        } else if (c.isDigit() && !prev.isLetterOrNumber() && prev != '_') {
+            // number, but not a part of a name like CATEGORY0 or :NAME1
+            while (i < n && (sql.at(i).isLetterOrNumber() ||
+                    sql.at(i) == '.'))
+                i++;
+            r.append('?');
+        } else {
+            r.append(c);
+            i++;
+        }
+    }
+
+    static const QRegularExpression list(
+            QStringLiteral("\\?(\\s*,\\s*\\?)+"));
+    r.replace(list, QStringLiteral("?, ..."));
+
+    return r;
+}
+
+bool SQLProfiler::record(const QString& statement, qint64 duration,
+        quint64 rows)
+{
+    QMutexLocker ml(&mutex);
+
+    SQLStatementStatistics& s = statements[statement];
+    if (s.count == 0)
+        s.sql = statement;
+    s.count++;
+    s.total += duration;
+    s.rows += rows;
+    if (duration > s.max)
+        s.max = duration;
+
+    // reservoir sampling: every execution has the same chance to be stored
+    if (s.samples.size() < MAX_SAMPLES) {
+        s.samples.append(duration);
+    } else {
+        std::uniform_int_distribution<quint64> d(0, s.count - 1);
+        quint64 j = d(random);
+        if (j < static_cast<quint64>(MAX_SAMPLES))
+            s.samples[static_cast<int>(j)] = duration;
+    }
+
+    // the plan is only captured once
+    qint64 threshold = explainThreshold;
+    bool r = threshold >= 0 && duration > threshold && s.plan.isEmpty();
+    if (r)
+        s.plan = QStringLiteral("...");
+
+    return r;
+}
+
+void SQLProfiler::setPlan(const QString& statement, const QString& plan)
+{
+    QMutexLocker ml(&mutex);
+
+    auto it = statements.find(statement);
+    if (it != statements.end())
+        it.value().plan = plan;
+}
+
+QList<SQLStatementStatistics> SQLProfiler::getStatistics() const
+{
+    mutex.lock();
+    QList<SQLStatementStatistics> r = statements.values();
+    mutex.unlock();
+
+    std::sort(r.begin(), r.end(), [](const SQLStatementStatistics& a,
+            const SQLStatementStatistics& b) {
+        return a.total > b.total;
+    });
+
+    return r;
+}
+
+QStringList SQLProfiler::createReport() const
+{
+    QList<SQLStatementStatistics> stats = getStatistics();
+
+    quint64 count = 0;
+    qint64 total = 0;
+    for (int i = 0; i < stats.size(); i++) {
+        count += stats.at(i).count;
+        total += stats.at(i).total;
+    }
+
+    QStringList r;
+    r.append(QString(QStringLiteral(
+            "SQL statements: %1, executions: %2, total time: %3 ms")).
+            arg(stats.size()).arg(count).arg(total / 1000000.0, 0, 'f', 1));
+    r.append(QString(QStringLiteral("%1 %2 %3 %4 %5 %6 statement")).
+            arg(QStringLiteral("count"), 9).
+            arg(QStringLiteral("total ms"), 10).
+            arg(QStringLiteral("p50 ms"), 9).
+            arg(QStringLiteral("p99 ms"), 9).
+            arg(QStringLiteral("max ms"), 9).
+            arg(QStringLiteral("rows"), 10));
+    for (int i = 0; i < stats.size(); i++) {
+        const SQLStatementStatistics& s = stats.at(i);
+        r.append(QString(QStringLiteral("%1 %2 %3 %4 %5 %6 %7")).
+                arg(s.count, 9).
+                arg(s.total / 1000000.0, 10, 'f', 1).
+                arg(s.percentile(0.5) / 1000000.0, 9, 'f', 3).
+                arg(s.percentile(0.99) / 1000000.0, 9, 'f', 3).
+                arg(s.max / 1000000.0, 9, 'f', 3).
+                arg(s.rows, 10).
+                arg(s.sql));
+        if (!s.plan.isEmpty()) {
+            QStringList lines = s.plan.split('\n');
+            for (int j = 0; j < lines.size(); j++) {
+                r.append(QString(62, ' ') + lines.at(j));
+            }
+        }
+    }
+
+    return r;
+}
+
+void SQLProfiler::clear()
+{
+    QMutexLocker ml(&mutex);
+
+    statements.clear();
+}
@@ -0,0 +1,151 @@
+#ifndef SQLPROFILER_H
+#define SQLPROFILER_H
+
+#include <atomic>
+#include <random>
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QMutex>
+
+/**
+ * @brief execution statistics for one normalized SQL statement
+ */
+class SQLStatementStatistics
+{
+public:
+    /** normalized SQL (see SQLProfiler::normalize()) */
+    QString sql;
+
+    /** number of executions */
+    quint64 count = 0;
+
+    /** sum of the execution times in nanoseconds */
+    qint64 total = 0;
+
+    /** longest execution time in nanoseconds */
+    qint64 max = 0;
+
+    /** number of the returned rows */
+    quint64 rows = 0;
+
+    /**
+     * execution times in nanoseconds. At most SQLProfiler::MAX_SAMPLES
+     * randomly chosen executions are stored.
+     */
+    QVector<qint64> samples;
+
+    /** output of EXPLAIN QUERY PLAN or "" if it was not captured */
+    QString plan;
+
+    /**
+     * @param p percentile between 0 and 1 (e.g. 0.99)
+     * @return execution time in nanoseconds estimated from the samples
+     */
+    qint64 percentile(double p) const;
+};
+
+/**
+ * @brief collects the execution times of the SQL statements executed using
+ *     MySQLQuery. The statements are aggregated after the literals are
+ *     replaced by placeholders.
+ *
+ * The profiler is disabled by default and only costs an atomic read per
+ * statement in this case. All functions are thread-safe.
+ */
+class SQLProfiler
+{
+    mutable QMutex mutex;
+
+    std::atomic<bool> enabled;
+
+    /** see setExplainThreshold() */
+    std::atomic<qint64> explainThreshold;
+
+    /** normalized SQL -> statistics */
+    QHash<QString, SQLStatementStatistics> statements;
+
+    /** chooses the samples */
+    std::minstd_rand random;
+public:
+    /** maximum number of samples per statement */
+    static const int MAX_SAMPLES = 4096;
+
+    SQLProfiler();
+
+    SQLProfiler(const SQLProfiler&) = delete;
+    SQLProfiler& operator=(const SQLProfiler&) = delete;
+
+    /**
+     * @return the profiler used by MySQLQuery
+     */
+    static SQLProfiler* getDefault();
+
+    /**
+     * @param v true = collect the statistics
+     */
+    void setEnabled(bool v);
+
+    /**
+     * @return true if the statistics are collected
+     */
+    bool isEnabled() const;
+
+    /**
+     * @param ns EXPLAIN QUERY PLAN is captured once for each statement that
+     *     took longer than this number of nanoseconds. -1 = never
+     */
+    void setExplainThreshold(qint64 ns);
+
+    /**
+     * @return see setExplainThreshold()
+     */
+    qint64 getExplainThreshold() const;
+
+    /**
+     * @brief replaces the string and number literals with "?" and removes
+     *     superfluous white space. Lists of placeholders like (?, ?, ?) are
+     *     shortened to (?, ...).
+     * @param sql SQL statement
+     * @return normalized statement
+     */
+    static QString normalize(const QString& sql);
+
+    /**
+     * @brief adds one execution of a statement
+     * @param statement normalized SQL
+     * @param duration execution time including fetching the rows in
+     *     nanoseconds
+     * @param rows number of the returned rows
+     * @return true if the plan for this statement should be captured and
+     *     passed to setPlan()
+     */
+    bool record(const QString& statement, qint64 duration, quint64 rows);
+
+    /**
+     * @param statement normalized SQL
+     * @param plan output of EXPLAIN QUERY PLAN
+     */
+    void setPlan(const QString& statement, const QString& plan);
+
+    /**
+     * @return statistics for all statements sorted by the total time
+     *     (largest first)
+     */
+    QList<SQLStatementStatistics> getStatistics() const;
+
+    /**
+     * @return text report for the statistics
+     */
+    QStringList createReport() const;
+
+    /**
+     * @brief removes all statistics
+     */
+    void clear();
+};
+
+#endif // SQLPROFILER_H
@@ -0,0 +1,118 @@
+#include "titleindex.h"
+
+#include <algorithm>
+#include <iterator>
+
+void TitleIndex::add(const QString &name, const QString &text, bool isNull)
+{
+    int index = names.size();
+    names.append(name);
+    texts.append(text);
+    hasText.append(!isNull);
+
+    if (!isNull) {
+        QStringList words = text.split(QLatin1Char(' '),
+                Qt::SkipEmptyParts);
+        for (int i = 0; i < words.size(); i++) {
+            QVector<int>& list = postings[words.at(i)];
+
+            // a word may occur more than once in a title
+            if (list.isEmpty() || list.last() != index)
+                list.append(index);
+        }
+    }
+}
+
+int TitleIndex::size() const
+{
+    return names.size();
+}
+
+QVector<int> TitleIndex::find(const QString &keyword) const
+{
+    QVector<int> r;
+    if (keyword.contains(QLatin1Char('%')) ||
+            keyword.contains(QLatin1Char('_')) ||
+            keyword.contains(QLatin1Char(' '))) {
+        QString pattern = QStringLiteral("% ") + keyword +
+                QStringLiteral(" %");
+        for (int i = 0; i < texts.size(); i++) {
+            if (hasText.at(i) && like(texts.at(i), pattern))
+                r.append(i);
+        }
+    } else {
+        r = postings.value(keyword);
+    }
+    return r;
+}
+
+QStringList TitleIndex::find(const QStringList &keywords, int limit) const
+{
+    QList<QVector<int> > lists;
+    for (int i = 0; i < keywords.size(); i++) {
+        const QString& kw = keywords.at(i);
+        if (kw.length() > 1)
+            lists.append(find(kw));
+    }
+
+    // the shortest lists first
+    std::sort(lists.begin(), lists.end(),
+            [](const QVector<int>& a, const QVector<int>& b) {
+        return a.size() < b.size();
+    });
+
+    QStringList r;
+    if (lists.isEmpty()) {
+        for (int i = 0; i < names.size() && r.size() < limit; i++) {
+            r.append(names.at(i));
+        }
+    } else {
+        QVector<int> result = lists.at(0);
+        for (int i = 1; i < lists.size() && !result.isEmpty(); i++) {
+            QVector<int> tmp;
+            std::set_intersection(result.begin(), result.end(),
+                    lists.at(i).begin(), lists.at(i).end(),
+                    std::back_inserter(tmp));
+            result = tmp;
+        }
+
+        for (int i = 0; i < result.size() && r.size() < limit; i++) {
+            r.append(names.at(result.at(i)));
+        }
+    }
+
+    return r;
+}
+
+bool TitleIndex::like(const QString &text, const QString &pattern)
+{
+    // SQLite compares code points
+    QVector<uint> t = text.toUcs4();
+    QVector<uint> p = pattern.toUcs4();
+
+    int ti = 0, pi = 0;
+
+    // position of the last % in the pattern and the position in the text
+    // where it started to match
+    int star = -1, mark = 0;
+    while (ti < t.size()) {
+        if (pi < p.size() && p.at(pi) == '%') {
+            star = pi++;
+            mark = ti;
+        } else if (pi < p.size() && (p.at(pi) == '_' ||
+                p.at(pi) == t.at(ti))) {
+            pi++;
+            ti++;
+        } else if (star >= 0) {
+            pi = star + 1;
+            ti = ++mark;
+        } else {
+            return false;
+        }
+    }
+
+    while (pi < p.size() && p.at(pi) == '%')
+        pi++;
+
+    return pi == p.size();
+}
@@ -0,0 +1,75 @@
+#ifndef TITLEINDEX_H
+#define TITLEINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+
+/**
+ * @brief in-memory inverted index for PACKAGE.TITLE_FULLTEXT. This is used
+ *     by DBRepository::findBetterPackages() while the installed software is
+ *     detected. A package matches a keyword if the SQL condition
+ *     TITLE_FULLTEXT LIKE '% keyword %' would be true.
+ *
+ * TITLE_FULLTEXT contains the words created by DBRepository::tokenizeTitle()
+ * separated by spaces. A keyword without spaces and LIKE wildcards matches
+ * exactly the packages where one of the words is equal to the keyword. The
+ * comparison is case-sensitive because the database is opened with
+ * "PRAGMA case_sensitive_like = on". Such keywords are found using the
+ * posting lists. All other keywords are compared with every title.
+ */
+class TitleIndex
+{
+private:
+    /** package names in the order they were added */
+    QStringList names;
+
+    /** TITLE_FULLTEXT for every package */
+    QStringList texts;
+
+    /** false = TITLE_FULLTEXT is NULL for this package */
+    QVector<bool> hasText;
+
+    /** word -> sorted package indexes */
+    QHash<QString, QVector<int> > postings;
+
+    /**
+     * @param keyword a keyword
+     * @return sorted indexes of the matching packages
+     */
+    QVector<int> find(const QString& keyword) const;
+public:
+    /**
+     * @brief adds a package
+     * @param name full package name
+     * @param text TITLE_FULLTEXT
+     * @param isNull true = TITLE_FULLTEXT is NULL
+     */
+    void add(const QString& name, const QString& text, bool isNull);
+
+    /**
+     * @return number of packages
+     */
+    int size() const;
+
+    /**
+     * @brief searches for packages matching all keywords. Keywords with less
+     *     than 2 characters are ignored like in the SQL query.
+     * @param keywords keywords from DBRepository::tokenizeTitle()
+     * @param limit maximum number of returned packages
+     * @return names of the first found packages in the order they were added
+     */
+    QStringList find(const QStringList& keywords, int limit) const;
+
+    /**
+     * @brief evaluates the SQLite condition "text LIKE pattern" with
+     *     "PRAGMA case_sensitive_like = on"
+     * @param text a text
+     * @param pattern pattern with % and _ as wildcards
+     * @return true if the text matches the pattern
+     */
+    static bool like(const QString& text, const QString& pattern);
+};
+
+#endif // TITLEINDEX_H
@@ -4,11 +4,33 @@
 
 const Version Version::EMPTY(-1, -1);
 
+/**
+ * @param v a number
+ * @return number of characters in QString::number(v)
+ */
+static int numberLength(int v)
+{
+    int r = 1;
+    unsigned int u;
+    if (v < 0) {
+        r++;
+        u = 0u - static_cast<unsigned int>(v);
+    } else {
+        u = static_cast<unsigned int>(v);
+    }
+    while (u >= 10) {
+        u /= 10;
+        r++;
+    }
+    return r;
+}
+
 Version::Version(): basic()
 {
     this->parts = &this->basic[0];
     this->parts[0] = 1;
     this->nparts = 1;
+    updateKey();
 }
 
 Version::Version(int a, int b): basic()
@@ -17,9 +39,11 @@ Version::Version(int a, int b): basic()
     this->parts[0] = a;
     this->parts[1] = b;
     this->nparts = 2;
+    updateKey();
 }
 
-Version::Version(const Version &v): basic()
+Version::Version(const Version &v): basic(), key(v.key), packed(v.packed),
+        str(v.str)
 {
     if (v.nparts <= BASIC_PARTS)
         this->parts = &basic[0];
@@ -40,33 +64,46 @@ Version& Version::operator =(const Version& v)
             this->parts = new int[v.nparts];
         this->nparts = v.nparts;
         memcpy(parts, v.parts, sizeof(parts[0]) * static_cast<size_t>(nparts));
+        this->key = v.key;
+        this->packed = v.packed;
+        this->str = v.str;
     }
     return *this;
 }
 
 bool Version::operator !=(const Version& v) const
 {
-    return this->compare(v) != 0;
+    if (this->packed && v.packed)
+        return this->key != v.key;
+    return this->compareParts(v) != 0;
 }
 
 bool Version::operator ==(const Version& v) const
 {
-    return this->compare(v) == 0;
+    if (this->packed && v.packed)
+        return this->key == v.key;
+    return this->compareParts(v) == 0;
 }
 
 bool Version::operator <(const Version& v) const
 {
-    return this->compare(v) < 0;
+    if (this->packed && v.packed)
+        return this->key < v.key;
+    return this->compareParts(v) < 0;
 }
 
 bool Version::operator <=(const Version& v) const
 {
-    return this->compare(v) <= 0;
+    if (this->packed && v.packed)
+        return this->key <= v.key;
+    return this->compareParts(v) <= 0;
 }
 
 bool Version::operator >(const Version& v) const
 {
-    return this->compare(v) > 0;
+    if (this->packed && v.packed)
+        return this->key > v.key;
+    return this->compareParts(v) > 0;
 }
 
 Version::~Version()
@@ -75,6 +112,23 @@ Version::~Version()
         delete[] this->parts;
 }
 
+void Version::updateKey()
+{
+    int n = nparts;
+    while (n > 1 && parts[n - 1] == 0)
+        n--;
+
+    packed = n <= BASIC_PARTS;
+    key = 0;
+    for (int i = 0; i < n && packed; i++) {
+        int p = parts[i];
+        if (p < 0 || p > 0xFFFF)
+            packed = false;
+        else
+            key |= static_cast<quint64>(p) << (48 - 16 * i);
+    }
+}
+
 void Version::setVersion(int a, int b)
 {
     if (this->parts != this->basic)
@@ -83,6 +137,8 @@ void Version::setVersion(int a, int b)
     this->parts[0] = a;
     this->parts[1] = b;
     this->nparts = 2;
+    this->str = QString();
+    updateKey();
 }
 
 void Version::setVersion(int a, int b, int c)
@@ -94,6 +150,8 @@ void Version::setVersion(int a, int b, int c)
     this->parts[1] = b;
     this->parts[2] = c;
     this->nparts = 3;
+    this->str = QString();
+    updateKey();
 }
 
 void Version::setVersion(int a, int b, int c, int d)
@@ -106,6 +164,8 @@ void Version::setVersion(int a, int b, int c, int d)
     this->parts[2] = c;
     this->parts[3] = d;
     this->nparts = 4;
+    this->str = QString();
+    updateKey();
 }
 
 bool Version::setVersion(const QString& v)
@@ -130,9 +190,20 @@ bool Version::setVersion(const QString& v)
                     this->parts = basic;
                 else
                     this->parts = new int[nparts];
+                int len = nparts - 1;
                 for (int i = 0; i < nparts; i++) {
                     this->parts[i] = sl.at(i).toInt();
+                    len += numberLength(this->parts[i]);
                 }
+
+                // leading zeros, signs and spaces make a part longer. The
+                // string can only be reused if it has the canonical length.
+                if (len == v.length())
+                    this->str = v;
+                else
+                    this->str = QString();
+
+                updateKey();
                 result = true;
             }
         }
@@ -155,6 +226,8 @@ void Version::prepend(int number)
         delete[] this->parts;
     this->parts = newParts;
     this->nparts = this->nparts + 1;
+    this->str = QString();
+    updateKey();
 }
 
 QString Version::getVersionString(int nparts) const
@@ -173,6 +246,9 @@ QString Version::getVersionString(int nparts) const
 
 QString Version::getVersionString() const
 {
+    if (!this->str.isNull())
+        return this->str;
+
     QString r;
     for (int i = 0; i < this->nparts; i++) {
         if (i != 0)
@@ -209,6 +285,11 @@ void Version::normalize()
             delete[] this->parts;
         this->parts = newParts;
         this->nparts = this->nparts - n;
+
+        // every removed part is ".0" in the canonical string. The key does
+        // not change.
+        if (!this->str.isNull())
+            this->str.chop(2 * n);
     }
 }
 
@@ -219,16 +300,48 @@ bool Version::isNormalized() const
 
 QString Version::toComparableString() const
 {
-    QString r;
+    // all segments have 10 characters. The string is created in place as
+    // this is called for every row in INSTALLED.
+    QString r(this->nparts * 11 - 1, QLatin1Char('0'));
+    QChar* data = r.data();
     for (int i = 0; i < this->nparts; i++) {
+        int p = this->parts[i];
+        if (p < 0) {
+            r.clear();
+            break;
+        }
+
+        QChar* segment = data + i * 11;
         if (i != 0)
-            r.append('.');
-        r.append(QString::number(this->parts[i]).rightJustified(10, '0'));
+            segment[-1] = QLatin1Char('.');
+        for (int j = 9; j >= 0 && p != 0; j--) {
+            segment[j] = QLatin1Char(static_cast<char>('0' + p % 10));
+            p /= 10;
+        }
     }
+
+    // negative numbers are not really supported, but should produce the
+    // same result as before
+    if (r.isEmpty()) {
+        for (int i = 0; i < this->nparts; i++) {
+            if (i != 0)
+                r.append('.');
+            r.append(QString::number(this->parts[i]).rightJustified(10, '0'));
+        }
+    }
+
     return r;
 }
 
 int Version::compare(const Version &other) const
+{
+    if (this->packed && other.packed)
+        return (this->key > other.key) - (this->key < other.key);
+
+    return compareParts(other);
+}
+
+int Version::compareParts(const Version &other) const
 {
     int nmax = nparts;
     if (other.nparts > nmax)
@@ -21,6 +21,29 @@ private:
     int* parts;
 
     int nparts;
+
+    /**
+     * the first 4 parts with 16 bits each (the first part in the highest
+     * bits). Only valid if packed=true. Two packed versions can be compared
+     * by comparing the keys.
+     */
+    quint64 key;
+
+    /**
+     * true = "key" is valid. This is the case if all parts are between 0 and
+     * 65535 and only the first 4 parts may be non-zero.
+     */
+    bool packed;
+
+    /**
+     * the value for getVersionString() or a null string if it is not known
+     */
+    QString str;
+
+    /**
+     * @brief re-computes "key" and "packed" after a change
+     */
+    void updateKey();
 public:
     /** an empty/null object */
     static const Version EMPTY;
@@ -113,6 +136,15 @@ public:
      */
     int compare(const Version& other) const;
 
+    /**
+     * Compares this version with another one part by part without using the
+     * packed representation. compare() should be used instead.
+     *
+     * @param other other version
+     * @return <0, 0 or >0
+     */
+    int compareParts(const Version& other) const;
+
     /**
      * @return number of parts in this version number. Returns 1 for the
      *     version "0"
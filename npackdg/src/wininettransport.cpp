@@ -0,0 +1,618 @@
+#include "wininettransport.h"
+
+#include <algorithm>
+
+#include <QObject>
+#include <QMutex>
+#include <QLoggingCategory>
+
+#include "wpmutils.h"
+
+#ifndef HTTP_QUERY_ACCEPT_RANGES
+#define HTTP_QUERY_ACCEPT_RANGES 42
+#endif
+
+#ifndef HTTP_QUERY_ETAG
+#define HTTP_QUERY_ETAG 54
+#endif
+
+QMutex WinINetTransport::connectionsMutex;
+int WinINetTransport::reservedConnections = 0;
+DWORD WinINetTransport::maxConnections[2] = {2, 2};
+
+DWORD __stdcall myInternetAuthNotifyCallback(DWORD_PTR /* dwContext */,
+        DWORD dwReturn, LPVOID /* lpReserved */) {
+    qCDebug(npackd) << "myInternetAuthNotifyCallback" << dwReturn;
+    return 0;
+}
+
+/**
+ * @brief WinINet handles for one request
+ */
+class WinINetConnection: public HttpConnection
+{
+public:
+    HINTERNET internet = nullptr;
+    HINTERNET hConnectHandle = nullptr;
+    HINTERNET hResourceHandle = nullptr;
+
+    ~WinINetConnection() override
+    {
+        if (hResourceHandle)
+            InternetCloseHandle(hResourceHandle);
+        if (hConnectHandle)
+            InternetCloseHandle(hConnectHandle);
+        if (internet)
+            InternetCloseHandle(internet);
+    }
+
+    int read(char* buffer, int size, QString* err) override
+    {
+        DWORD len = 0;
+        if (!InternetReadFile(hResourceHandle, buffer,
+                static_cast<DWORD>(size), &len)) {
+            WPMUtils::formatMessage(GetLastError(), err);
+            len = 0;
+        }
+        return static_cast<int>(len);
+    }
+};
+
+HttpConnection* WinINetTransport::open(Job* job,
+        const Downloader::Request& request, Downloader::Response* response,
+        bool* gzip)
+{
+    QUrl url = request.url;
+    QString verb = request.httpMethod;
+    QString* mime = &response->mimeType;
+    QString* contentDisposition = &response->contentDisposition;
+    HWND parentWindow = defaultPasswordWindow;
+    bool useCache = request.useCache;
+    bool keepConnection = request.keepConnection;
+    bool interactive = request.interactive;
+
+    *gzip = false;
+
+    WinINetConnection* c = new WinINetConnection();
+
+    QString server = url.host();
+    QString resource = url.path();
+    QString encQuery = url.query(QUrl::FullyEncoded);
+    if (!encQuery.isEmpty())
+        resource.append('?').append(encQuery);
+
+    QString agent("Npackd/");
+    agent.append(NPACKD_VERSION);
+
+    agent += " (compatible; MSIE 9.0)";
+
+    c->internet = InternetOpenW(WPMUtils::toLPWSTR(agent),
+            INTERNET_OPEN_TYPE_PRECONFIG,
+            nullptr, nullptr, 0);
+
+    if (c->internet == nullptr) {
+        QString errMsg;
+        WPMUtils::formatMessage(GetLastError(), &errMsg);
+        job->setErrorMessage(errMsg);
+    }
+
+    if (job->shouldProceed()) {
+        // change the timeout to 5 minutes
+        DWORD rec_timeout = static_cast<DWORD>(request.timeout) * 1000;
+        InternetSetOption(c->internet, INTERNET_OPTION_RECEIVE_TIMEOUT,
+                &rec_timeout, sizeof(rec_timeout));
+        InternetSetOption(c->internet, INTERNET_OPTION_SEND_TIMEOUT,
+                &rec_timeout, sizeof(rec_timeout));
+
+        // enable automatic gzip decoding
+#ifndef INTERNET_OPTION_HTTP_DECODING
+        const DWORD INTERNET_OPTION_HTTP_DECODING = 65;
+#endif
+        BOOL b = TRUE;
+        InternetSetOption(c->internet, INTERNET_OPTION_HTTP_DECODING,
+                &b, sizeof(b));
+    }
+
+    // here "internet" cannot be 0, but we add the comparison to silence
+    // Coverity
+    if (job->shouldProceed() && c->internet != nullptr) {
+        INTERNET_PORT port = static_cast<INTERNET_PORT>(
+                url.port(url.scheme() == "https" ?
+                INTERNET_DEFAULT_HTTPS_PORT: INTERNET_DEFAULT_HTTP_PORT));
+        c->hConnectHandle = InternetConnectW(c->internet,
+                WPMUtils::toLPWSTR(server), port, nullptr, nullptr, INTERNET_SERVICE_HTTP, 0, 0);
+
+        if (c->hConnectHandle == nullptr) {
+            QString errMsg;
+            WPMUtils::formatMessage(GetLastError(), &errMsg);
+            job->setErrorMessage(errMsg);
+        }
+    }
+
+    HINTERNET hConnectHandle = c->hConnectHandle;
+
+    if (job->shouldProceed()) {
+        if (!request.user.isEmpty()) {
+            setStringOption(hConnectHandle, INTERNET_OPTION_USERNAME,
+                    request.user);
+
+            if (!request.password.isEmpty()) {
+                setStringOption(hConnectHandle, INTERNET_OPTION_PASSWORD,
+                        request.password);
+            }
+        }
+    }
+
+    if (job->shouldProceed()) {
+        if (!request.proxyUser.isEmpty()) {
+            setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_USERNAME,
+                    request.proxyUser);
+
+            if (!request.proxyPassword.isEmpty()) {
+                setStringOption(hConnectHandle, INTERNET_OPTION_PROXY_PASSWORD,
+                        request.proxyPassword);
+            }
+        }
+    }
+
+    // flags: http://msdn.microsoft.com/en-us/library/aa383661(v=vs.85).aspx
+    // We support accepting any mime file type since this is a simple download
+    // of a file
+    //
+    // hConnectHandle is only checked here to silence Coverity
+    if (job->shouldProceed() && hConnectHandle != nullptr) {
+        LPCTSTR ppszAcceptTypes[2];
+        ppszAcceptTypes[0] = L"*/*";
+        ppszAcceptTypes[1] = nullptr;
+        DWORD flags = (url.scheme() == "https" ? INTERNET_FLAG_SECURE : 0);
+        if (keepConnection)
+            flags |= INTERNET_FLAG_KEEP_CONNECTION;
+        if (!request.useInternet)
+            flags |= INTERNET_FLAG_FROM_CACHE;
+        flags |= INTERNET_FLAG_RESYNCHRONIZE;
+
+        // parts of a file are not cached
+        if (!useCache || request.rangeStart >= 0)
+            flags |= INTERNET_FLAG_DONT_CACHE | INTERNET_FLAG_PRAGMA_NOCACHE |
+                    INTERNET_FLAG_RELOAD;
+        c->hResourceHandle = HttpOpenRequestW(hConnectHandle,
+                WPMUtils::toLPWSTR(verb),
+                WPMUtils::toLPWSTR(resource),
+                nullptr, nullptr, ppszAcceptTypes,
+                flags, 0);
+        if (c->hResourceHandle == nullptr) {
+            QString errMsg;
+            WPMUtils::formatMessage(GetLastError(), &errMsg);
+            job->setErrorMessage(errMsg);
+        }
+    }
+
+    qCDebug(npackd) << "HttpOpenRequestW succeeded";
+
+    HINTERNET hResourceHandle = c->hResourceHandle;
+
+    if (hResourceHandle != nullptr && hConnectHandle != nullptr) {
+        if (job->shouldProceed()) {
+            // do not check for errors here
+            if (request.rangeStart >= 0) {
+                // the ranges refer to the uncompressed data
+                QString range = QString(QStringLiteral("Range: bytes=%1-%2")).
+                        arg(request.rangeStart).
+                        arg(request.rangeEnd >= 0 ?
+                        QString::number(request.rangeEnd) : QString());
+                HttpAddRequestHeadersW(hResourceHandle,
+                        WPMUtils::toLPWSTR(range),
+                        static_cast<DWORD>(-1),
+                        HTTP_ADDREQ_FLAG_ADD | HTTP_ADDREQ_FLAG_REPLACE);
+            } else {
+                HttpAddRequestHeadersW(hResourceHandle,
+                        L"Accept-Encoding: gzip, deflate",
+                        static_cast<DWORD>(-1),
+                        HTTP_ADDREQ_FLAG_ADD);
+            }
+        }
+
+        // qCDebug(npackd) << "download.5";
+        int callNumber = 0;
+        while (job->shouldProceed()) {
+            // qCDebug(npackd) << "download.5.1";
+
+            // NOTE: dwStatus is only valid if sendRequestError == 0
+            DWORD dwStatus = 0, dwStatusSize = sizeof(dwStatus);
+
+            DWORD sendRequestError = 0;
+
+            // the following call uses NULL for headers in case there are no headers
+            // because Windows 2003 generates the error 12150 otherwise
+            if (!HttpSendRequestW(hResourceHandle,
+                    request.headers.length() == 0 ? nullptr : WPMUtils::toLPWSTR(request.headers),
+                    static_cast<DWORD>(-1),
+                    request.postData.length() == 0 ? nullptr : const_cast<char*>(request.postData.data()),
+                    static_cast<DWORD>(request.postData.length()))) {
+                sendRequestError = GetLastError();
+            }
+
+            // http://msdn.microsoft.com/en-us/library/aa384220(v=vs.85).aspx
+            if (sendRequestError == 0) {
+                if (!HttpQueryInfo(hResourceHandle, HTTP_QUERY_FLAG_NUMBER |
+                        HTTP_QUERY_STATUS_CODE, &dwStatus, &dwStatusSize, nullptr)) {
+                    QString errMsg;
+                    WPMUtils::formatMessage(GetLastError(), &errMsg);
+                    job->setErrorMessage(errMsg);
+                    break;
+                }
+            }
+
+            qCDebug(npackd) << "WinINetTransport::open callNumber="
+                    << callNumber << ", sendRequestError="
+                    << sendRequestError << ", dwStatus=" << dwStatus;
+
+            // 2XX
+            if (sendRequestError == 0) {
+                DWORD hundreds = dwStatus / 100;
+                if (hundreds == 2 || hundreds == 5)
+                    break;
+            }
+
+            // the InternetErrorDlg calls below can either handle
+            // sendRequestError <> 0 or HTTP error code <> 2xx
+
+            void* p = nullptr;
+
+            // both calls to InternetErrorDlg should be enclosed by one
+            // mutex, so that only one dialog will be shown
+            loginDialogMutex.lock();
+
+            DWORD r;
+
+            // first call is processed differently
+            if (callNumber == 0) {
+                r = InternetErrorDlg(nullptr,
+                       hResourceHandle, sendRequestError,
+                        FLAGS_ERROR_UI_FILTER_FOR_ERRORS |
+                        FLAGS_ERROR_UI_FLAGS_CHANGE_OPTIONS |
+                        FLAGS_ERROR_UI_FLAGS_GENERATE_DATA |
+                        FLAGS_ERROR_UI_FLAGS_NO_UI, &p);
+                if ((r == ERROR_SUCCESS || r == ERROR_INTERNET_INTERNAL_ERROR) && interactive)
+                    r = ERROR_INTERNET_FORCE_RETRY;
+            } else {
+                if (interactive) {
+                    if (parentWindow) {
+                        r = InternetErrorDlg(parentWindow,
+                                hResourceHandle, sendRequestError,
+                                FLAGS_ERROR_UI_FILTER_FOR_ERRORS |
+                                FLAGS_ERROR_UI_FLAGS_CHANGE_OPTIONS |
+                                FLAGS_ERROR_UI_FLAGS_GENERATE_DATA, &p);
+                    } else {
+                        if (sendRequestError == 0) {
+                            QString e = inputPassword(hConnectHandle, dwStatus);
+
+                            //qCDebug(npackd) << "inputPassword: " << e;
+                            if (!e.isEmpty()) {
+                                job->setErrorMessage(e);
+                                r = ERROR_CANCELLED;
+                            } else {
+                                r = ERROR_INTERNET_FORCE_RETRY;
+                            }
+                        } else {
+                            // cannot help
+                            r = ERROR_SUCCESS;
+                        }
+                    }
+                } else {
+                    if (sendRequestError == 0) {
+                        QString e = setPassword(hConnectHandle, dwStatus,
+                                request);
+
+                        if (!e.isEmpty()) {
+                            job->setErrorMessage(e);
+                            r = ERROR_CANCELLED;
+                        } else {
+                            r = ERROR_INTERNET_FORCE_RETRY;
+                        }
+                    } else {
+                        // cannot help
+                        r = ERROR_SUCCESS;
+                    }
+                }
+            }
+
+            //qCDebug(npackd) << callNumber << r << dwStatus << url.toString();
+
+            if (job->shouldProceed()) {
+                if (r == ERROR_SUCCESS) {
+                    if (sendRequestError) {
+                        QString errMsg;
+                        WPMUtils::formatMessage(sendRequestError, &errMsg);
+                        job->setErrorMessage(errMsg);
+                    } else {
+                        job->setErrorMessage(QString(
+                                QObject::tr("HTTP status code %1")).arg(dwStatus));
+                    }
+                } else if (r == ERROR_INTERNET_FORCE_RETRY) {
+                    // nothing
+                } else if (r == ERROR_CANCELLED) {
+                    job->setErrorMessage(QObject::tr("Cancelled by the user"));
+                } else if (r == ERROR_INVALID_HANDLE) {
+                    job->setErrorMessage(QObject::tr("Invalid handle"));
+                } else {
+                    job->setErrorMessage(QString(
+                            QObject::tr("Unknown error %1 from InternetErrorDlg in attempt %2")).arg(r).arg(callNumber + 1));
+                }
+            }
+
+            loginDialogMutex.unlock();
+
+            if (!job->shouldProceed())
+                break;
+
+            // read all the data before re-sending the request
+            char smallBuffer[4 * 1024];
+            while (true) {
+                DWORD read;
+                if (!InternetReadFile(hResourceHandle, &smallBuffer,
+                        sizeof(smallBuffer), &read)) {
+                    QString errMsg;
+                    WPMUtils::formatMessage(GetLastError(), &errMsg);
+                    job->setErrorMessage(errMsg);
+                    goto out;
+                }
+
+                // qCDebug(npackd) << "read some bytes " << read;
+                if (read == 0)
+                    break;
+            }
+
+            callNumber++;
+        }; // while (job->shouldProceed())
+
+    out:
+        if (job->shouldProceed()) {
+            DWORD dwStatus, dwStatusSize = sizeof(dwStatus);
+
+            // http://msdn.microsoft.com/en-us/library/aa384220(v=vs.85).aspx
+            if (!HttpQueryInfo(hResourceHandle, HTTP_QUERY_FLAG_NUMBER |
+                    HTTP_QUERY_STATUS_CODE, &dwStatus, &dwStatusSize, nullptr)) {
+                QString errMsg;
+                WPMUtils::formatMessage(GetLastError(), &errMsg);
+                job->setErrorMessage(errMsg);
+            } else {
+                response->statusCode = static_cast<int>(dwStatus);
+            }
+        }
+
+        // MIME type
+        if (job->shouldProceed()) {
+            if (mime) {
+                WCHAR mimeBuffer[1024];
+                DWORD bufferLength = sizeof(mimeBuffer);
+                DWORD index = 0;
+                if (!HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_TYPE,
+                        &mimeBuffer, &bufferLength, &index)) {
+                    *mime = "application/octet-stream";
+                } else {
+                    *mime = QString::fromWCharArray(
+                            mimeBuffer, bufferLength / 2);
+                }
+            }
+        }
+
+        // Content-Encoding
+        if (job->shouldProceed()) {
+            WCHAR contentEncodingBuffer[1024];
+            DWORD bufferLength = sizeof(contentEncodingBuffer);
+            DWORD index = 0;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_ENCODING,
+                    &contentEncodingBuffer, &bufferLength, &index)) {
+                QString contentEncoding = QString::fromWCharArray(
+                        contentEncodingBuffer, bufferLength / 2);
+                *gzip = contentEncoding == "gzip" || contentEncoding == "deflate";
+            }
+        }
+
+        // Content-Disposition
+        if (job->shouldProceed()) {
+            if (contentDisposition) {
+                WCHAR cdBuffer[1024];
+                wcscpy(cdBuffer, L"Content-Disposition");
+                DWORD bufferLength = sizeof(cdBuffer);
+                DWORD index = 0;
+                if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CUSTOM,
+                        &cdBuffer, &bufferLength, &index)) {
+                    *contentDisposition = QString::fromWCharArray(
+                            cdBuffer, bufferLength / 2);
+                }
+            }
+        }
+
+        // content length
+        if (job->shouldProceed()) {
+            int64_t contentLength = -1;
+            WCHAR contentLengthBuffer[100];
+            DWORD bufferLength = sizeof(contentLengthBuffer);
+            DWORD index = 0;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_LENGTH,
+                    contentLengthBuffer, &bufferLength, &index)) {
+                QString s = QString::fromWCharArray(
+                        contentLengthBuffer, bufferLength / 2);
+                bool ok;
+                contentLength = s.toLongLong(&ok, 10);
+                if (!ok)
+                    contentLength = 0;
+            }
+
+            response->contentLength = contentLength;
+            response->acceptRanges = queryInfo(hResourceHandle,
+                    HTTP_QUERY_ACCEPT_RANGES).compare(QStringLiteral("bytes"),
+                    Qt::CaseInsensitive) == 0;
+            response->eTag = queryInfo(hResourceHandle, HTTP_QUERY_ETAG);
+            response->lastModified = queryInfo(hResourceHandle,
+                    HTTP_QUERY_LAST_MODIFIED);
+        }
+    }
+
+    if (!job->shouldProceed()) {
+        delete c;
+        c = nullptr;
+    }
+
+    return c;
+}
+
+void WinINetTransport::setMaxConnections(int reserved)
+{
+    const DWORD options[] = {INTERNET_OPTION_MAX_CONNS_PER_SERVER,
+            INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER};
+    for (int i = 0; i < 2; i++) {
+        DWORD conns = maxConnections[i] + static_cast<DWORD>(reserved);
+        InternetSetOption(nullptr, options[i], &conns, sizeof(conns));
+    }
+}
+
+void WinINetTransport::reserveConnections(int n)
+{
+    QMutexLocker ml(&connectionsMutex);
+
+    // the limits are process-wide. They are only raised while segmented
+    // downloads are running and restored by releaseConnections().
+    if (reservedConnections == 0) {
+        const DWORD options[] = {INTERNET_OPTION_MAX_CONNS_PER_SERVER,
+                INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER};
+        for (int i = 0; i < 2; i++) {
+            DWORD len = sizeof(maxConnections[i]);
+            if (!InternetQueryOption(nullptr, options[i], &maxConnections[i],
+                    &len))
+                maxConnections[i] = 2;
+        }
+    }
+
+    reservedConnections += n;
+
+    // WinINet may only allow 2 connections to the same server otherwise
+    setMaxConnections(reservedConnections);
+}
+
+void WinINetTransport::releaseConnections(int n)
+{
+    QMutexLocker ml(&connectionsMutex);
+
+    reservedConnections = std::max<int>(0, reservedConnections - n);
+    setMaxConnections(reservedConnections);
+}
+
+QString WinINetTransport::queryInfo(HINTERNET hResourceHandle, DWORD infoLevel)
+{
+    QString r;
+    WCHAR buffer[1024];
+    DWORD bufferLength = sizeof(buffer);
+    DWORD index = 0;
+    if (HttpQueryInfoW(hResourceHandle, infoLevel, buffer, &bufferLength,
+            &index)) {
+        r = QString::fromWCharArray(buffer, bufferLength / 2);
+    }
+    return r;
+}
+
+QString WinINetTransport::setStringOption(HINTERNET hInternet, DWORD dwOption,
+        const QString& value)
+{
+    QString result;
+    if (!InternetSetOptionW(hInternet,
+            dwOption, WPMUtils::toLPWSTR(value),
+            static_cast<DWORD>(value.length() + 1))) {
+        WPMUtils::formatMessage(GetLastError(), &result);
+    }
+    return result;
+}
+
+QString WinINetTransport::setPassword(HINTERNET hConnectHandle,
+        DWORD dwStatus, const Downloader::Request& request)
+{
+    QString result;
+
+    if (dwStatus == HTTP_STATUS_PROXY_AUTH_REQ) {
+        if (request.proxyUser.isEmpty()) {
+            result = QString(QObject::tr("Cannot handle HTTP status code %1")).
+                    arg(dwStatus);
+        }
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                    INTERNET_OPTION_PROXY_USERNAME, request.proxyUser);
+        }
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_PROXY_PASSWORD, request.proxyPassword);
+        }
+    } else if (dwStatus == HTTP_STATUS_DENIED) {
+        if (request.user.isEmpty()) {
+            result = QString(QObject::tr("Cannot handle HTTP status code %1")).
+                    arg(dwStatus);
+        }
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_USERNAME, request.user);
+        }
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_PASSWORD, request.password);
+        }
+    } else {
+        result = QString(QObject::tr("Cannot handle HTTP status code %1")).
+                arg(dwStatus);
+    }
+
+    return result;
+}
+
+QString WinINetTransport::inputPassword(HINTERNET hConnectHandle,
+        DWORD dwStatus)
+{
+    QString result;
+
+    QString username, password;
+    if (dwStatus == HTTP_STATUS_PROXY_AUTH_REQ) {
+        WPMUtils::writeln("\r\n" +
+                QObject::tr("The HTTP proxy requires authentication."));
+        WPMUtils::outputTextConsole(QObject::tr("Username") + ": ");
+        username = WPMUtils::inputTextConsole();
+        WPMUtils::outputTextConsole(QObject::tr("Password") + ": ");
+        password = WPMUtils::inputPasswordConsole();
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_PROXY_USERNAME, username);
+        }
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_PROXY_PASSWORD, password);
+        }
+    } else if (dwStatus == HTTP_STATUS_DENIED) {
+        WPMUtils::writeln("\r\n" +
+                QObject::tr("The HTTP server requires authentication.")
+                );
+        WPMUtils::outputTextConsole(QObject::tr("Username") + ": ");
+        username = WPMUtils::inputTextConsole();
+        WPMUtils::outputTextConsole(QObject::tr("Password") + ": ");
+        password = WPMUtils::inputPasswordConsole();
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_USERNAME, username);
+        }
+
+        if (result.isEmpty()) {
+            result = setStringOption(hConnectHandle,
+                INTERNET_OPTION_PASSWORD, password);
+        }
+    } else {
+        result = QString(QObject::tr("Cannot handle HTTP status code %1")).
+                arg(dwStatus);
+    }
+
+    return result;
+}
@@ -0,0 +1,67 @@
+#ifndef WININETTRANSPORT_H
+#define WININETTRANSPORT_H
+
+#include <windows.h>
+#include <wininet.h>
+
+#include <QMutex>
+
+#include "httptransport.h"
+
+/**
+ * @brief HTTP over WinINet. The proxy settings, the cache and the password
+ *     dialogs from Windows are used.
+ */
+class WinINetTransport: public HttpTransport
+{
+    /** protects reservedConnections and maxConnections */
+    static QMutex connectionsMutex;
+
+    /** number of connections reserved by reserveConnections() */
+    static int reservedConnections;
+
+    /**
+     * limits for INTERNET_OPTION_MAX_CONNS_PER_SERVER and
+     * INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER before the first reservation
+     */
+    static DWORD maxConnections[2];
+
+    /**
+     * @brief changes the process-wide WinINet limits for the connections to
+     *     the same server
+     * @param reserved number of additional connections
+     */
+    static void setMaxConnections(int reserved);
+
+    static QString setPassword(HINTERNET hConnectHandle, DWORD dwStatus,
+            const Downloader::Request &request);
+
+    static QString inputPassword(HINTERNET hConnectHandle, DWORD dwStatus);
+
+    /**
+     * @param hResourceHandle request handle
+     * @param infoLevel HTTP_QUERY_*
+     * @return value of the header or "" if it is not available
+     */
+    static QString queryInfo(HINTERNET hResourceHandle, DWORD infoLevel);
+public:
+    /**
+     * It would be nice to handle redirects explicitely so
+     *    that the file name could be derived
+     *    from the last URL:
+     *    http://www.experts-exchange.com/Programming/System/Windows__Programming/MFC/Q_20096714.html
+     * Manual authentication:
+     *    http://msdn.microsoft.com/en-us/library/aa384220(v=vs.85).aspx
+     */
+    HttpConnection* open(Job* job, const Downloader::Request& request,
+            Downloader::Response* response, bool* gzip) override;
+
+    void reserveConnections(int n) override;
+
+    void releaseConnections(int n) override;
+
+    static QString setStringOption(HINTERNET hInternet, DWORD dwOption,
+        const QString &value);
+};
+
+#endif // WININETTRANSPORT_H
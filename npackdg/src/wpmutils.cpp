@@ -16,6 +16,8 @@
 #include <inttypes.h>
 #include <lm.h>
 #include <memory>
+#include <atomic>
+#include <algorithm>
 #include <taskschd.h>
 #include <comdef.h>
 #include <sddl.h>
@@ -38,6 +40,11 @@
 #include <QLoggingCategory>
 #include <QDirIterator>
 
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QSet>
+
 #include <quazip.h>
 #include <quazipfile.h>
 
@@ -50,6 +57,8 @@
 #include "packageutils.h"
 #include "version.h"
 #include "windowsregistry.h"
+#include "directorycopier.h"
+#include "directoryremover.h"
 
 QAtomicInt WPMUtils::nextNamePipeId;
 
@@ -1111,6 +1120,22 @@ bool WPMUtils::isUnderOrEquals(const QString& file, const QString& dir)
                 WPMUtils::isUnder(file, dir);
 }
 
+QString WPMUtils::toLongPath(const QString& path)
+{
+    QString r = QDir::toNativeSeparators(path);
+    if (r.startsWith(QStringLiteral("\\\\?\\")) ||
+            r.startsWith(QStringLiteral("\\\\.\\")))
+        return r;
+
+    if (r.startsWith(QStringLiteral("\\\\")))
+        return QStringLiteral("\\\\?\\UNC\\") + r.mid(2);
+
+    if (r.length() >= 3 && r.at(1) == ':' && r.at(2) == '\\')
+        return QStringLiteral("\\\\?\\") + r;
+
+    return r;
+}
+
 QString WPMUtils::validateGUID(const QString& guid)
 {
     QString err;
@@ -2767,42 +2792,11 @@ QString WPMUtils::createLink(LPCWSTR lpszPathObj, LPCWSTR lpszPathLink,
 
 bool WPMUtils::copyDirectory(QString src, QString dest)
 {
-    // qCDebug(npackd) << "copyDirectory";
-
-    QDir srcDir(src);
-    QDir destDir(dest);
-
-    if (!destDir.mkpath(dest))
-        return false;
-
-    QDirIterator it(src, QDir::AllEntries | QDir::PermissionMask | QDir::AccessMask |
-            QDir::CaseSensitive | QDir::NoDotAndDotDot | QDir::NoSymLinks,
-            QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        QString relPath = srcDir.relativeFilePath(it.next());
-
-        // qCDebug(npackd) << "next file" << relPath;
-
-        QFileInfo fi = it.fileInfo();
-        if (fi.isDir()) {
-            // qCDebug(npackd) << "dir!";
-            relPath = WPMUtils::normalizePath(relPath, false);
-            // qCDebug(npackd) << "normalized" << relPath;
-            if (!relPath.isEmpty() && relPath != QStringLiteral(".") && relPath != QStringLiteral("..")) {
-                // qCDebug(npackd) << "mkdir!";
-                if (!destDir.mkdir(relPath)) {
-                    // qCDebug(npackd) << "mkdir failed";
-                    return false;
-                }
-            }
-        } else {
-            // qCDebug(npackd) << "file!";
-            if (!QFile::copy(srcDir.filePath(relPath), destDir.filePath(relPath)))
-                return false;
-        }
-    }
+    Job job;
+    DirectoryCopier c;
+    c.copy(&job, src, dest);
 
-    return true;
+    return job.getErrorMessage().isEmpty();
 }
 
 void WPMUtils::renameDirectory(Job* job, const QString &oldName, const QString &newName)
@@ -2834,14 +2828,19 @@ void WPMUtils::renameDirectory(Job* job, const QString &oldName, const QString &
     }
 
     if (job->shouldProceed() && !done) {
-        if (WPMUtils::copyDirectory(oldName, newName)) {
-            job->setProgress(0.5);
-
+        Job* copyJob = job->newSubJob(0.5, QObject::tr("Copying %1").arg(oldName), true, false);
+
+        // the old directory is deleted afterwards and its files can be
+        // linked instead of copied on the same volume
+        DirectoryCopier c;
+        c.setMode(DirectoryCopier::HARD_LINK);
+        c.copy(copyJob, oldName, newName);
+        if (copyJob->getErrorMessage().isEmpty()) {
             Job* sub = job->newSubJob(0.5, QObject::tr("Deleting %1").arg(oldName), true, false);
             WPMUtils::removeDirectory(sub, oldName, true);
             job->setProgress(1);
         } else {
-            job->setErrorMessage(QObject::tr("Error copying %1 to %2").arg(oldName).arg(newName));
+            job->setErrorMessage(QObject::tr("Error copying %1 to %2: %3").arg(oldName, newName, copyJob->getErrorMessage()));
         }
     }
 
@@ -2856,51 +2855,8 @@ void WPMUtils::removeDirectory(Job* job, const QString &aDir_, bool firstLevel)
                 arg(aDir.absolutePath().replace('/', '\\'));
     }
 
-    if (aDir.exists()) {
-        QFileInfoList entries = aDir.entryInfoList(
-                QDir::NoDotAndDotDot |
-                QDir::AllEntries | QDir::System);
-        int count = entries.size();
-        for (int idx = 0; idx < count; idx++) {
-            QFileInfo entryInfo = entries[idx];
-            QString path = entryInfo.absoluteFilePath();
-            if (entryInfo.isDir()) {
-                Job* sub = job->newSubJob(1 / ((double) count + 1),
-                        QObject::tr("Deleting the directory %1").arg(
-                        path.replace('/', '\\')));
-                removeDirectory(sub, path, false);
-                if (!sub->getErrorMessage().isEmpty())
-                    job->setErrorMessage(sub->getErrorMessage());
-                // if (!ok)
-                //    qCDebug(npackd) << "WPMUtils::removeDirectory.3" << *errMsg;
-            } else {
-                QFile file(path);
-                if (!file.remove() && file.exists()) {
-                    job->setErrorMessage(QString(QObject::tr("Cannot delete the file: %1")).
-                            arg(path));
-                    // qCDebug(npackd) << "WPMUtils::removeDirectory.1" << *errMsg;
-                } else {
-                    job->setProgress(idx / ((double) count + 1));
-                }
-            }
-            if (!job->getErrorMessage().isEmpty())
-                break;
-        }
-
-        if (job->getErrorMessage().isEmpty()) {
-            if (!aDir.rmdir(aDir.absolutePath()))
-                // qCDebug(npackd) << "WPMUtils::removeDirectory.2";
-                job->setErrorMessage(QString(
-                        QObject::tr("Cannot delete the directory: %1")).
-                        arg(aDir.absolutePath()));
-            else
-                job->setProgress(1);
-        }
-    } else {
-        job->setProgress(1);
-    }
-
-    job->complete();
+    DirectoryRemover r;
+    r.remove(job, aDir.absolutePath());
 }
 
 QString WPMUtils::makeValidFilename(const QString &name, QChar rep)
@@ -3277,72 +3233,193 @@ void WPMUtils::unzip(Job* job, const QString zipfile, const QString outputdir)
 {
     QString initialTitle = job->getTitle();
 
+    QString odir = outputdir;
+    if (!odir.endsWith('\\') && !odir.endsWith('/'))
+        odir.append('\\');
+
+    /** an entry from the central directory */
+    class Entry {
+    public:
+        QString name;
+        qint64 size;
+        unz64_file_pos pos;
+    };
+    QVector<Entry> entries;
+    qint64 total = 0;
+
+    // the central directory is read only once
     QuaZip zip(zipfile);
     if (!zip.open(QuaZip::mdUnzip)) {
         job->setErrorMessage(QString(QObject::tr("Cannot open the ZIP file %1: %2")).
                        arg(zipfile).arg(zip.getZipError()));
     } else {
-        job->setProgress(0.01);
+        entries.reserve(zip.getEntriesCount());
+        for (bool more = zip.goToFirstFile(); more; more = zip.goToNextFile()) {
+            QuaZipFileInfo64 info;
+            Entry e;
+            if (!zip.getCurrentFileInfo(&info) ||
+                    unzGetFilePos64(zip.getUnzFile(), &e.pos) != UNZ_OK) {
+                job->setErrorMessage(QString(
+                        QObject::tr("Error unzipping the file %1: Error %2 in %3")).
+                        arg(zipfile).arg(zip.getZipError()).
+                        arg(zip.getCurrentFileName()));
+                break;
+            }
+            e.name = info.name;
+            e.size = static_cast<qint64>(info.uncompressedSize);
+            entries.append(e);
+            total += e.size;
+        }
+        if (job->shouldProceed() && zip.getZipError() != UNZ_OK)
+            job->setErrorMessage(QString(QObject::tr("Cannot open the ZIP file %1: %2")).
+                           arg(zipfile).arg(zip.getZipError()));
+        zip.close();
     }
 
     if (job->shouldProceed()) {
-        QString odir = outputdir;
-        if (!odir.endsWith('\\') && !odir.endsWith('/'))
-            odir.append('\\');
+        job->setProgress(0.01);
+
+        // every directory is created only once
+        QSet<QString> dirs;
+        for (int i = 0; i < entries.size(); i++) {
+            QString path = QDir::cleanPath(odir + entries.at(i).name);
+            if (entries.at(i).name.endsWith('/'))
+                dirs.insert(path);
+            else
+                dirs.insert(QFileInfo(path).absolutePath());
+        }
+
+        // parents first
+        QStringList sorted = dirs.values();
+        std::sort(sorted.begin(), sorted.end());
+
+        QDir d;
+        for (int i = 0; i < sorted.size(); i++) {
+            if (!d.mkpath(sorted.at(i))) {
+                job->setErrorMessage(QString(QObject::tr("Cannot create directory %1")).arg(
+                        sorted.at(i)));
+                break;
+            }
+        }
+    }
 
+    if (job->shouldProceed()) {
         job->setTitle(initialTitle + QStringLiteral(" / ") +
                 QObject::tr("Extracting"));
-        QuaZipFile file(&zip);
-        int n = zip.getEntriesCount();
-        int blockSize = 1024 * 1024;
-        char* block = new char[blockSize];
-        int i = 0;
-        for (bool more = zip.goToFirstFile(); more; more = zip.goToNextFile()) {
-            QString name = zip.getCurrentFileName();
-            if (!file.open(QIODevice::ReadOnly)) {
-                job->setErrorMessage(QString(
-                        QObject::tr("Error unzipping the file %1: Error %2 in %3")).
-                        arg(zipfile).arg(file.getZipError()).
-                        arg(name));
-                break;
+
+        // the biggest files first so that the threads finish at the same time
+        QVector<int> order(entries.size());
+        for (int i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&entries](int a, int b) {
+            return entries.at(a).size > entries.at(b).size;
+        });
+
+        std::atomic<int> next(0);
+        std::atomic<int> files(0);
+        std::atomic<qint64> bytes(0);
+
+        // every thread reads the ZIP file using its own handle
+        auto extract = [&]() {
+            QuaZip z(zipfile);
+            if (!z.open(QuaZip::mdUnzip) || !z.goToFirstFile()) {
+                job->setErrorMessage(QString(QObject::tr("Cannot open the ZIP file %1: %2")).
+                               arg(zipfile).arg(z.getZipError()));
+                return;
             }
-            name.prepend(odir);
-            QFile meminfo(name);
-            QFileInfo infofile(meminfo);
-            QDir dira(infofile.absolutePath());
-            if (dira.mkpath(infofile.absolutePath())) {
-                if (meminfo.open(QIODevice::ReadWrite)) {
-                    while (true) {
-                        qint64 read = file.read(block, blockSize);
-                        if (read <= 0)
-                            break;
-                        meminfo.write(block, read);
+
+            QuaZipFile file(&z);
+            const int blockSize = 1024 * 1024;
+            QByteArray block(blockSize, Qt::Uninitialized);
+            while (job->shouldProceed()) {
+                int index = next++;
+                if (index >= order.size())
+                    break;
+
+                const Entry& e = entries.at(order.at(index));
+                if (!e.name.endsWith('/')) {
+                    unz64_file_pos pos = e.pos;
+                    if (unzGoToFilePos64(z.getUnzFile(), &pos) != UNZ_OK ||
+                            !file.open(QIODevice::ReadOnly)) {
+                        job->setErrorMessage(QString(
+                                QObject::tr("Error unzipping the file %1: Error %2 in %3")).
+                                arg(zipfile).arg(file.getZipError()).
+                                arg(e.name));
+                        break;
                     }
-                    meminfo.close();
+
+                    // the data is written directly without another buffer
+                    QFile out(odir + e.name);
+                    if (out.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+                        while (true) {
+                            qint64 read = file.read(block.data(), blockSize);
+                            if (read <= 0)
+                                break;
+                            out.write(block.constData(), read);
+                            bytes += read;
+                        }
+                        out.close();
+                    }
+                    file.close();
                 }
-            } else {
-                job->setErrorMessage(QString(QObject::tr("Cannot create directory %1")).arg(
-                        infofile.absolutePath()));
-                file.close();
+                files++;
             }
-            file.close(); // do not forget to close!
-            i++;
-            job->setProgress(0.01 + 0.99 * i / n);
-            if (i % 100 == 0)
+            z.close();
+        };
+
+        int nthreads = std::min<int>(std::min<int>(QThread::idealThreadCount(), 8),
+                static_cast<int>(entries.size()));
+        QThreadPool pool;
+        pool.setMaxThreadCount(std::max<int>(nthreads, 1));
+        for (int i = 0; i < nthreads; i++) {
+            QtConcurrent::run(&pool, extract);
+        }
+
+        // the progress is reported from this thread only
+        int lastTitle = 0;
+        while (true) {
+            bool done = pool.waitForDone(100);
+
+            int n = files;
+            if (total > 0)
+                job->setProgress(0.01 + 0.99 * bytes / total);
+            else if (entries.size() > 0)
+                job->setProgress(0.01 + 0.99 * n / entries.size());
+            if (n / 100 != lastTitle / 100) {
                 job->setTitle(initialTitle + QStringLiteral(" / ") +
-                        QString(QObject::tr("%L1 files")).arg(i));
+                        QString(QObject::tr("%L1 files")).arg(n));
+                lastTitle = n;
+            }
 
-            if (!job->shouldProceed())
+            if (done)
                 break;
         }
-        zip.close();
-
-        delete[] block;
     }
 
     job->complete();
 }
 
+QIODevice* WPMUtils::openZipEntry(const QString& zipfile,
+        const QString& entry, QString* err)
+{
+    *err = QString();
+
+    QuaZipFile* r = new QuaZipFile(zipfile, entry, QuaZip::csInsensitive);
+    if (!r->open(QIODevice::ReadOnly)) {
+        if (r->getZipError() == UNZ_OK)
+            *err = QString(QObject::tr("%1 is missing in the ZIP file %2")).
+                    arg(entry, zipfile);
+        else
+            *err = QString(QObject::tr("Error unzipping the file %1: Error %2 in %3")).
+                    arg(zipfile).arg(r->getZipError()).arg(entry);
+        delete r;
+        r = nullptr;
+    }
+
+    return r;
+}
+
 void WPMUtils::executeBatchFile(Job* job, const QString& where,
         const QString& path,
         const QString& outputFile, const QStringList& env,
@@ -7,6 +7,7 @@
 
 #include <QString>
 #include <QDir>
+#include <QIODevice>
 #include <QTime>
 #include <QCryptographicHash>
 #include <QThreadPool>
@@ -238,6 +239,17 @@ public:
      */
     static bool isUnderOrEquals(const QString &file, const QString &dir);
 
+    /**
+     * @brief adds the prefix \\?\ (or \\?\UNC\ for network paths) to an
+     *     absolute path so that the Windows API functions accept paths longer
+     *     than MAX_PATH characters. The path must not contain "." or "..".
+     * @param path absolute path
+     * @return path with the prefix. Relative paths and paths that already
+     *     have a prefix are returned unchanged.
+     * @threadsafe
+     */
+    static QString toLongPath(const QString& path);
+
     /**
      * @brief extracts an icon from a file using the Windows API ExtractIcon()
      * @param iconFile .ico, .exe, etc. Additionally to what is supported by
@@ -617,13 +629,26 @@ public:
     static QString createEmptyTempFile(const QString pattern);
 
     /**
-     * @brief unzips a file
+     * @brief unzips a file. The central directory is read once, all
+     *     directories are created first and the entries are extracted in
+     *     parallel.
      * @param job job
      * @param zipfile .zip file
      * @param outputdir output directory
      */
     static void unzip(Job* job, const QString zipfile, const QString outputdir);
 
+    /**
+     * @brief opens an entry in a ZIP file for reading. The entry is
+     *     decompressed while it is read and not stored on the disk.
+     * @param zipfile .zip file
+     * @param entry name of the entry. The case is ignored.
+     * @param err error message will be stored here
+     * @return [move] the opened entry or nullptr if an error occured
+     */
+    static QIODevice* openZipEntry(const QString& zipfile,
+            const QString& entry, QString* err);
+
     /**
      * @param job job to monitor the progress. The error message will be set
      *     to a non-empty string if the exit code of the process is not 0.